@@ -88,8 +88,12 @@ void playMultipleTracks(){
     char sampleTrack2[] = "spotify:track:4dJYjR2lM6SmYfLw2mnHvb";
     char sampleTrack3[] = "spotify:track:4uLU6hMCjMI75M1A2tKUQC";
 
-    char body[200];
-    sprintf(body, "{\"uris\" : [\"%s\", \"%s\", \"%s\"]}", sampleTrack1, sampleTrack2, sampleTrack3);
+    // The body can also be a JsonDocument, it's serialized into a buffer of exactly the right size
+    StaticJsonDocument<JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(3)> body;
+    JsonArray uris = body.createNestedArray("uris");
+    uris.add(sampleTrack1);
+    uris.add(sampleTrack2);
+    uris.add(sampleTrack3);
     if (spotify.playAdvanced(body)) {
         Serial.println("sent!");
     }
@@ -0,0 +1,145 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Parse throughput and memory of SpotifyAudioAnalysis on a generated
+// /v1/audio-analysis response of the size Spotify sends for a four minute
+// track. Nothing of the JSON is kept, so the memory is the object itself
+// plus the read buffer, whatever the size of the response.
+
+#include "SpotifyAudioAnalysis.h"
+#include "AllocCount.h"
+#include <algorithm>
+#include <string>
+
+#define BENCH_ROUNDS 50
+#define TRACK_SECONDS 240.0
+
+static void appendTimes(std::string &json, const char *name, double interval)
+{
+    char item[128];
+    json += "\"";
+    json += name;
+    json += "\":[";
+    for (double start = 0.49; start < TRACK_SECONDS; start += interval)
+    {
+        snprintf(item, sizeof(item), "{\"start\":%.5f,\"duration\":%.5f,\"confidence\":%.3f},",
+                 start, interval, 0.2 + 0.7 * ((int)(start * 13) % 10) / 10.0);
+        json += item;
+    }
+    json.back() = ']';
+    json += ",";
+}
+
+static std::string analysisJson()
+{
+    char item[512];
+    std::string json = "{\"meta\":{\"analyzer_version\":\"4.0.0\",\"platform\":\"Linux\",\"detailed_status\":\"OK\","
+                       "\"status_code\":0,\"timestamp\":1495193577,\"analysis_time\":6.93906,\"input_process\":\"libvorbisfile L+R 44100->22050\"},"
+                       "\"track\":{\"num_samples\":5292000,\"duration\":240.0,\"sample_md5\":\"\",\"offset_seconds\":0,"
+                       "\"window_seconds\":0,\"analysis_sample_rate\":22050,\"analysis_channels\":1,\"end_of_fade_in\":0.2,"
+                       "\"start_of_fade_out\":235.1,\"loudness\":-9.1,\"tempo\":118.2,\"tempo_confidence\":0.73,"
+                       "\"time_signature\":4,\"time_signature_confidence\":1,\"key\":9,\"key_confidence\":0.4,"
+                       "\"mode\":0,\"mode_confidence\":0.5,\"codestring\":\"";
+    // The fingerprints are long strings the parser has to skip
+    for (int i = 0; i < 24000; i++)
+    {
+        json += (char)('A' + i % 26);
+    }
+    json += "\",\"code_version\":3.15,\"echoprintstring\":\"";
+    for (int i = 0; i < 30000; i++)
+    {
+        json += (char)('a' + i % 26);
+    }
+    json += "\",\"echoprint_version\":4.12},";
+
+    appendTimes(json, "bars", 2.03);
+    appendTimes(json, "beats", 0.5076);
+    appendTimes(json, "tatums", 0.2538);
+
+    json += "\"sections\":[";
+    for (double start = 0; start < TRACK_SECONDS; start += 22.5)
+    {
+        snprintf(item, sizeof(item), "{\"start\":%.5f,\"duration\":22.5,\"confidence\":1,\"loudness\":-9.42,\"tempo\":118.21,"
+                                     "\"tempo_confidence\":0.63,\"key\":9,\"key_confidence\":0.4,\"mode\":0,\"mode_confidence\":0.51,"
+                                     "\"time_signature\":4,\"time_signature_confidence\":1},",
+                 start);
+        json += item;
+    }
+    json.back() = ']';
+
+    json += ",\"segments\":[";
+    for (double start = 0.2; start < TRACK_SECONDS; start += 0.24)
+    {
+        snprintf(item, sizeof(item), "{\"start\":%.5f,\"duration\":0.24,\"confidence\":0.%03d,\"loudness_start\":-23.053,"
+                                     "\"loudness_max_time\":0.07308,\"loudness_max\":-14.%03d,\"loudness_end\":0,"
+                                     "\"pitches\":[0.551,0.542,0.661,0.076,0.024,0.027,0.069,0.129,1,0.251,0.063,0.078],"
+                                     "\"timbre\":[42.115,64.373,-0.233,-82.917,-15.871,-11.312,8.451,-19.141,26.178,-7.314,-2.148,-2.013]},",
+                 start, (int)(start * 100) % 1000, (int)(start * 37) % 1000);
+        json += item;
+    }
+    json.back() = ']';
+    json += "}";
+    return json;
+}
+
+static SpotifyAudioAnalysis analysis;
+
+static void run(const std::string &json, size_t chunkSize, float minConfidence)
+{
+    analysis.minConfidence = minConfidence;
+    size_t allocations = 0;
+    size_t peakBytes = 0;
+    bool ok = true;
+    unsigned long start = micros();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        allocCountStart();
+        analysis.begin();
+        const uint8_t *data = (const uint8_t *)json.data();
+        for (size_t offset = 0; offset < json.size() && ok; offset += chunkSize)
+        {
+            ok = analysis.feed(data + offset, std::min(chunkSize, json.size() - offset));
+        }
+        AllocStats stats = allocCountStop();
+        allocations += stats.allocations;
+        peakBytes = std::max(peakBytes, stats.peakBytes);
+        ok = ok && analysis.complete();
+    }
+    unsigned long elapsed = micros() - start;
+
+    printf("%5zu byte reads, min confidence %.1f %8.1f MB/s %8.2f ms/analysis %4zu heap bytes %4zu allocs"
+           "   %u beats %u bars %u sections %u segments%s%s\n",
+           chunkSize, minConfidence, (double)json.size() * BENCH_ROUNDS / elapsed, elapsed / 1000.0 / BENCH_ROUNDS,
+           peakBytes, allocations / BENCH_ROUNDS, analysis.beatCount, analysis.barCount, analysis.sectionCount,
+           analysis.segmentCount, analysis.truncated ? " (truncated)" : "", ok ? "" : " FAILED");
+}
+
+int main()
+{
+    std::string json = analysisJson();
+    printf("audio analysis: %zu bytes of JSON, kept in %zu bytes (sizeof SpotifyAudioAnalysis)\n",
+           json.size(), sizeof(SpotifyAudioAnalysis));
+    // 128 bytes is what getAudioAnalysis() reads at a time
+    run(json, 128, 0);
+    run(json, 1024, 0);
+    run(json, 16, 0);
+    run(json, 128, 0.5);
+    return 0;
+}
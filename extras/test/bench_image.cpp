@@ -0,0 +1,110 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Throughput of getImage() with a callback for different chunk sizes, from
+// a local server standing in for the image CDN. Bigger chunks mean fewer
+// callbacks (and flash writes on an ESP), the numbers show from where on
+// that stops paying off for the parsing side.
+
+#include "ArduinoSpotify.h"
+#include "AllocCount.h"
+#include "TestServer.h"
+
+#define BENCH_IMAGE_SIZE (64 * 1024)
+#define BENCH_DOWNLOADS 200
+
+static char imageUrl[] = "https://i.scdn.co/image/ab67616d00001e02e464904cc3fed2b40fc55120";
+
+struct Download
+{
+    size_t bytes;
+    unsigned long callbacks;
+    uint32_t checksum;
+};
+
+static bool onChunk(const uint8_t *data, size_t length, size_t received, long contentLength, void *context)
+{
+    Download *download = (Download *)context;
+    download->bytes += length;
+    download->callbacks++;
+    // Touch the data like a sketch writing it somewhere would
+    for (size_t i = 0; i < length; i++)
+    {
+        download->checksum = download->checksum * 31 + data[i];
+    }
+    return true;
+}
+
+static void run(ArduinoSpotify &spotify, size_t chunkSize, bool chunked, TestServer &server)
+{
+    static uint8_t buffer[8192];
+    Download download = {0, 0, 0};
+    size_t allocations = 0;
+    int failed = 0;
+    unsigned long start = micros();
+    for (int i = 0; i < BENCH_DOWNLOADS; i++)
+    {
+        allocCountStart();
+        if (!spotify.getImage(imageUrl, onChunk, &download, buffer, chunkSize))
+        {
+            failed++;
+        }
+        allocations += allocCountStop().allocations;
+    }
+    unsigned long elapsed = micros() - start;
+
+    printf("%5zu byte chunks%-10s %8.1f MB/s %8.0f callbacks/image %6.2f allocs/image %d failed\n",
+           chunkSize, chunked ? ", chunked" : "", (double)download.bytes / elapsed,
+           (double)download.callbacks / BENCH_DOWNLOADS, (double)allocations / BENCH_DOWNLOADS, failed);
+}
+
+int main()
+{
+    std::string image(BENCH_IMAGE_SIZE, '\0');
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        image[i] = (char)(i * 7919 >> 3);
+    }
+    bool chunked = false;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        response.headers = "Content-Type: image/jpeg\r\n";
+        response.body = image;
+        response.chunked = chunked;
+        response.chunkSize = 4096;
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    spotify.keepAlive = true;
+
+    const size_t chunkSizes[] = {64, 256, 512, 1024, 2048, 4096, 8192};
+    for (int encoding = 0; encoding < 2; encoding++)
+    {
+        chunked = encoding == 1;
+        for (size_t chunkSize : chunkSizes)
+        {
+            run(spotify, chunkSize, chunked, server);
+        }
+    }
+    printf("%d connections\n", server.connections());
+    return 0;
+}
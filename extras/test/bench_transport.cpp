@@ -0,0 +1,126 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Requests per second and heap allocations per request of
+// SpotifyLeanTransport over loopback, and of SpotifyHTTPClientTransport on
+// top of host/HTTPClient, which follows the request path of the ESP32
+// core's HTTPClient. The numbers are for comparing the two and changes to
+// the transport, a PC over loopback says little about the absolute speed
+// on an ESP.
+
+#include <WiFiClient.h>
+#include "SpotifyTransport.h"
+#include "SpotifyHTTPClientTransport.h"
+#include "AllocCount.h"
+#include "TestServer.h"
+
+#define BENCH_REQUESTS 2000
+// HTTPClient waits 10 ms whenever the response isn't there yet
+#define BENCH_HTTPCLIENT_REQUESTS 200
+
+// About the size of a /v1/me/player response
+static std::string playerBody()
+{
+    std::string body = "{\"device\":{\"id\":\"0123456789abcdef0123456789abcdef01234567\",\"name\":\"Kitchen\"},\"items\":[";
+    while (body.size() < 3000)
+    {
+        body += "{\"name\":\"Some artist\",\"uri\":\"spotify:artist:0123456789abcdefghijkl\"},";
+    }
+    body += "{}]}";
+    return body;
+}
+
+static void run(const char *name, SpotifyTransport &transport, int requests, bool keepAlive, bool chunked)
+{
+    std::string body = playerBody();
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        response.body = body;
+        response.chunked = chunked;
+        response.chunkSize = 1024;
+    });
+
+    WiFiClient client;
+    uint8_t buffer[512];
+    size_t allocations = 0;
+    size_t bytesSent = 0;
+    unsigned long start = micros();
+    for (int i = 0; i < requests; i++)
+    {
+        // Opening the socket allocates in the POSIX layer, that's not ours
+        if (!client.connected())
+        {
+            client.connect("127.0.0.1", server.port());
+        }
+        allocCountStart();
+        int status = transport.request(client, "127.0.0.1", server.port(), "GET", "/v1/me/player?market=DE",
+                                       "application/json", NULL,
+                                       "Bearer BQDi0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz",
+                                       NULL, keepAlive);
+        SpotifyBodyStream &stream = transport.getStream();
+        while (status == 200 && !stream.complete() && !stream.failed())
+        {
+            stream.readAvailable(buffer, sizeof(buffer));
+        }
+        bytesSent += transport.getTiming().bytesSent;
+        transport.end();
+        allocations += allocCountStop().allocations;
+    }
+    unsigned long elapsed = micros() - start;
+
+    // HTTPClient doesn't say how much it sent
+    char sent[24] = "     -";
+    if (bytesSent > 0)
+    {
+        snprintf(sent, sizeof(sent), "%6zu", bytesSent / requests);
+    }
+    printf("%-36s %8.0f req/s %8.1f us/req %6.2f allocs/req %s bytes sent/req %5d connections\n",
+           name, requests * 1e6 / elapsed, (double)elapsed / requests,
+           (double)allocations / requests, sent, server.connections());
+}
+
+static void formatting()
+{
+    char header[SPOTIFY_REQUEST_HEADER_SIZE];
+    const int rounds = 200000;
+    unsigned long start = micros();
+    int length = 0;
+    for (int i = 0; i < rounds; i++)
+    {
+        length += SpotifyLeanTransport::formatRequest(header, sizeof(header), "api.spotify.com", "GET", "/v1/me/player?market=DE",
+                                                      "application/json", NULL, "Bearer BQDi0123456789abcdefghijklmnopqrstuvwxyz",
+                                                      -1, true);
+    }
+    unsigned long elapsed = micros() - start;
+    printf("%-36s %8.0f ns/call (%d bytes)\n", "formatRequest", elapsed * 1000.0 / rounds, length / rounds);
+}
+
+int main()
+{
+    SpotifyLeanTransport lean;
+    run("lean, keep-alive", lean, BENCH_REQUESTS, true, false);
+    run("lean, keep-alive, chunked", lean, BENCH_REQUESTS, true, true);
+    run("lean, connection per request", lean, BENCH_REQUESTS, false, false);
+    SpotifyHTTPClientTransport httpClient(2000);
+    run("HTTPClient, keep-alive", httpClient, BENCH_HTTPCLIENT_REQUESTS, true, false);
+    run("HTTPClient, keep-alive, chunked", httpClient, BENCH_HTTPCLIENT_REQUESTS, true, true);
+    run("HTTPClient, connection per request", httpClient, BENCH_HTTPCLIENT_REQUESTS, false, false);
+    formatting();
+    return 0;
+}
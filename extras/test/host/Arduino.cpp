@@ -0,0 +1,391 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "Arduino.h"
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros()
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield()
+{
+    std::this_thread::yield();
+}
+
+long random(long max)
+{
+    return (max > 0) ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+    return (max > min) ? min + random(max - min) : min;
+}
+
+String::String(const char *value)
+{
+    _buffer = NULL;
+    _length = 0;
+    _capacity = 0;
+    concat(value != NULL ? value : "");
+}
+
+String::String(const __FlashStringHelper *value) : String((const char *)value)
+{
+}
+
+String::String(const String &other) : String(other.c_str())
+{
+}
+
+String::String(char c) : String()
+{
+    concat(c);
+}
+
+String::String(int value, unsigned char base) : String((long)value, base)
+{
+}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base)
+{
+}
+
+String::String(long value, unsigned char base) : String()
+{
+    char buffer[24];
+    if (base == 16)
+    {
+        snprintf(buffer, sizeof(buffer), "%lx", (unsigned long)value);
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%ld", value);
+    }
+    concat(buffer);
+}
+
+String::String(unsigned long value, unsigned char base) : String()
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), (base == 16) ? "%lx" : "%lu", value);
+    concat(buffer);
+}
+
+String::~String()
+{
+    free(_buffer);
+}
+
+String &String::operator=(const String &other)
+{
+    if (this != &other)
+    {
+        _length = 0;
+        concat(other.c_str(), other.length());
+    }
+    return *this;
+}
+
+String &String::operator=(const char *value)
+{
+    String copy(value);
+    return *this = copy;
+}
+
+bool String::reserve(unsigned int size)
+{
+    if (_buffer != NULL && size <= _capacity)
+    {
+        return true;
+    }
+    char *buffer = (char *)realloc(_buffer, size + 1);
+    if (buffer == NULL)
+    {
+        return false;
+    }
+    if (_buffer == NULL)
+    {
+        buffer[0] = '\0';
+    }
+    _buffer = buffer;
+    _capacity = size;
+    return true;
+}
+
+bool String::concat(const char *value)
+{
+    return concat(value, strlen(value));
+}
+
+bool String::concat(const char *value, unsigned int length)
+{
+    if (!reserve(_length + length))
+    {
+        return false;
+    }
+    memmove(_buffer + _length, value, length);
+    _length += length;
+    _buffer[_length] = '\0';
+    return true;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+    if (from >= _length)
+    {
+        return -1;
+    }
+    const char *found = strchr(c_str() + from, c);
+    return (found != NULL) ? (int)(found - c_str()) : -1;
+}
+
+int String::indexOf(const char *value, unsigned int from) const
+{
+    if (from > _length)
+    {
+        return -1;
+    }
+    const char *found = strstr(c_str() + from, value);
+    return (found != NULL) ? (int)(found - c_str()) : -1;
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+    String result;
+    if (from < to && from < _length)
+    {
+        result.concat(c_str() + from, min(to, _length) - from);
+    }
+    return result;
+}
+
+void String::trim()
+{
+    unsigned int start = 0;
+    while (start < _length && isspace((unsigned char)_buffer[start]))
+    {
+        start++;
+    }
+    unsigned int end = _length;
+    while (end > start && isspace((unsigned char)_buffer[end - 1]))
+    {
+        end--;
+    }
+    *this = substring(start, end);
+}
+
+void String::toLowerCase()
+{
+    for (unsigned int i = 0; i < _length; i++)
+    {
+        _buffer[i] = tolower((unsigned char)_buffer[i]);
+    }
+}
+
+StringSumHelper operator+(const String &a, const String &b)
+{
+    StringSumHelper sum(a);
+    sum += b;
+    return sum;
+}
+
+StringSumHelper operator+(const String &a, const char *b)
+{
+    StringSumHelper sum(a);
+    sum += b;
+    return sum;
+}
+
+StringSumHelper operator+(const char *a, const String &b)
+{
+    StringSumHelper sum(a);
+    sum += b;
+    return sum;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while (written < size && write(buffer[written]) == 1)
+    {
+        written++;
+    }
+    return written;
+}
+
+size_t Print::print(long value, int base)
+{
+    char buffer[24];
+    if (base == HEX)
+    {
+        snprintf(buffer, sizeof(buffer), "%lX", (unsigned long)value);
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%ld", value);
+    }
+    return write(buffer);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), (base == HEX) ? "%lX" : "%lu", value);
+    return write(buffer);
+}
+
+size_t Print::print(double value, int digits)
+{
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return write(buffer);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return 0;
+    }
+    return write(buffer, min((size_t)length, sizeof(buffer) - 1));
+}
+
+int Stream::timedRead()
+{
+    unsigned long start = millis();
+    do
+    {
+        int c = read();
+        if (c >= 0)
+        {
+            return c;
+        }
+        yield();
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+    {
+        int c = timedRead();
+        if (c < 0)
+        {
+            break;
+        }
+        buffer[count++] = (char)c;
+    }
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+    {
+        int c = timedRead();
+        if (c < 0 || c == terminator)
+        {
+            break;
+        }
+        buffer[count++] = (char)c;
+    }
+    return count;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+    String result;
+    int c = timedRead();
+    while (c >= 0 && c != terminator)
+    {
+        result += (char)c;
+        c = timedRead();
+    }
+    return result;
+}
+
+bool Stream::findUntil(const char *target, const char *terminator)
+{
+    size_t targetLength = strlen(target);
+    size_t terminatorLength = (terminator != NULL) ? strlen(terminator) : 0;
+    size_t matched = 0;
+    size_t terminatorMatched = 0;
+    if (targetLength == 0)
+    {
+        return true;
+    }
+    int c;
+    while ((c = timedRead()) >= 0)
+    {
+        // Good enough for the targets used here, which don't repeat their start
+        matched = (c == target[matched]) ? matched + 1 : (c == target[0] ? 1 : 0);
+        if (matched == targetLength)
+        {
+            return true;
+        }
+        if (terminatorLength > 0)
+        {
+            terminatorMatched = (c == terminator[terminatorMatched]) ? terminatorMatched + 1 : (c == terminator[0] ? 1 : 0);
+            if (terminatorMatched == terminatorLength)
+            {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return fwrite(&c, 1, 1, stderr);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stderr);
+}
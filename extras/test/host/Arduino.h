@@ -0,0 +1,227 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Just enough of the Arduino core to run the library on a PC. Flash
+// strings are plain strings here, Serial goes to stderr.
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_float(addr) (*(const float *)(addr))
+#define pgm_read_ptr(addr) (*(const void *const *)(addr))
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+
+class __FlashStringHelper;
+#define FPSTR(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define F(s) FPSTR(s)
+
+#define DEC 10
+#define HEX 16
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long max);
+long random(long min, long max);
+
+template <typename T>
+T min(T a, T b) { return (b < a) ? b : a; }
+template <typename T>
+T max(T a, T b) { return (a < b) ? b : a; }
+template <typename T, typename L, typename H>
+T constrain(T x, L low, H high) { return (x < (T)low) ? (T)low : ((x > (T)high) ? (T)high : x); }
+
+class String
+{
+public:
+  String(const char *value = "");
+  String(const __FlashStringHelper *value);
+  String(const String &other);
+  explicit String(char c);
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  ~String();
+
+  String &operator=(const String &other);
+  String &operator=(const char *value);
+  String &operator+=(const String &other) { concat(other.c_str(), other.length()); return *this; }
+  String &operator+=(const char *value) { concat(value); return *this; }
+  String &operator+=(char c) { concat(c); return *this; }
+
+  bool reserve(unsigned int size);
+  bool concat(const char *value);
+  bool concat(const char *value, unsigned int length);
+  bool concat(char c) { return concat(&c, 1); }
+
+  const char *c_str() const { return _buffer != NULL ? _buffer : ""; }
+  unsigned int length() const { return _length; }
+  char operator[](unsigned int index) const { return (index < _length) ? _buffer[index] : 0; }
+
+  bool operator==(const String &other) const { return equals(other.c_str()); }
+  bool operator==(const char *value) const { return equals(value); }
+  bool operator!=(const String &other) const { return !equals(other.c_str()); }
+  bool operator!=(const char *value) const { return !equals(value); }
+  bool equals(const char *value) const { return strcmp(c_str(), value) == 0; }
+  bool equalsIgnoreCase(const String &other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+  bool startsWith(const String &prefix) const { return strncmp(c_str(), prefix.c_str(), prefix.length()) == 0; }
+
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const char *value, unsigned int from = 0) const;
+  String substring(unsigned int from) const { return substring(from, _length); }
+  String substring(unsigned int from, unsigned int to) const;
+  long toInt() const { return atol(c_str()); }
+  void trim();
+  void toLowerCase();
+
+private:
+  char *_buffer;
+  unsigned int _length;
+  unsigned int _capacity;
+};
+
+// ArduinoJson looks for this type next to String
+class StringSumHelper : public String
+{
+public:
+  StringSumHelper(const String &value) : String(value) {}
+};
+
+StringSumHelper operator+(const String &a, const String &b);
+StringSumHelper operator+(const String &a, const char *b);
+StringSumHelper operator+(const char *a, const String &b);
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *value) { return write((const uint8_t *)value, strlen(value)); }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+  virtual void flush() {}
+
+  size_t print(const char *value) { return write(value); }
+  size_t print(const __FlashStringHelper *value) { return write((const char *)value); }
+  size_t print(const String &value) { return write(value.c_str(), value.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  template <typename T>
+  size_t println(T value, int format) { return print(value, format) + println(); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+  Stream() : _timeout(1000) {}
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() { return _timeout; }
+  size_t readBytes(char *buffer, size_t length);
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+  size_t readBytesUntil(char terminator, char *buffer, size_t length);
+  String readStringUntil(char terminator);
+  bool find(const char *target) { return findUntil(target, NULL); }
+  bool findUntil(const char *target, const char *terminator);
+
+protected:
+  unsigned long _timeout;
+  // read() that waits up to the timeout
+  int timedRead();
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) {}
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+  // There is no heap to speak of, the tests count allocations instead
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMaxFreeBlockSize() { return 0; }
+};
+
+extern EspClass ESP;
+
+class IPAddress
+{
+public:
+  IPAddress() : b{0, 0, 0, 0} {}
+  IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) : b{b0, b1, b2, b3} {}
+  uint8_t operator[](int index) const { return b[index]; }
+  uint8_t &operator[](int index) { return b[index]; }
+  bool operator==(const IPAddress &other) const { return memcmp(b, other.b, sizeof(b)) == 0; }
+
+  uint8_t b[4];
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "FS.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs
+{
+
+File::Handle::~Handle()
+{
+    if (handle != NULL)
+    {
+        fclose(handle);
+    }
+}
+
+File::File(FILE *file) : _file(new Handle())
+{
+    _file->handle = file;
+    // There is nothing more to wait for at the end of a file
+    setTimeout(0);
+}
+
+size_t File::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size)
+{
+    return *this ? fwrite(buffer, 1, size, _file->handle) : 0;
+}
+
+int File::available()
+{
+    return *this ? (int)(size() - position()) : 0;
+}
+
+int File::read()
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+size_t File::read(uint8_t *buffer, size_t size)
+{
+    return *this ? fread(buffer, 1, size, _file->handle) : 0;
+}
+
+int File::peek()
+{
+    if (!*this)
+    {
+        return -1;
+    }
+    int c = fgetc(_file->handle);
+    if (c != EOF)
+    {
+        ungetc(c, _file->handle);
+    }
+    return (c != EOF) ? c : -1;
+}
+
+void File::flush()
+{
+    if (*this)
+    {
+        fflush(_file->handle);
+    }
+}
+
+size_t File::size()
+{
+    if (!*this)
+    {
+        return 0;
+    }
+    // Including what is still buffered
+    fflush(_file->handle);
+    struct stat info;
+    return (fstat(fileno(_file->handle), &info) == 0) ? (size_t)info.st_size : 0;
+}
+
+size_t File::position()
+{
+    return *this ? (size_t)ftell(_file->handle) : 0;
+}
+
+bool File::seek(uint32_t position)
+{
+    return *this && fseek(_file->handle, position, SEEK_SET) == 0;
+}
+
+void File::close()
+{
+    if (*this)
+    {
+        fclose(_file->handle);
+        _file->handle = NULL;
+    }
+}
+
+FS::FS(const char *root) : _root(root)
+{
+}
+
+std::string FS::hostPath(const char *path)
+{
+    return _root + (path[0] == '/' ? "" : "/") + path;
+}
+
+File FS::open(const char *path, const char *mode)
+{
+    std::string hostMode = std::string(mode) + "b";
+    FILE *file = fopen(hostPath(path).c_str(), hostMode.c_str());
+    return (file != NULL) ? File(file) : File();
+}
+
+bool FS::exists(const char *path)
+{
+    struct stat info;
+    return stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+    return ::remove(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char *path)
+{
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+}
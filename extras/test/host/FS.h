@@ -0,0 +1,90 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// A file system in a directory of the PC, with the calls of the ESP32 FS
+// the library uses. Paths are relative to the directory the FS was made
+// with, like they are relative to where LittleFS is mounted.
+
+#ifndef FS_h
+#define FS_h
+
+#include "Arduino.h"
+#include <stdio.h>
+#include <memory>
+#include <string>
+
+namespace fs
+{
+
+class File : public Stream
+{
+public:
+  File() {}
+  File(FILE *file);
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int available();
+  int read();
+  size_t read(uint8_t *buffer, size_t size);
+  int peek();
+  void flush();
+  size_t size();
+  size_t position();
+  bool seek(uint32_t position);
+  void close();
+  operator bool() const { return _file && _file->handle != NULL; }
+  using Print::write;
+
+private:
+  // Copies of a File are the same open file, like on the ESPs
+  struct Handle
+  {
+    FILE *handle;
+    ~Handle();
+  };
+  std::shared_ptr<Handle> _file;
+};
+
+class FS
+{
+public:
+  explicit FS(const char *root);
+
+  // "r", "w" or "a"
+  File open(const char *path, const char *mode = "r");
+  bool exists(const char *path);
+  bool remove(const char *path);
+  bool rename(const char *from, const char *to);
+  bool mkdir(const char *path);
+  bool rmdir(const char *path);
+
+private:
+  std::string _root;
+
+  std::string hostPath(const char *path);
+};
+
+}
+
+using fs::File;
+using fs::FS;
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "HTTPClient.h"
+
+HTTPClient::HTTPClient()
+{
+    _client = NULL;
+    _port = 0;
+    _userAgent = "ESP32HTTPClient";
+    _reuse = true;
+    _canReuse = false;
+    _tcpTimeout = 5000;
+    _connectTimeout = 5000;
+    _currentHeaders = NULL;
+    _headerKeysCount = 0;
+    _returnCode = 0;
+    _size = -1;
+}
+
+HTTPClient::~HTTPClient()
+{
+    delete[] _currentHeaders;
+}
+
+bool HTTPClient::begin(WiFiClient &client, String host, uint16_t port, String uri, bool https)
+{
+    _client = &client;
+    _headers = "";
+    _returnCode = 0;
+    _size = -1;
+    _host = host;
+    _port = port;
+    _uri = uri;
+    return true;
+}
+
+void HTTPClient::end()
+{
+    disconnect();
+    _headers = "";
+    _returnCode = 0;
+    _size = -1;
+}
+
+bool HTTPClient::connected()
+{
+    return _client != NULL && (_client->connected() || _client->available() > 0);
+}
+
+void HTTPClient::addHeader(const String &name, const String &value, bool first, bool replace)
+{
+    // Set by sendHeader()
+    if (name.equalsIgnoreCase("Connection") || name.equalsIgnoreCase("User-Agent") || name.equalsIgnoreCase("Host"))
+    {
+        return;
+    }
+    String headerLine = name;
+    headerLine += ": ";
+    if (replace)
+    {
+        int headerStart = _headers.indexOf(headerLine.c_str());
+        if (headerStart != -1)
+        {
+            int headerEnd = _headers.indexOf('\n', headerStart);
+            _headers = _headers.substring(0, headerStart) + _headers.substring(headerEnd + 1);
+        }
+    }
+    headerLine += value;
+    headerLine += "\r\n";
+    if (first)
+    {
+        _headers = headerLine + _headers;
+    }
+    else
+    {
+        _headers += headerLine;
+    }
+}
+
+void HTTPClient::collectHeaders(const char *headerKeys[], const size_t headerKeysCount)
+{
+    delete[] _currentHeaders;
+    _headerKeysCount = headerKeysCount;
+    _currentHeaders = new RequestArgument[headerKeysCount];
+    for (size_t i = 0; i < headerKeysCount; i++)
+    {
+        _currentHeaders[i].key = headerKeys[i];
+    }
+}
+
+String HTTPClient::header(const char *name)
+{
+    for (size_t i = 0; i < _headerKeysCount; i++)
+    {
+        if (_currentHeaders[i].key.equalsIgnoreCase(name))
+        {
+            return _currentHeaders[i].value;
+        }
+    }
+    return String();
+}
+
+bool HTTPClient::hasHeader(const char *name)
+{
+    return header(name).length() > 0;
+}
+
+int HTTPClient::sendRequest(const char *type, String payload)
+{
+    return sendRequest(type, (uint8_t *)payload.c_str(), payload.length());
+}
+
+int HTTPClient::sendRequest(const char *type, uint8_t *payload, size_t size)
+{
+    if (!connect())
+    {
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    if (payload != NULL && size > 0)
+    {
+        addHeader("Content-Length", String((unsigned long)size));
+    }
+    if (!sendHeader(type))
+    {
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+    if (payload != NULL && size > 0 && _client->write(payload, size) != size)
+    {
+        return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+    }
+    return handleHeaderResponse();
+}
+
+bool HTTPClient::connect()
+{
+    if (connected())
+    {
+        // Left over from the last response
+        while (_client->available() > 0)
+        {
+            _client->read();
+        }
+        return true;
+    }
+    if (!_client->connect(_host.c_str(), _port))
+    {
+        return false;
+    }
+    _client->setTimeout(_tcpTimeout);
+    return connected();
+}
+
+void HTTPClient::disconnect()
+{
+    if (!connected())
+    {
+        return;
+    }
+    while (_client->available() > 0)
+    {
+        _client->read();
+    }
+    if (!_reuse || !_canReuse)
+    {
+        _client->stop();
+    }
+}
+
+bool HTTPClient::sendHeader(const char *type)
+{
+    if (!connected())
+    {
+        return false;
+    }
+    String header = String(type) + " " + (_uri.length() ? _uri : String("/")) + " HTTP/1.1";
+    header += String("\r\nHost: ") + _host;
+    if (_port != 80 && _port != 443)
+    {
+        header += ':';
+        header += String((unsigned int)_port);
+    }
+    header += String("\r\nUser-Agent: ") + _userAgent + "\r\nConnection: ";
+    header += _reuse ? "keep-alive" : "close";
+    header += "\r\n";
+    header += "Accept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n";
+    header += _headers + "\r\n";
+    return _client->write((const uint8_t *)header.c_str(), header.length()) == header.length();
+}
+
+int HTTPClient::handleHeaderResponse()
+{
+    if (!connected())
+    {
+        return HTTPC_ERROR_NOT_CONNECTED;
+    }
+    for (size_t i = 0; i < _headerKeysCount; i++)
+    {
+        _currentHeaders[i].value = "";
+    }
+    _returnCode = 0;
+    _size = -1;
+    _canReuse = _reuse;
+
+    String transferEncoding;
+    unsigned long lastDataTime = millis();
+    bool firstLine = true;
+    while (connected())
+    {
+        if (_client->available() > 0)
+        {
+            String headerLine = _client->readStringUntil('\n');
+            headerLine.trim();
+            lastDataTime = millis();
+            if (firstLine)
+            {
+                firstLine = false;
+                if (_canReuse && headerLine.startsWith("HTTP/1."))
+                {
+                    _canReuse = headerLine[sizeof("HTTP/1.") - 1] != '0';
+                }
+                int codePos = headerLine.indexOf(' ') + 1;
+                _returnCode = headerLine.substring(codePos, headerLine.indexOf(' ', codePos)).toInt();
+            }
+            else if (headerLine.indexOf(':') > 0)
+            {
+                String headerName = headerLine.substring(0, headerLine.indexOf(':'));
+                String headerValue = headerLine.substring(headerLine.indexOf(':') + 1);
+                headerValue.trim();
+                if (headerName.equalsIgnoreCase("Content-Length"))
+                {
+                    _size = headerValue.toInt();
+                }
+                if (_canReuse && headerName.equalsIgnoreCase("Connection") &&
+                    headerValue.indexOf("close") >= 0 && headerValue.indexOf("keep-alive") < 0)
+                {
+                    _canReuse = false;
+                }
+                if (headerName.equalsIgnoreCase("Transfer-Encoding"))
+                {
+                    transferEncoding = headerValue;
+                }
+                for (size_t i = 0; i < _headerKeysCount; i++)
+                {
+                    if (_currentHeaders[i].key.equalsIgnoreCase(headerName))
+                    {
+                        _currentHeaders[i].value = headerValue;
+                        break;
+                    }
+                }
+            }
+
+            if (headerLine.length() == 0)
+            {
+                if (_returnCode == 0)
+                {
+                    return HTTPC_ERROR_NO_HTTP_SERVER;
+                }
+                if (transferEncoding.length() > 0 && !transferEncoding.equalsIgnoreCase("chunked"))
+                {
+                    return HTTPC_ERROR_ENCODING;
+                }
+                return _returnCode;
+            }
+        }
+        else
+        {
+            if (millis() - lastDataTime > _tcpTimeout)
+            {
+                return HTTPC_ERROR_READ_TIMEOUT;
+            }
+            delay(10);
+        }
+    }
+    return HTTPC_ERROR_CONNECTION_LOST;
+}
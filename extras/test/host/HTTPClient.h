@@ -0,0 +1,100 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef HTTPClient_h
+#define HTTPClient_h
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+// The request path of the ESP32 core's HTTPClient, without redirects,
+// cookies and basic auth. It builds the same Strings the original does
+// (host, URI, one per added header, the whole request header and each
+// response header line), so the benchmark can compare it with
+// SpotifyLeanTransport.
+class HTTPClient
+{
+public:
+  HTTPClient();
+  ~HTTPClient();
+
+  bool begin(WiFiClient &client, String host, uint16_t port, String uri = "/", bool https = false);
+  void end();
+
+  void setReuse(bool reuse) { _reuse = reuse; }
+  void setTimeout(uint16_t timeout) { _tcpTimeout = timeout; }
+  void setConnectTimeout(int32_t timeout) { _connectTimeout = timeout; }
+
+  void addHeader(const String &name, const String &value, bool first = false, bool replace = true);
+  void collectHeaders(const char *headerKeys[], const size_t headerKeysCount);
+  String header(const char *name);
+  bool hasHeader(const char *name);
+
+  int sendRequest(const char *type, String payload);
+  int sendRequest(const char *type, uint8_t *payload = NULL, size_t size = 0);
+
+  int getSize() { return _size; }
+  WiFiClient &getStream() { return *_client; }
+  bool connected();
+
+private:
+  struct RequestArgument
+  {
+    String key;
+    String value;
+  };
+
+  bool connect();
+  void disconnect();
+  bool sendHeader(const char *type);
+  int handleHeaderResponse();
+
+  WiFiClient *_client;
+  String _host;
+  uint16_t _port;
+  String _uri;
+  String _headers;
+  String _userAgent;
+  bool _reuse;
+  bool _canReuse;
+  uint16_t _tcpTimeout;
+  int32_t _connectTimeout;
+  RequestArgument *_currentHeaders;
+  size_t _headerKeysCount;
+  int _returnCode;
+  int _size;
+
+  HTTPClient(const HTTPClient &);
+  HTTPClient &operator=(const HTTPClient &);
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "WiFiClient.h"
+#include <atomic>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static char redirectHost[64];
+static uint16_t redirectPort = 0;
+static std::atomic<unsigned long> connects(0);
+
+void WiFiClient::redirect(const char *host, uint16_t port)
+{
+    if (host == NULL)
+    {
+        redirectPort = 0;
+        return;
+    }
+    strncpy(redirectHost, host, sizeof(redirectHost) - 1);
+    redirectPort = port;
+}
+
+unsigned long WiFiClient::connectCount()
+{
+    return connects;
+}
+
+WiFiClient::WiFiClient()
+{
+    _socket = -1;
+}
+
+WiFiClient::~WiFiClient()
+{
+    stop();
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+    char host[16];
+    snprintf(host, sizeof(host), "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+    return connect(host, port);
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+    stop();
+    if (redirectPort != 0)
+    {
+        host = redirectHost;
+        port = redirectPort;
+    }
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    {
+        return 0;
+    }
+
+    for (struct addrinfo *address = addresses; address != NULL && _socket < 0; address = address->ai_next)
+    {
+        _socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (_socket >= 0 && ::connect(_socket, address->ai_addr, address->ai_addrlen) != 0)
+        {
+            close(_socket);
+            _socket = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (_socket < 0)
+    {
+        return 0;
+    }
+
+    // Like the ESP cores, don't hold back small writes
+    int on = 1;
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    connects++;
+    return 1;
+}
+
+size_t WiFiClient::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while (_socket >= 0 && written < size)
+    {
+        ssize_t sent = send(_socket, buffer + written, size - written, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            if (sent < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        written += sent;
+    }
+    return written;
+}
+
+int WiFiClient::available()
+{
+    int count = 0;
+    if (_socket < 0 || ioctl(_socket, FIONREAD, &count) != 0)
+    {
+        return 0;
+    }
+    return count;
+}
+
+int WiFiClient::read()
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+    if (_socket < 0)
+    {
+        return -1;
+    }
+    ssize_t received = recv(_socket, buffer, size, MSG_DONTWAIT);
+    return (received > 0) ? (int)received : -1;
+}
+
+int WiFiClient::peek()
+{
+    uint8_t c;
+    if (_socket < 0 || recv(_socket, &c, 1, MSG_DONTWAIT | MSG_PEEK) != 1)
+    {
+        return -1;
+    }
+    return c;
+}
+
+void WiFiClient::stop()
+{
+    if (_socket >= 0)
+    {
+        close(_socket);
+        _socket = -1;
+    }
+}
+
+uint8_t WiFiClient::connected()
+{
+    if (_socket < 0)
+    {
+        return 0;
+    }
+    // Still connected while there is something to read, like on the ESPs
+    uint8_t c;
+    ssize_t received = recv(_socket, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+    if (received > 0)
+    {
+        return 1;
+    }
+    return (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef WiFiClient_h
+#define WiFiClient_h
+
+#include "Client.h"
+
+// Plain TCP over POSIX sockets. Like on the ESPs, read() and available()
+// never wait.
+class WiFiClient : public Client
+{
+public:
+  WiFiClient();
+  ~WiFiClient();
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(const char *host, uint16_t port);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int available();
+  int read();
+  int read(uint8_t *buffer, size_t size);
+  int peek();
+  void flush() {}
+  void stop();
+  uint8_t connected();
+  operator bool() { return _socket >= 0; }
+  void setNoDelay(bool noDelay) {}
+  using Print::write;
+
+  // Sends every connection to host:port instead, so the library can talk
+  // to a local test server while it thinks it talks to Spotify.
+  // NULL turns it off.
+  static void redirect(const char *host, uint16_t port);
+  // Connections opened so far, by all clients
+  static unsigned long connectCount();
+
+private:
+  int _socket;
+
+  // Not copyable, the socket would be closed twice
+  WiFiClient(const WiFiClient &);
+  WiFiClient &operator=(const WiFiClient &);
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "WiFiUdp.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The largest UDP payload
+#define WIFIUDP_MAX_PACKET 65507
+
+static uint32_t toAddress(IPAddress ip)
+{
+    uint32_t address;
+    memcpy(&address, ip.b, sizeof(address));
+    return address;
+}
+
+WiFiUDP::WiFiUDP()
+{
+    _socket = -1;
+    _drop = 0;
+    _inPosition = 0;
+    _remotePort = 0;
+    _outPort = 0;
+}
+
+WiFiUDP::~WiFiUDP()
+{
+    stop();
+}
+
+bool WiFiUDP::open(uint16_t port)
+{
+    stop();
+    _socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_socket < 0)
+    {
+        return false;
+    }
+    // Several clients on one machine join the same group and port
+    int on = 1;
+    setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = toAddress(_localIP);
+    address.sin_port = htons(port);
+    if (bind(_socket, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port)
+{
+    return open(port) ? 1 : 0;
+}
+
+uint8_t WiFiUDP::beginMulticast(IPAddress group, uint16_t port)
+{
+    if (!open(port))
+    {
+        return 0;
+    }
+    struct ip_mreq membership;
+    membership.imr_multiaddr.s_addr = toAddress(group);
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+    {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void WiFiUDP::stop()
+{
+    if (_socket >= 0)
+    {
+        close(_socket);
+        _socket = -1;
+    }
+    _in.clear();
+    _inPosition = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+    // Like on the ESPs, sending works without begin()
+    if (_socket < 0)
+    {
+        _socket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (_socket < 0)
+        {
+            return 0;
+        }
+    }
+    _out.clear();
+    _outIP = ip;
+    _outPort = port;
+    return 1;
+}
+
+size_t WiFiUDP::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+    size = min(size, (size_t)WIFIUDP_MAX_PACKET - _out.size());
+    _out.insert(_out.end(), buffer, buffer + size);
+    return size;
+}
+
+int WiFiUDP::endPacket()
+{
+    if (_socket < 0)
+    {
+        return 0;
+    }
+    if (_drop > 0)
+    {
+        _drop--;
+        return 1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = toAddress(_outIP);
+    address.sin_port = htons(_outPort);
+    ssize_t sent = sendto(_socket, _out.data(), _out.size(), 0, (struct sockaddr *)&address, sizeof(address));
+    return (sent == (ssize_t)_out.size()) ? 1 : 0;
+}
+
+int WiFiUDP::parsePacket()
+{
+    _in.clear();
+    _inPosition = 0;
+    if (_socket < 0)
+    {
+        return 0;
+    }
+
+    _in.resize(WIFIUDP_MAX_PACKET);
+    struct sockaddr_in address;
+    socklen_t addressLength = sizeof(address);
+    ssize_t received;
+    do
+    {
+        received = recvfrom(_socket, _in.data(), _in.size(), MSG_DONTWAIT, (struct sockaddr *)&address, &addressLength);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0)
+    {
+        _in.clear();
+        return 0;
+    }
+
+    _in.resize(received);
+    memcpy(_remoteIP.b, &address.sin_addr.s_addr, sizeof(_remoteIP.b));
+    _remotePort = ntohs(address.sin_port);
+    return (int)received;
+}
+
+int WiFiUDP::available()
+{
+    return (int)(_in.size() - _inPosition);
+}
+
+int WiFiUDP::read()
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+int WiFiUDP::read(uint8_t *buffer, size_t size)
+{
+    size = min(size, (size_t)available());
+    if (size == 0)
+    {
+        return -1;
+    }
+    memcpy(buffer, _in.data() + _inPosition, size);
+    _inPosition += size;
+    return (int)size;
+}
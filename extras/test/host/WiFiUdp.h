@@ -0,0 +1,78 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef WiFiUdp_h
+#define WiFiUdp_h
+
+#include "Arduino.h"
+#include <vector>
+
+// UDP over POSIX sockets, with the calls of the ESP32 WiFiUDP. Like on the
+// ESPs, parsePacket() never waits.
+class WiFiUDP
+{
+public:
+  WiFiUDP();
+  ~WiFiUDP();
+
+  uint8_t begin(uint16_t port);
+  uint8_t beginMulticast(IPAddress group, uint16_t port);
+  void stop();
+
+  int beginPacket(IPAddress ip, uint16_t port);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int endPacket();
+
+  // Size of the next packet, 0 if there is none. Drops what is left of the last one.
+  int parsePacket();
+  int available();
+  int read();
+  int read(uint8_t *buffer, size_t size);
+  IPAddress remoteIP() { return _remoteIP; }
+  uint16_t remotePort() { return _remotePort; }
+
+  // Binds to ip instead of every address, so a hub and its clients can
+  // listen on the same port on one machine (127.0.0.1, 127.0.0.2 ...).
+  // Call before begin().
+  void bindTo(IPAddress ip) { _localIP = ip; }
+  // The next count packets are lost on the way, endPacket() still succeeds
+  void dropNext(int count) { _drop = count; }
+
+private:
+  int _socket;
+  IPAddress _localIP;
+  int _drop;
+  std::vector<uint8_t> _in;
+  size_t _inPosition;
+  IPAddress _remoteIP;
+  uint16_t _remotePort;
+  std::vector<uint8_t> _out;
+  IPAddress _outIP;
+  uint16_t _outPort;
+
+  bool open(uint16_t port);
+
+  // Not copyable, the socket would be closed twice
+  WiFiUDP(const WiFiUDP &);
+  WiFiUDP &operator=(const WiFiUDP &);
+};
+
+#endif
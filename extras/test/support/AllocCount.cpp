@@ -0,0 +1,96 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "AllocCount.h"
+#include <malloc.h>
+#include <string.h>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void __libc_free(void *pointer);
+
+static thread_local bool counting = false;
+static thread_local AllocStats stats;
+static thread_local size_t liveBytes;
+
+static void allocated(void *pointer)
+{
+    if (counting && pointer != NULL)
+    {
+        stats.allocations++;
+        liveBytes += malloc_usable_size(pointer);
+        if (liveBytes > stats.peakBytes)
+        {
+            stats.peakBytes = liveBytes;
+        }
+    }
+}
+
+static void freed(void *pointer)
+{
+    if (counting && pointer != NULL)
+    {
+        size_t size = malloc_usable_size(pointer);
+        // Blocks from before the start don't count
+        liveBytes = (size < liveBytes) ? liveBytes - size : 0;
+    }
+}
+
+extern "C" void *malloc(size_t size)
+{
+    void *pointer = __libc_malloc(size);
+    allocated(pointer);
+    return pointer;
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    void *pointer = __libc_calloc(count, size);
+    allocated(pointer);
+    return pointer;
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    freed(pointer);
+    void *result = __libc_realloc(pointer, size);
+    allocated(result);
+    return result;
+}
+
+extern "C" void free(void *pointer)
+{
+    freed(pointer);
+    __libc_free(pointer);
+}
+
+void allocCountStart()
+{
+    memset(&stats, 0, sizeof(stats));
+    liveBytes = 0;
+    counting = true;
+}
+
+AllocStats allocCountStop()
+{
+    counting = false;
+    return stats;
+}
@@ -0,0 +1,40 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Counts the heap allocations of the calling thread, malloc() and new
+// included. Only works with glibc, which lets us wrap its malloc.
+
+#ifndef AllocCount_h
+#define AllocCount_h
+
+#include <stddef.h>
+
+struct AllocStats
+{
+  size_t allocations;
+  // Most bytes that were allocated at the same time while counting
+  size_t peakBytes;
+};
+
+// Starts counting (again) for this thread
+void allocCountStart();
+AllocStats allocCountStop();
+
+#endif
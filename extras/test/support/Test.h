@@ -0,0 +1,122 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Checks for the host tests, a failed one is reported and counted but
+// doesn't stop the test
+
+#ifndef Test_h
+#define Test_h
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static int testFailures = 0;
+
+#define CHECK(condition)                                                            \
+  do                                                                                \
+  {                                                                                 \
+    if (!(condition))                                                               \
+    {                                                                               \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      testFailures++;                                                               \
+    }                                                                               \
+  } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                                   \
+  do                                                                                    \
+  {                                                                                     \
+    long long expectedValue = (long long)(expected);                                    \
+    long long actualValue = (long long)(actual);                                        \
+    if (expectedValue != actualValue)                                                   \
+    {                                                                                   \
+      fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, \
+              actualValue, expectedValue);                                              \
+      testFailures++;                                                                   \
+    }                                                                                   \
+  } while (0)
+
+#define CHECK_STRING(expected, actual)                                                     \
+  do                                                                                       \
+  {                                                                                        \
+    if (strcmp((expected), (actual)) != 0)                                                 \
+    {                                                                                      \
+      fprintf(stderr, "%s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #actual, \
+              (actual), (expected));                                                       \
+      testFailures++;                                                                      \
+    }                                                                                      \
+  } while (0)
+
+// A file from fixtures/, the tests run from extras/test
+static inline std::string readFixture(const char *name)
+{
+  std::string path = std::string("fixtures/") + name;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Missing fixture %s\n", path.c_str());
+    testFailures++;
+    return "";
+  }
+  std::string content;
+  char buffer[4096];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    content.append(buffer, count);
+  }
+  fclose(file);
+  return content;
+}
+
+// An empty directory in /tmp for an fs::FS to work in
+static inline std::string makeTestDirectory()
+{
+  char path[] = "/tmp/arduino_spotify_XXXXXX";
+  if (mkdtemp(path) == NULL)
+  {
+    fprintf(stderr, "Could not create %s\n", path);
+    testFailures++;
+    return "/tmp";
+  }
+  return path;
+}
+
+static inline int removeTestPath(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+
+// The directory and everything in it
+static inline void removeTestDirectory(const std::string &path)
+{
+  nftw(path.c_str(), removeTestPath, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+// Return this from main()
+static inline int testResult(const char *name)
+{
+  printf("%s: %s\n", name, testFailures == 0 ? "ok" : "FAILED");
+  return testFailures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "TestServer.h"
+#include <WiFiClient.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+
+std::string TestRequest::header(const char *name) const
+{
+    size_t nameLength = strlen(name);
+    size_t start = 0;
+    while (start < headers.size())
+    {
+        size_t end = headers.find("\r\n", start);
+        if (end == std::string::npos)
+        {
+            end = headers.size();
+        }
+        if (end - start > nameLength && headers[start + nameLength] == ':' &&
+            strncasecmp(headers.c_str() + start, name, nameLength) == 0)
+        {
+            size_t value = start + nameLength + 1;
+            while (value < end && headers[value] == ' ')
+            {
+                value++;
+            }
+            return headers.substr(value, end - value);
+        }
+        start = end + 2;
+    }
+    return "";
+}
+
+TestServer::TestServer(TestHandler handler) : _handler(handler), _stopping(false), _connections(0), _requests(0)
+{
+    _listener = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if (bind(_listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(_listener, 16) != 0 ||
+        getsockname(_listener, (struct sockaddr *)&address, &length) != 0)
+    {
+        perror("test server");
+        exit(2);
+    }
+    _port = ntohs(address.sin_port);
+    _acceptor = std::thread(&TestServer::acceptLoop, this);
+}
+
+TestServer::~TestServer()
+{
+    _stopping = true;
+    shutdown(_listener, SHUT_RDWR);
+    close(_listener);
+    _acceptor.join();
+    {
+        std::lock_guard<std::mutex> lock(_socketsLock);
+        for (size_t i = 0; i < _sockets.size(); i++)
+        {
+            shutdown(_sockets[i], SHUT_RDWR);
+        }
+    }
+    for (size_t i = 0; i < _workers.size(); i++)
+    {
+        _workers[i].join();
+    }
+    WiFiClient::redirect(NULL, 0);
+}
+
+void TestServer::redirectClients()
+{
+    WiFiClient::redirect("127.0.0.1", _port);
+}
+
+void TestServer::acceptLoop()
+{
+    while (!_stopping)
+    {
+        int client = accept(_listener, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+        int on = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        std::lock_guard<std::mutex> lock(_socketsLock);
+        _sockets.push_back(client);
+        _workers.push_back(std::thread(&TestServer::serve, this, client, _connections++));
+    }
+}
+
+static bool sendAll(int socket, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t count = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (count <= 0)
+        {
+            return false;
+        }
+        sent += count;
+    }
+    return true;
+}
+
+static const char *reason(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 304:
+        return "Not Modified";
+    case 401:
+        return "Unauthorized";
+    case 404:
+        return "Not Found";
+    case 429:
+        return "Too Many Requests";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Status";
+    }
+}
+
+void TestServer::serve(int socket, int connection)
+{
+    std::string buffer;
+    char data[4096];
+    bool open = true;
+    while (open && !_stopping)
+    {
+        // Headers first, then as much body as Content-Length says
+        size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            ssize_t count = recv(socket, data, sizeof(data), 0);
+            if (count <= 0)
+            {
+                open = false;
+                break;
+            }
+            buffer.append(data, count);
+        }
+        if (!open)
+        {
+            break;
+        }
+
+        TestRequest request;
+        size_t lineEnd = buffer.find("\r\n");
+        std::string line = buffer.substr(0, lineEnd);
+        size_t space = line.find(' ');
+        request.method = line.substr(0, space);
+        request.path = line.substr(space + 1, line.rfind(' ') - space - 1);
+        request.headers = buffer.substr(lineEnd + 2, headerEnd + 2 - (lineEnd + 2));
+        request.connection = connection;
+        buffer.erase(0, headerEnd + 4);
+
+        size_t bodyLength = strtoul(request.header("Content-Length").c_str(), NULL, 10);
+        while (buffer.size() < bodyLength)
+        {
+            ssize_t count = recv(socket, data, sizeof(data), 0);
+            if (count <= 0)
+            {
+                open = false;
+                break;
+            }
+            buffer.append(data, count);
+        }
+        if (!open)
+        {
+            break;
+        }
+        request.body = buffer.substr(0, bodyLength);
+        buffer.erase(0, bodyLength);
+
+        TestResponse response;
+        {
+            std::lock_guard<std::mutex> lock(_handlerLock);
+            request.index = _requests++;
+            _handler(request, response);
+        }
+
+        unsigned long waited = 0;
+        while (waited < response.delayMs && !_stopping)
+        {
+            unsigned long step = std::min(response.delayMs - waited, 10UL);
+            std::this_thread::sleep_for(std::chrono::milliseconds(step));
+            waited += step;
+        }
+        if (response.drop || _stopping)
+        {
+            break;
+        }
+
+        bool keepAlive = !response.close && strcasecmp(request.header("Connection").c_str(), "close") != 0;
+        char statusLine[160];
+        snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %d %s\r\nConnection: %s\r\n",
+                 response.status, reason(response.status), keepAlive ? "keep-alive" : "close");
+        std::string out = statusLine;
+        out += response.headers;
+        if (response.chunked)
+        {
+            out += "Transfer-Encoding: chunked\r\n\r\n";
+            for (size_t i = 0; i < response.body.size(); i += response.chunkSize)
+            {
+                size_t size = std::min(response.chunkSize, response.body.size() - i);
+                char chunkHeader[16];
+                snprintf(chunkHeader, sizeof(chunkHeader), "%zx\r\n", size);
+                out += chunkHeader;
+                out.append(response.body, i, size);
+                out += "\r\n";
+            }
+            out += "0\r\n\r\n";
+        }
+        else
+        {
+            out += "Content-Length: " + std::to_string(response.body.size()) + "\r\n\r\n";
+            if (request.method != "HEAD")
+            {
+                out += response.body;
+            }
+        }
+        open = sendAll(socket, out) && keepAlive;
+    }
+
+    std::lock_guard<std::mutex> lock(_socketsLock);
+    for (size_t i = 0; i < _sockets.size(); i++)
+    {
+        if (_sockets[i] == socket)
+        {
+            _sockets.erase(_sockets.begin() + i);
+            break;
+        }
+    }
+    close(socket);
+}
@@ -0,0 +1,98 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TestServer_h
+#define TestServer_h
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TestRequest
+{
+  std::string method;
+  std::string path;
+  // All header lines as they came in
+  std::string headers;
+  std::string body;
+  // Counting from 0, over the whole server
+  int connection;
+  int index;
+
+  // Value of a header, empty if it wasn't sent
+  std::string header(const char *name) const;
+};
+
+struct TestResponse
+{
+  int status = 200;
+  // Extra header lines, each one ending in \r\n
+  std::string headers;
+  std::string body;
+  // Sends the body in chunks of chunkSize instead of with a Content-Length
+  bool chunked = false;
+  size_t chunkSize = 256;
+  // Waits this long before answering
+  unsigned long delayMs = 0;
+  // Closes the connection after the response
+  bool close = false;
+  // Closes the connection without answering
+  bool drop = false;
+};
+
+typedef std::function<void(const TestRequest &request, TestResponse &response)> TestHandler;
+
+// HTTP/1.1 server on a free port of 127.0.0.1, one thread per connection.
+// The handler is only ever called by one thread at a time.
+class TestServer
+{
+public:
+  TestServer(TestHandler handler);
+  ~TestServer();
+
+  uint16_t port() { return _port; }
+  // Points all WiFiClients at this server
+  void redirectClients();
+
+  int connections() { return _connections; }
+  int requests() { return _requests; }
+
+private:
+  TestHandler _handler;
+  std::mutex _handlerLock;
+  int _listener;
+  uint16_t _port;
+  std::atomic<bool> _stopping;
+  std::atomic<int> _connections;
+  std::atomic<int> _requests;
+  std::thread _acceptor;
+  std::mutex _socketsLock;
+  std::vector<int> _sockets;
+  std::vector<std::thread> _workers;
+
+  void acceptLoop();
+  void serve(int socket, int connection);
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Album art kept on a file system: hits and misses, the least recently used
+// image going first once the byte budget or SPOTIFY_ART_CACHE_MAX_ENTRIES is
+// reached, failed downloads leaving nothing behind, and begin() dropping
+// images whose files went missing
+
+#include "SpotifyAlbumArtCache.h"
+#include "Test.h"
+#include "TestServer.h"
+#include <FS.h>
+
+#define IMAGE_BYTES 1000
+#define SMALL_IMAGE_BYTES 10
+
+static std::string imageFile(fs::FS &fs, const char *path)
+{
+    std::string content;
+    fs::File file = fs.open(path, "r");
+    int c;
+    while (file && (c = file.read()) >= 0)
+    {
+        content += (char)c;
+    }
+    return content;
+}
+
+// The same name as the image, where it is downloaded to first
+static std::string downloadPath(const char *path)
+{
+    std::string tmp = path;
+    return tmp.substr(0, tmp.size() - 3) + "tmp";
+}
+
+int main()
+{
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        std::string name = request.path.substr(request.path.rfind('/') + 1);
+        if (name == "missing")
+        {
+            response.status = 404;
+            return;
+        }
+        response.headers = "Content-Type: image/jpeg\r\n";
+        size_t bytes = (name.compare(0, 5, "small") == 0) ? SMALL_IMAGE_BYTES : IMAGE_BYTES;
+        response.body = std::string(bytes, name[0]);
+    });
+    server.redirectClients();
+
+    std::string directory = makeTestDirectory();
+    fs::FS fs(directory.c_str());
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    char path[SPOTIFY_ART_CACHE_MAX_PATH];
+    char pathA[SPOTIFY_ART_CACHE_MAX_PATH];
+    char pathB[SPOTIFY_ART_CACHE_MAX_PATH];
+    char pathC[SPOTIFY_ART_CACHE_MAX_PATH];
+    char urlA[] = "https://i.scdn.co/image/a";
+    char urlB[] = "https://i.scdn.co/image/b";
+    char urlC[] = "https://i.scdn.co/image/c";
+    char urlD[] = "https://i.scdn.co/image/d";
+    char urlMissing[] = "https://i.scdn.co/image/missing";
+
+    // Room for three images
+    SpotifyAlbumArtCache cache(spotify, fs, "/art", 3 * IMAGE_BYTES + IMAGE_BYTES / 2);
+    CHECK(cache.begin());
+    CHECK(cache.getImagePath("spotify:album:a", urlA, 300, pathA, sizeof(pathA)));
+    CHECK(imageFile(fs, pathA) == std::string(IMAGE_BYTES, 'a'));
+    CHECK(!fs.exists(downloadPath(pathA).c_str()));
+    CHECK_EQUAL(1, cache.misses());
+    CHECK_EQUAL(IMAGE_BYTES, cache.usedBytes());
+
+    // Cached, no download
+    int requests = server.requests();
+    CHECK(cache.getImagePath("spotify:album:a", urlA, 300, path, sizeof(path)));
+    CHECK_STRING(pathA, path);
+    CHECK_EQUAL(requests, server.requests());
+    CHECK_EQUAL(1, cache.hits());
+    // Another size of the same album is another image
+    CHECK(cache.getImagePath("spotify:album:a", urlA, 64, path, sizeof(path)));
+    CHECK(strcmp(pathA, path) != 0);
+    CHECK_EQUAL(2, cache.misses());
+
+    // b fills the budget, c takes the place of the oldest image (a at 300)
+    CHECK(cache.getImagePath("spotify:album:b", urlB, 300, pathB, sizeof(pathB)));
+    CHECK_EQUAL(0, cache.evictions());
+    CHECK(cache.getImagePath("spotify:album:c", urlC, 300, pathC, sizeof(pathC)));
+    CHECK_EQUAL(1, cache.evictions());
+    CHECK(!fs.exists(pathA));
+    CHECK_EQUAL(3 * IMAGE_BYTES, cache.usedBytes());
+
+    // Using a (64) makes b the oldest
+    CHECK(cache.getImagePath("spotify:album:a", urlA, 64, pathA, sizeof(pathA)));
+    CHECK(cache.getImagePath("spotify:album:d", urlD, 300, path, sizeof(path)));
+    CHECK_EQUAL(2, cache.evictions());
+    CHECK(!fs.exists(pathB));
+    CHECK(fs.exists(pathA));
+    CHECK(fs.exists(pathC));
+    CHECK(fs.exists(path));
+    CHECK_EQUAL(3 * IMAGE_BYTES, cache.usedBytes());
+    CHECK_EQUAL(2, cache.hits());
+    CHECK_EQUAL(5, cache.misses());
+
+    // A failed download leaves neither the image nor the download behind
+    CHECK(!cache.getImagePath("spotify:album:missing", urlMissing, 300, path, sizeof(path)));
+    snprintf(path, sizeof(path), "/art/%08lx_300.jpg", (unsigned long)spotifyHash("spotify:album:missing"));
+    CHECK(!fs.exists(path));
+    CHECK(!fs.exists(downloadPath(path).c_str()));
+    CHECK_EQUAL(6, cache.misses());
+    CHECK_EQUAL(2, cache.evictions());
+    CHECK_EQUAL(3 * IMAGE_BYTES, cache.usedBytes());
+
+    // After a restart the index is read again, without the image that went missing
+    CHECK(fs.remove(pathC));
+    SpotifyAlbumArtCache restarted(spotify, fs, "/art", 3 * IMAGE_BYTES + IMAGE_BYTES / 2);
+    CHECK(restarted.begin());
+    CHECK_EQUAL(2 * IMAGE_BYTES, restarted.usedBytes());
+    requests = server.requests();
+    CHECK(restarted.getImagePath("spotify:album:a", urlA, 64, path, sizeof(path)));
+    CHECK(restarted.getImagePath("spotify:album:d", urlD, 300, path, sizeof(path)));
+    CHECK_EQUAL(2, restarted.hits());
+    CHECK_EQUAL(requests, server.requests());
+    CHECK(restarted.getImagePath("spotify:album:c", urlC, 300, path, sizeof(path)));
+    CHECK_EQUAL(1, restarted.misses());
+    CHECK_STRING(pathC, path);
+    CHECK(imageFile(fs, pathC) == std::string(IMAGE_BYTES, 'c'));
+
+    // The index has room for SPOTIFY_ART_CACHE_MAX_ENTRIES, however small they are
+    SpotifyAlbumArtCache small(spotify, fs, "/small", 1000000);
+    CHECK(small.begin());
+    char firstPath[SPOTIFY_ART_CACHE_MAX_PATH];
+    char url[] = "https://i.scdn.co/image/small";
+    char album[32];
+    for (int i = 0; i <= SPOTIFY_ART_CACHE_MAX_ENTRIES; i++)
+    {
+        snprintf(album, sizeof(album), "spotify:album:%d", i);
+        CHECK(small.getImagePath(album, url, 64, path, sizeof(path)));
+        if (i == 0)
+        {
+            strcpy(firstPath, path);
+        }
+    }
+    CHECK_EQUAL(1, small.evictions());
+    CHECK_EQUAL(SPOTIFY_ART_CACHE_MAX_ENTRIES * SMALL_IMAGE_BYTES, small.usedBytes());
+    CHECK(!fs.exists(firstPath));
+
+    removeTestDirectory(directory);
+    return testResult("album art cache");
+}
@@ -0,0 +1,99 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Heap allocations of a poll with the fixed-size structs and the default
+// (lean) transport. After the first call has set up the JSON document and
+// the connection there should be none at all.
+
+#include "ArduinoSpotify.h"
+#include "AllocCount.h"
+#include "Test.h"
+#include "TestServer.h"
+
+#define POLLS 100
+
+int main()
+{
+    std::string player = readFixture("player.json");
+    std::string currentlyPlaying = readFixture("currently_playing.json");
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        if (request.path.compare(0, 31, "/v1/me/player/currently-playing") == 0)
+        {
+            response.body = currentlyPlaying;
+        }
+        else
+        {
+            response.body = player;
+        }
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    spotify.keepAlive = true;
+    PlayerDetailsFixed playerDetails;
+    CurrentlyPlayingFixed track;
+
+    // Allocates the JSON document and opens the connection. The document is
+    // big enough for every filtered call, but not the 10 KB of an unfiltered one.
+    allocCountStart();
+    CHECK(spotify.getPlayerState(playerDetails, track));
+    AllocStats first = allocCountStop();
+    CHECK(first.peakBytes >= (size_t)spotify.fixedBufferSize);
+    CHECK(first.peakBytes < (size_t)spotify.deviceBufferSize);
+    CHECK(spotify.getCurrentlyPlaying(track));
+    CHECK(spotify.getPlayerDetails(playerDetails));
+
+    // A whole response grows it once, for every unfiltered call
+    allocCountStart();
+    CHECK(!spotify.getPlayerDetails().error);
+    AllocStats grown = allocCountStop();
+    CHECK(grown.peakBytes >= (size_t)spotify.playerDetailsBufferSize);
+    allocCountStart();
+    CHECK(!spotify.getPlayerDetails().error);
+    CHECK(!spotify.getCurrentlyPlaying().error);
+    AllocStats again = allocCountStop();
+    CHECK(again.peakBytes < (size_t)spotify.deviceBufferSize);
+
+    allocCountStart();
+    for (int i = 0; i < POLLS; i++)
+    {
+        CHECK(spotify.getPlayerState(playerDetails, track));
+    }
+    AllocStats state = allocCountStop();
+
+    allocCountStart();
+    for (int i = 0; i < POLLS; i++)
+    {
+        CHECK(spotify.getCurrentlyPlaying(track));
+        CHECK(spotify.getPlayerDetails(playerDetails));
+    }
+    AllocStats split = allocCountStop();
+
+    CHECK_EQUAL(0, (int)state.allocations);
+    CHECK_EQUAL(0, (int)split.allocations);
+    CHECK_EQUAL(1, server.connections());
+    CHECK_STRING("Life on Mars? - 2015 Remaster", track.trackName);
+    CHECK_EQUAL(62, playerDetails.device.volumePrecent);
+    printf("alloc: %zu allocations in %d getPlayerState() calls, %zu in %d getCurrentlyPlaying() + getPlayerDetails()\n",
+           state.allocations, POLLS, split.allocations, POLLS);
+    return testResult("alloc");
+}
@@ -0,0 +1,109 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Player commands sent from inside the callbacks poll() calls, with a
+// single client: the finished request must have let go of it by then
+
+#include "ArduinoSpotify.h"
+#include "Test.h"
+#include "TestServer.h"
+
+static ArduinoSpotify *spotify;
+static SpotifyMetrics metrics;
+static int callbacks = 0;
+static bool commandSent = false;
+static bool trackInCallback = false;
+static bool metricsRecorded = false;
+
+static void pauseWhenPlaying(const SpotifyAsyncResult &result)
+{
+    callbacks++;
+    trackInCallback = !result.error && result.currentlyPlaying != NULL &&
+                      result.currentlyPlaying->trackName == "Life on Mars? - 2015 Remaster";
+    // The request is finished and recorded before its callback runs
+    metricsRecorded = metrics.lastRequest().statusCode == 200;
+    commandSent = spotify->pause();
+}
+
+static void turnDownAfterPlay(const SpotifyAsyncResult &result)
+{
+    callbacks++;
+    commandSent = !result.error && spotify->setVolume(20);
+}
+
+static void pollUntil(int count)
+{
+    unsigned long start = millis();
+    while (callbacks < count && millis() - start < 3000)
+    {
+        spotify->poll();
+        delay(1);
+    }
+}
+
+int main()
+{
+    std::string currentlyPlaying = readFixture("currently_playing.json");
+    std::vector<std::string> requests;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        requests.push_back(request.method + " " + request.path);
+        if (request.method == "GET")
+        {
+            response.body = currentlyPlaying;
+        }
+        else
+        {
+            response.status = 204;
+        }
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify instance(client, (char *)"token");
+    spotify = &instance;
+    spotify->autoTokenRefresh = false;
+    spotify->keepAlive = true;
+    spotify->setMetrics(&metrics);
+
+    // Sync command from the callback of a poll
+    CHECK(spotify->getCurrentlyPlayingAsync(pauseWhenPlaying) > 0);
+    pollUntil(1);
+    CHECK_EQUAL(1, callbacks);
+    CHECK(trackInCallback);
+    CHECK(metricsRecorded);
+    CHECK(commandSent);
+    CHECK_EQUAL(2, (int)requests.size());
+    CHECK_STRING("PUT /v1/me/player/pause", requests[1].c_str());
+    CHECK_EQUAL(0, spotify->getConnectionStats().preemptions);
+
+    // And from the callback of an async command
+    commandSent = false;
+    CHECK(spotify->playAsync(turnDownAfterPlay) > 0);
+    pollUntil(2);
+    delay(50);
+    spotify->poll();
+    CHECK_EQUAL(2, callbacks);
+    CHECK(commandSent);
+    CHECK_EQUAL(4, (int)requests.size());
+    CHECK_STRING("PUT /v1/me/player/volume?volume_percent=20", requests[3].c_str());
+    CHECK_EQUAL(1, server.connections());
+
+    return testResult("async callbacks");
+}
@@ -0,0 +1,71 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifyCommandQueue sending what is left after merging in the order the
+// commands came in
+
+#include "SpotifyCommandQueue.h"
+#include "Test.h"
+#include "TestServer.h"
+
+int main()
+{
+    std::vector<std::string> requests;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        requests.push_back(request.method + " " + request.path);
+        response.status = 204;
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    SpotifyCommandQueue queue(spotify);
+
+    // The pause comes after the skip, which would start playback again
+    queue.setVolume(30);
+    queue.nextTrack();
+    queue.nextTrack();
+    queue.pause();
+    queue.setVolume(40);
+    CHECK(queue.flush());
+    CHECK(!queue.hasPending());
+    CHECK_EQUAL(4, (int)requests.size());
+    CHECK(requests[0].find("POST /v1/me/player/next") == 0);
+    CHECK(requests[1].find("POST /v1/me/player/next") == 0);
+    CHECK(requests[2].find("PUT /v1/me/player/pause") == 0);
+    CHECK(requests[3].find("PUT /v1/me/player/volume?volume_percent=40") == 0);
+    CHECK_EQUAL(1, queue.mergedCount());
+    CHECK_EQUAL(4, queue.sentCount());
+
+    // Play first, then the skip; a seek before a skip is dropped, one after it kept
+    requests.clear();
+    queue.play();
+    queue.seek(1000);
+    queue.previousTrack();
+    queue.seek(5000);
+    CHECK(queue.flush());
+    CHECK_EQUAL(3, (int)requests.size());
+    CHECK(requests[0].find("PUT /v1/me/player/play") == 0);
+    CHECK(requests[1].find("POST /v1/me/player/previous") == 0);
+    CHECK(requests[2].find("PUT /v1/me/player/seek?position_ms=5000") == 0);
+
+    return testResult("command queue");
+}
@@ -0,0 +1,148 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// A SpotifyHub and a SpotifyHubClient talking over loopback UDP: the full
+// state first, then deltas with only what changed, and a lost delta noticed
+// by its sequence number and made up for by asking the hub
+
+#include "SpotifyHub.h"
+#include "Test.h"
+#include <WiFiUdp.h>
+
+#define HUB_PORT 47277
+
+static SpotifyHub *hub;
+static SpotifyHubClient *hubClient;
+
+// Both ends until the client saw a change
+static bool exchange()
+{
+    unsigned long start = millis();
+    while (millis() - start < 1000)
+    {
+        hub->loop();
+        if (hubClient->loop())
+        {
+            return true;
+        }
+        delay(1);
+    }
+    return false;
+}
+
+int main()
+{
+    WiFiUDP hubUdp;
+    WiFiUDP clientUdp;
+    hubUdp.bindTo(IPAddress(127, 0, 0, 1));
+    clientUdp.bindTo(IPAddress(127, 0, 0, 2));
+
+    // Never used, the hub only publishes what it is given
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    // Unicast to the one client, so both ends can share the port on one machine
+    SpotifyHub instance(spotify, hubUdp, IPAddress(127, 0, 0, 2), HUB_PORT);
+    instance.pollIntervalMs = 0;
+    instance.fullStateIntervalMs = 60000;
+    SpotifyHubClient clientInstance(clientUdp, IPAddress(127, 0, 0, 2), HUB_PORT);
+    clientInstance.requestIntervalMs = 0;
+    hub = &instance;
+    hubClient = &clientInstance;
+    CHECK(hub->begin());
+    CHECK(hubClient->begin());
+    CHECK(!hubClient->hasState());
+
+    CurrentlyPlayingFixed track;
+    PlayerDetailsFixed player;
+    memset(&track, 0, sizeof(track));
+    memset(&player, 0, sizeof(player));
+    strcpy(track.trackName, "Life on Mars? - 2015 Remaster");
+    strcpy(track.trackUri, "spotify:track:3ZE3wv8V3w2T2f7nOCjV0N");
+    strcpy(track.firstArtistName, "David Bowie");
+    strcpy(track.contextUri, "spotify:playlist:37i9dQZF1DXcBWIGoYBM5M");
+    track.duraitonMs = 235546;
+    track.progressMs = 43210;
+    strcpy(player.device.id, "ed01a3ca8def0a1772eab7be6c4b0bb37b06163e");
+    strcpy(player.device.name, "Kitchen speaker");
+    player.device.isActive = true;
+    player.device.volumePrecent = 62;
+    player.repeateState = REPEAT_CONTEXT;
+    // Paused, so the progress stays put and no delta carries it
+    player.isPlaying = false;
+
+    // The first state is sent in full
+    hub->publish(track, player);
+    CHECK(exchange());
+    CHECK(hubClient->hasState());
+    CHECK_EQUAL(SPOTIFY_HUB_ALL, hubClient->changedFields());
+    CurrentlyPlayingFixed received;
+    PlayerDetailsFixed receivedPlayer;
+    CHECK(hubClient->getCurrentlyPlaying(received));
+    CHECK_STRING("Life on Mars? - 2015 Remaster", received.trackName);
+    CHECK_EQUAL(43210, received.progressMs);
+    CHECK(hubClient->getPlayerDetails(receivedPlayer));
+    CHECK_STRING("Kitchen speaker", receivedPlayer.device.name);
+    CHECK_EQUAL(REPEAT_CONTEXT, receivedPlayer.repeateState);
+    unsigned long fullBytes = hub->bytesSent;
+
+    // Nothing changed, nothing sent
+    hub->publish(track, player);
+    CHECK_EQUAL(1, hub->packetsSent);
+
+    // A volume change is a delta with just the volume
+    player.device.volumePrecent = 40;
+    hub->publish(track, player);
+    CHECK_EQUAL(2, hub->packetsSent);
+    CHECK(hub->bytesSent - fullBytes < 16);
+    CHECK(exchange());
+    CHECK_EQUAL(SPOTIFY_HUB_VOLUME, hubClient->changedFields());
+    CHECK(hubClient->getPlayerDetails(receivedPlayer));
+    CHECK_EQUAL(40, receivedPlayer.device.volumePrecent);
+    CHECK_STRING("Kitchen speaker", receivedPlayer.device.name);
+    CHECK_EQUAL(0, hubClient->packetsMissed);
+
+    // The shuffle delta is lost, the volume delta after it can't be applied
+    hubUdp.dropNext(1);
+    player.shuffleState = true;
+    hub->publish(track, player);
+    player.device.volumePrecent = 55;
+    hub->publish(track, player);
+    CHECK_EQUAL(4, hub->packetsSent);
+
+    // The client notices the gap, asks for the full state and gets both changes
+    CHECK(exchange());
+    CHECK_EQUAL(1, hubClient->packetsMissed);
+    CHECK_EQUAL(SPOTIFY_HUB_VOLUME | SPOTIFY_HUB_SHUFFLE_REPEAT, hubClient->changedFields());
+    CHECK(hubClient->getPlayerDetails(receivedPlayer));
+    CHECK(receivedPlayer.shuffleState);
+    CHECK_EQUAL(55, receivedPlayer.device.volumePrecent);
+    // The full state only went to the client that asked
+    CHECK_EQUAL(5, hub->packetsSent);
+    CHECK_EQUAL(4, hubClient->packetsReceived);
+
+    // In sync again, the next delta applies
+    player.isPlaying = true;
+    hub->publish(track, player);
+    CHECK(exchange());
+    CHECK(hubClient->changedFields() & SPOTIFY_HUB_PLAYING);
+    CHECK_EQUAL(1, hubClient->packetsMissed);
+
+    return testResult("hub");
+}
@@ -0,0 +1,98 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// keepAlive against a local server standing in for api.spotify.com:
+// connections are reused, and ones the server closed are replaced without
+// the sketch noticing
+
+#include "ArduinoSpotify.h"
+#include "Test.h"
+#include "TestServer.h"
+
+int main()
+{
+    std::string player = readFixture("player.json");
+    int dropRequest = -1;
+    int closeAfterRequest = -1;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        // Like a connection that timed out on the server while it was idle
+        response.drop = request.index == dropRequest;
+        response.close = request.index == closeAfterRequest;
+        if (request.method == "GET")
+        {
+            response.body = player;
+        }
+        else
+        {
+            response.status = 204;
+        }
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    PlayerDetailsFixed playerDetails;
+
+    // Off by default, a connection per request
+    for (int i = 0; i < 3; i++)
+    {
+        CHECK(spotify.getPlayerDetails(playerDetails));
+    }
+    CHECK_EQUAL(3, server.connections());
+    CHECK_EQUAL(3, spotify.getConnectionStats().handshakes);
+    CHECK_EQUAL(0, spotify.getConnectionStats().reuses);
+
+    spotify.keepAlive = true;
+    spotify.resetConnectionStats();
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(spotify.getPlayerDetails(playerDetails));
+    }
+    CHECK_EQUAL(4, server.connections());
+    CHECK_EQUAL(1, spotify.getConnectionStats().handshakes);
+    CHECK_EQUAL(9, spotify.getConnectionStats().reuses);
+
+    // The server hangs up on the next request, the GET is sent again on a
+    // new connection
+    dropRequest = server.requests();
+    CHECK(spotify.getPlayerDetails(playerDetails));
+    CHECK_EQUAL(200, spotify.getLastStatusCode());
+    CHECK_EQUAL(1, spotify.getConnectionStats().reconnects);
+    CHECK_EQUAL(5, server.connections());
+    CHECK_STRING("Kitchen speaker", playerDetails.device.name);
+
+    // The server says it closes the connection, the next call opens another
+    closeAfterRequest = server.requests();
+    CHECK(spotify.getPlayerDetails(playerDetails));
+    CHECK(spotify.getPlayerDetails(playerDetails));
+    CHECK(spotify.getPlayerDetails(playerDetails));
+    CHECK_EQUAL(6, server.connections());
+
+    // Commands use the same connection
+    int before = server.connections();
+    spotify.resetConnectionStats();
+    CHECK(spotify.pause());
+    CHECK(spotify.setVolume(40));
+    CHECK_EQUAL(before, server.connections());
+    CHECK_EQUAL(2, spotify.getConnectionStats().reuses);
+
+    return testResult("keep-alive");
+}
@@ -0,0 +1,169 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifySpscRing and SpotifySnapshotBuffer hammered from several threads.
+// Built with -fsanitize=thread, which fails the run on any data race.
+
+#include <thread>
+#include <vector>
+#include "SpotifyLockFree.h"
+#include "Test.h"
+
+#define RING_ITEMS 1000000
+#define SNAPSHOTS 200000
+#define READERS 3
+
+struct Item
+{
+    uint32_t sequence;
+    // Every field is derived from the sequence, so a torn copy shows
+    uint32_t check;
+    char text[24];
+};
+
+static Item makeItem(uint32_t sequence)
+{
+    Item item;
+    item.sequence = sequence;
+    item.check = sequence * 2654435761u;
+    snprintf(item.text, sizeof(item.text), "item %u", sequence);
+    return item;
+}
+
+static bool intact(const Item &item)
+{
+    Item expected = makeItem(item.sequence);
+    return item.check == expected.check && strcmp(item.text, expected.text) == 0;
+}
+
+static void ring()
+{
+    SpotifySpscRing<Item, 8> ring;
+    unsigned long full = 0;
+    std::thread producer([&] {
+        for (uint32_t i = 1; i <= RING_ITEMS; i++)
+        {
+            while (!ring.push(makeItem(i)))
+            {
+                full++;
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected = 1;
+    unsigned long broken = 0;
+    while (expected <= RING_ITEMS)
+    {
+        Item item;
+        if (!ring.pop(item))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        // Nothing lost, nothing twice, nothing out of order
+        if (item.sequence != expected || !intact(item))
+        {
+            broken++;
+        }
+        expected = item.sequence + 1;
+    }
+    producer.join();
+
+    Item item;
+    CHECK(!ring.pop(item));
+    CHECK_EQUAL(0, broken);
+    printf("ring: %d items, producer found it full %lu times\n", RING_ITEMS, full);
+}
+
+// Several cache lines, so a reader copying it often overlaps with the writer
+struct Snapshot
+{
+    uint32_t sequence;
+    char text[250];
+    uint8_t last;
+};
+
+static void snapshots()
+{
+    SpotifySnapshotBuffer<Snapshot> buffer;
+    Snapshot first;
+    CHECK(!buffer.read(first));
+
+    bool done = false;
+    std::vector<std::thread> readers;
+    unsigned long reads[READERS] = {0};
+    unsigned long broken[READERS] = {0};
+    for (int r = 0; r < READERS; r++)
+    {
+        readers.push_back(std::thread([&, r] {
+            uint32_t last = 0;
+            while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE))
+            {
+                Snapshot snapshot;
+                if (!buffer.read(snapshot))
+                {
+                    continue;
+                }
+                reads[r]++;
+                bool ok = snapshot.sequence >= last && snapshot.last == (uint8_t)snapshot.sequence;
+                for (size_t i = 0; i < sizeof(snapshot.text) && ok; i++)
+                {
+                    ok = snapshot.text[i] == (char)(snapshot.sequence + i);
+                }
+                if (!ok)
+                {
+                    broken[r]++;
+                }
+                last = snapshot.sequence;
+            }
+        }));
+    }
+
+    for (uint32_t i = 1; i <= SNAPSHOTS; i++)
+    {
+        Snapshot snapshot;
+        snapshot.sequence = i;
+        for (size_t j = 0; j < sizeof(snapshot.text); j++)
+        {
+            snapshot.text[j] = (char)(i + j);
+        }
+        snapshot.last = (uint8_t)i;
+        buffer.publish(snapshot);
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    for (int r = 0; r < READERS; r++)
+    {
+        readers[r].join();
+        CHECK_EQUAL(0, broken[r]);
+    }
+
+    Snapshot latest;
+    CHECK(buffer.read(latest));
+    CHECK_EQUAL(SNAPSHOTS, latest.sequence);
+    printf("snapshots: %d published, %lu/%lu/%lu read\n", SNAPSHOTS, reads[0], reads[1], reads[2]);
+}
+
+int main()
+{
+    ring();
+    snapshots();
+    return testResult("lockfree");
+}
@@ -0,0 +1,66 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Endpoint names SpotifyMetrics groups requests by: no query, no IDs
+
+#include "ArduinoSpotify.h"
+#include "Test.h"
+#include "TestServer.h"
+
+int main()
+{
+    std::string player = readFixture("player.json");
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        if (request.path.compare(0, 13, "/v1/me/player") == 0)
+        {
+            response.body = player;
+        }
+        else
+        {
+            response.status = 404;
+            response.body = "{\"error\":{\"status\":404,\"message\":\"Not found\"}}";
+        }
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    SpotifyMetrics metrics;
+    spotify.setMetrics(&metrics);
+
+    SpotifyAudioAnalysis *analysis = new SpotifyAudioAnalysis();
+    CHECK(!spotify.getAudioAnalysis("11dFghVXANMlKmJXsNCbNl", *analysis));
+    CHECK(!spotify.getAudioAnalysis("spotify:track:4uLU6hMCjMI75M1A2tKUQC", *analysis));
+    delete analysis;
+    CHECK_STRING("/v1/audio-analysis", metrics.lastRequest().endpoint);
+
+    PlayerDetailsFixed playerDetails;
+    CHECK(spotify.getPlayerDetails(playerDetails, "DE"));
+    CHECK_STRING("/v1/me/player", metrics.lastRequest().endpoint);
+
+    // Two different tracks, one endpoint
+    CHECK_EQUAL(2, metrics.endpointCount());
+    CHECK_STRING("/v1/audio-analysis", metrics.endpointName(0));
+    CHECK_EQUAL(2, metrics.requestCount(0));
+    CHECK_EQUAL(2, metrics.errorCount(0));
+
+    return testResult("metrics");
+}
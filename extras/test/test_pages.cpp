@@ -0,0 +1,109 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// getPlaylistTracks() sending fields on every page, and the items it hands
+// out with the default and with narrower fields
+
+#include "ArduinoSpotify.h"
+#include "Test.h"
+#include "TestServer.h"
+
+#define PLAYLIST "37i9dQZF1DXcBWIGoYBM5M"
+
+static std::string item(const char *name, bool full)
+{
+    std::string track = std::string("{\"track\":{\"name\":\"") + name + "\"";
+    if (full)
+    {
+        track += std::string(",\"uri\":\"spotify:track:") + name + "\",\"duration_ms\":215000,\"is_local\":false,"
+                 "\"artists\":[{\"name\":\"David Bowie\",\"uri\":\"spotify:artist:0oSGxfWSnnOXhD2fKuz2Gy\"}],"
+                 "\"album\":{\"name\":\"Hunky Dory\",\"uri\":\"spotify:album:6fQElzBNTiEMGdIeY0hy5l\"}";
+    }
+    return track + "}}";
+}
+
+static std::vector<std::string> names;
+
+static bool collect(const SpotifyTrackFixed &track, int index, void *context)
+{
+    names.push_back(track.name);
+    *(bool *)context = track.uri[0] != '\0';
+    return true;
+}
+
+int main()
+{
+    std::vector<std::string> paths;
+    bool nextHasFields = false;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        paths.push_back(request.path);
+        // Spotify only sends what fields asks for
+        bool full = request.path.find("fields=items%28track%28name%29%29") == std::string::npos;
+        if (request.path.find("offset=2") == std::string::npos)
+        {
+            response.body = "{\"items\":[" + item("Changes", full) + "," + item("Oh! You Pretty Things", full) + "],"
+                            "\"next\":\"https://api.spotify.com/v1/playlists/" PLAYLIST "/tracks?offset=2&limit=2" +
+                            (nextHasFields ? "&fields=items%28track%28name%29%29%2Cnext" : "") + "\"}";
+        }
+        else
+        {
+            response.body = "{\"items\":[" + item("Eight Line Poem", full) + "],\"next\":null}";
+        }
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    spotify.pageSize = 2;
+    bool hasUri = false;
+
+    // Default fields, also on the page the next link points to
+    CHECK_EQUAL(3, spotify.getPlaylistTracks(PLAYLIST, collect, &hasUri));
+    CHECK_EQUAL(2, (int)paths.size());
+    CHECK_STRING("/v1/playlists/" PLAYLIST "/tracks?limit=2&offset=0&fields="
+                 "items%28added_at%2Ctrack%28name%2Curi%2Cduration_ms%2Cis_local%2Cartists%28name%2Curi%29%2C"
+                 "album%28name%2Curi%29%29%29%2Cnext",
+                 paths[0].c_str());
+    CHECK(paths[1].find("offset=2&limit=2&fields=items%28added_at") != std::string::npos);
+    CHECK_STRING("Eight Line Poem", names[2].c_str());
+    CHECK(hasUri);
+
+    // Narrower fields from the sketch, kept when the next link has them
+    names.clear();
+    paths.clear();
+    nextHasFields = true;
+    spotify.playlistTrackFields = "items(track(name)),next";
+    CHECK_EQUAL(3, spotify.getPlaylistTracks(PLAYLIST, collect, &hasUri));
+    CHECK_STRING("/v1/playlists/" PLAYLIST "/tracks?limit=2&offset=0&fields=items%28track%28name%29%29%2Cnext",
+                 paths[0].c_str());
+    CHECK_STRING("/v1/playlists/" PLAYLIST "/tracks?offset=2&limit=2&fields=items%28track%28name%29%29%2Cnext",
+                 paths[1].c_str());
+    CHECK_STRING("Oh! You Pretty Things", names[1].c_str());
+    CHECK(!hasUri);
+
+    // None at all
+    paths.clear();
+    spotify.playlistTrackFields = NULL;
+    CHECK_EQUAL(3, spotify.getPlaylistTracks(PLAYLIST, collect, &hasUri));
+    CHECK(paths[0].find("fields") == std::string::npos);
+
+    return testResult("pages");
+}
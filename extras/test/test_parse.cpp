@@ -0,0 +1,170 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Recorded responses parsed with and without the filters, and
+// getPlayerState() against the two requests it replaces. All of them must
+// end up with the same values.
+
+#include "ArduinoSpotify.h"
+#include "Test.h"
+#include "TestServer.h"
+
+static void checkEqual(const CurrentlyPlaying &expected, const CurrentlyPlaying &actual)
+{
+    CHECK(!actual.error);
+    CHECK_STRING(expected.firstArtistName.c_str(), actual.firstArtistName.c_str());
+    CHECK_STRING(expected.firstArtistUri.c_str(), actual.firstArtistUri.c_str());
+    CHECK_STRING(expected.albumName.c_str(), actual.albumName.c_str());
+    CHECK_STRING(expected.albumUri.c_str(), actual.albumUri.c_str());
+    CHECK_STRING(expected.trackName.c_str(), actual.trackName.c_str());
+    CHECK_STRING(expected.trackUri.c_str(), actual.trackUri.c_str());
+    CHECK_STRING(expected.contextUri.c_str(), actual.contextUri.c_str());
+    CHECK_EQUAL(expected.numImages, actual.numImages);
+    for (int i = 0; i < expected.numImages; i++)
+    {
+        CHECK_EQUAL(expected.albumImages[i].height, actual.albumImages[i].height);
+        CHECK_EQUAL(expected.albumImages[i].width, actual.albumImages[i].width);
+        CHECK_STRING(expected.albumImages[i].url.c_str(), actual.albumImages[i].url.c_str());
+    }
+    CHECK_EQUAL(expected.isPlaying, actual.isPlaying);
+    CHECK_EQUAL(expected.progressMs, actual.progressMs);
+    CHECK_EQUAL(expected.duraitonMs, actual.duraitonMs);
+}
+
+static void checkEqual(const PlayerDetails &expected, const PlayerDetails &actual)
+{
+    CHECK(!actual.error);
+    CHECK_STRING(expected.device.id.c_str(), actual.device.id.c_str());
+    CHECK_STRING(expected.device.name.c_str(), actual.device.name.c_str());
+    CHECK_STRING(expected.device.type.c_str(), actual.device.type.c_str());
+    CHECK_EQUAL(expected.device.isActive, actual.device.isActive);
+    CHECK_EQUAL(expected.device.isRestricted, actual.device.isRestricted);
+    CHECK_EQUAL(expected.device.isPrivateSession, actual.device.isPrivateSession);
+    CHECK_EQUAL(expected.device.volumePrecent, actual.device.volumePrecent);
+    CHECK_EQUAL(expected.progressMs, actual.progressMs);
+    CHECK_EQUAL(expected.isPlaying, actual.isPlaying);
+    CHECK_EQUAL(expected.repeateState, actual.repeateState);
+    CHECK_EQUAL(expected.shuffleState, actual.shuffleState);
+}
+
+static void checkEqual(const CurrentlyPlaying &expected, const CurrentlyPlayingFixed &actual)
+{
+    CHECK(!actual.error);
+    CHECK(!actual.truncated);
+    CHECK_STRING(expected.firstArtistName.c_str(), actual.firstArtistName);
+    CHECK_STRING(expected.firstArtistUri.c_str(), actual.firstArtistUri);
+    CHECK_STRING(expected.albumName.c_str(), actual.albumName);
+    CHECK_STRING(expected.albumUri.c_str(), actual.albumUri);
+    CHECK_STRING(expected.trackName.c_str(), actual.trackName);
+    CHECK_STRING(expected.trackUri.c_str(), actual.trackUri);
+    CHECK_STRING(expected.contextUri.c_str(), actual.contextUri);
+    CHECK_EQUAL(expected.numImages, actual.numImages);
+    for (int i = 0; i < expected.numImages; i++)
+    {
+        CHECK_EQUAL(expected.albumImages[i].height, actual.albumImages[i].height);
+        CHECK_EQUAL(expected.albumImages[i].width, actual.albumImages[i].width);
+        CHECK_STRING(expected.albumImages[i].url.c_str(), actual.albumImages[i].url);
+    }
+    CHECK_EQUAL(expected.isPlaying, actual.isPlaying);
+    CHECK_EQUAL(expected.progressMs, actual.progressMs);
+    CHECK_EQUAL(expected.duraitonMs, actual.duraitonMs);
+}
+
+static void checkEqual(const PlayerDetails &expected, const PlayerDetailsFixed &actual)
+{
+    CHECK(!actual.error);
+    CHECK(!actual.truncated);
+    CHECK_STRING(expected.device.id.c_str(), actual.device.id);
+    CHECK_STRING(expected.device.name.c_str(), actual.device.name);
+    CHECK_STRING(expected.device.type.c_str(), actual.device.type);
+    CHECK_EQUAL(expected.device.isActive, actual.device.isActive);
+    CHECK_EQUAL(expected.device.isRestricted, actual.device.isRestricted);
+    CHECK_EQUAL(expected.device.isPrivateSession, actual.device.isPrivateSession);
+    CHECK_EQUAL(expected.device.volumePrecent, actual.device.volumePrecent);
+    CHECK_EQUAL(expected.progressMs, actual.progressMs);
+    CHECK_EQUAL(expected.isPlaying, actual.isPlaying);
+    CHECK_EQUAL(expected.repeateState, actual.repeateState);
+    CHECK_EQUAL(expected.shuffleState, actual.shuffleState);
+}
+
+int main()
+{
+    std::string player = readFixture("player.json");
+    std::string currentlyPlaying = readFixture("currently_playing.json");
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        if (request.path.compare(0, 31, "/v1/me/player/currently-playing") == 0)
+        {
+            response.body = currentlyPlaying;
+        }
+        else
+        {
+            response.body = player;
+        }
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+
+    // The full parse, checked against the fixtures by hand
+    spotify.filterResponses = false;
+    CurrentlyPlaying track = spotify.getCurrentlyPlaying();
+    PlayerDetails details = spotify.getPlayerDetails();
+    CHECK(!track.error);
+    CHECK_STRING("Life on Mars? - 2015 Remaster", track.trackName.c_str());
+    CHECK_STRING("David Bowie", track.firstArtistName.c_str());
+    CHECK_STRING("spotify:playlist:37i9dQZF1DXcBWIGoYBM5M", track.contextUri.c_str());
+    CHECK_EQUAL(3, track.numImages);
+    CHECK_EQUAL(43210, track.progressMs);
+    CHECK(track.isPlaying);
+    CHECK(!details.error);
+    CHECK_STRING("Kitchen speaker", details.device.name.c_str());
+    CHECK_EQUAL(62, details.device.volumePrecent);
+    CHECK_EQUAL(REPEAT_CONTEXT, details.repeateState);
+    CHECK(details.shuffleState);
+
+    PlayerDetails stateDetails;
+    CurrentlyPlaying stateTrack;
+    CHECK(spotify.getPlayerState(stateDetails, stateTrack));
+    checkEqual(track, stateTrack);
+    checkEqual(details, stateDetails);
+
+    // Filtered
+    spotify.filterResponses = true;
+    checkEqual(track, spotify.getCurrentlyPlaying());
+    checkEqual(details, spotify.getPlayerDetails());
+    CHECK(spotify.getPlayerState(stateDetails, stateTrack));
+    checkEqual(track, stateTrack);
+    checkEqual(details, stateDetails);
+
+    // Heap-free, always filtered
+    CurrentlyPlayingFixed fixedTrack;
+    PlayerDetailsFixed fixedDetails;
+    CHECK(spotify.getCurrentlyPlaying(fixedTrack));
+    CHECK(spotify.getPlayerDetails(fixedDetails));
+    checkEqual(track, fixedTrack);
+    checkEqual(details, fixedDetails);
+    CHECK(spotify.getPlayerState(fixedDetails, fixedTrack));
+    checkEqual(track, fixedTrack);
+    checkEqual(details, fixedDetails);
+
+    return testResult("parse");
+}
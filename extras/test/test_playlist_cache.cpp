@@ -0,0 +1,128 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifyPlaylistCache with the file store: the tracks are only downloaded
+// again when the playlist's snapshot_id changed
+
+#include "SpotifyPlaylistCache.h"
+#include "Test.h"
+#include "TestServer.h"
+#include <FS.h>
+
+#define PLAYLIST "37i9dQZF1DXcBWIGoYBM5M"
+
+static std::string item(const char *name)
+{
+    return std::string("{\"track\":{\"name\":\"") + name + "\",\"uri\":\"spotify:track:" + name +
+           "\",\"duration_ms\":215000,\"is_local\":false,"
+           "\"artists\":[{\"name\":\"David Bowie\",\"uri\":\"spotify:artist:0oSGxfWSnnOXhD2fKuz2Gy\"}],"
+           "\"album\":{\"name\":\"Hunky Dory\",\"uri\":\"spotify:album:6fQElzBNTiEMGdIeY0hy5l\"}}}";
+}
+
+static std::vector<std::string> names;
+
+static bool collect(const SpotifyTrackFixed &track, int index, void *context)
+{
+    names.push_back(track.name);
+    CHECK_STRING("Hunky Dory", track.albumName);
+    CHECK_EQUAL(215000, track.durationMs);
+    return true;
+}
+
+int main()
+{
+    std::string snapshot = "MTAsZjM4";
+    std::string tracks = item("Changes") + "," + item("Kooks");
+    int snapshotStatus = 200;
+    std::vector<std::string> snapshotPaths;
+    int trackRequests = 0;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        if (request.path.find("/tracks") != std::string::npos)
+        {
+            trackRequests++;
+            response.body = "{\"items\":[" + tracks + "],\"next\":null}";
+        }
+        else
+        {
+            snapshotPaths.push_back(request.path);
+            response.status = snapshotStatus;
+            response.body = "{\"snapshot_id\":\"" + snapshot + "\"}";
+        }
+    });
+    server.redirectClients();
+
+    std::string directory = makeTestDirectory();
+    fs::FS fs(directory.c_str());
+    SpotifyFilePlaylistStore store(fs);
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    SpotifyPlaylistCache cache(spotify, store);
+
+    // Nothing stored, downloaded
+    CHECK_EQUAL(2, cache.getTracks(PLAYLIST, collect));
+    CHECK_EQUAL(1, trackRequests);
+    CHECK_EQUAL(1, cache.misses());
+    CHECK_STRING("/v1/playlists/" PLAYLIST "?fields=snapshot_id", snapshotPaths[0].c_str());
+    SpotifyPlaylistInfo info;
+    CHECK(store.getInfo(PLAYLIST, info));
+    CHECK_STRING("MTAsZjM4", info.snapshotId);
+    CHECK_EQUAL(2, info.trackCount);
+
+    // Same snapshot_id, the tracks come from the store
+    names.clear();
+    CHECK_EQUAL(2, cache.getTracks(PLAYLIST, collect));
+    CHECK_EQUAL(1, trackRequests);
+    CHECK_EQUAL(2, (int)snapshotPaths.size());
+    CHECK_EQUAL(1, cache.hits());
+    CHECK(cache.bytesSaved() > 0);
+    CHECK_STRING("Kooks", names[1].c_str());
+
+    // The playlist changed, downloaded again
+    snapshot = "MTEsYTI5";
+    tracks += "," + item("Quicksand");
+    names.clear();
+    CHECK_EQUAL(3, cache.getTracks(PLAYLIST, collect));
+    CHECK_EQUAL(2, trackRequests);
+    CHECK_EQUAL(2, cache.misses());
+    CHECK_STRING("Quicksand", names[2].c_str());
+
+    // The snapshot_id from getPlaylists() saves asking for it
+    SpotifyPlaylistFixed playlist;
+    memset(&playlist, 0, sizeof(playlist));
+    strcpy(playlist.id, PLAYLIST);
+    strcpy(playlist.snapshotId, "MTEsYTI5");
+    CHECK_EQUAL(3, cache.getTracks(playlist, collect));
+    CHECK_EQUAL(3, (int)snapshotPaths.size());
+    CHECK_EQUAL(2, trackRequests);
+    CHECK_EQUAL(2, cache.hits());
+
+    // Without an answer the stored copy is used
+    snapshotStatus = 404;
+    names.clear();
+    CHECK_EQUAL(3, cache.getTracks(PLAYLIST, collect));
+    CHECK_EQUAL(2, trackRequests);
+    CHECK_EQUAL(3, (int)names.size());
+    cache.useStaleOnError = false;
+    CHECK_EQUAL(-1, cache.getTracks(PLAYLIST, collect));
+
+    removeTestDirectory(directory);
+    return testResult("playlist cache");
+}
@@ -0,0 +1,94 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifyQuery encoding and what happens when a value doesn't fit
+
+#include "SpotifyQuery.h"
+#include "Test.h"
+
+static void encodes()
+{
+    SpotifyQuery<64> path("/v1/search");
+    path.add("q", "Motörhead ace/spades").add("limit", 5).add("offset", "");
+    CHECK(!path.overflowed());
+    CHECK_STRING("/v1/search?q=Mot%C3%B6rhead%20ace%2Fspades&limit=5", path.c_str());
+
+    // Every byte >= 0x80 is encoded, whatever isalnum() makes of it in the
+    // current locale
+    char high[2] = {(char)0xE9, '\0'};
+    SpotifyQuery<16> body;
+    body.add("a", high).add("b", true);
+    CHECK_STRING("a=%E9&b=true", body.c_str());
+}
+
+static void overflows()
+{
+    // Room for the unencoded value but not for the encoded one
+    SpotifyQuery<spotifyQuerySize(sizeof("/p"), spotifyQueryParam("q", 3))> path("/p");
+    path.add("q", "abc");
+    CHECK(!path.overflowed());
+    CHECK_STRING("/p?q=abc", path.c_str());
+
+    SpotifyQuery<spotifyQuerySize(sizeof("/p"), spotifyQueryParam("q", 3))> encoded("/p");
+    encoded.add("q", "a b");
+    CHECK(encoded.overflowed());
+    CHECK(strlen(encoded.c_str()) < sizeof("/p?q=abc"));
+
+    // Sized for the encoded length (3 bytes per space)
+    SpotifyQuery<spotifyQuerySize(sizeof("/p"), spotifyQueryParam("q", 9))> exact("/p");
+    exact.add("q", "a b c");
+    CHECK(!exact.overflowed());
+    CHECK_STRING("/p?q=a%20b%20c", exact.c_str());
+}
+
+static void segments()
+{
+    // How getAudioAnalysis() builds its path
+    SpotifyQuery<sizeof("/v1/audio-analysis/") + 22> path("/v1/audio-analysis/");
+    path.addSegment("11dFghVXANMlKmJXsNCbNl");
+    CHECK(!path.overflowed());
+    CHECK_STRING("/v1/audio-analysis/11dFghVXANMlKmJXsNCbNl", path.c_str());
+
+    SpotifyQuery<sizeof("/v1/audio-analysis/") + 22> tooLong("/v1/audio-analysis/");
+    tooLong.addSegment("11dFghVXANMlKmJXsNCbNlX");
+    CHECK(tooLong.overflowed());
+
+    // Can't get out of the path
+    SpotifyQuery<64> escaped("/v1/playlists/");
+    escaped.addSegment("../me?x=1");
+    CHECK_STRING("/v1/playlists/..%2Fme%3Fx%3D1", escaped.c_str());
+
+    // The '/' in between is added if the path doesn't end in one
+    SpotifyQuery<64> tracks("/v1/playlists/");
+    tracks.addSegment("37i9dQZF1DXcBWIGoYBM5M").addSegment("tracks");
+    CHECK_STRING("/v1/playlists/37i9dQZF1DXcBWIGoYBM5M/tracks", tracks.c_str());
+
+    SpotifyQuery<64> afterQuery("/v1/tracks");
+    afterQuery.add("ids", "a").addSegment("b");
+    CHECK(afterQuery.overflowed());
+}
+
+int main()
+{
+    encodes();
+    overflows();
+    segments();
+    return testResult("query");
+}
@@ -0,0 +1,163 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifyRateLimiter in front of a server that answers with 429
+
+#include <WiFiClient.h>
+#include "SpotifyRateLimiter.h"
+#include "SpotifyTransport.h"
+#include "Test.h"
+#include "TestServer.h"
+
+// What ArduinoSpotify does around every request
+static int limitedRequest(SpotifyRateLimiter &limiter, SpotifyTransport &transport, WiFiClient &client,
+                          uint16_t port, SpotifyPriority priority)
+{
+    if (!limiter.acquire(priority))
+    {
+        return SPOTIFY_RATE_LIMITED;
+    }
+    int status = transport.request(client, "127.0.0.1", port, priority == SPOTIFY_PRIORITY_USER ? "PUT" : "GET",
+                                   "/v1/me/player", NULL, NULL, NULL, NULL, true);
+    if (status == 429)
+    {
+        limiter.rateLimited(transport.getRetryAfter());
+    }
+    else if (status > 0)
+    {
+        limiter.succeeded();
+    }
+    transport.end();
+    return status;
+}
+
+// The defaults must not get in the way of a sketch that polls fast
+static void defaultsOnlyBackOff()
+{
+    TestServer server([](const TestRequest &request, TestResponse &response) {});
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    SpotifyRateLimiter limiter;
+    for (int i = 0; i < 100; i++)
+    {
+        CHECK_EQUAL(200, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    }
+    CHECK_EQUAL(0, limiter.refusedCount());
+    CHECK_EQUAL(100, server.requests());
+}
+
+static void retryAfter()
+{
+    unsigned long firstAt = 0;
+    unsigned long secondAt = 0;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        if (request.index == 0)
+        {
+            firstAt = millis();
+            response.status = 429;
+            response.headers = "Retry-After: 1\r\n";
+        }
+        else if (request.index == 1)
+        {
+            secondAt = millis();
+        }
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    SpotifyRateLimiter limiter;
+
+    CHECK_EQUAL(429, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    CHECK_EQUAL(1, limiter.rateLimitedCount());
+    CHECK(limiter.backoffRemainingMs() > 900);
+    // Player commands wait too, Spotify would refuse them all the same
+    CHECK_EQUAL(SPOTIFY_RATE_LIMITED, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_USER));
+
+    // Poll every 10ms until a request gets through again
+    unsigned long start = millis();
+    int status = SPOTIFY_RATE_LIMITED;
+    while (status == SPOTIFY_RATE_LIMITED && millis() - start < 3000)
+    {
+        delay(10);
+        status = limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND);
+    }
+    CHECK_EQUAL(200, status);
+    CHECK_EQUAL(2, server.requests());
+    CHECK(secondAt - firstAt >= 1000);
+    CHECK(secondAt - firstAt < 1200);
+    CHECK(limiter.refusedCount() > 50);
+}
+
+static void backoffWithoutRetryAfter()
+{
+    TestServer server([](const TestRequest &request, TestResponse &response) {
+        response.status = 429;
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    SpotifyRateLimiter limiter;
+    limiter.defaultBackoffMs = 100;
+
+    CHECK_EQUAL(429, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    CHECK(limiter.backoffRemainingMs() > 50 && limiter.backoffRemainingMs() <= 100);
+    delay(110);
+    // Doubled for the second one in a row
+    CHECK_EQUAL(429, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    CHECK(limiter.backoffRemainingMs() > 150 && limiter.backoffRemainingMs() <= 200);
+
+    // Turned off, nothing is held back
+    limiter.enabled = false;
+    CHECK_EQUAL(429, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    CHECK_EQUAL(3, server.requests());
+}
+
+static void tokenBucket()
+{
+    TestServer server([](const TestRequest &request, TestResponse &response) {});
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    SpotifyRateLimiter limiter;
+    limiter.tokenBucket = true;
+    limiter.burst = 4;
+    limiter.reservedForUser = 2;
+    limiter.refillMs = 200;
+
+    // Polls stop where the reserve starts, commands may use it
+    CHECK_EQUAL(200, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    CHECK_EQUAL(200, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    CHECK_EQUAL(SPOTIFY_RATE_LIMITED, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_BACKGROUND));
+    CHECK_EQUAL(200, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_USER));
+    CHECK_EQUAL(200, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_USER));
+    CHECK_EQUAL(SPOTIFY_RATE_LIMITED, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_USER));
+    CHECK_EQUAL(4, server.requests());
+
+    delay(210);
+    CHECK_EQUAL(200, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_USER));
+    CHECK_EQUAL(SPOTIFY_RATE_LIMITED, limitedRequest(limiter, transport, client, server.port(), SPOTIFY_PRIORITY_USER));
+    CHECK_EQUAL(3, limiter.refusedCount());
+}
+
+int main()
+{
+    defaultsOnlyBackOff();
+    retryAfter();
+    backoffWithoutRetryAfter();
+    tokenBucket();
+    return testResult("rate limit");
+}
@@ -0,0 +1,101 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// How long ArduinoSpotify blocks when Spotify is slow or failing, sync
+// calls against async ones
+
+#include "ArduinoSpotify.h"
+#include "Test.h"
+#include "TestServer.h"
+
+static int asyncStatus = 0;
+
+static void asyncDone(const SpotifyAsyncResult &result)
+{
+    asyncStatus = result.statusCode;
+}
+
+int main()
+{
+    std::string player = readFixture("player.json");
+    int failFirst = 0;
+    unsigned long delayMs = 0;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        response.delayMs = delayMs;
+        if (request.index < failFirst)
+        {
+            response.status = 503;
+            return;
+        }
+        response.body = player;
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    spotify.timeoutPolicy.defaultTimeoutMs = 300;
+    PlayerDetailsFixed playerDetails;
+    CurrentlyPlayingFixed currentlyPlaying;
+
+    // A stalled server costs a blocking call one timeout, not three plus backoffs
+    delayMs = 1000;
+    unsigned long start = millis();
+    CHECK(!spotify.getPlayerState(playerDetails, currentlyPlaying));
+    unsigned long elapsed = millis() - start;
+    CHECK(elapsed >= 300 && elapsed < 500);
+    CHECK_EQUAL(HTTPC_ERROR_READ_TIMEOUT, spotify.getLastStatusCode());
+    delay(800);
+    CHECK_EQUAL(1, server.requests());
+    CHECK_EQUAL(0, spotify.timeoutPolicy.retryCount());
+
+    // Opted in, the same call gets through two 503s
+    delayMs = 0;
+    failFirst = server.requests() + 2;
+    spotify.timeoutPolicy.syncRetries = true;
+    start = millis();
+    CHECK(spotify.getPlayerState(playerDetails, currentlyPlaying));
+    elapsed = millis() - start;
+    CHECK_EQUAL(4, server.requests());
+    CHECK_EQUAL(2, spotify.timeoutPolicy.retryCount());
+    // 200 + 400ms backoff
+    CHECK(elapsed >= 600 && elapsed < 1000);
+
+    // Async retries stay on and never block poll()
+    spotify.timeoutPolicy.syncRetries = false;
+    failFirst = server.requests() + 2;
+    CHECK(spotify.getPlayerStateAsync(asyncDone) > 0);
+    unsigned long longestPoll = 0;
+    start = millis();
+    while (asyncStatus == 0 && millis() - start < 3000)
+    {
+        unsigned long pollStart = millis();
+        spotify.poll();
+        longestPoll = max(longestPoll, millis() - pollStart);
+        delay(1);
+    }
+    CHECK_EQUAL(200, asyncStatus);
+    CHECK_EQUAL(7, server.requests());
+    CHECK_EQUAL(4, spotify.timeoutPolicy.retryCount());
+    CHECK(longestPoll < 100);
+    printf("retries: longest poll() %lums\n", longestPoll);
+
+    return testResult("retries");
+}
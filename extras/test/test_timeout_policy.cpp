@@ -0,0 +1,113 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifyTimeoutPolicy learning from a server that answers late on purpose
+
+#include <WiFiClient.h>
+#include "SpotifyTimeoutPolicy.h"
+#include "SpotifyTransport.h"
+#include "Test.h"
+#include "TestServer.h"
+
+#define HOST "127.0.0.1"
+
+// One request the way ArduinoSpotify::sendRequest() sends it
+static int timedRequest(SpotifyTimeoutPolicy &policy, SpotifyTransport &transport, WiFiClient &client,
+                        uint16_t port, const char *uri)
+{
+    unsigned long timeout = policy.timeoutFor("GET", HOST, uri);
+    transport.setTimeout(timeout);
+    int status = transport.request(client, HOST, port, "GET", uri, NULL, NULL, NULL, NULL, true);
+    if (status > 0)
+    {
+        policy.record("GET", HOST, uri, transport.getTiming().waitMs);
+    }
+    else if (status == HTTPC_ERROR_READ_TIMEOUT)
+    {
+        policy.recordTimeout("GET", HOST, uri, timeout);
+    }
+    transport.end();
+    return status;
+}
+
+static void learnsTheTimeout()
+{
+    unsigned long delayMs = 30;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        response.delayMs = delayMs;
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    SpotifyTimeoutPolicy policy;
+
+    CHECK_EQUAL(SPOTIFY_TIMEOUT, policy.timeoutFor("GET", HOST, "/v1/me/player"));
+    for (int i = 0; i < policy.minSamples; i++)
+    {
+        CHECK_EQUAL(200, timedRequest(policy, transport, client, server.port(), "/v1/me/player"));
+    }
+    // p95 in the 100ms bucket, plus the margins, and then minTimeoutMs
+    CHECK_EQUAL(100, policy.percentile("GET", HOST, "/v1/me/player"));
+    CHECK_EQUAL(500, policy.timeoutFor("GET", HOST, "/v1/me/player"));
+    // Other endpoints aren't affected, IDs don't make endpoints of their own
+    CHECK_EQUAL(SPOTIFY_TIMEOUT, policy.timeoutFor("GET", HOST, "/v1/me/player/devices"));
+    CHECK_EQUAL(500, policy.timeoutFor("GET", HOST, "/v1/me/player?market=DE"));
+
+    // The server stalls, the request gives up after the learned timeout
+    // instead of SPOTIFY_TIMEOUT
+    delayMs = 1500;
+    unsigned long start = millis();
+    CHECK_EQUAL(HTTPC_ERROR_READ_TIMEOUT, timedRequest(policy, transport, client, server.port(), "/v1/me/player"));
+    unsigned long elapsed = millis() - start;
+    CHECK(elapsed >= 500 && elapsed < 700);
+    CHECK_EQUAL(1, policy.timeoutCount());
+
+    // The timeout counts as a slow sample: p95 is now in the 750ms bucket,
+    // so the endpoint gets 750 + 375 + 300ms
+    CHECK_EQUAL(1425, policy.timeoutFor("GET", HOST, "/v1/me/player"));
+    delayMs = 900;
+    CHECK_EQUAL(200, timedRequest(policy, transport, client, server.port(), "/v1/me/player"));
+}
+
+static void retries()
+{
+    SpotifyTimeoutPolicy policy;
+    CHECK(policy.shouldRetry("GET", HTTPC_ERROR_READ_TIMEOUT, 1));
+    CHECK(policy.shouldRetry("GET", 503, 2));
+    CHECK(!policy.shouldRetry("GET", 503, 3));
+    CHECK(!policy.shouldRetry("GET", 404, 1));
+    CHECK(!policy.shouldRetry("PUT", HTTPC_ERROR_READ_TIMEOUT, 1));
+    CHECK(!policy.shouldRetry("POST", 503, 1));
+    CHECK_EQUAL(2, policy.retryCount());
+    CHECK_EQUAL(200, policy.backoffMs(1));
+    CHECK_EQUAL(400, policy.backoffMs(2));
+    CHECK_EQUAL(2000, policy.backoffMs(10));
+    CHECK(!policy.syncRetries);
+
+    policy.enabled = false;
+    CHECK(!policy.shouldRetry("GET", 503, 1));
+    CHECK_EQUAL(SPOTIFY_TIMEOUT, policy.timeoutFor("GET", HOST, "/v1/me/player"));
+}
+
+int main()
+{
+    learnsTheTimeout();
+    retries();
+    return testResult("timeout policy");
+}
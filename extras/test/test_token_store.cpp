@@ -0,0 +1,125 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// The access token kept in a file across reboots: restored while it is
+// still valid, saved again after every refresh, and refreshed by poll()
+// (and only by poll()) before it runs out
+
+#include "ArduinoSpotify.h"
+#include "Test.h"
+#include "TestServer.h"
+#include <FS.h>
+
+static void storeToken(SpotifyTokenStore &store, const char *accessToken, long validForS)
+{
+    SpotifyStoredToken token;
+    strcpy(token.accessToken, accessToken);
+    token.expiresAt = time(NULL) + validForS;
+    CHECK(store.save(token));
+}
+
+int main()
+{
+    std::string player = readFixture("player.json");
+    int tokenRequests = 0;
+    std::string authorization;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        if (request.path == SPOTIFY_TOKEN_ENDPOINT)
+        {
+            tokenRequests++;
+            response.body = R"({"access_token":"fresh","token_type":"Bearer","expires_in":3600})";
+        }
+        else
+        {
+            authorization = request.header("Authorization");
+            response.body = player;
+        }
+    });
+    server.redirectClients();
+
+    std::string directory = makeTestDirectory();
+    fs::FS fs(directory.c_str());
+    SpotifyFileTokenStore store(fs);
+    SpotifyStoredToken loaded;
+    PlayerDetailsFixed playerDetails;
+    CurrentlyPlayingFixed track;
+
+    // Nothing stored yet
+    CHECK(!store.load(loaded));
+    WiFiClient firstClient;
+    ArduinoSpotify first(firstClient, "id", "secret", "refresh");
+    first.setTokenStore(&store);
+    CHECK(!first.restoreAccessToken());
+
+    // An expired token isn't used
+    storeToken(store, "expired", -10);
+    CHECK(!first.restoreAccessToken());
+
+    // A valid one is, without asking for a new one
+    storeToken(store, "stored", 3600);
+    CHECK(store.load(loaded));
+    CHECK_STRING("stored", loaded.accessToken);
+    CHECK(first.restoreAccessToken());
+    CHECK(first.getPlayerState(playerDetails, track));
+    CHECK(authorization == "Bearer stored");
+    CHECK_EQUAL(0, tokenRequests);
+
+    // An hour left is nothing for poll() to do
+    unsigned long start = millis();
+    while (millis() - start < 100)
+    {
+        first.poll();
+        delay(1);
+    }
+    CHECK_EQUAL(0, tokenRequests);
+
+    // Half a minute left, less than tokenRefreshMarginMs. A call still uses
+    // the token it has...
+    storeToken(store, "stored", 30);
+    WiFiClient secondClient;
+    ArduinoSpotify second(secondClient, "id", "secret", "refresh");
+    second.setTokenStore(&store);
+    CHECK(second.restoreAccessToken());
+    CHECK(second.getPlayerState(playerDetails, track));
+    CHECK(authorization == "Bearer stored");
+    CHECK_EQUAL(0, tokenRequests);
+
+    // ...while poll() refreshes it ahead of time and saves the new one
+    start = millis();
+    while (tokenRequests == 0 || !store.load(loaded) || strcmp(loaded.accessToken, "fresh") != 0)
+    {
+        if (millis() - start > 3000)
+        {
+            break;
+        }
+        second.poll();
+        delay(1);
+    }
+    CHECK_EQUAL(1, tokenRequests);
+    CHECK(store.load(loaded));
+    CHECK_STRING("fresh", loaded.accessToken);
+    CHECK(loaded.expiresAt >= (uint32_t)time(NULL) + 3590);
+    CHECK(second.getPlayerState(playerDetails, track));
+    CHECK(authorization == "Bearer fresh");
+    CHECK_EQUAL(1, tokenRequests);
+
+    removeTestDirectory(directory);
+    return testResult("token store");
+}
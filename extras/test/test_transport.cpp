@@ -0,0 +1,216 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifyLeanTransport against a local server
+
+#include <WiFiClient.h>
+#include "SpotifyTransport.h"
+#include "Test.h"
+#include "TestServer.h"
+
+static std::string readBody(SpotifyTransport &transport)
+{
+    std::string body;
+    uint8_t buffer[100];
+    SpotifyBodyStream &stream = transport.getStream();
+    while (!stream.complete() && !stream.failed())
+    {
+        size_t count = stream.readAvailable(buffer, sizeof(buffer));
+        body.append((const char *)buffer, count);
+    }
+    return body;
+}
+
+static void contentLength()
+{
+    TestServer server([](const TestRequest &request, TestResponse &response) {
+        response.body = "{\"is_playing\":true}";
+        response.headers = "ETag: \"abc\"\r\n";
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    int status = transport.request(client, "127.0.0.1", server.port(), "GET", "/v1/me/player", "application/json",
+                                   NULL, "Bearer token", NULL, false);
+    CHECK_EQUAL(200, status);
+    CHECK_EQUAL(19, transport.getSize());
+    CHECK_STRING("\"abc\"", transport.getETag());
+    CHECK_EQUAL(-1, transport.getRetryAfter());
+    CHECK(readBody(transport) == "{\"is_playing\":true}");
+    transport.end();
+}
+
+static void chunked()
+{
+    std::string expected;
+    for (int i = 0; i < 500; i++)
+    {
+        expected += (char)('a' + i % 26);
+    }
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        response.body = expected;
+        response.chunked = true;
+        response.chunkSize = 37;
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    CHECK_EQUAL(200, transport.request(client, "127.0.0.1", server.port(), "GET", "/", NULL, NULL, NULL, NULL, false));
+    CHECK_EQUAL(-1, transport.getSize());
+    CHECK(readBody(transport) == expected);
+    transport.end();
+}
+
+static void requestHeadersAndBody()
+{
+    TestRequest received;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        received = request;
+        response.status = 204;
+    });
+    // The Host header has to say Spotify, the connection still goes to the test server
+    server.redirectClients();
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    int status = transport.request(client, "api.spotify.com", server.port(), "PUT", "/v1/me/player/volume?volume_percent=50",
+                                   "application/json", "application/json", "Bearer token", "{\"a\":1}", false);
+    CHECK_EQUAL(204, status);
+    transport.end();
+    CHECK(received.method == "PUT");
+    CHECK(received.path == "/v1/me/player/volume?volume_percent=50");
+    CHECK(received.header("Host") == "api.spotify.com");
+    CHECK(received.header("Authorization") == "Bearer token");
+    CHECK(received.header("Content-Length") == "7");
+    CHECK(received.header("Connection") == "close");
+    CHECK(received.body == "{\"a\":1}");
+    // "PUT <path> HTTP/1.1\r\n", the headers, an empty line and the body
+    CHECK_EQUAL(4 + received.path.size() + 11 + received.headers.size() + 2 + 7, transport.getTiming().bytesSent);
+}
+
+// Written a byte at a time, like serializeJson does
+class RepeatedBody : public SpotifyRequestBody
+{
+public:
+    RepeatedBody(char c, size_t count) : _c(c), _count(count) {}
+
+    size_t length() const { return _count; }
+    size_t writeTo(Print &out) const
+    {
+        size_t written = 0;
+        for (size_t i = 0; i < _count; i++)
+        {
+            written += out.write((uint8_t)_c);
+        }
+        return written;
+    }
+
+private:
+    char _c;
+    size_t _count;
+};
+
+static void streamedBody()
+{
+    TestRequest received;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        received = request;
+        response.status = 204;
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    // More than fits behind the headers, so it goes out in several writes
+    RepeatedBody body('x', 2000);
+    int status = transport.request(client, "127.0.0.1", server.port(), "PUT", "/v1/me/player/play",
+                                   "application/json", "application/json", "Bearer token", body, false);
+    CHECK_EQUAL(204, status);
+    transport.end();
+    CHECK(received.header("Content-Length") == "2000");
+    CHECK(received.body == std::string(2000, 'x'));
+    CHECK_EQUAL(4 + received.path.size() + 11 + received.headers.size() + 2 + 2000, transport.getTiming().bytesSent);
+}
+
+static void keepAlive()
+{
+    TestServer server([](const TestRequest &request, TestResponse &response) {
+        response.body = "0123456789";
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK_EQUAL(200, transport.request(client, "127.0.0.1", server.port(), "GET", "/", NULL, NULL, NULL, NULL, true));
+        // Not reading the body, end() has to skip it so the next response starts clean
+        transport.end();
+    }
+    CHECK_EQUAL(1, server.connections());
+    CHECK_EQUAL(5, server.requests());
+}
+
+static void serverCloses()
+{
+    TestServer server([](const TestRequest &request, TestResponse &response) {
+        response.close = true;
+        response.headers = "Retry-After: 3\r\n";
+        response.status = 429;
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport;
+    for (int i = 0; i < 2; i++)
+    {
+        CHECK_EQUAL(429, transport.request(client, "127.0.0.1", server.port(), "GET", "/", NULL, NULL, NULL, NULL, true));
+        CHECK_EQUAL(3, transport.getRetryAfter());
+        transport.end();
+    }
+    CHECK_EQUAL(2, server.connections());
+}
+
+static void errors()
+{
+    TestServer server([](const TestRequest &request, TestResponse &response) {
+        if (request.index == 0)
+        {
+            response.drop = true;
+        }
+        else
+        {
+            response.delayMs = 500;
+        }
+    });
+    WiFiClient client;
+    SpotifyLeanTransport transport(200);
+    CHECK_EQUAL(HTTPC_ERROR_CONNECTION_LOST, transport.request(client, "127.0.0.1", server.port(), "GET", "/", NULL, NULL, NULL, NULL, false));
+    transport.end();
+    CHECK_EQUAL(HTTPC_ERROR_READ_TIMEOUT, transport.request(client, "127.0.0.1", server.port(), "GET", "/", NULL, NULL, NULL, NULL, false));
+    transport.end();
+
+    char header[40];
+    CHECK_EQUAL(-1, SpotifyLeanTransport::formatRequest(header, sizeof(header), "api.spotify.com", "GET", "/v1/me/player",
+                                                        NULL, NULL, "Bearer token", -1, true));
+}
+
+int main()
+{
+    contentLength();
+    chunked();
+    requestHeadersAndBody();
+    streamedBody();
+    keepAlive();
+    serverCloses();
+    errors();
+    return testResult("transport");
+}
@@ -0,0 +1,114 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// SpotifyWorker on a std::thread, commands from the main thread while the
+// worker polls. Built with -fsanitize=thread.
+
+#include "SpotifyWorker.h"
+#include "Test.h"
+#include "TestServer.h"
+
+static bool waitFor(SpotifyWorker &worker, SpotifyPlayerSnapshot &snapshot, bool (*done)(const SpotifyPlayerSnapshot &))
+{
+    unsigned long start = millis();
+    while (millis() - start < 5000)
+    {
+        if (worker.getSnapshot(snapshot) && done(snapshot))
+        {
+            return true;
+        }
+        delay(1);
+    }
+    return false;
+}
+
+int main()
+{
+    std::string player = readFixture("player.json");
+    bool playing = true;
+    int volume = 62;
+    TestServer server([&](const TestRequest &request, TestResponse &response) {
+        if (request.method == "GET" && request.path.compare(0, 13, "/v1/me/player") == 0)
+        {
+            response.body = player;
+            if (!playing)
+            {
+                size_t at = response.body.rfind("\"is_playing\": true");
+                response.body.replace(at, 18, "\"is_playing\": false");
+            }
+            size_t at = response.body.find("\"volume_percent\": 62");
+            response.body.replace(at, 20, "\"volume_percent\": " + std::to_string(volume));
+        }
+        else if (request.path.compare(0, 19, "/v1/me/player/pause") == 0)
+        {
+            playing = false;
+            response.status = 204;
+        }
+        else if (request.path.compare(0, 36, "/v1/me/player/volume?volume_percent=") == 0)
+        {
+            volume = atoi(request.path.c_str() + 36);
+            response.status = 204;
+        }
+        else
+        {
+            response.status = 404;
+        }
+    });
+    server.redirectClients();
+
+    WiFiClient client;
+    ArduinoSpotify spotify(client, (char *)"token");
+    spotify.autoTokenRefresh = false;
+    SpotifyWorker worker(spotify);
+    worker.pollIntervalMs = 20;
+    worker.afterCommandDelayMs = 5;
+    CHECK(worker.begin());
+
+    SpotifyPlayerSnapshot snapshot;
+    CHECK(waitFor(worker, snapshot, [](const SpotifyPlayerSnapshot &s) { return s.sequence > 0; }));
+    CHECK(!snapshot.error);
+    CHECK(snapshot.playerDetails.isPlaying);
+    CHECK_STRING("Life on Mars? - 2015 Remaster", snapshot.currentlyPlaying.trackName);
+
+    CHECK(worker.pause());
+    CHECK(waitFor(worker, snapshot, [](const SpotifyPlayerSnapshot &s) { return s.commandsDone == 1 && !s.playerDetails.isPlaying; }));
+
+    // More commands than the ring holds, queued while the worker is busy
+    int queued = 0;
+    for (int i = 0; i < 50; i++)
+    {
+        queued += worker.setVolume(i) ? 1 : 0;
+    }
+    CHECK_EQUAL(50, queued + (int)worker.droppedCommands());
+    CHECK(waitFor(worker, snapshot, [](const SpotifyPlayerSnapshot &s) { return s.commandsDone + s.commandsFailed > 1; }));
+
+    // Readers on the main thread don't wait for the worker
+    unsigned long start = millis();
+    for (int i = 0; i < 10000; i++)
+    {
+        worker.getSnapshot(snapshot);
+    }
+    CHECK(millis() - start < 1000);
+
+    worker.end();
+    CHECK_EQUAL(0, snapshot.commandsFailed);
+    printf("worker: %d requests, %lu commands dropped\n", server.requests(), worker.droppedCommands());
+    return testResult("worker");
+}
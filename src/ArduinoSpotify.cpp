@@ -20,14 +20,207 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "ArduinoSpotify.h"
 
+// Request paths and bodies are built in fixed buffers, sized at compile time
+// for the longest values we allow (see SpotifyQuery.h). Longer values don't
+// fit and the request isn't sent.
+static constexpr size_t deviceIdParam = spotifyQueryParam("device_id", SPOTIFY_DEVICE_ID_LENGTH - 1);
+static constexpr size_t marketParam = spotifyQueryParam("market", SPOTIFY_MARKET_LENGTH);
+typedef SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT), marketParam)> CurrentlyPlayingPath;
+typedef SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PLAYER_ENDPOINT), marketParam)> PlayerPath;
+// Form bodies start without a path
+typedef SpotifyQuery<spotifyQuerySize(1,
+                                      spotifyQueryParam("grant_type", sizeof("authorization_code") - 1),
+                                      spotifyQueryParam("refresh_token", SPOTIFY_REFRESH_TOKEN_LENGTH),
+                                      spotifyQueryParam("client_id", SPOTIFY_CLIENT_ID_LENGTH),
+                                      spotifyQueryParam("client_secret", SPOTIFY_CLIENT_ID_LENGTH))>
+    RefreshTokenBody;
+typedef SpotifyQuery<spotifyQuerySize(1,
+                                      spotifyQueryParam("grant_type", sizeof("authorization_code") - 1),
+                                      spotifyQueryParam("code", SPOTIFY_AUTH_CODE_LENGTH),
+                                      spotifyQueryParam("redirect_uri", SPOTIFY_REDIRECT_URL_LENGTH),
+                                      spotifyQueryParam("client_id", SPOTIFY_CLIENT_ID_LENGTH),
+                                      spotifyQueryParam("client_secret", SPOTIFY_CLIENT_ID_LENGTH))>
+    AccessTokensBody;
+
+// Only the fields read by fillCurrentlyPlaying()/fillPlayerDetails().
+// For arrays ArduinoJson applies the first element of the filter to all elements.
+static const char currentlyPlayingFilter[] PROGMEM =
+    R"({"context":{"uri":true},"is_playing":true,"progress_ms":true,)"
+    R"("item":{"name":true,"uri":true,"duration_ms":true,)"
+    R"("album":{"name":true,"uri":true,"artists":[{"name":true,"uri":true}],)"
+    R"("images":[{"height":true,"width":true,"url":true}]}}})";
+
+// Everything of the two above, /v1/me/player has both
+static const char playerStateFilter[] PROGMEM =
+    R"({"context":{"uri":true},"is_playing":true,"progress_ms":true,)"
+    R"("shuffle_state":true,"repeat_state":true,)"
+    R"("device":{"id":true,"name":true,"type":true,"is_active":true,)"
+    R"("is_private_session":true,"is_restricted":true,"volume_percent":true},)"
+    R"("item":{"name":true,"uri":true,"duration_ms":true,)"
+    R"("album":{"name":true,"uri":true,"artists":[{"name":true,"uri":true}],)"
+    R"("images":[{"height":true,"width":true,"url":true}]}}})";
+
+static const char devicesFilter[] PROGMEM =
+    R"({"devices":[{"id":true,"name":true,"type":true,"is_active":true,)"
+    R"("is_private_session":true,"is_restricted":true,"volume_percent":true}]})";
+
+
+static const char playerDetailsFilter[] PROGMEM =
+    R"({"progress_ms":true,"is_playing":true,"shuffle_state":true,"repeat_state":true,)"
+    R"("device":{"id":true,"name":true,"type":true,"is_active":true,)"
+    R"("is_private_session":true,"is_restricted":true,"volume_percent":true}})";
+
+// One track of the queue, the item part of currentlyPlayingFilter
+static const char queueItemFilter[] PROGMEM =
+    R"({"name":true,"uri":true,"duration_ms":true,)"
+    R"("album":{"name":true,"uri":true,"artists":[{"name":true,"uri":true}],)"
+    R"("images":[{"height":true,"width":true,"url":true}]}})";
+
+// One item of the list responses, see forEachItem()
+static const char playlistFilter[] PROGMEM =
+    R"({"id":true,"name":true,"uri":true,"owner":{"display_name":true},)"
+    R"("snapshot_id":true,"tracks":{"total":true},"public":true,"collaborative":true})";
+
+static const char trackItemFilter[] PROGMEM =
+    R"({"added_at":true,"played_at":true,)"
+    R"("track":{"name":true,"uri":true,"duration_ms":true,"is_local":true,)"
+    R"("artists":[{"name":true,"uri":true}],"album":{"name":true,"uri":true}}})";
+
+// Returns false if src had to be cut off
+static bool copyField(char *dest, size_t size, const char *src)
+{
+    if (src == NULL)
+    {
+        dest[0] = '\0';
+        return true;
+    }
+    size_t length = strlen(src);
+    if (length >= size)
+    {
+        memcpy(dest, src, size - 1);
+        dest[size - 1] = '\0';
+        return false;
+    }
+    memcpy(dest, src, length + 1);
+    return true;
+}
+
+// Skips whitespace, the next character is left in the stream
+static int peekToken(Stream &stream)
+{
+    int c = stream.peek();
+    while (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+    {
+        stream.read();
+        c = stream.peek();
+    }
+    return c;
+}
+
+// Longest key findKey() can look for
+#define SPOTIFY_MAX_KEY_LENGTH 16
+
+// Finds "key" and the colon after it, the value is next in the stream.
+// Spotify formats its responses, so there may be whitespace in between.
+static bool findKey(Stream &stream, const char *key)
+{
+    size_t length = strlen(key);
+    if (length > SPOTIFY_MAX_KEY_LENGTH)
+    {
+        return false;
+    }
+    char target[SPOTIFY_MAX_KEY_LENGTH + 3];
+    target[0] = '"';
+    memcpy(target + 1, key, length);
+    target[length + 1] = '"';
+    target[length + 2] = '\0';
+    while (stream.find(target))
+    {
+        if (peekToken(stream) == ':')
+        {
+            stream.read();
+            return true;
+        }
+    }
+    return false;
+}
+
+static RepeatOptions parseRepeatState(const char *repeat_state)
+{
+    if (repeat_state != NULL && strncmp(repeat_state, "track", 5) == 0)
+    {
+        return REPEAT_TRACK;
+    }
+    else if (repeat_state != NULL && strncmp(repeat_state, "context", 7) == 0)
+    {
+        return REPEAT_CONTEXT;
+    }
+    return REPEAT_OFF;
+}
+
+// Retries wait for their backoff to pass
+static bool asyncDue(const SpotifyAsyncRequest &request)
+{
+    return request.attempts == 0 || (long)(millis() - request.retryAt) >= 0;
+}
+
+// Serialized straight into the request, so it needs no buffer
+class SpotifyJsonBody : public SpotifyRequestBody
+{
+public:
+    SpotifyJsonBody(const JsonDocument &doc) : _doc(doc) {}
+
+    size_t length() const { return measureJson(_doc); }
+    size_t writeTo(Print &out) const { return serializeJson(_doc, out); }
+
+private:
+    const JsonDocument &_doc;
+};
+
+uint32_t spotifyHash(const char *text)
+{
+    uint32_t hash = 2166136261UL;
+    while (*text != '\0')
+    {
+        hash ^= (uint8_t)*text++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
 ArduinoSpotify::ArduinoSpotify(WiFiClient &client, char *bearerToken)
 {
     _client = &client;
     _bearerToken = String("Bearer ") + bearerToken;
-    _http = new HTTPClient();
-    _http->setTimeout(SPOTIFY_TIMEOUT);
-    _http->setConnectTimeout(SPOTIFY_TIMEOUT);
- }
+    _refreshToken = "";
+    _clientId = "";
+    _clientSecret = "";
+    _timeTokenRefreshed = 0;
+    _tokenTimeToLiveMs = 0;
+    _tokenStore = NULL;
+    _tokenRefreshAttempted = false;
+    _numConnections = 0;
+    _currentConnection = NULL;
+    resetConnectionStats();
+    addConnectionClient(client);
+    initAsync();
+    _imageBuffer = NULL;
+    _jsonArena = NULL;
+    _ownedJsonArena = NULL;
+    resetJsonUsage();
+    _lastStatusCode = 0;
+    _metrics = NULL;
+    _requestMetricsActive = false;
+    _asyncMetricsActive = false;
+    _tokenRefreshMs = 0;
+    _listBytes = 0;
+    _commandStart = 0;
+    _playerCacheValid = false;
+    _playerCacheAt = 0;
+    _pendingState = 0;
+    _stateMismatches = 0;
+    _requestTimeoutMs = SPOTIFY_TIMEOUT;
+}
 
 ArduinoSpotify::ArduinoSpotify(WiFiClient &client, const char *clientId, const char *clientSecret, const char *refreshToken)
 {
@@ -35,42 +228,414 @@ ArduinoSpotify::ArduinoSpotify(WiFiClient &client, const char *clientId, const c
     _clientId = clientId;
     _clientSecret = clientSecret;
     _refreshToken = refreshToken;
-    _http = new HTTPClient();
-    _http->setTimeout(SPOTIFY_TIMEOUT);
-    _http->setConnectTimeout(SPOTIFY_TIMEOUT);
+    _timeTokenRefreshed = 0;
+    _tokenTimeToLiveMs = 0;
+    _tokenStore = NULL;
+    _tokenRefreshAttempted = false;
+    _numConnections = 0;
+    _currentConnection = NULL;
+    resetConnectionStats();
+    addConnectionClient(client);
+    initAsync();
+    _imageBuffer = NULL;
+    _jsonArena = NULL;
+    _ownedJsonArena = NULL;
+    resetJsonUsage();
+    _lastStatusCode = 0;
+    _metrics = NULL;
+    _requestMetricsActive = false;
+    _asyncMetricsActive = false;
+    _tokenRefreshMs = 0;
+    _listBytes = 0;
+    _commandStart = 0;
+    _playerCacheValid = false;
+    _playerCacheAt = 0;
+    _pendingState = 0;
+    _stateMismatches = 0;
+    _requestTimeoutMs = SPOTIFY_TIMEOUT;
 }
 
-int ArduinoSpotify::makeRequestWithBody(const char *type, const char *uri, const char *authorization, const char *body, const char *contentType, const char *host)
+SpotifyTransport *ArduinoSpotify::createTransport()
+{
+    return new SpotifyLeanTransport(SPOTIFY_TIMEOUT);
+}
+
+bool ArduinoSpotify::addConnectionClient(WiFiClient &client, SpotifyTransport *transport)
 {
-    if (!_http->begin(*_client, String(host), (uint16_t)SPOTIFY_PORT, String(uri), true))
+    if (_numConnections >= SPOTIFY_MAX_CONNECTIONS)
     {
-        Serial.println(F("Connection failed"));
-        return -1;
+        Serial.println(F("Too many connection clients"));
+        return false;
+    }
+
+    SpotifyConnection *connection = &_connections[_numConnections];
+    connection->client = &client;
+    // Every connection needs its own transport, it holds the state of the
+    // response that is being read from that connection.
+    connection->transport = (transport != NULL) ? transport : createTransport();
+    connection->ownsTransport = (transport == NULL);
+    connection->host[0] = '\0';
+    connection->lastUsed = 0;
+    connection->busy = false;
+    _numConnections++;
+    if (_numConnections == 1)
+    {
+        _transport = connection->transport;
+    }
+    return true;
+}
+
+bool ArduinoSpotify::setTransport(SpotifyTransport &transport, uint8_t connection)
+{
+    if (connection >= _numConnections || _connections[connection].busy)
+    {
+        Serial.println(F("Can't set transport of this connection"));
+        return false;
+    }
+
+    SpotifyConnection *slot = &_connections[connection];
+    slot->transport->end();
+    slot->client->stop();
+    slot->host[0] = '\0';
+    if (_transport == slot->transport)
+    {
+        _transport = &transport;
     }
+    if (slot->ownsTransport)
+    {
+        delete slot->transport;
+    }
+    slot->transport = &transport;
+    slot->ownsTransport = false;
+    return true;
+}
+
+SpotifyConnection *ArduinoSpotify::acquireConnection(const char *host)
+{
+    SpotifyConnection *connection = NULL;
+    for (uint8_t i = 0; i < _numConnections; i++)
+    {
+        if (!_connections[i].busy && strcmp(_connections[i].host, host) == 0)
+        {
+            connection = &_connections[i];
+            break;
+        }
+    }
+
+    if (connection == NULL)
+    {
+        // Take an unused connection, or the one that was idle the longest
+        for (uint8_t i = 0; i < _numConnections; i++)
+        {
+            if (_connections[i].busy)
+            {
+                continue;
+            }
+            if (_connections[i].host[0] == '\0')
+            {
+                connection = &_connections[i];
+                break;
+            }
+            if (connection == NULL || millis() - _connections[i].lastUsed > millis() - connection->lastUsed)
+            {
+                connection = &_connections[i];
+            }
+        }
+
+        if (connection == NULL)
+        {
+            // All of them are used by async requests
+            return NULL;
+        }
+
+        // Still connected to another host
+        connection->client->stop();
+        strncpy(connection->host, host, SPOTIFY_MAX_HOST_LENGTH - 1);
+        connection->host[SPOTIFY_MAX_HOST_LENGTH - 1] = '\0';
+        _connectionReused = false;
+    }
+    else
+    {
+        _connectionReused = keepAlive && connection->client->connected();
+    }
+
+    if (_connectionReused)
+    {
+        _connectionStats.reuses++;
+    }
+    else
+    {
+        _connectionStats.handshakes++;
+    }
+
+    connection->lastUsed = millis();
+    _currentConnection = connection;
+    _client = connection->client;
+    _transport = connection->transport;
+    return connection;
+}
+
+int ArduinoSpotify::sendRequest(const char *method, const char *uri, const char *accept, const char *contentType, const char *authorization, const SpotifyRequestBody *body, const char *host)
+{
+    if (_metrics != NULL && !_requestMetricsActive)
+    {
+        // Reconnects count as the same request
+        beginMetrics(_requestMetrics, host, uri);
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_TOKEN_REFRESH] = _tokenRefreshMs;
+        _requestMetricsActive = true;
+        _requestStart = millis();
+        _parseEnd = 0;
+    }
+    _tokenRefreshMs = 0;
+    _responseStart = millis();
 
-    _http->addHeader(F("Accept"), F("application/json"));
-    _http->addHeader(F("Content-Type"), contentType);
-    // Will be replaced by HttpClient, if > 0)
-    _http->addHeader(F("Content-Length"), "0");
+    bool limited = strcmp(host, SPOTIFY_HOST) == 0;
+    SpotifyPriority priority = (strcmp(method, "GET") == 0) ? SPOTIFY_PRIORITY_BACKGROUND : SPOTIFY_PRIORITY_USER;
+    if (limited && priority == SPOTIFY_PRIORITY_USER)
+    {
+        // Frees the connection instead of opening another one next to it
+        preemptAsync();
+    }
+    if (limited && !rateLimiter.acquire(priority))
+    {
+#ifdef SPOTIFY_DEBUG
+        Serial.println(F("Request refused by the rate limiter"));
+#endif
+        _requestMetrics.statusCode = SPOTIFY_RATE_LIMITED;
+        _lastStatusCode = SPOTIFY_RATE_LIMITED;
+        return SPOTIFY_RATE_LIMITED;
+    }
 
-    if (authorization != NULL)
+    SpotifyConnection *connection = acquireConnection(host);
+    if (connection == NULL)
     {
-        _http->addHeader(F("Authorization"), authorization);
+        Serial.println(F("No free connection"));
+        _requestMetrics.statusCode = -1;
+        _lastStatusCode = -1;
+        return -1;
     }
 
+    _requestTimeoutMs = timeoutPolicy.timeoutFor(method, host, uri);
+    _transport->setTimeout(_requestTimeoutMs);
+
     // give the esp a breather
     yield();
 
-    if(strcmp(type, "PUT") == 0) {
-        return _http->PUT((uint8_t*)body, strlen(body));
-    } else {
-        return _http->POST((uint8_t*)body, strlen(body));
+    int statusCode;
+    if (body != NULL)
+    {
+        statusCode = _transport->request(*connection->client, host, (uint16_t)SPOTIFY_PORT, method, uri, accept, contentType, authorization, *body, keepAlive);
+    }
+    else
+    {
+        statusCode = _transport->request(*connection->client, host, (uint16_t)SPOTIFY_PORT, method, uri, accept, contentType, authorization, (const char *)NULL, keepAlive);
+    }
+    _lastStatusCode = statusCode;
+    if (statusCode > 0)
+    {
+        timeoutPolicy.record(method, host, uri, _transport->getTiming().waitMs);
+    }
+    else if (statusCode == HTTPC_ERROR_READ_TIMEOUT)
+    {
+        timeoutPolicy.recordTimeout(method, host, uri, _requestTimeoutMs);
+    }
+    if (limited && statusCode == 429)
+    {
+        rateLimiter.rateLimited(_transport->getRetryAfter());
+    }
+    else if (limited && statusCode > 0)
+    {
+        rateLimiter.succeeded();
+    }
+    if (_requestMetricsActive)
+    {
+        const SpotifyTransportTiming &timing = _transport->getTiming();
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_CONNECT] += timing.connectMs;
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_SEND] += timing.sendMs;
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_WAIT] += timing.waitMs;
+        _requestMetrics.bytesSent += timing.bytesSent;
+        _requestMetrics.statusCode = statusCode;
+        _requestMetrics.reused = _connectionReused;
+        _responseStart = millis();
+    }
+    return statusCode;
+}
+
+int ArduinoSpotify::getLastStatusCode()
+{
+    return _lastStatusCode;
+}
+
+void ArduinoSpotify::setMetrics(SpotifyMetrics *metrics)
+{
+    _metrics = metrics;
+    _requestMetricsActive = false;
+    _asyncMetricsActive = false;
+}
+
+void ArduinoSpotify::beginMetrics(SpotifyRequestMetrics &metrics, const char *host, const char *uri)
+{
+    memset(&metrics, 0, sizeof(metrics));
+    // Images are grouped by their host
+    if (strcmp(host, SPOTIFY_HOST) != 0 && strcmp(host, SPOTIFY_ACCOUNTS_HOST) != 0)
+    {
+        strncpy(metrics.endpoint, host, SPOTIFY_METRICS_ENDPOINT_LENGTH - 1);
+        metrics.heapBefore = ESP.getFreeHeap();
+        return;
+    }
+
+    // API calls by their path without the query and IDs (like the timeout
+    // policy does), so all playlists share one endpoint
+    size_t length = 0;
+    const char *segment = uri;
+    while (*segment != '\0' && *segment != '?')
+    {
+        size_t segmentLength = strcspn(segment + 1, "/?") + 1;
+        if (segmentLength <= SPOTIFY_ID_SEGMENT_LENGTH + 1)
+        {
+            size_t copied = min(segmentLength, (size_t)SPOTIFY_METRICS_ENDPOINT_LENGTH - 1 - length);
+            memcpy(metrics.endpoint + length, segment, copied);
+            length += copied;
+        }
+        segment += segmentLength;
+    }
+    metrics.endpoint[length] = '\0';
+    metrics.heapBefore = ESP.getFreeHeap();
+}
+
+void ArduinoSpotify::finishRequestMetrics()
+{
+    unsigned long now = millis();
+    SpotifyBodyStream &stream = _transport->getStream();
+    unsigned long waited = stream.waitedMs();
+    if (_parseEnd != 0)
+    {
+        // The body is parsed while it is read, the parser only waited for data in read()
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_BODY] = waited;
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_PARSE] = _parseEnd - _responseStart - waited;
+    }
+    else
+    {
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_BODY] = now - _responseStart;
+    }
+    _requestMetrics.phaseMs[SPOTIFY_PHASE_TOTAL] = now - _requestStart + _requestMetrics.phaseMs[SPOTIFY_PHASE_TOKEN_REFRESH];
+    // Without a response the stream still belongs to the previous one
+    _requestMetrics.bytesReceived = (_requestMetrics.statusCode > 0) ? stream.bytesReceived() : 0;
+}
+
+// The response of a player command arrived
+void ArduinoSpotify::commandDone()
+{
+    if (_requestMetricsActive)
+    {
+        _requestMetrics.phaseMs[SPOTIFY_PHASE_COMMAND] = millis() - _commandStart;
+    }
+}
+
+bool ArduinoSpotify::shouldReconnect(int statusCode, bool idempotent)
+{
+    if (statusCode >= 0 || !_connectionReused)
+    {
+        return false;
+    }
+
+    // A kept-alive connection might have been closed by the server since
+    // the last request. Nothing was sent if the request itself failed, and
+    // only idempotent requests get repeated when the response went missing.
+    bool retry = (statusCode == HTTPC_ERROR_CONNECTION_REFUSED ||
+                  statusCode == HTTPC_ERROR_SEND_HEADER_FAILED ||
+                  statusCode == HTTPC_ERROR_SEND_PAYLOAD_FAILED ||
+                  statusCode == HTTPC_ERROR_NOT_CONNECTED ||
+                  (idempotent && statusCode == HTTPC_ERROR_CONNECTION_LOST));
+    if (retry)
+    {
+#ifdef SPOTIFY_DEBUG
+        Serial.println(F("Kept-alive connection was closed, reconnecting"));
+#endif
+        _transport->end();
+        _currentConnection->client->stop();
+        _connectionStats.reconnects++;
+    }
+    return retry;
+}
+
+// Sends a GET again after a backoff when the policy allows it. Blocks for
+// the backoff, so only with syncRetries set.
+bool ArduinoSpotify::shouldRetry(const char *method, int statusCode, uint8_t attempt)
+{
+    if (!timeoutPolicy.syncRetries || !timeoutPolicy.shouldRetry(method, statusCode, attempt))
+    {
+        return false;
+    }
+
+    unsigned long backoff = timeoutPolicy.backoffMs(attempt);
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Request failed with "));
+    Serial.print(statusCode);
+    Serial.print(F(", retrying in "));
+    Serial.println(backoff);
+#endif
+    // Connections used by async requests are left alone (no free connection)
+    if (_currentConnection != NULL && !_currentConnection->busy)
+    {
+        _transport->end();
+        if (statusCode < 0)
+        {
+            // Whatever was on its way might still arrive
+            _currentConnection->client->stop();
+        }
+    }
+    delay(backoff);
+    return true;
+}
+
+void ArduinoSpotify::closeConnections()
+{
+    for (uint8_t i = 0; i < _numConnections; i++)
+    {
+        _connections[i].transport->end();
+        _connections[i].client->stop();
+        _connections[i].host[0] = '\0';
+    }
+}
+
+const SpotifyConnectionStats &ArduinoSpotify::getConnectionStats()
+{
+    return _connectionStats;
+}
+
+void ArduinoSpotify::resetConnectionStats()
+{
+    _connectionStats.handshakes = 0;
+    _connectionStats.reuses = 0;
+    _connectionStats.reconnects = 0;
+    _connectionStats.preemptions = 0;
+}
+
+int ArduinoSpotify::makeRequestWithBody(const char *type, const char *uri, const char *authorization, const char *body, const char *contentType, const char *host)
+{
+    if (body == NULL)
+    {
+        return makeBodyRequest(type, uri, authorization, NULL, contentType, host);
     }
+    SpotifyStringBody stringBody(body);
+    return makeBodyRequest(type, uri, authorization, &stringBody, contentType, host);
+}
+
+int ArduinoSpotify::makeBodyRequest(const char *type, const char *uri, const char *authorization, const SpotifyRequestBody *body, const char *contentType, const char *host)
+{
+    int statusCode;
+    do
+    {
+        statusCode = sendRequest(type, uri, "application/json", contentType, authorization, body, host);
+    } while (shouldReconnect(statusCode, false));
+
+    return statusCode;
 }
 
 int ArduinoSpotify::makePutRequest(const char *uri, const char *authorization, const char *body, const char *contentType, const char *host)
 {
-    return makeRequestWithBody("PUT", uri, authorization, body, contentType);
+    return makeRequestWithBody("PUT", uri, authorization, body, contentType, host);
 }
 
 int ArduinoSpotify::makePostRequest(const char *uri, const char *authorization, const char *body, const char *contentType, const char *host)
@@ -80,26 +645,36 @@ int ArduinoSpotify::makePostRequest(const char *uri, const char *authorization,
 
 int ArduinoSpotify::makeGetRequest(const char *uri, const char *authorization, const char *accept, const char *host)
 {
-    if (!_http->begin(*_client, String(host), (uint16_t)SPOTIFY_PORT, String(uri), true))
+    int statusCode;
+    uint8_t attempt = 0;
+    do
     {
-        Serial.println(F("Connection failed"));
-        return -1;
-    }
+        statusCode = sendRequest("GET", uri, accept, NULL, authorization, NULL, host);
+    } while (shouldReconnect(statusCode, true) || shouldRetry("GET", statusCode, ++attempt));
+
+    return statusCode;
+}
 
-    if (accept != NULL)
+int ArduinoSpotify::makeGetRequest(const SpotifyQueryWriter &command, const char *authorization, const char *accept, const char *host)
+{
+    if (command.overflowed())
     {
-        _http->addHeader(F("Accept"), accept);
+        Serial.println(F("Request path too long"));
+        _lastStatusCode = SPOTIFY_PATH_TOO_LONG;
+        return SPOTIFY_PATH_TOO_LONG;
     }
+    return makeGetRequest(command.c_str(), authorization, accept, host);
+}
 
-    if (authorization != NULL)
+int ArduinoSpotify::makeRequestWithBody(const char *type, const SpotifyQueryWriter &command, const char *authorization, const char *body, const char *contentType, const char *host)
+{
+    if (command.overflowed())
     {
-        _http->addHeader(F("Authorization"), authorization);
+        Serial.println(F("Request path too long"));
+        _lastStatusCode = SPOTIFY_PATH_TOO_LONG;
+        return SPOTIFY_PATH_TOO_LONG;
     }
-
-    // give the esp a breather
-    yield();
-
-    return _http->GET();
+    return makeRequestWithBody(type, command.c_str(), authorization, body, contentType, host);
 }
 
 void ArduinoSpotify::setRefreshToken(const char *refreshToken)
@@ -107,16 +682,29 @@ void ArduinoSpotify::setRefreshToken(const char *refreshToken)
     _refreshToken = refreshToken;
 }
 
+void ArduinoSpotify::writeRefreshBody(SpotifyQueryWriter &body)
+{
+    body.add("grant_type", "refresh_token")
+        .add("refresh_token", _refreshToken)
+        .add("client_id", _clientId)
+        .add("client_secret", _clientSecret);
+}
+
 bool ArduinoSpotify::refreshAccessToken()
 {
-    char body[1000];
-    sprintf(body, refreshAccessTokensBody, _refreshToken, _clientId, _clientSecret);
+    RefreshTokenBody body;
+    writeRefreshBody(body);
+    if (body.overflowed())
+    {
+        Serial.println(F("Refresh token or client credentials too long"));
+        return false;
+    }
 
 #ifdef SPOTIFY_DEBUG
-    Serial.println(body);
+    Serial.println(body.c_str());
 #endif
 
-    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
+    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body.c_str(), "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
     unsigned long now = millis();
 
 #ifdef SPOTIFY_DEBUG
@@ -127,14 +715,12 @@ bool ArduinoSpotify::refreshAccessToken()
     bool refreshed = false;
     if (statusCode == 200)
     {
-        DynamicJsonDocument doc(1000);
-        DeserializationError error = deserializeJson(doc, _http->getStream());
+        JsonDocument &doc = jsonArena(1000);
+        DeserializationError error = deserializeJson(doc, _transport->getStream());
+        recordJsonUsage(SPOTIFY_JSON_TOKEN, error);
         if (!error)
         {
-            _bearerToken = String("Bearer ") + doc["access_token"].as<String>();
-            int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-            _tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-            _timeTokenRefreshed = now;
+            storeAccessToken(doc, now);
             refreshed = true;
         }
     }
@@ -150,13 +736,68 @@ bool ArduinoSpotify::refreshAccessToken()
     return refreshed;
 }
 
+void ArduinoSpotify::storeAccessToken(JsonDocument &doc, unsigned long now)
+{
+    _bearerToken = String("Bearer ") + doc["access_token"].as<String>();
+    int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
+    _tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
+    _timeTokenRefreshed = now;
+
+    time_t currentTime = time(NULL);
+    if (_tokenStore != NULL && currentTime > SPOTIFY_MIN_VALID_TIME)
+    {
+        SpotifyStoredToken token;
+        strncpy(token.accessToken, doc["access_token"] | "", SPOTIFY_MAX_TOKEN_LENGTH - 1);
+        token.accessToken[SPOTIFY_MAX_TOKEN_LENGTH - 1] = '\0';
+        token.expiresAt = currentTime + tokenTtl;
+        if (!_tokenStore->save(token))
+        {
+            Serial.println(F("Could not save access token"));
+        }
+    }
+}
+
+void ArduinoSpotify::setTokenStore(SpotifyTokenStore *tokenStore)
+{
+    _tokenStore = tokenStore;
+}
+
+bool ArduinoSpotify::restoreAccessToken()
+{
+    time_t currentTime = time(NULL);
+    if (_tokenStore == NULL || currentTime < SPOTIFY_MIN_VALID_TIME)
+    {
+        // Without the current time there is no way to tell if it expired
+        return false;
+    }
+
+    SpotifyStoredToken token;
+    if (!_tokenStore->load(token) || (time_t)token.expiresAt <= currentTime + 2)
+    {
+        return false;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Restored access token, valid for (s): "));
+    Serial.println((long)(token.expiresAt - currentTime));
+#endif
+
+    _bearerToken = String("Bearer ") + token.accessToken;
+    _tokenTimeToLiveMs = ((token.expiresAt - currentTime) * 1000) - 2000;
+    _timeTokenRefreshed = millis();
+    return true;
+}
+
 bool ArduinoSpotify::checkAndRefreshAccessToken()
 {
     unsigned long timeSinceLastRefresh = millis() - _timeTokenRefreshed;
     if (timeSinceLastRefresh >= _tokenTimeToLiveMs)
     {
         Serial.println("Refresh of the Access token is due, doing that now.");
-        return refreshAccessToken();
+        unsigned long start = millis();
+        bool refreshed = refreshAccessToken();
+        _tokenRefreshMs += millis() - start;
+        return refreshed;
     }
 
     // Token is still valid
@@ -165,14 +806,23 @@ bool ArduinoSpotify::checkAndRefreshAccessToken()
 
 const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *redirectUrl)
 {
-    char body[1000];
-    sprintf(body, requestAccessTokensBody, code, redirectUrl, _clientId, _clientSecret);
+    AccessTokensBody body;
+    body.add("grant_type", "authorization_code")
+        .add("code", code)
+        .add("redirect_uri", redirectUrl)
+        .add("client_id", _clientId)
+        .add("client_secret", _clientSecret);
+    if (body.overflowed())
+    {
+        Serial.println(F("Code or redirect URL too long"));
+        return _refreshToken;
+    }
 
 #ifdef SPOTIFY_DEBUG
-    Serial.println(body);
+    Serial.println(body.c_str());
 #endif
 
-    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
+    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body.c_str(), "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
     unsigned long now = millis();
 
 #ifdef SPOTIFY_DEBUG
@@ -182,15 +832,14 @@ const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *re
 
     if (statusCode == 200)
     {
-        DynamicJsonDocument doc(1000);
-        DeserializationError error = deserializeJson(doc, _http->getStream());
+        JsonDocument &doc = jsonArena(1000);
+        DeserializationError error = deserializeJson(doc, _transport->getStream());
+        recordJsonUsage(SPOTIFY_JSON_TOKEN, error);
         if (!error)
         {
-            this->_bearerToken = String("Bearer ") + doc["access_token"].as<String>();
-            _refreshToken = doc["refresh_token"].as<char *>();
-            int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-            _tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-            _timeTokenRefreshed = now;
+            storeAccessToken(doc, now);
+            _requestedRefreshToken = doc["refresh_token"].as<String>();
+            _refreshToken = _requestedRefreshToken.c_str();
         }
     }
     else
@@ -207,89 +856,93 @@ const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *re
 
 bool ArduinoSpotify::play(const char *deviceId)
 {
-    char command[100] = SPOTIFY_PLAY_ENDPOINT;
-    return playerControl(command, deviceId);
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PLAY_ENDPOINT), deviceIdParam)> command(SPOTIFY_PLAY_ENDPOINT);
+    command.add("device_id", deviceId);
+    return playerCommand("PUT", command, "", SPOTIFY_CHANGE_PLAY);
 }
 
 bool ArduinoSpotify::playAdvanced(const char *body, const char *deviceId)
 {
-    char command[100] = SPOTIFY_PLAY_ENDPOINT;
-    return playerControl(command, deviceId, body);
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PLAY_ENDPOINT), deviceIdParam)> command(SPOTIFY_PLAY_ENDPOINT);
+    command.add("device_id", deviceId);
+    return playerCommand("PUT", command, body, SPOTIFY_CHANGE_TRACK);
+}
+
+bool ArduinoSpotify::playAdvanced(const JsonDocument &body, const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PLAY_ENDPOINT), deviceIdParam)> command(SPOTIFY_PLAY_ENDPOINT);
+    command.add("device_id", deviceId);
+    SpotifyJsonBody json(body);
+    return playerCommand("PUT", command, json, SPOTIFY_CHANGE_TRACK);
 }
 
 bool ArduinoSpotify::pause(const char *deviceId)
 {
-    char command[100] = SPOTIFY_PAUSE_ENDPOINT;
-    return playerControl(command, deviceId);
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PAUSE_ENDPOINT), deviceIdParam)> command(SPOTIFY_PAUSE_ENDPOINT);
+    command.add("device_id", deviceId);
+    return playerCommand("PUT", command, "", SPOTIFY_CHANGE_PAUSE);
 }
 
 bool ArduinoSpotify::setVolume(int volume, const char *deviceId)
 {
-    char command[125];
-    sprintf(command, SPOTIFY_VOLUME_ENDPOINT, volume);
-    return playerControl(command, deviceId);
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_VOLUME_PATH),
+                                  spotifyQueryParam("volume_percent", SPOTIFY_INT_PARAM_LENGTH),
+                                  deviceIdParam)>
+        command(SPOTIFY_VOLUME_PATH);
+    command.add("volume_percent", volume).add("device_id", deviceId);
+    return playerCommand("PUT", command, "", SPOTIFY_CHANGE_VOLUME, volume);
 }
 
 bool ArduinoSpotify::toggleShuffle(bool shuffle, const char *deviceId)
 {
-    char command[125];
-    char shuffleState[10];
-    if (shuffle)
-    {
-        strcpy(shuffleState, "true");
-    }
-    else
-    {
-        strcpy(shuffleState, "false");
-    }
-    sprintf(command, SPOTIFY_SHUFFLE_ENDPOINT, shuffleState);
-    return playerControl(command, deviceId);
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_SHUFFLE_PATH),
+                                  spotifyQueryParam("state", sizeof("false") - 1),
+                                  deviceIdParam)>
+        command(SPOTIFY_SHUFFLE_PATH);
+    command.add("state", shuffle).add("device_id", deviceId);
+    return playerCommand("PUT", command, "", SPOTIFY_CHANGE_SHUFFLE, shuffle);
 }
 
 bool ArduinoSpotify::setRepeatMode(RepeatOptions repeat, const char *deviceId)
 {
-    char command[125];
-    char repeatState[10];
+    const char *repeatState = "off";
     switch (repeat)
     {
     case REPEAT_TRACK:
-        strcpy(repeatState, "track");
+        repeatState = "track";
         break;
     case REPEAT_CONTEXT:
-        strcpy(repeatState, "context");
+        repeatState = "context";
         break;
     case REPEAT_OFF:
-        strcpy(repeatState, "off");
+        repeatState = "off";
         break;
     }
 
-    sprintf(command, SPOTIFY_REPEAT_ENDPOINT, repeatState);
-    return playerControl(command, deviceId);
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_REPEAT_PATH),
+                                  spotifyQueryParam("state", sizeof("context") - 1),
+                                  deviceIdParam)>
+        command(SPOTIFY_REPEAT_PATH);
+    command.add("state", repeatState).add("device_id", deviceId);
+    return playerCommand("PUT", command, "", SPOTIFY_CHANGE_REPEAT, repeat);
 }
 
-bool ArduinoSpotify::playerControl(char *command, const char *deviceId, const char *body)
+bool ArduinoSpotify::playerCommand(const char *method, const SpotifyQueryWriter &command, const char *body,
+                                   SpotifyPlayerChange change, long changeValue)
 {
-    if (deviceId[0] != '\0')
-    {
-        char *questionMarkPointer;
-        questionMarkPointer = strchr(command, '?');
-        // DeviceId is char[41] so let's add 20 to be safe with the rest
-        char deviceIdBuff[60];
-        if (questionMarkPointer == NULL)
-        {
-            sprintf(deviceIdBuff, "?device_id=%s", deviceId);
-        }
-        else
-        {
-            // params already started
-            sprintf(deviceIdBuff, "&device_id=%s", deviceId);
-        }
-        strcat(command, deviceIdBuff);
-    }
+    SpotifyStringBody stringBody(body);
+    return playerCommand(method, command, stringBody, change, changeValue);
+}
+
+bool ArduinoSpotify::playerCommand(const char *method, const SpotifyQueryWriter &command, const SpotifyRequestBody &body,
+                                   SpotifyPlayerChange change, long changeValue)
+{
+    _commandStart = millis();
 
 #ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-    Serial.println(body);
+    Serial.println(command.c_str());
+    body.writeTo(Serial);
+    Serial.println();
 #endif
 
     if (autoTokenRefresh)
@@ -297,75 +950,203 @@ bool ArduinoSpotify::playerControl(char *command, const char *deviceId, const ch
         checkAndRefreshAccessToken();
     }
 
-    int statusCode = makePutRequest(command, _bearerToken.c_str(), body);
+    int statusCode;
+    if (command.overflowed())
+    {
+        Serial.println(F("Request path too long"));
+        _lastStatusCode = SPOTIFY_PATH_TOO_LONG;
+        statusCode = SPOTIFY_PATH_TOO_LONG;
+    }
+    else
+    {
+        statusCode = makeBodyRequest(method, command.c_str(), _bearerToken.c_str(), &body);
+    }
+    commandDone();
 
     stopClient();
 
     //Will return 204 if all went well.
-    return (statusCode == 204);
+    if (statusCode != 204)
+    {
+        return false;
+    }
+    applyPlayerChange(change, changeValue);
+    return true;
 }
 
-bool ArduinoSpotify::playerNavigate(char *command, const char *deviceId)
+long ArduinoSpotify::cachedProgress(unsigned long now)
 {
-    if (deviceId[0] != 0)
+    if (!_playerCache.isPlaying)
     {
-        // DeviceId is char[41]
-        char deviceIdBuff[60];
-        sprintf(deviceIdBuff, "?device_id=%s", deviceId);
-        strcat(command, deviceIdBuff);
+        return _playerCache.progressMs;
     }
+    return _playerCache.progressMs + (long)(now - _playerCacheAt);
+}
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
-
-    if (autoTokenRefresh)
+bool ArduinoSpotify::getCachedPlayerDetails(PlayerDetailsFixed &playerDetails)
+{
+    if (!_playerCacheValid)
     {
-        checkAndRefreshAccessToken();
+        return false;
     }
-    int statusCode = makePostRequest(command, _bearerToken.c_str());
-
-    stopClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+    playerDetails = _playerCache;
+    playerDetails.progressMs = cachedProgress(millis());
+    return true;
 }
 
-bool ArduinoSpotify::nextTrack(const char *deviceId)
+uint8_t ArduinoSpotify::getStateMismatches()
 {
-    char command[100] = SPOTIFY_NEXT_TRACK_ENDPOINT;
-    return playerNavigate(command, deviceId);
+    return _stateMismatches;
 }
 
-bool ArduinoSpotify::previousTrack(const char *deviceId)
+// Does to the cache what the command did to the player
+void ArduinoSpotify::applyPlayerChange(SpotifyPlayerChange change, long changeValue)
 {
-    char command[100] = SPOTIFY_PREVIOUS_TRACK_ENDPOINT;
-    return playerNavigate(command, deviceId);
+    if (!optimisticState || !_playerCacheValid || change == SPOTIFY_CHANGE_NONE)
+    {
+        return;
+    }
+
+    unsigned long now = millis();
+    _playerCache.progressMs = cachedProgress(now);
+    _playerCacheAt = now;
+
+    switch (change)
+    {
+    case SPOTIFY_CHANGE_PLAY:
+        _playerCache.isPlaying = true;
+        _pendingState |= SPOTIFY_STATE_PLAYING;
+        break;
+    case SPOTIFY_CHANGE_PAUSE:
+        _playerCache.isPlaying = false;
+        _pendingState |= SPOTIFY_STATE_PLAYING;
+        break;
+    case SPOTIFY_CHANGE_VOLUME:
+        _playerCache.device.volumePrecent = changeValue;
+        _pendingState |= SPOTIFY_STATE_VOLUME;
+        break;
+    case SPOTIFY_CHANGE_SHUFFLE:
+        _playerCache.shuffleState = changeValue != 0;
+        _pendingState |= SPOTIFY_STATE_SHUFFLE;
+        break;
+    case SPOTIFY_CHANGE_REPEAT:
+        _playerCache.repeateState = (RepeatOptions)changeValue;
+        _pendingState |= SPOTIFY_STATE_REPEAT;
+        break;
+    case SPOTIFY_CHANGE_SEEK:
+        _playerCache.progressMs = changeValue;
+        _pendingState |= SPOTIFY_STATE_PROGRESS;
+        break;
+    case SPOTIFY_CHANGE_TRACK:
+        _playerCache.progressMs = 0;
+        _playerCache.isPlaying = true;
+        _pendingState |= SPOTIFY_STATE_PLAYING | SPOTIFY_STATE_PROGRESS;
+        break;
+    default:
+        break;
+    }
 }
 
-bool ArduinoSpotify::seek(int position, const char *deviceId)
+// Replaces the cache with a fetched player state. Fields a command changed
+// since the last fetch are compared first, the device and the shuffle/repeat
+// state are only in the responses of /me/player.
+void ArduinoSpotify::reconcilePlayerState(JsonDocument &doc, bool hasDevice)
 {
-    char command[100] = SPOTIFY_SEEK_ENDPOINT;
-    char tempBuff[100];
-    sprintf(tempBuff, "?position_ms=%d", position);
-    strcat(command, tempBuff);
-    if (deviceId[0] != 0)
+    unsigned long now = millis();
+    bool isPlaying = doc["is_playing"].as<bool>();
+    long progressMs = doc["progress_ms"].as<long>();
+
+    uint8_t checked = _pendingState & (SPOTIFY_STATE_PLAYING | SPOTIFY_STATE_PROGRESS);
+    uint8_t mismatches = 0;
+    if ((checked & SPOTIFY_STATE_PLAYING) && isPlaying != _playerCache.isPlaying)
+    {
+        mismatches |= SPOTIFY_STATE_PLAYING;
+    }
+    if ((checked & SPOTIFY_STATE_PROGRESS) && labs(progressMs - cachedProgress(now)) > SPOTIFY_PROGRESS_TOLERANCE_MS)
     {
-        sprintf(tempBuff, "?device_id=%s", deviceId);
-        strcat(command, tempBuff);
+        mismatches |= SPOTIFY_STATE_PROGRESS;
     }
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
+    if (hasDevice)
+    {
+        JsonObject device = doc["device"];
+        uint8_t volume = device["volume_percent"].as<int>();
+        bool shuffle = doc["shuffle_state"].as<bool>();
+        RepeatOptions repeat = parseRepeatState(doc["repeat_state"]);
 
-    if (autoTokenRefresh)
+        checked |= _pendingState & (SPOTIFY_STATE_VOLUME | SPOTIFY_STATE_SHUFFLE | SPOTIFY_STATE_REPEAT);
+        if ((checked & SPOTIFY_STATE_VOLUME) && volume != _playerCache.device.volumePrecent)
+        {
+            mismatches |= SPOTIFY_STATE_VOLUME;
+        }
+        if ((checked & SPOTIFY_STATE_SHUFFLE) && shuffle != _playerCache.shuffleState)
+        {
+            mismatches |= SPOTIFY_STATE_SHUFFLE;
+        }
+        if ((checked & SPOTIFY_STATE_REPEAT) && repeat != _playerCache.repeateState)
+        {
+            mismatches |= SPOTIFY_STATE_REPEAT;
+        }
+
+        _playerCache.truncated = !fillDevice(device, _playerCache.device);
+        _playerCache.shuffleState = shuffle;
+        _playerCache.repeateState = repeat;
+        _playerCache.error = false;
+        _playerCacheValid = true;
+    }
+
+    _playerCache.isPlaying = isPlaying;
+    _playerCache.progressMs = progressMs;
+    _playerCacheAt = now;
+
+    _pendingState &= ~checked;
+    _stateMismatches = (_stateMismatches & ~checked) | mismatches;
+
+#ifdef SPOTIFY_DEBUG
+    if (mismatches != 0)
     {
-        checkAndRefreshAccessToken();
+        Serial.print(F("Player state differs from the command: "));
+        Serial.println(mismatches);
     }
-    int statusCode = makePutRequest(command, _bearerToken.c_str());
-    stopClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+#endif
+}
+
+bool ArduinoSpotify::playerControl(char *command, const char *deviceId, const char *body)
+{
+    SpotifyQuery<SPOTIFY_MAX_PATH_LENGTH> path(command);
+    path.add("device_id", deviceId);
+    return playerCommand("PUT", path, body);
+}
+
+bool ArduinoSpotify::playerNavigate(char *command, const char *deviceId)
+{
+    SpotifyQuery<SPOTIFY_MAX_PATH_LENGTH> path(command);
+    path.add("device_id", deviceId);
+    return playerCommand("POST", path);
+}
+
+bool ArduinoSpotify::nextTrack(const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_NEXT_TRACK_ENDPOINT), deviceIdParam)> command(SPOTIFY_NEXT_TRACK_ENDPOINT);
+    command.add("device_id", deviceId);
+    return playerCommand("POST", command, "", SPOTIFY_CHANGE_TRACK);
+}
+
+bool ArduinoSpotify::previousTrack(const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PREVIOUS_TRACK_ENDPOINT), deviceIdParam)> command(SPOTIFY_PREVIOUS_TRACK_ENDPOINT);
+    command.add("device_id", deviceId);
+    return playerCommand("POST", command, "", SPOTIFY_CHANGE_TRACK);
+}
+
+bool ArduinoSpotify::seek(int position, const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_SEEK_ENDPOINT),
+                                  spotifyQueryParam("position_ms", SPOTIFY_INT_PARAM_LENGTH),
+                                  deviceIdParam)>
+        command(SPOTIFY_SEEK_ENDPOINT);
+    command.add("position_ms", position).add("device_id", deviceId);
+    return playerCommand("PUT", command, "", SPOTIFY_CHANGE_SEEK, position);
 }
 
 uint8_t ArduinoSpotify::getDevices(SpotifyDevice resultDevices[], uint8_t maxDevices)
@@ -386,13 +1167,19 @@ uint8_t ArduinoSpotify::getDevices(SpotifyDevice resultDevices[], uint8_t maxDev
     if (statusCode == 200)
     {
         // Get from https://arduinojson.org/v6/assistant/
-        const size_t bufferSize = deviceBufferSize;
-
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
+        JsonDocument &doc = jsonArena(filterResponses ? devicesFilteredBufferSize : deviceBufferSize);
 
         // Parse JSON object
-        DeserializationError error = deserializeJson(doc, _http->getStream());
+        DeserializationError error;
+        if (filterResponses)
+        {
+            error = deserializeFiltered(doc, devicesFilter);
+        }
+        else
+        {
+            error = deserializeJson(doc, _transport->getStream());
+        }
+        recordJsonUsage(SPOTIFY_JSON_DEVICES, error);
         if (!error)
         {
             JsonArray devices = doc["devices"].as<JsonArray>();
@@ -430,6 +1217,8 @@ uint8_t ArduinoSpotify::getDevices(SpotifyDevice resultDevices[], uint8_t maxDev
 }
 bool ArduinoSpotify::transferPlayback(const char *deviceId, bool play)
 {
+    _commandStart = millis();
+
 #ifdef SPOTIFY_DEBUG
     Serial.println(SPOTIFY_TRANSFER_ENDPOINT);
 #endif
@@ -439,13 +1228,17 @@ bool ArduinoSpotify::transferPlayback(const char *deviceId, bool play)
         checkAndRefreshAccessToken();
     }
 
-    char body[100];
-    sprintf(body, "{\"device_ids\":[\"%s\"],\"play\":\"%s\"}", deviceId, (play?"true":"false"));
+    StaticJsonDocument<JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(1)> doc;
+    doc.createNestedArray("device_ids").add(deviceId);
+    doc["play"] = play;
 #ifdef SPOTIFY_DEBUG
-    Serial.println(body);
+    serializeJson(doc, Serial);
+    Serial.println();
 #endif
 
-    int statusCode = makePutRequest(SPOTIFY_TRANSFER_ENDPOINT, _bearerToken.c_str(), body);
+    SpotifyJsonBody body(doc);
+    int statusCode = makeBodyRequest("PUT", SPOTIFY_TRANSFER_ENDPOINT, _bearerToken.c_str(), &body);
+    commandDone();
     stopClient();
     //Will return 204 if all went well.
     return statusCode == 204;
@@ -453,16 +1246,11 @@ bool ArduinoSpotify::transferPlayback(const char *deviceId, bool play)
 
 CurrentlyPlaying ArduinoSpotify::getCurrentlyPlaying(const char *market)
 {
-    char command[100] = SPOTIFY_CURRENTLY_PLAYING_ENDPOINT;
-    if (market[0] != 0)
-    {
-        char marketBuff[30];
-        sprintf(marketBuff, "?market=%s", market);
-        strcat(command, marketBuff);
-    }
+    CurrentlyPlayingPath command(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT);
+    command.add("market", market);
 
 #ifdef SPOTIFY_DEBUG
-    Serial.println(command);
+    Serial.println(command.c_str());
 #endif
     if (autoTokenRefresh)
     {
@@ -477,56 +1265,22 @@ CurrentlyPlaying ArduinoSpotify::getCurrentlyPlaying(const char *market)
 
     if (statusCode == 200)
     {
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(currentlyPlayingBufferSize);
+        JsonDocument &doc = jsonArena(filterResponses ? currentlyPlayingFilteredBufferSize : currentlyPlayingBufferSize);
 
         // Parse JSON object
-        DeserializationError error = deserializeJson(doc, _http->getStream());
+        DeserializationError error;
+        if (filterResponses)
+        {
+            error = deserializeFiltered(doc, currentlyPlayingFilter);
+        }
+        else
+        {
+            error = deserializeJson(doc, _transport->getStream());
+        }
+        recordJsonUsage(SPOTIFY_JSON_CURRENTLY_PLAYING, error);
         if (!error)
         {
-            currentlyPlaying.contextUri = doc["context"]["uri"].as<String>();
-
-            JsonObject item = doc["item"];
-            JsonObject firstArtist = item["album"]["artists"][0];
-
-            currentlyPlaying.firstArtistName = firstArtist["name"].as<String>();
-            currentlyPlaying.firstArtistUri = firstArtist["uri"].as<String>();
-
-            currentlyPlaying.albumName = item["album"]["name"].as<String>();
-            currentlyPlaying.albumUri = item["album"]["uri"].as<String>();
-
-            JsonArray images = item["album"]["images"];
-
-            // Images are returned in order of width, so last should be smallest.
-            int numImages = images.size();
-            int startingIndex = 0;
-            if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
-            {
-                startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
-                currentlyPlaying.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
-            }
-            else
-            {
-                currentlyPlaying.numImages = numImages;
-            }
-
-            for (int i = 0; i < currentlyPlaying.numImages; i++)
-            {
-                int adjustedIndex = startingIndex + i;
-                currentlyPlaying.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
-                currentlyPlaying.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
-                currentlyPlaying.albumImages[i].url = images[adjustedIndex]["url"].as<String>();
-            }
-
-            currentlyPlaying.trackName = item["name"].as<String>();
-            currentlyPlaying.trackUri = item["uri"].as<String>();
-
-            currentlyPlaying.isPlaying = doc["is_playing"].as<bool>();
-
-            currentlyPlaying.progressMs = doc["progress_ms"].as<long>();
-            currentlyPlaying.duraitonMs = item["duration_ms"].as<long>();
-
-            currentlyPlaying.error = false;
+            fillCurrentlyPlaying(doc, currentlyPlaying);
         }
         else
         {
@@ -540,20 +1294,13 @@ CurrentlyPlaying ArduinoSpotify::getCurrentlyPlaying(const char *market)
 
 PlayerDetails ArduinoSpotify::getPlayerDetails(const char *market)
 {
-    char command[100] = SPOTIFY_PLAYER_ENDPOINT;
-    if (market[0] != 0)
-    {
-        char marketBuff[30];
-        sprintf(marketBuff, "?market=%s", market);
-        strcat(command, marketBuff);
-    }
+    PlayerPath command(SPOTIFY_PLAYER_ENDPOINT);
+    command.add("market", market);
 
 #ifdef SPOTIFY_DEBUG
-    Serial.println(command);
+    Serial.println(command.c_str());
 #endif
 
-    // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = playerDetailsBufferSize;
     PlayerDetails playerDetails;
     // This flag will get cleared if all goes well
     playerDetails.error = true;
@@ -566,44 +1313,72 @@ PlayerDetails ArduinoSpotify::getPlayerDetails(const char *market)
 
     if (statusCode == 200)
     {
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
+        JsonDocument &doc = jsonArena(filterResponses ? playerDetailsFilteredBufferSize : playerDetailsBufferSize);
 
         // Parse JSON object
-        DeserializationError error = deserializeJson(doc, _http->getStream());
+        DeserializationError error;
+        if (filterResponses)
+        {
+            error = deserializeFiltered(doc, playerDetailsFilter);
+        }
+        else
+        {
+            error = deserializeJson(doc, _transport->getStream());
+        }
+        recordJsonUsage(SPOTIFY_JSON_PLAYER_DETAILS, error);
         if (!error)
         {
-            JsonObject device = doc["device"];
-            
-            playerDetails.device.id = device["id"].as<String>();
-            playerDetails.device.name = device["name"].as<String>();
-            playerDetails.device.type = device["type"].as<String>();
-            playerDetails.device.isActive = device["is_active"].as<bool>();
-            playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
-            playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
-            playerDetails.device.volumePrecent = device["volume_percent"].as<int>();
+            fillPlayerDetails(doc, playerDetails);
+        }
+        else
+        {
+            Serial.print(F("deserializeJson() failed with code "));
+            Serial.println(error.c_str());
+        }
+    }
+    stopClient();
+    return playerDetails;
+}
 
-            playerDetails.progressMs = doc["progress_ms"].as<long>();
-            playerDetails.isPlaying = doc["is_playing"].as<bool>();
+bool ArduinoSpotify::getPlayerState(PlayerDetails &playerDetails, CurrentlyPlaying &currentlyPlaying, const char *market)
+{
+    PlayerPath command(SPOTIFY_PLAYER_ENDPOINT);
+    command.add("market", market);
 
-            playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
+#ifdef SPOTIFY_DEBUG
+    Serial.println(command.c_str());
+#endif
 
-            const char *repeat_state = doc["repeat_state"]; // "off"
+    // These flags will get cleared if all goes well
+    playerDetails.error = true;
+    currentlyPlaying.error = true;
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
+    }
 
-            if (strncmp(repeat_state, "track", 5) == 0)
-            {
-                playerDetails.repeateState = REPEAT_TRACK;
-            }
-            else if (strncmp(repeat_state, "context", 7) == 0)
-            {
-                playerDetails.repeateState = REPEAT_CONTEXT;
-            }
-            else
-            {
-                playerDetails.repeateState = REPEAT_OFF;
-            }
+    int statusCode = makeGetRequest(command, _bearerToken.c_str());
+
+    if (statusCode == 200)
+    {
+        JsonDocument &doc = jsonArena(filterResponses ? playerStateFilteredBufferSize : playerStateBufferSize);
 
-            playerDetails.error = false;
+        // Parse JSON object
+        DeserializationError error;
+        if (filterResponses)
+        {
+            error = deserializeFiltered(doc, playerStateFilter);
+        }
+        else
+        {
+            error = deserializeJson(doc, _transport->getStream());
+        }
+        recordJsonUsage(SPOTIFY_JSON_PLAYER_STATE, error);
+        if (!error)
+        {
+            // The player response contains the same "item" as currently-playing
+            fillPlayerDetails(doc, playerDetails);
+            fillCurrentlyPlaying(doc, currentlyPlaying);
         }
         else
         {
@@ -612,106 +1387,1731 @@ PlayerDetails ArduinoSpotify::getPlayerDetails(const char *market)
         }
     }
     stopClient();
-    return playerDetails;
+    return !playerDetails.error;
 }
 
-bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
+int ArduinoSpotify::getPlayerStateAsync(SpotifyAsyncCallback callback, const char *market)
 {
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("Parsing image URL: "));
-    Serial.println(imageUrl);
-#endif
+    PlayerPath command(SPOTIFY_PLAYER_ENDPOINT);
+    command.add("market", market);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_STATE, "GET", command, NULL, callback);
+}
 
-    uint8_t lengthOfString = strlen(imageUrl);
+void ArduinoSpotify::fillCurrentlyPlaying(JsonDocument &doc, CurrentlyPlaying &currentlyPlaying)
+{
+    currentlyPlaying.contextUri = doc["context"]["uri"].as<String>();
 
-    // We are going to just assume https, that's all I've
-    // seen and I can't imagine a company will go back
-    // to http
+    JsonObject item = doc["item"];
+    JsonObject firstArtist = item["album"]["artists"][0];
 
-    if (strncmp(imageUrl, "https://", 8) != 0)
+    currentlyPlaying.firstArtistName = firstArtist["name"].as<String>();
+    currentlyPlaying.firstArtistUri = firstArtist["uri"].as<String>();
+
+    currentlyPlaying.albumName = item["album"]["name"].as<String>();
+    currentlyPlaying.albumUri = item["album"]["uri"].as<String>();
+
+    JsonArray images = item["album"]["images"];
+
+    // Images are returned in order of width, so last should be smallest.
+    int numImages = images.size();
+    int startingIndex = 0;
+    if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
     {
-        Serial.print(F("Url not in expected format: "));
-        Serial.println(imageUrl);
-        Serial.println("(expected it to start with \"https://\")");
-        return false;
+        startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
+        currentlyPlaying.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
+    }
+    else
+    {
+        currentlyPlaying.numImages = numImages;
     }
 
-    uint8_t protocolLength = 8;
+    for (int i = 0; i < currentlyPlaying.numImages; i++)
+    {
+        int adjustedIndex = startingIndex + i;
+        currentlyPlaying.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
+        currentlyPlaying.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
+        currentlyPlaying.albumImages[i].url = images[adjustedIndex]["url"].as<String>();
+    }
 
-    char *pathStart = strchr(imageUrl + protocolLength, '/');
-    uint8_t pathIndex = pathStart - imageUrl;
-    uint8_t pathLength = lengthOfString - pathIndex;
-    char path[pathLength + 1];
-    strncpy(path, pathStart, pathLength);
-    path[pathLength] = '\0';
+    currentlyPlaying.trackName = item["name"].as<String>();
+    currentlyPlaying.trackUri = item["uri"].as<String>();
 
-    uint8_t hostLength = pathIndex - protocolLength;
-    char host[hostLength + 1];
-    strncpy(host, imageUrl + protocolLength, hostLength);
-    host[hostLength] = '\0';
+    currentlyPlaying.isPlaying = doc["is_playing"].as<bool>();
 
-#ifdef SPOTIFY_DEBUG
+    currentlyPlaying.progressMs = doc["progress_ms"].as<long>();
+    currentlyPlaying.duraitonMs = item["duration_ms"].as<long>();
 
-    Serial.print(F("host: "));
-    Serial.println(host);
+    currentlyPlaying.error = false;
+    reconcilePlayerState(doc, false);
+}
 
-    Serial.print(F("len:host:"));
-    Serial.println(hostLength);
+void ArduinoSpotify::fillPlayerDetails(JsonDocument &doc, PlayerDetails &playerDetails)
+{
+    JsonObject device = doc["device"];
 
-    Serial.print(F("path: "));
-    Serial.println(path);
+    playerDetails.device.id = device["id"].as<String>();
+    playerDetails.device.name = device["name"].as<String>();
+    playerDetails.device.type = device["type"].as<String>();
+    playerDetails.device.isActive = device["is_active"].as<bool>();
+    playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
+    playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
+    playerDetails.device.volumePrecent = device["volume_percent"].as<int>();
 
-    Serial.print(F("len:path: "));
-    Serial.println(strlen(path));
-#endif
+    playerDetails.progressMs = doc["progress_ms"].as<long>();
+    playerDetails.isPlaying = doc["is_playing"].as<bool>();
 
-    bool status = false;
-    int statusCode = makeGetRequest(path, NULL, "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8", host);
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("statusCode: "));
-    Serial.println(statusCode);
-#endif
-    if (statusCode == 200)
-    {
+    playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
 
-#ifdef SPOTIFY_DEBUG
-        Serial.print(F("file length: "));
-        Serial.println(_http->getSize());
-#endif
+    playerDetails.repeateState = parseRepeatState(doc["repeat_state"]); // "off"
+
+    playerDetails.error = false;
+    reconcilePlayerState(doc, true);
+}
 
-        _http->writeToStream(file);
+JsonDocument *ArduinoSpotify::fetchFixed(const char *endpoint, SpotifyJsonEndpoint jsonEndpoint, const char *market, const char *filter)
+{
+    // currently-playing is the longest of the endpoints
+    CurrentlyPlayingPath command(endpoint);
+    command.add("market", market);
 
 #ifdef SPOTIFY_DEBUG
-            Serial.println(F("Finished getting image"));
+    Serial.println(command.c_str());
 #endif
 
-        status = true;
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
     }
 
-    stopClient();
+    int statusCode = makeGetRequest(command, _bearerToken.c_str());
+    if (statusCode != 200)
+    {
+        stopClient();
+        return NULL;
+    }
 
-    return status;
+    JsonDocument &doc = jsonArena(fixedBufferSize);
+    DeserializationError error = deserializeFiltered(doc, filter);
+    recordJsonUsage(jsonEndpoint, error);
+    stopClient();
+    if (error)
+    {
+        Serial.print(F("deserializeJson() failed with code "));
+        Serial.println(error.c_str());
+        return NULL;
+    }
+    return &doc;
 }
 
-void ArduinoSpotify::parseError()
+bool ArduinoSpotify::getCurrentlyPlaying(CurrentlyPlayingFixed &currentlyPlaying, const char *market)
 {
-    DynamicJsonDocument doc(1000);
-    DeserializationError error = deserializeJson(doc, _http->getStream());
-    if (!error)
-    {
-        Serial.println(F("getAuthToken error"));
-        serializeJson(doc, Serial);
-    }
-    else
+    currentlyPlaying.error = true;
+    JsonDocument *doc = fetchFixed(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT, SPOTIFY_JSON_CURRENTLY_PLAYING, market, currentlyPlayingFilter);
+    if (doc == NULL)
     {
-        Serial.println(F("Could not parse error"));
+        return false;
     }
+    fillCurrentlyPlaying(*doc, currentlyPlaying);
+    return true;
 }
 
-void ArduinoSpotify::stopClient()
+bool ArduinoSpotify::getPlayerDetails(PlayerDetailsFixed &playerDetails, const char *market)
 {
-#ifdef SPOTIFY_DEBUG
+    playerDetails.error = true;
+    JsonDocument *doc = fetchFixed(SPOTIFY_PLAYER_ENDPOINT, SPOTIFY_JSON_PLAYER_DETAILS, market, playerDetailsFilter);
+    if (doc == NULL)
+    {
+        return false;
+    }
+    fillPlayerDetails(*doc, playerDetails);
+    return true;
+}
+
+bool ArduinoSpotify::getPlayerState(PlayerDetailsFixed &playerDetails, CurrentlyPlayingFixed &currentlyPlaying, const char *market)
+{
+    playerDetails.error = true;
+    currentlyPlaying.error = true;
+    JsonDocument *doc = fetchFixed(SPOTIFY_PLAYER_ENDPOINT, SPOTIFY_JSON_PLAYER_STATE, market, playerStateFilter);
+    if (doc == NULL)
+    {
+        return false;
+    }
+    fillPlayerDetails(*doc, playerDetails);
+    fillCurrentlyPlaying(*doc, currentlyPlaying);
+    return true;
+}
+
+uint8_t ArduinoSpotify::getDevices(SpotifyDeviceFixed resultDevices[], uint8_t maxDevices)
+{
+    JsonDocument *doc = fetchFixed(SPOTIFY_DEVICES_ENDPOINT, SPOTIFY_JSON_DEVICES, NULL, devicesFilter);
+    if (doc == NULL)
+    {
+        return 0;
+    }
+
+    JsonArray devices = (*doc)["devices"].as<JsonArray>();
+    uint8_t results = devices.size();
+    if (results > maxDevices)
+    {
+        Serial.printf("Too many devices: %d > %d (ignoring some)\n", results, maxDevices);
+        results = maxDevices;
+    }
+
+    for (uint8_t i = 0; i < results; i++)
+    {
+        fillDevice(devices[i], resultDevices[i]);
+    }
+    return results;
+}
+
+int ArduinoSpotify::getQueue(CurrentlyPlayingFixed tracks[], uint8_t maxTracks)
+{
+#ifdef SPOTIFY_DEBUG
+    Serial.println(SPOTIFY_QUEUE_ENDPOINT);
+#endif
+
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
+    }
+
+    int statusCode = makeGetRequest(SPOTIFY_QUEUE_ENDPOINT, _bearerToken.c_str());
+    if (statusCode != 200)
+    {
+        stopClient();
+        return -1;
+    }
+
+    StaticJsonDocument<SPOTIFY_FILTER_BUFFER_SIZE> filter;
+    deserializeJson(filter, FPSTR(queueItemFilter));
+
+    // Each track comes with all its markets, so like forEachItem() they are
+    // parsed one at a time and the queue is left once there are enough
+    Stream &stream = _transport->getStream();
+    if (!findKey(stream, "queue") || peekToken(stream) != '[')
+    {
+        Serial.println(F("No queue in response"));
+        stopClient();
+        return -1;
+    }
+    stream.read();
+
+    int count = 0;
+    bool more = peekToken(stream) != ']';
+    while (more && count < maxTracks)
+    {
+        JsonDocument &doc = jsonArena(fixedBufferSize);
+        DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
+        recordJsonUsage(SPOTIFY_JSON_QUEUE_ITEM, error);
+        if (error)
+        {
+            Serial.print(F("deserializeJson() failed with code "));
+            Serial.println(error.c_str());
+            stopClient();
+            return -1;
+        }
+
+        CurrentlyPlayingFixed &track = tracks[count++];
+        track.contextUri[0] = '\0';
+        track.isPlaying = false;
+        track.progressMs = 0;
+        track.truncated = !fillPlayingItem(doc.as<JsonObject>(), track);
+        track.error = false;
+
+        more = stream.findUntil(",", "]");
+    }
+
+    stopClient();
+    return count;
+}
+
+bool ArduinoSpotify::fillDevice(JsonObject device, SpotifyDeviceFixed &result)
+{
+    bool complete = copyField(result.id, sizeof(result.id), device["id"]);
+    complete &= copyField(result.name, sizeof(result.name), device["name"]);
+    complete &= copyField(result.type, sizeof(result.type), device["type"]);
+    result.isActive = device["is_active"].as<bool>();
+    result.isPrivateSession = device["is_private_session"].as<bool>();
+    result.isRestricted = device["is_restricted"].as<bool>();
+    result.volumePrecent = device["volume_percent"].as<int>();
+    result.truncated = !complete;
+    return complete;
+}
+
+void ArduinoSpotify::fillCurrentlyPlaying(JsonDocument &doc, CurrentlyPlayingFixed &currentlyPlaying)
+{
+    bool complete = copyField(currentlyPlaying.contextUri, SPOTIFY_URI_LENGTH, doc["context"]["uri"]);
+    complete &= fillPlayingItem(doc["item"], currentlyPlaying);
+
+    currentlyPlaying.isPlaying = doc["is_playing"].as<bool>();
+    currentlyPlaying.progressMs = doc["progress_ms"].as<long>();
+
+    currentlyPlaying.truncated = !complete;
+    currentlyPlaying.error = false;
+    reconcilePlayerState(doc, false);
+}
+
+// The fields of CurrentlyPlayingFixed that belong to the track
+bool ArduinoSpotify::fillPlayingItem(JsonObject item, CurrentlyPlayingFixed &currentlyPlaying)
+{
+    JsonObject firstArtist = item["album"]["artists"][0];
+
+    bool complete = copyField(currentlyPlaying.firstArtistName, SPOTIFY_NAME_LENGTH, firstArtist["name"]);
+    complete &= copyField(currentlyPlaying.firstArtistUri, SPOTIFY_URI_LENGTH, firstArtist["uri"]);
+
+    complete &= copyField(currentlyPlaying.albumName, SPOTIFY_NAME_LENGTH, item["album"]["name"]);
+    complete &= copyField(currentlyPlaying.albumUri, SPOTIFY_URI_LENGTH, item["album"]["uri"]);
+
+    JsonArray images = item["album"]["images"];
+
+    // Images are returned in order of width, so last should be smallest.
+    int numImages = images.size();
+    int startingIndex = 0;
+    if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
+    {
+        startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
+        currentlyPlaying.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
+    }
+    else
+    {
+        currentlyPlaying.numImages = numImages;
+    }
+
+    for (int i = 0; i < currentlyPlaying.numImages; i++)
+    {
+        int adjustedIndex = startingIndex + i;
+        currentlyPlaying.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
+        currentlyPlaying.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
+        complete &= copyField(currentlyPlaying.albumImages[i].url, SPOTIFY_URL_LENGTH, images[adjustedIndex]["url"]);
+    }
+
+    complete &= copyField(currentlyPlaying.trackName, SPOTIFY_NAME_LENGTH, item["name"]);
+    complete &= copyField(currentlyPlaying.trackUri, SPOTIFY_URI_LENGTH, item["uri"]);
+
+    currentlyPlaying.duraitonMs = item["duration_ms"].as<long>();
+    return complete;
+}
+
+void ArduinoSpotify::fillPlayerDetails(JsonDocument &doc, PlayerDetailsFixed &playerDetails)
+{
+    playerDetails.truncated = !fillDevice(doc["device"], playerDetails.device);
+
+    playerDetails.progressMs = doc["progress_ms"].as<long>();
+    playerDetails.isPlaying = doc["is_playing"].as<bool>();
+
+    playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
+    playerDetails.repeateState = parseRepeatState(doc["repeat_state"]);
+
+    playerDetails.error = false;
+    reconcilePlayerState(doc, true);
+}
+
+DeserializationError ArduinoSpotify::deserializeFiltered(JsonDocument &doc, const char *filterJson, char *input, size_t inputLength)
+{
+    // The filters are small constant documents, parsing them on the stack
+    // is cheap compared to keeping the whole response around
+    StaticJsonDocument<SPOTIFY_FILTER_BUFFER_SIZE> filter;
+    DeserializationError error = deserializeJson(filter, FPSTR(filterJson));
+    if (error)
+    {
+        return error;
+    }
+    if (input != NULL)
+    {
+        // Strings stay in the (writable) input instead of being copied
+        return deserializeJson(doc, input, inputLength, DeserializationOption::Filter(filter));
+    }
+    return deserializeJson(doc, _transport->getStream(), DeserializationOption::Filter(filter));
+}
+
+typedef SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PLAYLIST_ENDPOINT) + SPOTIFY_PLAYLIST_ID_LENGTH + sizeof("/tracks"),
+                                      spotifyQueryParam("limit", SPOTIFY_INT_PARAM_LENGTH),
+                                      spotifyQueryParam("offset", SPOTIFY_INT_PARAM_LENGTH),
+                                      spotifyQueryParam("fields", SPOTIFY_FIELDS_LENGTH))>
+    PagePath;
+
+// A next link, plus the fields parameter if it doesn't have it
+#define SPOTIFY_PAGE_PATH_LENGTH spotifyQuerySize(SPOTIFY_MAX_PATH_LENGTH, spotifyQueryParam("fields", SPOTIFY_FIELDS_LENGTH))
+
+int ArduinoSpotify::getPlaylists(SpotifyPlaylistCallback callback, void *context, int offset)
+{
+    PagePath path(SPOTIFY_PLAYLISTS_ENDPOINT);
+    path.add("limit", (int)pageSize).add("offset", offset);
+    return forEachItem(path, playlistFilter, NULL, callback, NULL, context);
+}
+
+int ArduinoSpotify::getPlaylistTracks(const char *playlistId, SpotifyTrackCallback callback, void *context, int offset)
+{
+    if (strlen(playlistId) >= SPOTIFY_PLAYLIST_ID_LENGTH)
+    {
+        Serial.println(F("Playlist ID too long"));
+        return -1;
+    }
+
+    PagePath path(SPOTIFY_PLAYLIST_ENDPOINT);
+    path.addSegment(playlistId).addSegment("tracks");
+    path.add("limit", (int)pageSize).add("offset", offset).add("fields", playlistTrackFields);
+    return forEachItem(path, trackItemFilter, playlistTrackFields, NULL, callback, context);
+}
+
+int ArduinoSpotify::getSavedTracks(SpotifyTrackCallback callback, void *context, int offset)
+{
+    PagePath path(SPOTIFY_SAVED_TRACKS_ENDPOINT);
+    path.add("limit", (int)pageSize).add("offset", offset);
+    return forEachItem(path, trackItemFilter, NULL, NULL, callback, context);
+}
+
+int ArduinoSpotify::getRecentlyPlayed(SpotifyTrackCallback callback, void *context)
+{
+    PagePath path(SPOTIFY_RECENTLY_PLAYED_ENDPOINT);
+    path.add("limit", (int)pageSize);
+    return forEachItem(path, trackItemFilter, NULL, NULL, callback, context);
+}
+
+// Instead of parsing a whole page, the items array is found in the stream
+// and every element is parsed on its own into the arena, which is reused for
+// the next one. After the items only the "next" link is read. fields (if
+// set) goes on every page, the first one must have it already.
+int ArduinoSpotify::forEachItem(const SpotifyQueryWriter &firstPage, const char *filterJson, const char *fields, SpotifyPlaylistCallback playlistCallback, SpotifyTrackCallback trackCallback, void *context)
+{
+    if (firstPage.overflowed())
+    {
+        Serial.println(F("Path too long"));
+        return -1;
+    }
+
+    StaticJsonDocument<SPOTIFY_FILTER_BUFFER_SIZE> filter;
+    if (deserializeJson(filter, FPSTR(filterJson)))
+    {
+        return -1;
+    }
+
+    char path[SPOTIFY_PAGE_PATH_LENGTH];
+    if (!copyField(path, sizeof(path), firstPage.c_str()))
+    {
+        Serial.println(F("Path too long"));
+        return -1;
+    }
+
+    _listBytes = 0;
+    int index = 0;
+    while (path[0] != '\0')
+    {
+#ifdef SPOTIFY_DEBUG
+        Serial.println(path);
+#endif
+
+        if (autoTokenRefresh)
+        {
+            checkAndRefreshAccessToken();
+        }
+
+        int statusCode = makeGetRequest(path, _bearerToken.c_str());
+        if (statusCode != 200)
+        {
+            stopClient();
+            return -1;
+        }
+
+        SpotifyBodyStream &stream = _transport->getStream();
+        if (!findKey(stream, "items") || peekToken(stream) != '[')
+        {
+            Serial.println(F("No items in response"));
+            stopClient();
+            return -1;
+        }
+
+        stream.read();
+        bool more = peekToken(stream) != ']';
+        while (more)
+        {
+            JsonDocument &doc = jsonArena(pageItemBufferSize);
+            DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
+            recordJsonUsage(SPOTIFY_JSON_PAGE_ITEM, error);
+            if (error)
+            {
+                Serial.print(F("deserializeJson() failed with code "));
+                Serial.println(error.c_str());
+                stopClient();
+                return -1;
+            }
+
+            bool keepGoing;
+            if (playlistCallback != NULL)
+            {
+                SpotifyPlaylistFixed playlist;
+                fillPlaylist(doc.as<JsonObject>(), playlist);
+                keepGoing = playlistCallback(playlist, index, context);
+            }
+            else
+            {
+                SpotifyTrackFixed track;
+                fillTrack(doc.as<JsonObject>(), track);
+                keepGoing = trackCallback(track, index, context);
+            }
+            index++;
+
+            if (!keepGoing)
+            {
+                _listBytes += stream.bytesReceived();
+                // Closes the connection if the rest of the page is still on its way
+                stopClient();
+                return index;
+            }
+            more = stream.findUntil(",", "]");
+        }
+
+        path[0] = '\0';
+        if (findKey(stream, "next"))
+        {
+            JsonDocument &doc = jsonArena(pageItemBufferSize);
+            if (!deserializeJson(doc, stream))
+            {
+                const char *next = doc.as<const char *>();
+                const char *prefix = "https://" SPOTIFY_HOST;
+                if (next != NULL && strncmp(next, prefix, strlen(prefix)) == 0)
+                {
+                    SpotifyQueryWriter nextPage(path, sizeof(path), next + strlen(prefix));
+                    if (strstr(next, "fields=") == NULL)
+                    {
+                        // Left out when empty
+                        nextPage.add("fields", fields);
+                    }
+                    if (nextPage.overflowed())
+                    {
+                        Serial.println(F("Next page path too long"));
+                        stopClient();
+                        return -1;
+                    }
+                }
+            }
+        }
+
+        // The rest is a few bytes, reading it keeps the connection usable
+        while (stream.read() >= 0)
+        {
+        }
+        _listBytes += stream.bytesReceived();
+        stopClient();
+    }
+
+    return index;
+}
+
+size_t ArduinoSpotify::getLastListBytes()
+{
+    return _listBytes;
+}
+
+bool ArduinoSpotify::getPlaylistSnapshot(const char *playlistId, char *snapshotId, size_t size)
+{
+    if (strlen(playlistId) >= SPOTIFY_PLAYLIST_ID_LENGTH)
+    {
+        Serial.println(F("Playlist ID too long"));
+        return false;
+    }
+
+    // The rest of the playlist (including its first page of tracks) is left out
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PLAYLIST_ENDPOINT) + SPOTIFY_PLAYLIST_ID_LENGTH - 1,
+                                  spotifyQueryParam("fields", sizeof("snapshot_id") - 1))>
+        path(SPOTIFY_PLAYLIST_ENDPOINT);
+    path.addSegment(playlistId).add("fields", "snapshot_id");
+
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
+    }
+
+    int statusCode = makeGetRequest(path, _bearerToken.c_str());
+    if (statusCode != 200)
+    {
+        stopClient();
+        return false;
+    }
+
+    JsonDocument &doc = jsonArena(pageItemBufferSize);
+    DeserializationError error = deserializeJson(doc, _transport->getStream());
+    recordJsonUsage(SPOTIFY_JSON_PLAYLIST_SNAPSHOT, error);
+    stopClient();
+    if (error)
+    {
+        Serial.print(F("deserializeJson() failed with code "));
+        Serial.println(error.c_str());
+        return false;
+    }
+
+    const char *snapshot = doc["snapshot_id"];
+    return snapshot != NULL && copyField(snapshotId, size, snapshot);
+}
+
+bool ArduinoSpotify::fillPlaylist(JsonObject playlist, SpotifyPlaylistFixed &result)
+{
+    bool complete = copyField(result.id, sizeof(result.id), playlist["id"]);
+    complete &= copyField(result.name, sizeof(result.name), playlist["name"]);
+    complete &= copyField(result.uri, sizeof(result.uri), playlist["uri"]);
+    complete &= copyField(result.ownerName, sizeof(result.ownerName), playlist["owner"]["display_name"]);
+    complete &= copyField(result.snapshotId, sizeof(result.snapshotId), playlist["snapshot_id"]);
+    result.trackCount = playlist["tracks"]["total"].as<int>();
+    result.isPublic = playlist["public"].as<bool>();
+    result.collaborative = playlist["collaborative"].as<bool>();
+    result.truncated = !complete;
+    return complete;
+}
+
+bool ArduinoSpotify::fillTrack(JsonObject item, SpotifyTrackFixed &result)
+{
+    // Removed tracks of a playlist have a null track
+    JsonObject track = item["track"];
+    bool complete = copyField(result.name, sizeof(result.name), track["name"]);
+    complete &= copyField(result.uri, sizeof(result.uri), track["uri"]);
+    complete &= copyField(result.firstArtistName, sizeof(result.firstArtistName), track["artists"][0]["name"]);
+    complete &= copyField(result.firstArtistUri, sizeof(result.firstArtistUri), track["artists"][0]["uri"]);
+    complete &= copyField(result.albumName, sizeof(result.albumName), track["album"]["name"]);
+    complete &= copyField(result.albumUri, sizeof(result.albumUri), track["album"]["uri"]);
+    result.durationMs = track["duration_ms"].as<long>();
+    result.isLocal = track["is_local"].as<bool>();
+    const char *timestamp = item["added_at"];
+    if (timestamp == NULL)
+    {
+        timestamp = item["played_at"];
+    }
+    complete &= copyField(result.timestamp, sizeof(result.timestamp), timestamp);
+    result.truncated = !complete;
+    return complete;
+}
+
+bool ArduinoSpotify::getAudioAnalysis(const char *trackId, SpotifyAudioAnalysis &analysis)
+{
+    // Takes the URI from currentlyPlaying as well
+    if (strncmp(trackId, "spotify:track:", 14) == 0)
+    {
+        trackId += 14;
+    }
+
+    SpotifyQuery<sizeof(SPOTIFY_AUDIO_ANALYSIS_ENDPOINT) + SPOTIFY_TRACK_ID_LENGTH - 1> command(SPOTIFY_AUDIO_ANALYSIS_ENDPOINT);
+    command.addSegment(trackId);
+    if (command.overflowed())
+    {
+        Serial.println(F("Track ID too long"));
+        return false;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.println(command.c_str());
+#endif
+
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
+    }
+
+    analysis.begin();
+    int statusCode = makeGetRequest(command.c_str(), _bearerToken.c_str());
+    if (statusCode != 200)
+    {
+        if (statusCode > 0)
+        {
+            parseError();
+        }
+        stopClient();
+        return false;
+    }
+
+    SpotifyBodyStream &stream = _transport->getStream();
+
+    // The response is a few hundred KB, it only ever passes through this
+    uint8_t buffer[128];
+    unsigned long lastProgress = millis();
+    while (!stream.complete() && !analysis.complete())
+    {
+        size_t read = stream.readAvailable(buffer, sizeof(buffer));
+        if (read > 0)
+        {
+            lastProgress = millis();
+            if (!analysis.feed(buffer, read))
+            {
+                break;
+            }
+        }
+        else if (stream.failed())
+        {
+            break;
+        }
+        else if (millis() - lastProgress > _requestTimeoutMs)
+        {
+            Serial.println(F("Timeout while getting audio analysis"));
+            break;
+        }
+        else
+        {
+            // give the esp a breather
+            yield();
+        }
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Beats: "));
+    Serial.print(analysis.beatCount);
+    Serial.print(F(", bars: "));
+    Serial.print(analysis.barCount);
+    Serial.print(F(", sections: "));
+    Serial.print(analysis.sectionCount);
+    Serial.print(F(", segments: "));
+    Serial.println(analysis.segmentCount);
+#endif
+
+    stopClient();
+
+    if (!analysis.complete())
+    {
+        Serial.println(F("Could not read audio analysis"));
+        return false;
+    }
+    return true;
+}
+
+int ArduinoSpotify::requestImage(char *imageUrl)
+{
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Parsing image URL: "));
+    Serial.println(imageUrl);
+#endif
+
+    uint8_t lengthOfString = strlen(imageUrl);
+
+    // We are going to just assume https, that's all I've
+    // seen and I can't imagine a company will go back
+    // to http
+
+    if (strncmp(imageUrl, "https://", 8) != 0)
+    {
+        Serial.print(F("Url not in expected format: "));
+        Serial.println(imageUrl);
+        Serial.println("(expected it to start with \"https://\")");
+        return -1;
+    }
+
+    uint8_t protocolLength = 8;
+
+    char *pathStart = strchr(imageUrl + protocolLength, '/');
+    uint8_t pathIndex = pathStart - imageUrl;
+    uint8_t pathLength = lengthOfString - pathIndex;
+    char path[pathLength + 1];
+    strncpy(path, pathStart, pathLength);
+    path[pathLength] = '\0';
+
+    uint8_t hostLength = pathIndex - protocolLength;
+    char host[hostLength + 1];
+    strncpy(host, imageUrl + protocolLength, hostLength);
+    host[hostLength] = '\0';
+
+#ifdef SPOTIFY_DEBUG
+
+    Serial.print(F("host: "));
+    Serial.println(host);
+
+    Serial.print(F("len:host:"));
+    Serial.println(hostLength);
+
+    Serial.print(F("path: "));
+    Serial.println(path);
+
+    Serial.print(F("len:path: "));
+    Serial.println(strlen(path));
+#endif
+
+    int statusCode = makeGetRequest(path, NULL, "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8", host);
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("statusCode: "));
+    Serial.println(statusCode);
+#endif
+    return statusCode;
+}
+
+static bool writeImageToStream(const uint8_t *data, size_t length, size_t received, long contentLength, void *context)
+{
+    return ((Stream *)context)->write(data, length) == length;
+}
+
+bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
+{
+    return getImage(imageUrl, writeImageToStream, file);
+}
+
+bool ArduinoSpotify::getImage(char *imageUrl, SpotifyImageCallback callback, void *context, uint8_t *buffer, size_t bufferSize)
+{
+    if (buffer == NULL)
+    {
+        if (_imageBuffer == NULL)
+        {
+            _imageBuffer = (uint8_t *)malloc(imageChunkSize);
+            if (_imageBuffer == NULL)
+            {
+                Serial.println(F("Could not allocate image buffer"));
+                return false;
+            }
+        }
+        buffer = _imageBuffer;
+        bufferSize = imageChunkSize;
+    }
+
+    int statusCode = requestImage(imageUrl);
+    if (statusCode != 200)
+    {
+        stopClient();
+        return false;
+    }
+
+    long contentLength = _transport->getSize();
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("file length: "));
+    Serial.println(contentLength);
+#endif
+
+    SpotifyBodyStream &stream = _transport->getStream();
+
+    size_t received = 0;
+    size_t filled = 0;
+    bool stopped = false;
+    unsigned long lastProgress = millis();
+    while (!stream.complete())
+    {
+        size_t read = stream.readAvailable(buffer + filled, bufferSize - filled);
+        if (read > 0)
+        {
+            filled += read;
+            received += read;
+            lastProgress = millis();
+            if (filled == bufferSize)
+            {
+                stopped = !callback(buffer, filled, received, contentLength, context);
+                filled = 0;
+                if (stopped)
+                {
+                    break;
+                }
+            }
+        }
+        else if (stream.failed())
+        {
+            break;
+        }
+        else if (millis() - lastProgress > _requestTimeoutMs)
+        {
+            Serial.println(F("Timeout while getting image"));
+            break;
+        }
+        else
+        {
+            // give the esp a breather
+            yield();
+        }
+    }
+
+    // Without a length the image ends with the connection
+    bool complete = stream.complete();
+    if (filled > 0 && !stopped)
+    {
+        stopped = !callback(buffer, filled, received, contentLength, context);
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Finished getting image, bytes: "));
+    Serial.println(received);
+#endif
+
+    // Closes the connection if the rest of the image is still on its way
+    stopClient();
+
+    return complete && !stopped;
+}
+
+void ArduinoSpotify::initAsync()
+{
+    _asyncQueueLength = 0;
+    _asyncState = SPOTIFY_ASYNC_IDLE;
+    _asyncNextHandle = 1;
+    _asyncConnection = NULL;
+    _asyncBuffer = NULL;
+    _asyncTimeoutMs = SPOTIFY_TIMEOUT;
+    _asyncSentAt = 0;
+}
+
+int ArduinoSpotify::queueAsync(SpotifyRequestType type, const char *method, const SpotifyQueryWriter &command, const char *body, SpotifyAsyncCallback callback,
+                               SpotifyPlayerChange change, long changeValue)
+{
+    if (_asyncQueueLength >= SPOTIFY_ASYNC_QUEUE_SIZE)
+    {
+        Serial.println(F("Async queue is full"));
+        return -1;
+    }
+    if (command.overflowed() || command.length() >= SPOTIFY_MAX_PATH_LENGTH)
+    {
+        Serial.println(F("Async command too long"));
+        return -1;
+    }
+
+    SpotifyAsyncRequest request;
+    request.handle = _asyncNextHandle++;
+    if (_asyncNextHandle <= 0)
+    {
+        _asyncNextHandle = 1;
+    }
+    request.type = type;
+    request.method = method;
+    request.host = SPOTIFY_HOST;
+    strcpy(request.path, command.c_str());
+    request.body = body;
+    request.callback = callback;
+    request.queuedAt = millis();
+    request.change = change;
+    request.changeValue = changeValue;
+    request.attempts = 0;
+
+    if (type == SPOTIFY_REQUEST_PLAYER_CONTROL && preemptPolls)
+    {
+        insertAsync(request);
+        preemptAsync();
+    }
+    else
+    {
+        _asyncQueue[_asyncQueueLength++] = request;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Queued async request: "));
+    Serial.println(command.c_str());
+#endif
+
+    return request.handle;
+}
+
+// Puts a request behind the player commands at the front of the queue
+// (but ahead of the polls), the caller checks there is room
+bool ArduinoSpotify::insertAsync(const SpotifyAsyncRequest &request)
+{
+    if (_asyncQueueLength >= SPOTIFY_ASYNC_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    uint8_t index = 0;
+    while (index < _asyncQueueLength && _asyncQueue[index].type == SPOTIFY_REQUEST_PLAYER_CONTROL)
+    {
+        index++;
+    }
+    memmove(&_asyncQueue[index + 1], &_asyncQueue[index], (_asyncQueueLength - index) * sizeof(SpotifyAsyncRequest));
+    _asyncQueue[index] = request;
+    _asyncQueueLength++;
+    return true;
+}
+
+// Cuts the async poll in flight short so a player command doesn't have to
+// wait for its response. Returns true if there was one.
+bool ArduinoSpotify::preemptAsync()
+{
+    // Commands and token refreshes are finished, a poll that is being parsed
+    // is done in a moment (and might be the one calling us from its callback)
+    if (!preemptPolls || _asyncState == SPOTIFY_ASYNC_IDLE || _asyncState == SPOTIFY_ASYNC_PARSE ||
+        _asyncRequest.type == SPOTIFY_REQUEST_PLAYER_CONTROL || _asyncRequest.type == SPOTIFY_REQUEST_TOKEN)
+    {
+        return false;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Preempting async request: "));
+    Serial.println(_asyncRequest.path);
+#endif
+
+    if (_asyncConnection != NULL)
+    {
+        if (_asyncState != SPOTIFY_ASYNC_SEND)
+        {
+            // The rest of the response is still on its way
+            _asyncConnection->client->stop();
+        }
+        _asyncConnection->busy = false;
+        _asyncConnection = NULL;
+    }
+    // Its timings would only be partial
+    _asyncMetricsActive = false;
+    _connectionStats.preemptions++;
+
+    if (!insertAsync(_asyncRequest))
+    {
+        finishAsync(SPOTIFY_PREEMPTED);
+        return true;
+    }
+    _asyncState = SPOTIFY_ASYNC_IDLE;
+    return true;
+}
+
+// Puts a GET that failed on the way back into the queue, to be sent again
+// after a backoff (see SpotifyTimeoutPolicy). Its callback is only called
+// once it succeeded or ran out of retries.
+bool ArduinoSpotify::retryAsyncLater(int statusCode)
+{
+    if (_asyncQueueLength >= SPOTIFY_ASYNC_QUEUE_SIZE ||
+        !timeoutPolicy.shouldRetry(_asyncRequest.method, statusCode, _asyncRequest.attempts + 1))
+    {
+        return false;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Async request failed with "));
+    Serial.print(statusCode);
+    Serial.println(F(", queued again"));
+#endif
+
+    if (_asyncConnection != NULL)
+    {
+        if (!keepAlive || !_asyncResponse.keepAlive || !_asyncResponse.bodyComplete())
+        {
+            _asyncConnection->client->stop();
+        }
+        _asyncConnection->busy = false;
+        _asyncConnection = NULL;
+    }
+    // Only the attempt that gets a response is recorded
+    _asyncMetricsActive = false;
+
+    _asyncRequest.attempts++;
+    _asyncRequest.retryAt = millis() + timeoutPolicy.backoffMs(_asyncRequest.attempts);
+    insertAsync(_asyncRequest);
+    _asyncState = SPOTIFY_ASYNC_IDLE;
+    return true;
+}
+
+int ArduinoSpotify::getCurrentlyPlayingAsync(SpotifyAsyncCallback callback, const char *market)
+{
+    CurrentlyPlayingPath command(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT);
+    command.add("market", market);
+    return queueAsync(SPOTIFY_REQUEST_CURRENTLY_PLAYING, "GET", command, NULL, callback);
+}
+
+int ArduinoSpotify::getPlayerDetailsAsync(SpotifyAsyncCallback callback, const char *market)
+{
+    PlayerPath command(SPOTIFY_PLAYER_ENDPOINT);
+    command.add("market", market);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_DETAILS, "GET", command, NULL, callback);
+}
+
+int ArduinoSpotify::playAsync(SpotifyAsyncCallback callback, const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PLAY_ENDPOINT), deviceIdParam)> command(SPOTIFY_PLAY_ENDPOINT);
+    command.add("device_id", deviceId);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_CONTROL, "PUT", command, "", callback, SPOTIFY_CHANGE_PLAY);
+}
+
+int ArduinoSpotify::pauseAsync(SpotifyAsyncCallback callback, const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PAUSE_ENDPOINT), deviceIdParam)> command(SPOTIFY_PAUSE_ENDPOINT);
+    command.add("device_id", deviceId);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_CONTROL, "PUT", command, "", callback, SPOTIFY_CHANGE_PAUSE);
+}
+
+int ArduinoSpotify::setVolumeAsync(int volume, SpotifyAsyncCallback callback, const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_VOLUME_PATH),
+                                  spotifyQueryParam("volume_percent", SPOTIFY_INT_PARAM_LENGTH),
+                                  deviceIdParam)>
+        command(SPOTIFY_VOLUME_PATH);
+    command.add("volume_percent", volume).add("device_id", deviceId);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_CONTROL, "PUT", command, "", callback, SPOTIFY_CHANGE_VOLUME, volume);
+}
+
+int ArduinoSpotify::nextTrackAsync(SpotifyAsyncCallback callback, const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_NEXT_TRACK_ENDPOINT), deviceIdParam)> command(SPOTIFY_NEXT_TRACK_ENDPOINT);
+    command.add("device_id", deviceId);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_CONTROL, "POST", command, "", callback, SPOTIFY_CHANGE_TRACK);
+}
+
+int ArduinoSpotify::previousTrackAsync(SpotifyAsyncCallback callback, const char *deviceId)
+{
+    SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_PREVIOUS_TRACK_ENDPOINT), deviceIdParam)> command(SPOTIFY_PREVIOUS_TRACK_ENDPOINT);
+    command.add("device_id", deviceId);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_CONTROL, "POST", command, "", callback, SPOTIFY_CHANGE_TRACK);
+}
+
+int ArduinoSpotify::playerControlAsync(char *command, SpotifyAsyncCallback callback, const char *deviceId, const char *body)
+{
+    SpotifyQuery<SPOTIFY_MAX_PATH_LENGTH> path(command);
+    path.add("device_id", deviceId);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_CONTROL, "PUT", path, body, callback);
+}
+
+int ArduinoSpotify::playerNavigateAsync(char *command, SpotifyAsyncCallback callback, const char *deviceId)
+{
+    SpotifyQuery<SPOTIFY_MAX_PATH_LENGTH> path(command);
+    path.add("device_id", deviceId);
+    return queueAsync(SPOTIFY_REQUEST_PLAYER_CONTROL, "POST", path, "", callback);
+}
+
+bool ArduinoSpotify::poll()
+{
+    unsigned long sliceStart = millis();
+    while (stepAsync() && millis() - sliceStart < asyncSliceMs)
+    {
+        // give the esp a breather
+        yield();
+    }
+    return _asyncState != SPOTIFY_ASYNC_IDLE || _asyncQueueLength > 0;
+}
+
+// Does one step of the request in flight, returns false if there is
+// nothing to do until more data arrives
+bool ArduinoSpotify::stepAsync()
+{
+    switch (_asyncState)
+    {
+    case SPOTIFY_ASYNC_IDLE:
+        return startAsync();
+    case SPOTIFY_ASYNC_CONNECT:
+        return connectAsync();
+    case SPOTIFY_ASYNC_SEND:
+        return sendAsync();
+    case SPOTIFY_ASYNC_HEADERS:
+        return readAsyncHeaders();
+    case SPOTIFY_ASYNC_BODY:
+        return readAsyncBody();
+    case SPOTIFY_ASYNC_PARSE:
+        parseAsync();
+        return true;
+    }
+    return false;
+}
+
+bool ArduinoSpotify::startAsync()
+{
+    unsigned long timeSinceLastRefresh = millis() - _timeTokenRefreshed;
+    bool canRefresh = autoTokenRefresh && _refreshToken[0] != '\0' &&
+                      (!_tokenRefreshAttempted || millis() - _lastTokenRefreshAttempt >= SPOTIFY_TOKEN_RETRY_MS);
+    bool tokenDue = timeSinceLastRefresh >= _tokenTimeToLiveMs;
+    // Nothing else to do, so refresh ahead of time
+    bool tokenDueSoon = _asyncQueueLength == 0 && timeSinceLastRefresh + tokenRefreshMarginMs >= _tokenTimeToLiveMs;
+    bool refreshToken = canRefresh && (tokenDue || tokenDueSoon);
+
+    if (_asyncQueueLength == 0 && !refreshToken)
+    {
+        return false;
+    }
+
+    // Queued requests all go to api.spotify.com
+    uint8_t next = 0;
+    bool refused = false;
+    if (!refreshToken)
+    {
+        if (rateLimiter.backoffRemainingMs() > 0)
+        {
+            // Counts the refused request
+            refused = !rateLimiter.acquire(asyncPriority(_asyncQueue[0]));
+        }
+        else
+        {
+            // Player commands can overtake polls while there are only tokens left
+            // for them, and everything can overtake a retry that has to wait
+            while (next < _asyncQueueLength &&
+                   (!asyncDue(_asyncQueue[next]) || !rateLimiter.canSend(asyncPriority(_asyncQueue[next]))))
+            {
+                next++;
+            }
+            if (next == _asyncQueueLength)
+            {
+                return false;
+            }
+            rateLimiter.acquire(asyncPriority(_asyncQueue[next]));
+        }
+    }
+
+    if (_asyncBuffer == NULL)
+    {
+        _asyncBuffer = (char *)malloc(asyncBufferSize);
+        if (_asyncBuffer == NULL)
+        {
+            Serial.println(F("Could not allocate async buffer"));
+            return false;
+        }
+    }
+
+    if (refreshToken)
+    {
+        // Refresh the token first, the queued request stays where it is
+        _tokenRefreshAttempted = true;
+        _lastTokenRefreshAttempt = millis();
+        _asyncRequest.handle = 0;
+        _asyncRequest.type = SPOTIFY_REQUEST_TOKEN;
+        _asyncRequest.method = "POST";
+        _asyncRequest.host = SPOTIFY_ACCOUNTS_HOST;
+        strcpy(_asyncRequest.path, SPOTIFY_TOKEN_ENDPOINT);
+        _asyncRequest.body = NULL;
+        _asyncRequest.callback = NULL;
+        _asyncRequest.queuedAt = millis();
+        _asyncRequest.change = SPOTIFY_CHANGE_NONE;
+        _asyncRequest.attempts = 0;
+    }
+    else
+    {
+        _asyncRequest = _asyncQueue[next];
+        _asyncQueueLength--;
+        memmove(&_asyncQueue[next], &_asyncQueue[next + 1], (_asyncQueueLength - next) * sizeof(SpotifyAsyncRequest));
+    }
+
+    _asyncResponse.reset();
+    _asyncRetried = false;
+    _asyncTimeoutMs = timeoutPolicy.timeoutFor(_asyncRequest.method, _asyncRequest.host, _asyncRequest.path);
+    if (refused)
+    {
+        // Backing off after a 429, sending it would only make that longer
+        finishAsync(SPOTIFY_RATE_LIMITED);
+        return true;
+    }
+    _asyncState = SPOTIFY_ASYNC_CONNECT;
+    if (_metrics != NULL)
+    {
+        beginMetrics(_asyncMetrics, _asyncRequest.host, _asyncRequest.path);
+        _asyncMetrics.async = true;
+        _asyncMetricsActive = true;
+        _asyncStart = millis();
+        _asyncPhaseStart = _asyncStart;
+    }
+    return true;
+}
+
+bool ArduinoSpotify::connectAsync()
+{
+    SpotifyConnection *connection = acquireConnection(_asyncRequest.host);
+    if (connection == NULL)
+    {
+        finishAsync(HTTPC_ERROR_CONNECTION_REFUSED);
+        return true;
+    }
+
+    if (!_connectionReused)
+    {
+        // This is the only step that blocks (up to the client's timeout),
+        // the TLS handshake can't be split up.
+        bool connected = connection->client->connect(_asyncRequest.host, SPOTIFY_PORT);
+        asyncPhaseDone(SPOTIFY_PHASE_CONNECT);
+        if (!connected)
+        {
+            Serial.println(F("Connection failed"));
+            if (!retryAsyncLater(HTTPC_ERROR_CONNECTION_REFUSED))
+            {
+                finishAsync(HTTPC_ERROR_CONNECTION_REFUSED);
+            }
+            return true;
+        }
+    }
+    _asyncMetrics.reused = _connectionReused;
+
+    connection->busy = true;
+    _asyncConnection = connection;
+    _asyncState = SPOTIFY_ASYNC_SEND;
+    return true;
+}
+
+bool ArduinoSpotify::sendAsync()
+{
+    const char *body = _asyncRequest.body;
+    char *header = _asyncBuffer;
+    size_t headerSize = asyncBufferSize;
+
+    if (_asyncRequest.type == SPOTIFY_REQUEST_TOKEN)
+    {
+        // The body goes to the start of the buffer, the headers after it
+        SpotifyQueryWriter tokenBody(_asyncBuffer, asyncBufferSize);
+        writeRefreshBody(tokenBody);
+        if (tokenBody.overflowed())
+        {
+            Serial.println(F("Async request too large"));
+            finishAsync(HTTPC_ERROR_TOO_LESS_RAM);
+            return true;
+        }
+        body = _asyncBuffer;
+        header = _asyncBuffer + tokenBody.length() + 1;
+        headerSize = asyncBufferSize - tokenBody.length() - 1;
+    }
+
+    size_t bodyLength = (body != NULL) ? strlen(body) : 0;
+    bool token = _asyncRequest.type == SPOTIFY_REQUEST_TOKEN;
+    const char *contentType = NULL;
+    if (body != NULL)
+    {
+        contentType = token ? "application/x-www-form-urlencoded" : "application/json";
+    }
+    int headerLength = SpotifyLeanTransport::formatRequest(header, headerSize, _asyncRequest.host, _asyncRequest.method,
+                                                           _asyncRequest.path, "application/json", contentType,
+                                                           token ? NULL : _bearerToken.c_str(),
+                                                           (body != NULL) ? (long)bodyLength : -1, keepAlive);
+    if (headerLength < 0)
+    {
+        Serial.println(F("Async request too large"));
+        finishAsync(HTTPC_ERROR_TOO_LESS_RAM);
+        return true;
+    }
+
+    WiFiClient *client = _asyncConnection->client;
+    bool sent = client->write((const uint8_t *)header, headerLength) == (size_t)headerLength;
+    if (sent && bodyLength > 0)
+    {
+        sent = client->write((const uint8_t *)body, bodyLength) == bodyLength;
+    }
+    if (!sent)
+    {
+        if (!retryAsync(false))
+        {
+            finishAsync(HTTPC_ERROR_SEND_HEADER_FAILED);
+        }
+        return true;
+    }
+
+    _asyncMetrics.bytesSent += headerLength + bodyLength;
+    asyncPhaseDone(SPOTIFY_PHASE_SEND);
+    _asyncResponse.reset(true);
+    _asyncLastProgress = millis();
+    _asyncSentAt = _asyncLastProgress;
+    _asyncState = SPOTIFY_ASYNC_HEADERS;
+    return true;
+}
+
+// A kept-alive connection might have been closed by the server since the last
+// request, try once more on a new connection (see shouldReconnect())
+bool ArduinoSpotify::retryAsync(bool requestSent)
+{
+    if (!_connectionReused || _asyncRetried || _asyncResponse.bytesReceived > 0)
+    {
+        return false;
+    }
+    if (requestSent && strcmp(_asyncRequest.method, "GET") != 0)
+    {
+        return false;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.println(F("Kept-alive connection was closed, reconnecting"));
+#endif
+    _asyncConnection->client->stop();
+    _asyncConnection->busy = false;
+    _asyncConnection = NULL;
+    _connectionStats.reconnects++;
+    _asyncRetried = true;
+    _asyncState = SPOTIFY_ASYNC_CONNECT;
+    return true;
+}
+
+bool ArduinoSpotify::readAsyncHeaders()
+{
+    WiFiClient *client = _asyncConnection->client;
+    size_t received = _asyncResponse.bytesReceived;
+    if (_asyncResponse.readHeaders(*client))
+    {
+        asyncPhaseDone(SPOTIFY_PHASE_WAIT);
+        timeoutPolicy.record(_asyncRequest.method, _asyncRequest.host, _asyncRequest.path, millis() - _asyncSentAt);
+        if (_asyncRequest.type != SPOTIFY_REQUEST_TOKEN)
+        {
+            if (_asyncResponse.statusCode == 429)
+            {
+                rateLimiter.rateLimited(_asyncResponse.retryAfter);
+            }
+            else
+            {
+                rateLimiter.succeeded();
+            }
+        }
+        _asyncBodyLength = 0;
+        _asyncOverflow = false;
+        _asyncState = SPOTIFY_ASYNC_BODY;
+        return true;
+    }
+
+    if (_asyncResponse.bytesReceived != received)
+    {
+        _asyncLastProgress = millis();
+    }
+    else if (!client->connected())
+    {
+        if (!retryAsync(true) && !retryAsyncLater(HTTPC_ERROR_CONNECTION_LOST))
+        {
+            finishAsync(HTTPC_ERROR_CONNECTION_LOST);
+        }
+        return true;
+    }
+    else if (millis() - _asyncLastProgress > _asyncTimeoutMs)
+    {
+        timeoutPolicy.recordTimeout(_asyncRequest.method, _asyncRequest.host, _asyncRequest.path, _asyncTimeoutMs);
+        if (!retryAsyncLater(HTTPC_ERROR_READ_TIMEOUT))
+        {
+            finishAsync(HTTPC_ERROR_READ_TIMEOUT);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool ArduinoSpotify::readAsyncBody()
+{
+    WiFiClient *client = _asyncConnection->client;
+    size_t read;
+    if (_asyncBodyLength < (size_t)asyncBufferSize - 1)
+    {
+        read = _asyncResponse.readBody(*client, (uint8_t *)_asyncBuffer + _asyncBodyLength, asyncBufferSize - 1 - _asyncBodyLength);
+        _asyncBodyLength += read;
+    }
+    else
+    {
+        // Keep reading so the connection can be reused, but drop the data
+        uint8_t discard[64];
+        read = _asyncResponse.readBody(*client, discard, sizeof(discard));
+        if (read > 0 && !_asyncOverflow)
+        {
+            Serial.println(F("Async response is larger than asyncBufferSize"));
+            _asyncOverflow = true;
+        }
+    }
+
+    if (_asyncResponse.bodyComplete())
+    {
+        asyncPhaseDone(SPOTIFY_PHASE_BODY);
+        _asyncBuffer[_asyncBodyLength] = '\0';
+        _asyncState = SPOTIFY_ASYNC_PARSE;
+        return true;
+    }
+
+    if (read > 0)
+    {
+        _asyncLastProgress = millis();
+        return true;
+    }
+
+    if (!client->connected() && client->available() <= 0)
+    {
+        if (_asyncResponse.contentLength < 0 && !_asyncResponse.chunked)
+        {
+            // The end of the connection is the end of the body
+            asyncPhaseDone(SPOTIFY_PHASE_BODY);
+            _asyncBuffer[_asyncBodyLength] = '\0';
+            _asyncState = SPOTIFY_ASYNC_PARSE;
+        }
+        else if (!retryAsyncLater(HTTPC_ERROR_CONNECTION_LOST))
+        {
+            finishAsync(HTTPC_ERROR_CONNECTION_LOST);
+        }
+        return true;
+    }
+
+    if (millis() - _asyncLastProgress > _asyncTimeoutMs)
+    {
+        if (!retryAsyncLater(HTTPC_ERROR_READ_TIMEOUT))
+        {
+            finishAsync(HTTPC_ERROR_READ_TIMEOUT);
+        }
+        return true;
+    }
+    return false;
+}
+
+void ArduinoSpotify::parseAsync()
+{
+    int statusCode = _asyncResponse.statusCode;
+    if (retryAsyncLater(statusCode))
+    {
+        // 5xx
+        return;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Async status code: "));
+    Serial.println(statusCode);
+#endif
+
+    SpotifyAsyncResult result;
+    result.handle = _asyncRequest.handle;
+    result.type = _asyncRequest.type;
+    result.statusCode = statusCode;
+    result.error = true;
+    result.currentlyPlaying = NULL;
+    result.playerDetails = NULL;
+    // Filled here, passed to the callback once the request is done
+    CurrentlyPlaying currentlyPlaying;
+    currentlyPlaying.error = true;
+    PlayerDetails playerDetails;
+    playerDetails.error = true;
+
+    if (_asyncRequest.type == SPOTIFY_REQUEST_PLAYER_CONTROL)
+    {
+        //Will return 204 if all went well.
+        result.error = (statusCode != 204);
+        if (!result.error)
+        {
+            applyPlayerChange(_asyncRequest.change, _asyncRequest.changeValue);
+        }
+    }
+    else if (statusCode == 200 && !_asyncOverflow)
+    {
+        DeserializationError error;
+        if (_asyncRequest.type == SPOTIFY_REQUEST_TOKEN)
+        {
+            JsonDocument &doc = jsonArena(1000);
+            error = deserializeJson(doc, _asyncBuffer, _asyncBodyLength);
+            recordJsonUsage(SPOTIFY_JSON_TOKEN, error);
+            asyncPhaseDone(SPOTIFY_PHASE_PARSE);
+            if (!error)
+            {
+                storeAccessToken(doc, millis());
+                result.error = false;
+            }
+        }
+        else
+        {
+            bool wantsCurrentlyPlaying = _asyncRequest.type != SPOTIFY_REQUEST_PLAYER_DETAILS;
+            bool wantsPlayerDetails = _asyncRequest.type != SPOTIFY_REQUEST_CURRENTLY_PLAYING;
+
+            size_t bufferSize;
+            const char *filter;
+            SpotifyJsonEndpoint jsonEndpoint;
+            if (_asyncRequest.type == SPOTIFY_REQUEST_CURRENTLY_PLAYING)
+            {
+                bufferSize = filterResponses ? currentlyPlayingFilteredBufferSize : currentlyPlayingBufferSize;
+                filter = currentlyPlayingFilter;
+                jsonEndpoint = SPOTIFY_JSON_CURRENTLY_PLAYING;
+            }
+            else if (_asyncRequest.type == SPOTIFY_REQUEST_PLAYER_DETAILS)
+            {
+                bufferSize = filterResponses ? playerDetailsFilteredBufferSize : playerDetailsBufferSize;
+                filter = playerDetailsFilter;
+                jsonEndpoint = SPOTIFY_JSON_PLAYER_DETAILS;
+            }
+            else
+            {
+                bufferSize = filterResponses ? playerStateFilteredBufferSize : playerStateBufferSize;
+                filter = playerStateFilter;
+                jsonEndpoint = SPOTIFY_JSON_PLAYER_STATE;
+            }
+
+            JsonDocument &doc = jsonArena(bufferSize);
+            if (filterResponses)
+            {
+                error = deserializeFiltered(doc, filter, _asyncBuffer, _asyncBodyLength);
+            }
+            else
+            {
+                error = deserializeJson(doc, _asyncBuffer, _asyncBodyLength);
+            }
+            recordJsonUsage(jsonEndpoint, error);
+            asyncPhaseDone(SPOTIFY_PHASE_PARSE);
+            if (!error)
+            {
+                if (wantsCurrentlyPlaying)
+                {
+                    fillCurrentlyPlaying(doc, currentlyPlaying);
+                    result.currentlyPlaying = &currentlyPlaying;
+                }
+                if (wantsPlayerDetails)
+                {
+                    fillPlayerDetails(doc, playerDetails);
+                    result.playerDetails = &playerDetails;
+                }
+                result.error = false;
+            }
+        }
+
+        if (error)
+        {
+            Serial.print(F("deserializeJson() failed with code "));
+            Serial.println(error.c_str());
+        }
+    }
+
+    finishAsync(statusCode, &result);
+}
+
+void ArduinoSpotify::finishAsync(int statusCode, const SpotifyAsyncResult *result)
+{
+    // The request is done before its callback is called: a player command sent
+    // from the callback must not find it in flight and preempt it (so it
+    // would be sent a second time), nor find its connection still busy.
+    SpotifyAsyncCallback callback = _asyncRequest.callback;
+    _asyncRequest.callback = NULL;
+
+    if (_asyncConnection != NULL)
+    {
+        if (!keepAlive || !_asyncResponse.keepAlive || !_asyncResponse.bodyComplete())
+        {
+            _asyncConnection->client->stop();
+        }
+        _asyncConnection->busy = false;
+        _asyncConnection = NULL;
+    }
+    _asyncState = SPOTIFY_ASYNC_IDLE;
+
+    if (_asyncMetricsActive)
+    {
+        _asyncMetricsActive = false;
+        if (_asyncRequest.type == SPOTIFY_REQUEST_PLAYER_CONTROL)
+        {
+            _asyncMetrics.phaseMs[SPOTIFY_PHASE_COMMAND] = millis() - _asyncRequest.queuedAt;
+        }
+        _asyncMetrics.statusCode = statusCode;
+        _asyncMetrics.bytesReceived = _asyncResponse.bytesReceived;
+        _asyncMetrics.phaseMs[SPOTIFY_PHASE_TOTAL] = millis() - _asyncStart;
+        _asyncMetrics.heapAfter = ESP.getFreeHeap();
+        _metrics->record(_asyncMetrics);
+    }
+
+    if (callback != NULL && result != NULL)
+    {
+        callback(*result);
+    }
+    else if (callback != NULL)
+    {
+        // Failed before there was a response
+        SpotifyAsyncResult failed;
+        failed.handle = _asyncRequest.handle;
+        failed.type = _asyncRequest.type;
+        failed.statusCode = statusCode;
+        failed.error = true;
+        failed.currentlyPlaying = NULL;
+        failed.playerDetails = NULL;
+        callback(failed);
+    }
+}
+
+SpotifyPriority ArduinoSpotify::asyncPriority(const SpotifyAsyncRequest &request)
+{
+    return (request.type == SPOTIFY_REQUEST_PLAYER_CONTROL) ? SPOTIFY_PRIORITY_USER : SPOTIFY_PRIORITY_BACKGROUND;
+}
+
+void ArduinoSpotify::asyncPhaseDone(SpotifyMetricsPhase phase)
+{
+    if (_asyncMetricsActive)
+    {
+        unsigned long now = millis();
+        _asyncMetrics.phaseMs[phase] += now - _asyncPhaseStart;
+        _asyncPhaseStart = now;
+    }
+}
+
+void ArduinoSpotify::parseError()
+{
+    JsonDocument &doc = jsonArena(1000);
+    DeserializationError error = deserializeJson(doc, _transport->getStream());
+    recordJsonUsage(SPOTIFY_JSON_ERROR, error);
+    if (!error)
+    {
+        Serial.println(F("getAuthToken error"));
+        serializeJson(doc, Serial);
+    }
+    else
+    {
+        Serial.println(F("Could not parse error"));
+    }
+}
+
+void ArduinoSpotify::setJsonArena(JsonDocument &doc)
+{
+    delete _ownedJsonArena;
+    _ownedJsonArena = NULL;
+    _jsonArena = &doc;
+}
+
+JsonDocument &ArduinoSpotify::jsonArena(size_t size)
+{
+    // Responses that don't fit fail with NoMemory and are counted in
+    // getJsonUsage()
+    if (_jsonArena != NULL && (_ownedJsonArena == NULL || jsonArenaSize > 0 || _jsonArena->capacity() >= size))
+    {
+        return *_jsonArena;
+    }
+
+    if (jsonArenaSize > 0)
+    {
+        size = jsonArenaSize;
+    }
+    else if (_jsonArena == NULL)
+    {
+        // Large enough for every filtered call (1000 is what token and
+        // error responses use), so most sketches never re-allocate it
+        size = max(size, (size_t)1000);
+        size = max(size, (size_t)devicesFilteredBufferSize);
+        size = max(size, (size_t)currentlyPlayingFilteredBufferSize);
+        size = max(size, (size_t)playerDetailsFilteredBufferSize);
+        size = max(size, (size_t)playerStateFilteredBufferSize);
+        size = max(size, (size_t)fixedBufferSize);
+        size = max(size, (size_t)pageItemBufferSize);
+    }
+    else
+    {
+        // The first unfiltered call: grow once, to what all of them need
+        size = max(size, (size_t)deviceBufferSize);
+        size = max(size, (size_t)currentlyPlayingBufferSize);
+        size = max(size, (size_t)playerDetailsBufferSize);
+        size = max(size, (size_t)playerStateBufferSize);
+        // Freed first, so the new one can take its place in the heap
+        delete _ownedJsonArena;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Allocating JSON arena: "));
+    Serial.println(size);
+#endif
+
+    _ownedJsonArena = new DynamicJsonDocument(size);
+    _jsonArena = _ownedJsonArena;
+    return *_jsonArena;
+}
+
+void ArduinoSpotify::recordJsonUsage(SpotifyJsonEndpoint endpoint, DeserializationError error)
+{
+    if (_requestMetricsActive)
+    {
+        _parseEnd = millis();
+    }
+
+    SpotifyJsonUsage *usage = &_jsonUsage[endpoint];
+    if (_jsonArena->memoryUsage() > usage->highWaterMark)
+    {
+        usage->highWaterMark = _jsonArena->memoryUsage();
+    }
+    if (error == DeserializationError::NoMemory)
+    {
+        usage->overflows++;
+        Serial.print(F("JSON arena too small, capacity: "));
+        Serial.println(_jsonArena->capacity());
+    }
+}
+
+const SpotifyJsonUsage &ArduinoSpotify::getJsonUsage(SpotifyJsonEndpoint endpoint)
+{
+    return _jsonUsage[endpoint];
+}
+
+void ArduinoSpotify::resetJsonUsage()
+{
+    for (uint8_t i = 0; i < SPOTIFY_JSON_ENDPOINTS; i++)
+    {
+        _jsonUsage[i].highWaterMark = 0;
+        _jsonUsage[i].overflows = 0;
+    }
+}
+
+void ArduinoSpotify::stopClient()
+{
+#ifdef SPOTIFY_DEBUG
         Serial.println(F("Closing client"));
 #endif
-        _http->end();
+        if (_requestMetricsActive)
+        {
+            finishRequestMetrics();
+        }
+        // With keepAlive the transport leaves the connection open
+        // if the server allows it
+        _transport->end();
+        if (_requestMetricsActive)
+        {
+            _requestMetricsActive = false;
+            _requestMetrics.heapAfter = ESP.getFreeHeap();
+            _metrics->record(_requestMetrics);
+        }
 }
\ No newline at end of file
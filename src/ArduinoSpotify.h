@@ -31,18 +31,21 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <WiFiClient.h>
-#if defined(ESP32)
-#include <HTTPClient.h>
-#elif defined(ESP8266)
-#include <ESP8266HTTPClient.h>
-#endif
+#include "SpotifyHttpResponse.h"
+#include "SpotifyTransport.h"
+#include "SpotifyTokenStore.h"
+#include "SpotifyMetrics.h"
+#include "SpotifyRateLimiter.h"
+#include "SpotifyTimeoutPolicy.h"
+#include "SpotifyQuery.h"
+#include "SpotifyAudioAnalysis.h"
+#include <time.h>
 
 #define SPOTIFY_HOST "api.spotify.com"
 #define SPOTIFY_ACCOUNTS_HOST "accounts.spotify.com"
 #define SPOTIFY_PORT 443
 // Fingerprint correct as of July 23rd, 2020
 #define SPOTIFY_FINGERPRINT "B9 79 6B CE FD 61 21 97 A7 02 90 EE DA CD F0 A0 44 13 0E EB"
-#define SPOTIFY_TIMEOUT 2000
 
 #define SPOTIFY_CURRENTLY_PLAYING_ENDPOINT "/v1/me/player/currently-playing"
 
@@ -50,9 +53,14 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #define SPOTIFY_PLAY_ENDPOINT "/v1/me/player/play"
 #define SPOTIFY_PAUSE_ENDPOINT "/v1/me/player/pause"
+// printf formats, kept for sketches that build these requests themselves
 #define SPOTIFY_VOLUME_ENDPOINT "/v1/me/player/volume?volume_percent=%d"
 #define SPOTIFY_SHUFFLE_ENDPOINT "/v1/me/player/shuffle?state=%s"
 #define SPOTIFY_REPEAT_ENDPOINT "/v1/me/player/repeat?state=%s"
+// The same paths without the query, which the library adds with SpotifyQuery
+#define SPOTIFY_VOLUME_PATH "/v1/me/player/volume"
+#define SPOTIFY_SHUFFLE_PATH "/v1/me/player/shuffle"
+#define SPOTIFY_REPEAT_PATH "/v1/me/player/repeat"
 #define SPOTIFY_TRANSFER_ENDPOINT "/v1/me/player"
 #define SPOTIFY_DEVICES_ENDPOINT "/v1/me/player/devices"
 
@@ -60,11 +68,107 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #define SPOTIFY_PREVIOUS_TRACK_ENDPOINT "/v1/me/player/previous"
 
 #define SPOTIFY_SEEK_ENDPOINT "/v1/me/player/seek"
+#define SPOTIFY_QUEUE_ENDPOINT "/v1/me/player/queue"
 
 #define SPOTIFY_TOKEN_ENDPOINT "/api/token"
 
+#define SPOTIFY_AUDIO_ANALYSIS_ENDPOINT "/v1/audio-analysis/"
+
+#define SPOTIFY_PLAYLISTS_ENDPOINT "/v1/me/playlists"
+// Followed by the playlist ID and "/tracks"
+#define SPOTIFY_PLAYLIST_ENDPOINT "/v1/playlists/"
+#define SPOTIFY_SAVED_TRACKS_ENDPOINT "/v1/me/tracks"
+#define SPOTIFY_RECENTLY_PLAYED_ENDPOINT "/v1/me/player/recently-played"
+
+// Longest (URL-encoded) values the token request bodies have room for
+#ifndef SPOTIFY_CLIENT_ID_LENGTH
+#define SPOTIFY_CLIENT_ID_LENGTH 32
+#endif
+#ifndef SPOTIFY_REFRESH_TOKEN_LENGTH
+#define SPOTIFY_REFRESH_TOKEN_LENGTH 200
+#endif
+#ifndef SPOTIFY_AUTH_CODE_LENGTH
+#define SPOTIFY_AUTH_CODE_LENGTH 400
+#endif
+#ifndef SPOTIFY_REDIRECT_URL_LENGTH
+#define SPOTIFY_REDIRECT_URL_LENGTH 200
+#endif
+
+// Stored tokens are only trusted once the clock was set (after Sep 2020)
+#define SPOTIFY_MIN_VALID_TIME 1600000000
+// Wait this long before trying a failed background token refresh again
+#define SPOTIFY_TOKEN_RETRY_MS 10000
+
 #define SPOTIFY_NUM_ALBUM_IMAGES 3
 
+// Capacities (incl. the terminating 0) of the fields in the *Fixed structs,
+// longer values get cut off and flagged as truncated
+#ifndef SPOTIFY_NAME_LENGTH
+#define SPOTIFY_NAME_LENGTH 64
+#endif
+#ifndef SPOTIFY_URI_LENGTH
+#define SPOTIFY_URI_LENGTH 64
+#endif
+#ifndef SPOTIFY_URL_LENGTH
+#define SPOTIFY_URL_LENGTH 80
+#endif
+#define SPOTIFY_DEVICE_ID_LENGTH 41
+#define SPOTIFY_TRACK_ID_LENGTH 23
+#define SPOTIFY_PLAYLIST_ID_LENGTH 23
+#ifndef SPOTIFY_SNAPSHOT_ID_LENGTH
+#define SPOTIFY_SNAPSHOT_ID_LENGTH 80
+#endif
+// ISO 8601 with ms, e.g. "2016-12-13T20:44:04.589Z"
+#define SPOTIFY_TIMESTAMP_LENGTH 25
+#define SPOTIFY_DEVICE_TYPE_LENGTH 16
+
+// Size of the StaticJsonDocument the response filters are parsed into
+#define SPOTIFY_FILTER_BUFFER_SIZE 512
+
+// One connection for each of api.spotify.com, accounts.spotify.com and the image CDN
+#define SPOTIFY_MAX_CONNECTIONS 3
+#define SPOTIFY_MAX_HOST_LENGTH 64
+
+// Requests that can wait for poll() besides the one in flight
+#define SPOTIFY_ASYNC_QUEUE_SIZE 4
+// Passed to the callback of a poll that was cut short by a player command
+// and couldn't be queued again
+#define SPOTIFY_PREEMPTED -499
+#define SPOTIFY_MAX_PATH_LENGTH 128
+
+// What getPlaylistTracks() asks for by default (Spotify's fields parameter),
+// everything SpotifyTrackFixed has
+#define SPOTIFY_PLAYLIST_TRACK_FIELDS "items(added_at,track(name,uri,duration_ms,is_local,artists(name,uri),album(name,uri))),next"
+// Longest (URL-encoded) fields value the page paths have room for
+#ifndef SPOTIFY_FIELDS_LENGTH
+#define SPOTIFY_FIELDS_LENGTH 192
+#endif
+
+// Responses that are parsed into the JSON arena, see getJsonUsage()
+enum SpotifyJsonEndpoint
+{
+  SPOTIFY_JSON_TOKEN,
+  SPOTIFY_JSON_ERROR,
+  SPOTIFY_JSON_DEVICES,
+  SPOTIFY_JSON_CURRENTLY_PLAYING,
+  SPOTIFY_JSON_PLAYER_DETAILS,
+  SPOTIFY_JSON_PLAYER_STATE,
+  // One item of a playlist/track list
+  SPOTIFY_JSON_PAGE_ITEM,
+  SPOTIFY_JSON_PLAYLIST_SNAPSHOT,
+  // One track of the queue
+  SPOTIFY_JSON_QUEUE_ITEM,
+  SPOTIFY_JSON_ENDPOINTS
+};
+
+struct SpotifyJsonUsage
+{
+  // Most bytes of the arena a response of this endpoint used
+  size_t highWaterMark;
+  // Responses that didn't fit
+  unsigned int overflows;
+};
+
 enum RepeatOptions
 {
   REPEAT_TRACK,
@@ -72,6 +176,32 @@ enum RepeatOptions
   REPEAT_OFF
 };
 
+// What a successful player command changes in the cached player state
+enum SpotifyPlayerChange
+{
+  SPOTIFY_CHANGE_NONE,
+  SPOTIFY_CHANGE_PLAY,
+  SPOTIFY_CHANGE_PAUSE,
+  SPOTIFY_CHANGE_VOLUME,
+  SPOTIFY_CHANGE_SHUFFLE,
+  SPOTIFY_CHANGE_REPEAT,
+  SPOTIFY_CHANGE_SEEK,
+  // Next/previous track or a new context, starts playing from the beginning
+  SPOTIFY_CHANGE_TRACK
+};
+
+// Fields of the cached player state, see getStateMismatches()
+#define SPOTIFY_STATE_PLAYING 0x01
+#define SPOTIFY_STATE_VOLUME 0x02
+#define SPOTIFY_STATE_SHUFFLE 0x04
+#define SPOTIFY_STATE_REPEAT 0x08
+#define SPOTIFY_STATE_PROGRESS 0x10
+
+// How far the fetched progress may be off the one the cache extrapolated
+#ifndef SPOTIFY_PROGRESS_TOLERANCE_MS
+#define SPOTIFY_PROGRESS_TOLERANCE_MS 3000
+#endif
+
 struct SpotifyImage
 {
   int height;
@@ -102,6 +232,117 @@ struct PlayerDetails
   bool error;
 };
 
+// Same as the structs above, but without any heap allocations.
+// Filled in place by the overloads taking a reference.
+struct SpotifyImageFixed
+{
+  int height;
+  int width;
+  char url[SPOTIFY_URL_LENGTH];
+};
+
+struct SpotifyDeviceFixed
+{
+  char id[SPOTIFY_DEVICE_ID_LENGTH];
+  char name[SPOTIFY_NAME_LENGTH];
+  char type[SPOTIFY_DEVICE_TYPE_LENGTH];
+  bool isActive;
+  bool isRestricted;
+  bool isPrivateSession;
+  uint8_t volumePrecent;
+  bool truncated;
+};
+
+struct PlayerDetailsFixed
+{
+  SpotifyDeviceFixed device;
+
+  long progressMs;
+  bool isPlaying;
+  RepeatOptions repeateState;
+  bool shuffleState;
+
+  bool truncated;
+  bool error;
+};
+
+struct CurrentlyPlayingFixed
+{
+  char firstArtistName[SPOTIFY_NAME_LENGTH];
+  char firstArtistUri[SPOTIFY_URI_LENGTH];
+  char albumName[SPOTIFY_NAME_LENGTH];
+  char albumUri[SPOTIFY_URI_LENGTH];
+  char trackName[SPOTIFY_NAME_LENGTH];
+  char trackUri[SPOTIFY_URI_LENGTH];
+  char contextUri[SPOTIFY_URI_LENGTH];
+  SpotifyImageFixed albumImages[SPOTIFY_NUM_ALBUM_IMAGES];
+  int numImages;
+  bool isPlaying;
+  long progressMs;
+  long duraitonMs;
+
+  // One of the strings didn't fit
+  bool truncated;
+  bool error;
+};
+
+struct SpotifyPlaylistFixed
+{
+  char id[SPOTIFY_PLAYLIST_ID_LENGTH];
+  char name[SPOTIFY_NAME_LENGTH];
+  char uri[SPOTIFY_URI_LENGTH];
+  char ownerName[SPOTIFY_NAME_LENGTH];
+  char snapshotId[SPOTIFY_SNAPSHOT_ID_LENGTH];
+  int trackCount;
+  bool isPublic;
+  bool collaborative;
+
+  bool truncated;
+};
+
+struct SpotifyTrackFixed
+{
+  char name[SPOTIFY_NAME_LENGTH];
+  char uri[SPOTIFY_URI_LENGTH];
+  char firstArtistName[SPOTIFY_NAME_LENGTH];
+  char firstArtistUri[SPOTIFY_URI_LENGTH];
+  char albumName[SPOTIFY_NAME_LENGTH];
+  char albumUri[SPOTIFY_URI_LENGTH];
+  long durationMs;
+  bool isLocal;
+  // When it was added (playlists, saved tracks) or played (recently played)
+  char timestamp[SPOTIFY_TIMESTAMP_LENGTH];
+
+  bool truncated;
+};
+
+// Get one item of a list at a time, index counts from the first item
+// requested. Return false to stop, the rest isn't downloaded.
+typedef bool (*SpotifyPlaylistCallback)(const SpotifyPlaylistFixed &playlist, int index, void *context);
+typedef bool (*SpotifyTrackCallback)(const SpotifyTrackFixed &track, int index, void *context);
+
+struct SpotifyConnection
+{
+  WiFiClient *client;
+  SpotifyTransport *transport;
+  // transport was created by the library
+  bool ownsTransport;
+  char host[SPOTIFY_MAX_HOST_LENGTH];
+  unsigned long lastUsed;
+  // In use by an async request
+  bool busy;
+};
+
+struct SpotifyConnectionStats
+{
+  unsigned long handshakes;
+  unsigned long reuses;
+  // Kept-alive connections that turned out to be closed by the server
+  unsigned long reconnects;
+  // Async polls cut short by player commands
+  unsigned long preemptions;
+};
+
 struct CurrentlyPlaying
 {
   String firstArtistName;
@@ -120,6 +361,66 @@ struct CurrentlyPlaying
   bool error;
 };
 
+enum SpotifyRequestType
+{
+  SPOTIFY_REQUEST_CURRENTLY_PLAYING,
+  SPOTIFY_REQUEST_PLAYER_DETAILS,
+  // Both of the above from a single request
+  SPOTIFY_REQUEST_PLAYER_STATE,
+  SPOTIFY_REQUEST_PLAYER_CONTROL,
+  SPOTIFY_REQUEST_TOKEN
+};
+
+struct SpotifyAsyncResult
+{
+  int handle;
+  SpotifyRequestType type;
+  int statusCode;
+  bool error;
+  // Set for the matching request type if there was no error,
+  // only valid during the callback
+  CurrentlyPlaying *currentlyPlaying;
+  PlayerDetails *playerDetails;
+};
+
+typedef void (*SpotifyAsyncCallback)(const SpotifyAsyncResult &result);
+
+// Gets the next part of an image, received counts all bytes so far and
+// contentLength is -1 if the server didn't send it. Return false to stop.
+typedef bool (*SpotifyImageCallback)(const uint8_t *data, size_t length, size_t received, long contentLength, void *context);
+
+struct SpotifyAsyncRequest
+{
+  int handle;
+  SpotifyRequestType type;
+  const char *method;
+  const char *host;
+  char path[SPOTIFY_MAX_PATH_LENGTH];
+  // Not copied, has to stay valid until the callback was called
+  const char *body;
+  SpotifyAsyncCallback callback;
+  unsigned long queuedAt;
+  // Retries so far (see SpotifyTimeoutPolicy), not sent before retryAt
+  uint8_t attempts;
+  unsigned long retryAt;
+  // Applied to the cached player state when a command returns 204
+  SpotifyPlayerChange change;
+  long changeValue;
+};
+
+enum SpotifyAsyncState
+{
+  SPOTIFY_ASYNC_IDLE,
+  SPOTIFY_ASYNC_CONNECT,
+  SPOTIFY_ASYNC_SEND,
+  SPOTIFY_ASYNC_HEADERS,
+  SPOTIFY_ASYNC_BODY,
+  SPOTIFY_ASYNC_PARSE
+};
+
+// Small hash (FNV-1a) to compare URIs and IDs without keeping a copy
+uint32_t spotifyHash(const char *text);
+
 class ArduinoSpotify
 {
 public:
@@ -131,18 +432,28 @@ public:
   bool refreshAccessToken();
   bool checkAndRefreshAccessToken();
   const char *requestAccessTokens(const char *code, const char *redirectUrl);
+  void setTokenStore(SpotifyTokenStore *tokenStore);
+  // Opt-in, every request is passed to metrics once it's done (NULL to stop)
+  void setMetrics(SpotifyMetrics *metrics);
+  bool restoreAccessToken();
 
   // Generic Request Methods
   int makeGetRequest(const char *command, const char *authorization, const char *accept = "application/json", const char *host = SPOTIFY_HOST);
   int makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
   int makePostRequest(const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
   int makePutRequest(const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
+  // Return SPOTIFY_PATH_TOO_LONG without sending anything if the command didn't fit its buffer
+  int makeGetRequest(const SpotifyQueryWriter &command, const char *authorization, const char *accept = "application/json", const char *host = SPOTIFY_HOST);
+  int makeRequestWithBody(const char *type, const SpotifyQueryWriter &command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
 
   // User methods
   CurrentlyPlaying getCurrentlyPlaying(const char *market = "");
   PlayerDetails getPlayerDetails(const char *market = "");
+  // Fills both from a single request, returns false on errors
+  bool getPlayerState(PlayerDetails &playerDetails, CurrentlyPlaying &currentlyPlaying, const char *market = "");
   bool play(const char *deviceId = "");
   bool playAdvanced(const char *body, const char *deviceId = "");
+  bool playAdvanced(const JsonDocument &body, const char *deviceId = "");
   bool pause(const char *deviceId = "");
   bool setVolume(int volume, const char *deviceId = "");
   bool toggleShuffle(bool shuffle, const char *deviceId = "");
@@ -155,15 +466,146 @@ public:
   uint8_t getDevices(SpotifyDevice devices[], uint8_t maxDevices);
   bool transferPlayback(const char *deviceId, bool play = false);
 
+  // Heap-free versions of the above, they fill the given struct(s) and return
+  // false on errors. The JSON document they use is allocated once and kept.
+  bool getCurrentlyPlaying(CurrentlyPlayingFixed &currentlyPlaying, const char *market = "");
+  bool getPlayerDetails(PlayerDetailsFixed &playerDetails, const char *market = "");
+  bool getPlayerState(PlayerDetailsFixed &playerDetails, CurrentlyPlayingFixed &currentlyPlaying, const char *market = "");
+  uint8_t getDevices(SpotifyDeviceFixed devices[], uint8_t maxDevices);
+  // The first maxTracks tracks that play next (only the fields belonging to
+  // the track are set), the rest of the queue isn't downloaded. Returns the
+  // number of tracks or -1 on errors.
+  int getQueue(CurrentlyPlayingFixed tracks[], uint8_t maxTracks);
+
+  // List methods
+  // These go through all pages of the list, parsing one item at a time, so
+  // they need the same memory for any length. They return the number of
+  // items passed to the callback or -1 on errors.
+  int getPlaylists(SpotifyPlaylistCallback callback, void *context = NULL, int offset = 0);
+  int getPlaylistTracks(const char *playlistId, SpotifyTrackCallback callback, void *context = NULL, int offset = 0);
+  int getSavedTracks(SpotifyTrackCallback callback, void *context = NULL, int offset = 0);
+  // The last 50 tracks at most, newest first
+  int getRecentlyPlayed(SpotifyTrackCallback callback, void *context = NULL);
+  // Bytes received by the last of the above, all pages together
+  size_t getLastListBytes();
+  // Only gets the snapshot_id of a playlist, it changes with the playlist
+  bool getPlaylistSnapshot(const char *playlistId, char *snapshotId, size_t size);
+
+  // Streams the analysis of a track (its ID or URI) into the given struct
+  // without buffering the response, returns false on errors
+  bool getAudioAnalysis(const char *trackId, SpotifyAudioAnalysis &analysis);
+
   // Image methods
   bool getImage(char *imageUrl, Stream *file);
+  // Without a buffer the library's own one (imageChunkSize bytes) is used
+  bool getImage(char *imageUrl, SpotifyImageCallback callback, void *context = NULL, uint8_t *buffer = NULL, size_t bufferSize = 0);
+
+  // Async methods
+  // These return a handle (or -1 if the queue is full) right away, the work is
+  // done in poll() and the result is passed to the callback.
+  int getCurrentlyPlayingAsync(SpotifyAsyncCallback callback, const char *market = "");
+  int getPlayerDetailsAsync(SpotifyAsyncCallback callback, const char *market = "");
+  int getPlayerStateAsync(SpotifyAsyncCallback callback, const char *market = "");
+  int playAsync(SpotifyAsyncCallback callback = NULL, const char *deviceId = "");
+  int pauseAsync(SpotifyAsyncCallback callback = NULL, const char *deviceId = "");
+  int setVolumeAsync(int volume, SpotifyAsyncCallback callback = NULL, const char *deviceId = "");
+  int nextTrackAsync(SpotifyAsyncCallback callback = NULL, const char *deviceId = "");
+  int previousTrackAsync(SpotifyAsyncCallback callback = NULL, const char *deviceId = "");
+  int playerControlAsync(char *command, SpotifyAsyncCallback callback = NULL, const char *deviceId = "", const char *body = "");
+  int playerNavigateAsync(char *command, SpotifyAsyncCallback callback = NULL, const char *deviceId = "");
+  // Call this from loop(), returns true while there is still work to do
+  bool poll();
+
+  // Connection methods
+  // transport defaults to a SpotifyLeanTransport owned by the library
+  bool addConnectionClient(WiFiClient &client, SpotifyTransport *transport = NULL);
+  // Replaces the transport of a connection, e.g. with a SpotifyHTTPClientTransport
+  bool setTransport(SpotifyTransport &transport, uint8_t connection = 0);
+  void closeConnections();
+  const SpotifyConnectionStats &getConnectionStats();
+  void resetConnectionStats();
+
+  // All responses are parsed into one document that is kept between calls.
+  // Pass your own one (e.g. a StaticJsonDocument) or let the library allocate it.
+  void setJsonArena(JsonDocument &doc);
+  const SpotifyJsonUsage &getJsonUsage(SpotifyJsonEndpoint endpoint);
+  void resetJsonUsage();
 
   int tagArraySize = 10;
   int deviceBufferSize = 10000;
   int currentlyPlayingBufferSize = 10000;
   int playerDetailsBufferSize = 10000;
+  int playerStateBufferSize = 10000;
   bool autoTokenRefresh = true;
 
+  // When set, only the fields that end up in CurrentlyPlaying/PlayerDetails are
+  // kept while parsing (available_markets etc. are skipped on the fly), so the
+  // much smaller buffers below are enough.
+  bool filterResponses = false;
+  int currentlyPlayingFilteredBufferSize = 1500;
+  int playerDetailsFilteredBufferSize = 800;
+  int playerStateFilteredBufferSize = 2000;
+  int devicesFilteredBufferSize = 1500;
+  // Size needed by the heap-free methods (always filtered)
+  int fixedBufferSize = 3000;
+  // Size needed for one item of the list methods
+  int pageItemBufferSize = 1500;
+  // Items requested per page by the list methods (at most 50)
+  uint8_t pageSize = 50;
+  // Sent as fields with getPlaylistTracks(), so the pages leave out what
+  // isn't needed (NULL or "" for everything). Fields that aren't in it are
+  // left empty and without next only the first page is read.
+  const char *playlistTrackFields = SPOTIFY_PLAYLIST_TRACK_FIELDS;
+  // Size of the JSON arena the library allocates on first use. With 0 it is
+  // the largest of the filtered sizes above, grown once to the largest
+  // unfiltered one by the first call that parses a whole response (without
+  // filterResponses). Use getJsonUsage() to find the exact size your calls need.
+  size_t jsonArenaSize = 0;
+
+  // Keep connections open between calls instead of doing a new TLS handshake
+  // every time. Every host gets its own client, add more with addConnectionClient()
+  // (e.g. for accounts.spotify.com and the image CDN), otherwise the connection
+  // is moved between hosts when needed.
+  bool keepAlive = false;
+
+  // Player commands (sync or async) don't wait for an async poll that is in
+  // flight: it is cut short, its partial response dropped and it's queued
+  // again behind the command. Async commands also go ahead of queued polls.
+  bool preemptPolls = true;
+
+  // Player commands that return 204 are applied to a cached copy of the
+  // player state right away, so the UI can show the result without fetching
+  // it again. The next real fetch replaces the cache, fields it doesn't
+  // agree on are flagged in getStateMismatches().
+  bool optimisticState = true;
+  // False until the player state was fetched once (getPlayerDetails or
+  // getPlayerState, sync or async). The progress is moved on while playing.
+  bool getCachedPlayerDetails(PlayerDetailsFixed &playerDetails);
+  // SPOTIFY_STATE_* fields where the last fetch after a command disagreed
+  // with what the command should have done (e.g. the device refused it)
+  uint8_t getStateMismatches();
+
+  // poll() returns after this many ms, unless it's waiting for the
+  // connection (the TLS handshake can't be split up, keepAlive helps).
+  unsigned int asyncSliceMs = 5;
+  // Async responses are read into this buffer (allocated once) before parsing
+  int asyncBufferSize = 10000;
+  // Size of the buffer getImage() passes to the callback
+  size_t imageChunkSize = 1024;
+  // Shared by all requests to api.spotify.com, refused requests return
+  // SPOTIFY_RATE_LIMITED (async: as the statusCode of the result)
+  SpotifyRateLimiter rateLimiter;
+  // Sets the timeout of every request from the latency its endpoint had so
+  // far and sends GETs again that timed out or failed with a 5xx
+  SpotifyTimeoutPolicy timeoutPolicy;
+  // Status code (or error) of the last request, e.g. to tell why play() returned false
+  int getLastStatusCode();
+
+  // poll() refreshes the access token this long before it expires, so none
+  // of the other calls has to wait for it. Only poll() does: without it the
+  // token is refreshed by the first call after it expired.
+  unsigned long tokenRefreshMarginMs = 60000;
+
 private:
   String _bearerToken;
   const char *_refreshToken;
@@ -171,15 +613,115 @@ private:
   const char *_clientSecret;
   unsigned int _timeTokenRefreshed;
   unsigned int _tokenTimeToLiveMs;
+  SpotifyTokenStore *_tokenStore;
+  bool _tokenRefreshAttempted;
+  unsigned long _lastTokenRefreshAttempt;
   WiFiClient *_client;
-  HTTPClient *_http;
+  SpotifyTransport *_transport;
+  SpotifyConnection _connections[SPOTIFY_MAX_CONNECTIONS];
+  uint8_t _numConnections;
+  SpotifyConnectionStats _connectionStats;
+  SpotifyConnection *_currentConnection;
+  bool _connectionReused;
+  SpotifyTransport *createTransport();
+  SpotifyConnection *acquireConnection(const char *host);
+  int sendRequest(const char *method, const char *uri, const char *accept, const char *contentType, const char *authorization, const SpotifyRequestBody *body, const char *host);
+  int makeBodyRequest(const char *type, const char *uri, const char *authorization, const SpotifyRequestBody *body,
+                      const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
+  bool shouldReconnect(int statusCode, bool idempotent);
+  bool shouldRetry(const char *method, int statusCode, uint8_t attempt);
+  unsigned long _requestTimeoutMs;
+  int requestImage(char *imageUrl);
+  uint8_t *_imageBuffer;
+  bool playerCommand(const char *method, const SpotifyQueryWriter &command, const char *body = "",
+                     SpotifyPlayerChange change = SPOTIFY_CHANGE_NONE, long changeValue = 0);
+  bool playerCommand(const char *method, const SpotifyQueryWriter &command, const SpotifyRequestBody &body,
+                     SpotifyPlayerChange change = SPOTIFY_CHANGE_NONE, long changeValue = 0);
+  void writeRefreshBody(SpotifyQueryWriter &body);
+  void storeAccessToken(JsonDocument &doc, unsigned long now);
+
+  SpotifyAsyncRequest _asyncQueue[SPOTIFY_ASYNC_QUEUE_SIZE];
+  uint8_t _asyncQueueLength;
+  SpotifyAsyncRequest _asyncRequest;
+  SpotifyAsyncState _asyncState;
+  int _asyncNextHandle;
+  SpotifyConnection *_asyncConnection;
+  SpotifyHttpResponse _asyncResponse;
+  char *_asyncBuffer;
+  size_t _asyncBodyLength;
+  bool _asyncOverflow;
+  bool _asyncRetried;
+  unsigned long _asyncLastProgress;
+  void initAsync();
+  int queueAsync(SpotifyRequestType type, const char *method, const SpotifyQueryWriter &command, const char *body, SpotifyAsyncCallback callback,
+                 SpotifyPlayerChange change = SPOTIFY_CHANGE_NONE, long changeValue = 0);
+  bool stepAsync();
+  bool startAsync();
+  bool connectAsync();
+  bool sendAsync();
+  bool readAsyncHeaders();
+  bool readAsyncBody();
+  void parseAsync();
+  bool retryAsync(bool requestSent);
+  // Calls the callback with result, or with an error if it's NULL
+  void finishAsync(int statusCode, const SpotifyAsyncResult *result = NULL);
+  SpotifyPriority asyncPriority(const SpotifyAsyncRequest &request);
+  bool preemptAsync();
+  bool insertAsync(const SpotifyAsyncRequest &request);
+  bool retryAsyncLater(int statusCode);
+  unsigned long _asyncTimeoutMs;
+  unsigned long _asyncSentAt;
+  unsigned long _commandStart;
+  void commandDone();
+
+  PlayerDetailsFixed _playerCache;
+  bool _playerCacheValid;
+  unsigned long _playerCacheAt;
+  uint8_t _pendingState;
+  uint8_t _stateMismatches;
+  long cachedProgress(unsigned long now);
+  void applyPlayerChange(SpotifyPlayerChange change, long changeValue);
+  void reconcilePlayerState(JsonDocument &doc, bool hasDevice);
   // Should not be needed, but might be use to save some RAM between requests
   void stopClient();
   void parseError();
-  const char *requestAccessTokensBody =
-      R"(grant_type=authorization_code&code=%s&redirect_uri=%s&client_id=%s&client_secret=%s)";
-  const char *refreshAccessTokensBody =
-      R"(grant_type=refresh_token&refresh_token=%s&client_id=%s&client_secret=%s)";
+  DeserializationError deserializeFiltered(JsonDocument &doc, const char *filterJson, char *input = NULL, size_t inputLength = 0);
+  void fillCurrentlyPlaying(JsonDocument &doc, CurrentlyPlaying &currentlyPlaying);
+  void fillPlayerDetails(JsonDocument &doc, PlayerDetails &playerDetails);
+  void fillCurrentlyPlaying(JsonDocument &doc, CurrentlyPlayingFixed &currentlyPlaying);
+  bool fillPlayingItem(JsonObject item, CurrentlyPlayingFixed &currentlyPlaying);
+  void fillPlayerDetails(JsonDocument &doc, PlayerDetailsFixed &playerDetails);
+  bool fillDevice(JsonObject device, SpotifyDeviceFixed &result);
+  JsonDocument *fetchFixed(const char *endpoint, SpotifyJsonEndpoint jsonEndpoint, const char *market, const char *filter);
+  JsonDocument *_jsonArena;
+  // Set when the library allocated the arena
+  DynamicJsonDocument *_ownedJsonArena;
+  SpotifyJsonUsage _jsonUsage[SPOTIFY_JSON_ENDPOINTS];
+  JsonDocument &jsonArena(size_t size);
+  void recordJsonUsage(SpotifyJsonEndpoint endpoint, DeserializationError error);
+  int forEachItem(const SpotifyQueryWriter &firstPage, const char *filterJson, const char *fields, SpotifyPlaylistCallback playlistCallback, SpotifyTrackCallback trackCallback, void *context);
+  bool fillPlaylist(JsonObject playlist, SpotifyPlaylistFixed &result);
+  bool fillTrack(JsonObject item, SpotifyTrackFixed &result);
+  size_t _listBytes;
+  // refresh_token of requestAccessTokens(), the arena is reused
+  String _requestedRefreshToken;
+
+  int _lastStatusCode;
+  SpotifyMetrics *_metrics;
+  SpotifyRequestMetrics _requestMetrics;
+  bool _requestMetricsActive;
+  unsigned long _requestStart;
+  unsigned long _responseStart;
+  unsigned long _parseEnd;
+  // Spent in checkAndRefreshAccessToken(), added to the next request
+  unsigned long _tokenRefreshMs;
+  SpotifyRequestMetrics _asyncMetrics;
+  bool _asyncMetricsActive;
+  unsigned long _asyncStart;
+  unsigned long _asyncPhaseStart;
+  void beginMetrics(SpotifyRequestMetrics &metrics, const char *host, const char *uri);
+  void finishRequestMetrics();
+  void asyncPhaseDone(SpotifyMetricsPhase phase);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,270 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyAlbumArtCache.h"
+
+SpotifyAlbumArtCache::SpotifyAlbumArtCache(ArduinoSpotify &spotify, fs::FS &fs, const char *directory, size_t byteBudget)
+{
+    _spotify = &spotify;
+    _fs = &fs;
+    _directory = directory;
+    _byteBudget = byteBudget;
+    _numEntries = 0;
+    _useCounter = 0;
+    _usedBytes = 0;
+    _hits = 0;
+    _misses = 0;
+    _evictions = 0;
+}
+
+void SpotifyAlbumArtCache::entryPath(const SpotifyAlbumArtEntry &entry, const char *extension, char *path, size_t pathSize)
+{
+    snprintf(path, pathSize, "%s/%08lx_%u.%s", _directory, (unsigned long)entry.key, entry.imageSize, extension);
+}
+
+void SpotifyAlbumArtCache::indexPath(char *path, size_t pathSize)
+{
+    snprintf(path, pathSize, "%s/index", _directory);
+}
+
+bool SpotifyAlbumArtCache::begin()
+{
+    _numEntries = 0;
+    _usedBytes = 0;
+    _useCounter = 0;
+
+    // LittleFS needs the directory, SPIFFS doesn't know about directories
+    _fs->mkdir(_directory);
+
+    char path[SPOTIFY_ART_CACHE_MAX_PATH];
+    indexPath(path, sizeof(path));
+    fs::File index = _fs->open(path, "r");
+    if (!index)
+    {
+        // Nothing cached yet
+        return true;
+    }
+
+    bool changed = false;
+    SpotifyAlbumArtEntry entry;
+    while (_numEntries < SPOTIFY_ART_CACHE_MAX_ENTRIES &&
+           index.read((uint8_t *)&entry, sizeof(entry)) == sizeof(entry))
+    {
+        entryPath(entry, "jpg", path, sizeof(path));
+        if (!_fs->exists(path))
+        {
+            changed = true;
+            continue;
+        }
+        _entries[_numEntries++] = entry;
+        _usedBytes += entry.bytes;
+        if (entry.lastUsed > _useCounter)
+        {
+            _useCounter = entry.lastUsed;
+        }
+    }
+    index.close();
+
+    if (changed)
+    {
+        saveIndex();
+    }
+    return true;
+}
+
+void SpotifyAlbumArtCache::saveIndex()
+{
+    // Only written when images are added or removed, hits only update the
+    // order in RAM to spare the flash
+    char path[SPOTIFY_ART_CACHE_MAX_PATH];
+    indexPath(path, sizeof(path));
+    fs::File index = _fs->open(path, "w");
+    if (!index)
+    {
+        Serial.println(F("Could not write album art index"));
+        return;
+    }
+    index.write((const uint8_t *)_entries, sizeof(SpotifyAlbumArtEntry) * _numEntries);
+    index.close();
+}
+
+int SpotifyAlbumArtCache::findEntry(uint32_t key, int imageSize)
+{
+    for (uint8_t i = 0; i < _numEntries; i++)
+    {
+        if (_entries[i].key == key && _entries[i].imageSize == imageSize)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void SpotifyAlbumArtCache::removeEntry(uint8_t index)
+{
+    char path[SPOTIFY_ART_CACHE_MAX_PATH];
+    entryPath(_entries[index], "jpg", path, sizeof(path));
+    _fs->remove(path);
+    _usedBytes -= _entries[index].bytes;
+    _numEntries--;
+    memmove(&_entries[index], &_entries[index + 1], sizeof(SpotifyAlbumArtEntry) * (_numEntries - index));
+}
+
+void SpotifyAlbumArtCache::makeRoom(size_t bytes)
+{
+    while (_numEntries > 0 && (_usedBytes + bytes > _byteBudget || _numEntries >= SPOTIFY_ART_CACHE_MAX_ENTRIES))
+    {
+        uint8_t oldest = 0;
+        for (uint8_t i = 1; i < _numEntries; i++)
+        {
+            if (_entries[i].lastUsed < _entries[oldest].lastUsed)
+            {
+                oldest = i;
+            }
+        }
+        removeEntry(oldest);
+        _evictions++;
+    }
+}
+
+bool SpotifyAlbumArtCache::getImagePath(const char *albumUri, char *imageUrl, int imageSize, char *path, size_t pathSize)
+{
+    uint32_t key = spotifyHash(albumUri);
+    int index = findEntry(key, imageSize);
+    if (index >= 0)
+    {
+        _hits++;
+        _entries[index].lastUsed = ++_useCounter;
+        entryPath(_entries[index], "jpg", path, pathSize);
+        return true;
+    }
+
+    _misses++;
+
+    SpotifyAlbumArtEntry entry;
+    entry.key = key;
+    entry.imageSize = imageSize;
+    entry.bytes = 0;
+    entry.lastUsed = ++_useCounter;
+
+    // Downloaded under another name, so a failed download (or a reset in
+    // the middle of one) never leaves a broken image under the final one
+    char tmpPath[SPOTIFY_ART_CACHE_MAX_PATH];
+    entryPath(entry, "tmp", tmpPath, sizeof(tmpPath));
+    fs::File file = _fs->open(tmpPath, "w");
+    if (!file)
+    {
+        Serial.println(F("Could not create album art file"));
+        return false;
+    }
+    bool downloaded = _spotify->getImage(imageUrl, &file);
+    entry.bytes = file.size();
+    file.close();
+
+    if (!downloaded || entry.bytes == 0)
+    {
+        _fs->remove(tmpPath);
+        return false;
+    }
+
+    // The new image might be over budget on its own, it still gets used
+    makeRoom(entry.bytes);
+    // SPIFFS can't rename onto an existing file
+    entryPath(entry, "jpg", path, pathSize);
+    _fs->remove(path);
+    if (!_fs->rename(tmpPath, path))
+    {
+        Serial.println(F("Could not write album art file"));
+        _fs->remove(tmpPath);
+        return false;
+    }
+    _entries[_numEntries++] = entry;
+    _usedBytes += entry.bytes;
+    saveIndex();
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Cached album art: "));
+    Serial.println(path);
+#endif
+
+    return true;
+}
+
+bool SpotifyAlbumArtCache::getImage(const char *albumUri, char *imageUrl, int imageSize, Stream *file)
+{
+    char path[SPOTIFY_ART_CACHE_MAX_PATH];
+    if (!getImagePath(albumUri, imageUrl, imageSize, path, sizeof(path)))
+    {
+        return false;
+    }
+
+    fs::File cached = _fs->open(path, "r");
+    if (!cached)
+    {
+        return false;
+    }
+    uint8_t buffer[128];
+    size_t read;
+    while ((read = cached.read(buffer, sizeof(buffer))) > 0)
+    {
+        file->write(buffer, read);
+    }
+    cached.close();
+    return true;
+}
+
+bool SpotifyAlbumArtCache::getImagePath(const CurrentlyPlaying &currentlyPlaying, int imageIndex, char *path, size_t pathSize)
+{
+    if (imageIndex < 0 || imageIndex >= currentlyPlaying.numImages)
+    {
+        return false;
+    }
+    const SpotifyImage &image = currentlyPlaying.albumImages[imageIndex];
+    return getImagePath(currentlyPlaying.albumUri.c_str(), (char *)image.url.c_str(), image.width, path, pathSize);
+}
+
+void SpotifyAlbumArtCache::clear()
+{
+    while (_numEntries > 0)
+    {
+        removeEntry(_numEntries - 1);
+    }
+    saveIndex();
+}
+
+unsigned long SpotifyAlbumArtCache::hits()
+{
+    return _hits;
+}
+
+unsigned long SpotifyAlbumArtCache::misses()
+{
+    return _misses;
+}
+
+unsigned long SpotifyAlbumArtCache::evictions()
+{
+    return _evictions;
+}
+
+size_t SpotifyAlbumArtCache::usedBytes()
+{
+    return _usedBytes;
+}
@@ -0,0 +1,85 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyAlbumArtCache_h
+#define SpotifyAlbumArtCache_h
+
+#include <FS.h>
+#include "ArduinoSpotify.h"
+
+#define SPOTIFY_ART_CACHE_MAX_ENTRIES 32
+// Directory + "/" + 8 hex digits + "_" + size + ".jpg"
+#define SPOTIFY_ART_CACHE_MAX_PATH 48
+
+struct SpotifyAlbumArtEntry
+{
+  // Hash of the album URI
+  uint32_t key;
+  uint16_t imageSize;
+  uint32_t bytes;
+  uint32_t lastUsed;
+};
+
+// Keeps downloaded album art on a file system, so the next track of the same
+// album doesn't need to download it again. The least recently used images are
+// removed once more than byteBudget bytes are used.
+class SpotifyAlbumArtCache
+{
+public:
+  SpotifyAlbumArtCache(ArduinoSpotify &spotify, fs::FS &fs, const char *directory = "/art", size_t byteBudget = 200000);
+
+  // Loads the index of what is already cached, call after mounting the file system
+  bool begin();
+  // Downloads the image unless it's cached and puts its file name into path
+  bool getImagePath(const char *albumUri, char *imageUrl, int imageSize, char *path, size_t pathSize);
+  // Same as above, but writes the image to the stream
+  bool getImage(const char *albumUri, char *imageUrl, int imageSize, Stream *file);
+  // For the images in CurrentlyPlaying.albumImages
+  bool getImagePath(const CurrentlyPlaying &currentlyPlaying, int imageIndex, char *path, size_t pathSize);
+  void clear();
+
+  unsigned long hits();
+  unsigned long misses();
+  unsigned long evictions();
+  size_t usedBytes();
+
+private:
+  ArduinoSpotify *_spotify;
+  fs::FS *_fs;
+  const char *_directory;
+  size_t _byteBudget;
+
+  SpotifyAlbumArtEntry _entries[SPOTIFY_ART_CACHE_MAX_ENTRIES];
+  uint8_t _numEntries;
+  uint32_t _useCounter;
+  size_t _usedBytes;
+  unsigned long _hits;
+  unsigned long _misses;
+  unsigned long _evictions;
+
+  void entryPath(const SpotifyAlbumArtEntry &entry, const char *extension, char *path, size_t pathSize);
+  void indexPath(char *path, size_t pathSize);
+  int findEntry(uint32_t key, int imageSize);
+  void removeEntry(uint8_t index);
+  void makeRoom(size_t bytes);
+  void saveIndex();
+};
+
+#endif
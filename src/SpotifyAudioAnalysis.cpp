@@ -0,0 +1,512 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyAudioAnalysis.h"
+
+// Nesting of the values we keep: {"beats":[{"start":...}]}
+#define SPOTIFY_ANALYSIS_ARRAY_DEPTH 2
+#define SPOTIFY_ANALYSIS_ITEM_DEPTH 3
+#define SPOTIFY_ANALYSIS_MAX_DEPTH 32
+
+SpotifyAudioAnalysis::SpotifyAudioAnalysis()
+{
+    begin();
+}
+
+void SpotifyAudioAnalysis::begin()
+{
+    _token = TOKEN_NONE;
+    _escaped = false;
+    _isKey = false;
+    _expectKey = false;
+    _failed = false;
+    _complete = false;
+    _depth = 0;
+    _arrays = 0;
+    _key[0] = '\0';
+    _keyLength = 0;
+    _numberLength = 0;
+    _array = ARRAY_NONE;
+
+    float threshold = minConfidence * 255 + 0.5f;
+    _minConfidence = threshold <= 0 ? 0 : (threshold >= 255 ? 255 : (uint8_t)threshold);
+
+    beatCount = 0;
+    barCount = 0;
+    sectionCount = 0;
+    segmentCount = 0;
+    truncated = false;
+}
+
+bool SpotifyAudioAnalysis::feed(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length && !_failed; i++)
+    {
+        if (!process((char)data[i]))
+        {
+            _failed = true;
+#ifdef SPOTIFY_DEBUG
+            Serial.print(F("Invalid audio analysis JSON at byte "));
+            Serial.println(i);
+#endif
+        }
+    }
+
+    return !_failed;
+}
+
+bool SpotifyAudioAnalysis::complete()
+{
+    return _complete && !_failed;
+}
+
+bool SpotifyAudioAnalysis::process(char c)
+{
+    switch (_token)
+    {
+    case TOKEN_STRING:
+        if (_escaped)
+        {
+            _escaped = false;
+        }
+        else if (c == '\\')
+        {
+            _escaped = true;
+        }
+        else if (c == '"')
+        {
+            _token = TOKEN_NONE;
+            if (_isKey)
+            {
+                _key[_keyLength] = '\0';
+            }
+        }
+        else if (_isKey && _keyLength < SPOTIFY_ANALYSIS_KEY_LENGTH - 1)
+        {
+            _key[_keyLength++] = c;
+        }
+        return true;
+    case TOKEN_NUMBER:
+        if ((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' || c == 'e' || c == 'E')
+        {
+            if (_numberLength < SPOTIFY_ANALYSIS_NUMBER_LENGTH - 1)
+            {
+                _number[_numberLength++] = c;
+            }
+            return true;
+        }
+        _token = TOKEN_NONE;
+        _number[_numberLength] = '\0';
+        number();
+        break;
+    case TOKEN_LITERAL:
+        if (c >= 'a' && c <= 'z')
+        {
+            return true;
+        }
+        _token = TOKEN_NONE;
+        break;
+    default:
+        break;
+    }
+
+    switch (c)
+    {
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+        return true;
+    case '{':
+        value();
+        return open(false);
+    case '[':
+        value();
+        return open(true);
+    case '}':
+        return close(false);
+    case ']':
+        return close(true);
+    case ':':
+        _expectKey = false;
+        return true;
+    case ',':
+        _expectKey = _depth > 0 && !inArray(_depth);
+        return true;
+    case '"':
+        _isKey = _expectKey;
+        if (_isKey)
+        {
+            _keyLength = 0;
+        }
+        else
+        {
+            value();
+        }
+        _token = TOKEN_STRING;
+        return true;
+    case 't':
+    case 'f':
+    case 'n':
+        value();
+        _token = TOKEN_LITERAL;
+        return true;
+    default:
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            value();
+            _number[0] = c;
+            _numberLength = 1;
+            _token = TOKEN_NUMBER;
+            return true;
+        }
+        return false;
+    }
+}
+
+// Called whenever a value starts, _key still names it
+void SpotifyAudioAnalysis::value()
+{
+    if (_depth == 0)
+    {
+        // Anything after the closing brace of the document
+        _failed = _complete;
+    }
+}
+
+bool SpotifyAudioAnalysis::open(bool isArray)
+{
+    if (_complete || _depth >= SPOTIFY_ANALYSIS_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    if (isArray && _depth == SPOTIFY_ANALYSIS_ARRAY_DEPTH - 1)
+    {
+        if (strcmp(_key, "beats") == 0)
+        {
+            _array = ARRAY_BEATS;
+        }
+        else if (strcmp(_key, "bars") == 0)
+        {
+            _array = ARRAY_BARS;
+        }
+        else if (strcmp(_key, "sections") == 0)
+        {
+            _array = ARRAY_SECTIONS;
+        }
+        else if (strcmp(_key, "segments") == 0)
+        {
+            _array = ARRAY_SEGMENTS;
+        }
+    }
+    else if (!isArray && _depth == SPOTIFY_ANALYSIS_ITEM_DEPTH - 1 && _array != ARRAY_NONE)
+    {
+        _start = 0;
+        _duration = 0;
+        _confidence = 1000;
+        _loudness = 0;
+        _tempo = 0;
+    }
+
+    if (isArray)
+    {
+        _arrays |= (uint32_t)1 << _depth;
+    }
+    else
+    {
+        _arrays &= ~((uint32_t)1 << _depth);
+    }
+    _depth++;
+    _expectKey = !isArray;
+    return true;
+}
+
+bool SpotifyAudioAnalysis::close(bool isArray)
+{
+    if (_depth == 0 || inArray(_depth) != isArray)
+    {
+        return false;
+    }
+
+    if (!isArray && _depth == SPOTIFY_ANALYSIS_ITEM_DEPTH && _array != ARRAY_NONE)
+    {
+        item();
+    }
+    else if (isArray && _depth == SPOTIFY_ANALYSIS_ARRAY_DEPTH)
+    {
+        _array = ARRAY_NONE;
+    }
+
+    _depth--;
+    _expectKey = false;
+    _complete = _depth == 0;
+    return true;
+}
+
+bool SpotifyAudioAnalysis::inArray(uint8_t level)
+{
+    return (_arrays >> (level - 1)) & 1;
+}
+
+void SpotifyAudioAnalysis::number()
+{
+    if (_depth != SPOTIFY_ANALYSIS_ITEM_DEPTH || _array == ARRAY_NONE)
+    {
+        return;
+    }
+
+    int64_t milli;
+    if (!parseMilli(_number, milli))
+    {
+        return;
+    }
+
+    if (strcmp(_key, "start") == 0)
+    {
+        _start = milli;
+    }
+    else if (strcmp(_key, "duration") == 0)
+    {
+        _duration = milli;
+    }
+    else if (strcmp(_key, "confidence") == 0)
+    {
+        _confidence = milli;
+    }
+    else if (_array == ARRAY_SECTIONS && strcmp(_key, "loudness") == 0)
+    {
+        _loudness = milli;
+    }
+    else if (_array == ARRAY_SECTIONS && strcmp(_key, "tempo") == 0)
+    {
+        _tempo = milli;
+    }
+    else if (_array == ARRAY_SEGMENTS && strcmp(_key, "loudness_max") == 0)
+    {
+        _loudness = milli;
+    }
+}
+
+static uint32_t clampMs(int64_t milli, uint32_t max)
+{
+    if (milli < 0)
+    {
+        return 0;
+    }
+    return milli > max ? max : (uint32_t)milli;
+}
+
+static int16_t clampCenti(int64_t milli)
+{
+    int64_t centi = milli / 10;
+    if (centi < INT16_MIN)
+    {
+        return INT16_MIN;
+    }
+    return centi > INT16_MAX ? INT16_MAX : (int16_t)centi;
+}
+
+void SpotifyAudioAnalysis::item()
+{
+    uint8_t confidence = (clampMs(_confidence, 1000) * 255 + 500) / 1000;
+    if (confidence < _minConfidence)
+    {
+        return;
+    }
+
+    uint32_t startMs = clampMs(_start, UINT32_MAX);
+    switch (_array)
+    {
+    case ARRAY_BEATS:
+    case ARRAY_BARS:
+    {
+        bool beat = _array == ARRAY_BEATS;
+        uint16_t &count = beat ? beatCount : barCount;
+        uint16_t max = beat ? min(maxBeats, (uint16_t)SPOTIFY_ANALYSIS_MAX_BEATS) : min(maxBars, (uint16_t)SPOTIFY_ANALYSIS_MAX_BARS);
+        if (count >= max)
+        {
+            truncated = true;
+            return;
+        }
+        SpotifyTimeInterval &interval = beat ? beats[count] : bars[count];
+        interval.startMs = startMs;
+        interval.durationMs = clampMs(_duration, UINT16_MAX);
+        interval.confidence = confidence;
+        count++;
+        break;
+    }
+    case ARRAY_SECTIONS:
+        if (sectionCount >= min(maxSections, (uint16_t)SPOTIFY_ANALYSIS_MAX_SECTIONS))
+        {
+            truncated = true;
+            return;
+        }
+        sections[sectionCount].startMs = startMs;
+        sections[sectionCount].durationMs = clampMs(_duration, UINT32_MAX);
+        sections[sectionCount].loudness = clampCenti(_loudness);
+        sections[sectionCount].tempo = clampMs(_tempo / 10, UINT16_MAX);
+        sections[sectionCount].confidence = confidence;
+        sectionCount++;
+        break;
+    case ARRAY_SEGMENTS:
+        if (segmentCount >= min(maxSegments, (uint16_t)SPOTIFY_ANALYSIS_MAX_SEGMENTS))
+        {
+            truncated = true;
+            return;
+        }
+        segments[segmentCount].startMs = startMs;
+        segments[segmentCount].durationMs = clampMs(_duration, UINT16_MAX);
+        segments[segmentCount].loudnessMax = clampCenti(_loudness);
+        segments[segmentCount].confidence = confidence;
+        segmentCount++;
+        break;
+    default:
+        break;
+    }
+}
+
+// Parses a JSON number into thousandths without going through floats,
+// digits past the third decimal are dropped
+bool SpotifyAudioAnalysis::parseMilli(const char *text, int64_t &milli)
+{
+    bool negative = *text == '-';
+    if (negative)
+    {
+        text++;
+    }
+
+    // Mantissa as an integer, plus where the decimal point was
+    int64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; *text >= '0' && *text <= '9'; text++)
+    {
+        if (mantissa < 100000000000000LL)
+        {
+            mantissa = mantissa * 10 + (*text - '0');
+        }
+        else
+        {
+            exponent++;
+        }
+        digits = true;
+    }
+    if (*text == '.')
+    {
+        for (text++; *text >= '0' && *text <= '9'; text++)
+        {
+            if (mantissa < 100000000000000LL)
+            {
+                mantissa = mantissa * 10 + (*text - '0');
+                exponent--;
+            }
+            digits = true;
+        }
+    }
+    if (!digits)
+    {
+        return false;
+    }
+    if (*text == 'e' || *text == 'E')
+    {
+        text++;
+        bool negativeExponent = *text == '-';
+        if (*text == '-' || *text == '+')
+        {
+            text++;
+        }
+        int value = 0;
+        for (; *text >= '0' && *text <= '9'; text++)
+        {
+            if (value < 1000)
+            {
+                value = value * 10 + (*text - '0');
+            }
+        }
+        exponent += negativeExponent ? -value : value;
+    }
+
+    for (exponent += 3; exponent > 0 && mantissa != 0; exponent--)
+    {
+        if (mantissa > INT64_MAX / 10)
+        {
+            mantissa = INT64_MAX;
+            break;
+        }
+        mantissa *= 10;
+    }
+    for (; exponent < 0 && mantissa != 0; exponent++)
+    {
+        mantissa /= 10;
+    }
+
+    milli = negative ? -mantissa : mantissa;
+    return true;
+}
+
+template <typename T>
+int SpotifyAudioAnalysis::indexAt(const T *items, uint16_t count, uint32_t positionMs)
+{
+    // Last item that started at or before positionMs
+    int low = 0;
+    int high = count - 1;
+    int found = -1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        if (items[middle].startMs <= positionMs)
+        {
+            found = middle;
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    if (found >= 0 && positionMs - items[found].startMs >= items[found].durationMs)
+    {
+        // In a gap, e.g. after an item dropped for its confidence
+        return -1;
+    }
+    return found;
+}
+
+int SpotifyAudioAnalysis::beatAt(uint32_t positionMs)
+{
+    return indexAt(beats, beatCount, positionMs);
+}
+
+int SpotifyAudioAnalysis::barAt(uint32_t positionMs)
+{
+    return indexAt(bars, barCount, positionMs);
+}
+
+int SpotifyAudioAnalysis::sectionAt(uint32_t positionMs)
+{
+    return indexAt(sections, sectionCount, positionMs);
+}
+
+int SpotifyAudioAnalysis::segmentAt(uint32_t positionMs)
+{
+    return indexAt(segments, segmentCount, positionMs);
+}
@@ -0,0 +1,166 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyAudioAnalysis_h
+#define SpotifyAudioAnalysis_h
+
+#include <Arduino.h>
+
+// Array sizes, everything after that is dropped (about 9KB with the defaults)
+#ifndef SPOTIFY_ANALYSIS_MAX_BEATS
+#define SPOTIFY_ANALYSIS_MAX_BEATS 512
+#endif
+#ifndef SPOTIFY_ANALYSIS_MAX_BARS
+#define SPOTIFY_ANALYSIS_MAX_BARS 160
+#endif
+#ifndef SPOTIFY_ANALYSIS_MAX_SECTIONS
+#define SPOTIFY_ANALYSIS_MAX_SECTIONS 24
+#endif
+#ifndef SPOTIFY_ANALYSIS_MAX_SEGMENTS
+#define SPOTIFY_ANALYSIS_MAX_SEGMENTS 256
+#endif
+
+// Longest key we need to tell apart ("loudness_max")
+#define SPOTIFY_ANALYSIS_KEY_LENGTH 16
+#define SPOTIFY_ANALYSIS_NUMBER_LENGTH 24
+
+// Times are in ms, confidence is 0-255
+struct SpotifyTimeInterval
+{
+  uint32_t startMs;
+  uint16_t durationMs;
+  uint8_t confidence;
+};
+
+struct SpotifySection
+{
+  uint32_t startMs;
+  uint32_t durationMs;
+  // 1/100 dB
+  int16_t loudness;
+  // 1/100 BPM
+  uint16_t tempo;
+  uint8_t confidence;
+};
+
+struct SpotifySegment
+{
+  uint32_t startMs;
+  uint16_t durationMs;
+  // Peak loudness in 1/100 dB
+  int16_t loudnessMax;
+  uint8_t confidence;
+};
+
+// Keeps the beats, bars, sections and segment loudness of an
+// /v1/audio-analysis response. The JSON is fed in as it arrives and never
+// held in memory, only the values above end up in the arrays.
+class SpotifyAudioAnalysis
+{
+public:
+  SpotifyAudioAnalysis();
+
+  // Starts a new analysis, call before the first feed()
+  void begin();
+  // Returns false once the data isn't valid JSON
+  bool feed(const uint8_t *data, size_t length);
+  // The whole document was fed
+  bool complete();
+
+  // Index of the item that is playing at positionMs, -1 if there is none
+  int beatAt(uint32_t positionMs);
+  int barAt(uint32_t positionMs);
+  int sectionAt(uint32_t positionMs);
+  int segmentAt(uint32_t positionMs);
+
+  // Items below this confidence (0.0-1.0) are dropped
+  float minConfidence = 0;
+  // Keep fewer items than the arrays hold
+  uint16_t maxBeats = SPOTIFY_ANALYSIS_MAX_BEATS;
+  uint16_t maxBars = SPOTIFY_ANALYSIS_MAX_BARS;
+  uint16_t maxSections = SPOTIFY_ANALYSIS_MAX_SECTIONS;
+  uint16_t maxSegments = SPOTIFY_ANALYSIS_MAX_SEGMENTS;
+
+  SpotifyTimeInterval beats[SPOTIFY_ANALYSIS_MAX_BEATS];
+  SpotifyTimeInterval bars[SPOTIFY_ANALYSIS_MAX_BARS];
+  SpotifySection sections[SPOTIFY_ANALYSIS_MAX_SECTIONS];
+  SpotifySegment segments[SPOTIFY_ANALYSIS_MAX_SEGMENTS];
+  uint16_t beatCount;
+  uint16_t barCount;
+  uint16_t sectionCount;
+  uint16_t segmentCount;
+  // Some items didn't fit (not counting the ones below minConfidence)
+  bool truncated;
+
+private:
+  enum ArrayKind
+  {
+    ARRAY_NONE,
+    ARRAY_BEATS,
+    ARRAY_BARS,
+    ARRAY_SECTIONS,
+    ARRAY_SEGMENTS
+  };
+
+  enum TokenState
+  {
+    TOKEN_NONE,
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_LITERAL
+  };
+
+  // Parser state
+  TokenState _token;
+  bool _escaped;
+  bool _isKey;
+  bool _expectKey;
+  bool _failed;
+  bool _complete;
+  uint8_t _depth;
+  // Bit n is set if level n is an array
+  uint32_t _arrays;
+  char _key[SPOTIFY_ANALYSIS_KEY_LENGTH];
+  uint8_t _keyLength;
+  char _number[SPOTIFY_ANALYSIS_NUMBER_LENGTH];
+  uint8_t _numberLength;
+  ArrayKind _array;
+  uint8_t _minConfidence;
+
+  // Values of the item that is being read
+  int64_t _start;
+  int64_t _duration;
+  int64_t _confidence;
+  int64_t _loudness;
+  int64_t _tempo;
+
+  bool process(char c);
+  bool open(bool isArray);
+  bool close(bool isArray);
+  void value();
+  void number();
+  void item();
+  bool inArray(uint8_t level);
+  static bool parseMilli(const char *text, int64_t &milli);
+  template <typename T>
+  static int indexAt(const T *items, uint16_t count, uint32_t positionMs);
+};
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyCommandQueue.h"
+
+SpotifyCommandQueue::SpotifyCommandQueue(ArduinoSpotify &spotify, const char *deviceId)
+{
+    _spotify = &spotify;
+    _deviceId = deviceId;
+    _merged = 0;
+    _sent = 0;
+    _failed = 0;
+    _commandCount = 0;
+    memset(_commandOrder, 0, sizeof(_commandOrder));
+    clear();
+}
+
+void SpotifyCommandQueue::clear()
+{
+    _playState = PLAY_STATE_NONE;
+    _volumePending = false;
+    _seekPending = false;
+    _shufflePending = false;
+    _repeatPending = false;
+    _navigationRuns = 0;
+}
+
+bool SpotifyCommandQueue::hasPending()
+{
+    return _playState != PLAY_STATE_NONE || _volumePending || _seekPending ||
+           _shufflePending || _repeatPending || _navigationRuns > 0;
+}
+
+void SpotifyCommandQueue::commandAdded(CommandKind kind)
+{
+    if (!hasPending())
+    {
+        _firstCommandAt = millis();
+    }
+    _lastCommandAt = millis();
+    _commandOrder[kind] = ++_commandCount;
+}
+
+void SpotifyCommandQueue::setPlayState(PlayState state)
+{
+    commandAdded(COMMAND_PLAY_STATE);
+    if (_playState == PLAY_STATE_NONE)
+    {
+        _playState = state;
+    }
+    else if (_playState == state)
+    {
+        // Same thing twice
+        _merged++;
+    }
+    else
+    {
+        // A play and a pause cancel each other out
+        _playState = PLAY_STATE_NONE;
+        _merged += 2;
+    }
+}
+
+void SpotifyCommandQueue::play()
+{
+    setPlayState(PLAY_STATE_PLAY);
+}
+
+void SpotifyCommandQueue::pause()
+{
+    setPlayState(PLAY_STATE_PAUSE);
+}
+
+void SpotifyCommandQueue::setVolume(int volume)
+{
+    commandAdded(COMMAND_VOLUME);
+    if (_volumePending)
+    {
+        _merged++;
+    }
+    _volumePending = true;
+    _volume = volume;
+}
+
+void SpotifyCommandQueue::seek(int position)
+{
+    commandAdded(COMMAND_SEEK);
+    if (_seekPending)
+    {
+        _merged++;
+    }
+    _seekPending = true;
+    _seekPosition = position;
+}
+
+void SpotifyCommandQueue::toggleShuffle(bool shuffle)
+{
+    commandAdded(COMMAND_SHUFFLE);
+    if (_shufflePending)
+    {
+        _merged++;
+    }
+    _shufflePending = true;
+    _shuffle = shuffle;
+}
+
+void SpotifyCommandQueue::setRepeatMode(RepeatOptions repeat)
+{
+    commandAdded(COMMAND_REPEAT);
+    if (_repeatPending)
+    {
+        _merged++;
+    }
+    _repeatPending = true;
+    _repeat = repeat;
+}
+
+void SpotifyCommandQueue::navigate(SpotifyNavigation direction)
+{
+    commandAdded(COMMAND_NAVIGATION);
+    if (_seekPending)
+    {
+        // Seeking was meant for the track we are leaving
+        _seekPending = false;
+        _merged++;
+    }
+
+    if (_navigationRuns > 0)
+    {
+        SpotifyNavigationRun *last = &_navigation[_navigationRuns - 1];
+        if (last->direction == direction && last->count < 255)
+        {
+            last->count++;
+            return;
+        }
+    }
+
+    if (_navigationRuns >= SPOTIFY_COMMAND_QUEUE_NAVIGATION_RUNS)
+    {
+        Serial.println(F("Too many navigation commands queued (ignoring some)"));
+        _merged++;
+        return;
+    }
+
+    _navigation[_navigationRuns].direction = direction;
+    _navigation[_navigationRuns].count = 1;
+    _navigationRuns++;
+}
+
+void SpotifyCommandQueue::nextTrack()
+{
+    navigate(SPOTIFY_NAVIGATE_NEXT);
+}
+
+void SpotifyCommandQueue::previousTrack()
+{
+    navigate(SPOTIFY_NAVIGATE_PREVIOUS);
+}
+
+bool SpotifyCommandQueue::loop()
+{
+    if (!hasPending())
+    {
+        return false;
+    }
+
+    unsigned long now = millis();
+    if (now - _lastCommandAt < debounceMs && now - _firstCommandAt < maxDelayMs)
+    {
+        return false;
+    }
+
+    flush();
+    return true;
+}
+
+void SpotifyCommandQueue::sent(bool success)
+{
+    _sent++;
+    if (!success)
+    {
+        _failed++;
+    }
+}
+
+bool SpotifyCommandQueue::flush()
+{
+    unsigned long failedBefore = _failed;
+
+    // Take everything out first, commands added from here on (e.g. from an
+    // interrupt) end up in the next flush
+    PlayState playState = _playState;
+    bool volumePending = _volumePending;
+    int volume = _volume;
+    bool seekPending = _seekPending;
+    int seekPosition = _seekPosition;
+    bool shufflePending = _shufflePending;
+    bool shuffle = _shuffle;
+    bool repeatPending = _repeatPending;
+    RepeatOptions repeat = _repeat;
+    SpotifyNavigationRun navigation[SPOTIFY_COMMAND_QUEUE_NAVIGATION_RUNS];
+    uint8_t navigationRuns = _navigationRuns;
+    memcpy(navigation, _navigation, sizeof(SpotifyNavigationRun) * navigationRuns);
+    unsigned long order[COMMAND_KINDS];
+    memcpy(order, _commandOrder, sizeof(order));
+    clear();
+
+    // In the order they came in: a pause after a skip has to come after it
+    // (skipping starts playback again), a seek after a skip is for the new track
+    bool done[COMMAND_KINDS] = {false};
+    for (uint8_t kinds = 0; kinds < COMMAND_KINDS; kinds++)
+    {
+        uint8_t kind = COMMAND_KINDS;
+        for (uint8_t i = 0; i < COMMAND_KINDS; i++)
+        {
+            if (!done[i] && (kind == COMMAND_KINDS || order[i] < order[kind]))
+            {
+                kind = i;
+            }
+        }
+        done[kind] = true;
+
+        switch (kind)
+        {
+        case COMMAND_PLAY_STATE:
+            if (playState == PLAY_STATE_PLAY)
+            {
+                sent(_spotify->play(_deviceId));
+            }
+            else if (playState == PLAY_STATE_PAUSE)
+            {
+                sent(_spotify->pause(_deviceId));
+            }
+            break;
+        case COMMAND_NAVIGATION:
+            for (uint8_t i = 0; i < navigationRuns; i++)
+            {
+                for (uint8_t j = 0; j < navigation[i].count; j++)
+                {
+                    if (navigation[i].direction == SPOTIFY_NAVIGATE_NEXT)
+                    {
+                        sent(_spotify->nextTrack(_deviceId));
+                    }
+                    else
+                    {
+                        sent(_spotify->previousTrack(_deviceId));
+                    }
+                }
+            }
+            break;
+        case COMMAND_SEEK:
+            if (seekPending)
+            {
+                sent(_spotify->seek(seekPosition, _deviceId));
+            }
+            break;
+        case COMMAND_VOLUME:
+            if (volumePending)
+            {
+                sent(_spotify->setVolume(volume, _deviceId));
+            }
+            break;
+        case COMMAND_SHUFFLE:
+            if (shufflePending)
+            {
+                sent(_spotify->toggleShuffle(shuffle, _deviceId));
+            }
+            break;
+        case COMMAND_REPEAT:
+            if (repeatPending)
+            {
+                sent(_spotify->setRepeatMode(repeat, _deviceId));
+            }
+            break;
+        }
+    }
+
+    return _failed == failedBefore;
+}
+
+unsigned long SpotifyCommandQueue::mergedCount()
+{
+    return _merged;
+}
+
+unsigned long SpotifyCommandQueue::sentCount()
+{
+    return _sent;
+}
+
+unsigned long SpotifyCommandQueue::failedCount()
+{
+    return _failed;
+}
@@ -0,0 +1,123 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyCommandQueue_h
+#define SpotifyCommandQueue_h
+
+#include "ArduinoSpotify.h"
+
+// Runs of next/previous presses kept until the next flush
+#define SPOTIFY_COMMAND_QUEUE_NAVIGATION_RUNS 8
+
+enum SpotifyNavigation
+{
+  SPOTIFY_NAVIGATE_NEXT,
+  SPOTIFY_NAVIGATE_PREVIOUS
+};
+
+struct SpotifyNavigationRun
+{
+  SpotifyNavigation direction;
+  uint8_t count;
+};
+
+// Collects player commands and only sends what is still relevant once the
+// input settled down, e.g. only the last volume of a knob being turned.
+// Call loop() from your loop().
+class SpotifyCommandQueue
+{
+public:
+  SpotifyCommandQueue(ArduinoSpotify &spotify, const char *deviceId = "");
+
+  void play();
+  void pause();
+  void setVolume(int volume);
+  void seek(int position);
+  void nextTrack();
+  void previousTrack();
+  void toggleShuffle(bool shuffle);
+  void setRepeatMode(RepeatOptions repeat);
+
+  // Sends the pending commands once they are due, returns true if it did
+  bool loop();
+  // Sends the pending commands right away, returns false if any of them failed
+  bool flush();
+  bool hasPending();
+  void clear();
+
+  unsigned long mergedCount();
+  unsigned long sentCount();
+  unsigned long failedCount();
+
+  // Wait for this long without new commands before sending...
+  unsigned long debounceMs = 150;
+  // ...but never delay a command for longer than this
+  unsigned long maxDelayMs = 500;
+
+private:
+  enum PlayState
+  {
+    PLAY_STATE_NONE,
+    PLAY_STATE_PLAY,
+    PLAY_STATE_PAUSE
+  };
+
+  // A flush sends every kind where its last command came in
+  enum CommandKind
+  {
+    COMMAND_PLAY_STATE,
+    COMMAND_NAVIGATION,
+    COMMAND_SEEK,
+    COMMAND_VOLUME,
+    COMMAND_SHUFFLE,
+    COMMAND_REPEAT,
+    COMMAND_KINDS
+  };
+
+  ArduinoSpotify *_spotify;
+  const char *_deviceId;
+
+  PlayState _playState;
+  bool _volumePending;
+  int _volume;
+  bool _seekPending;
+  int _seekPosition;
+  bool _shufflePending;
+  bool _shuffle;
+  bool _repeatPending;
+  RepeatOptions _repeat;
+  SpotifyNavigationRun _navigation[SPOTIFY_COMMAND_QUEUE_NAVIGATION_RUNS];
+  uint8_t _navigationRuns;
+  unsigned long _commandOrder[COMMAND_KINDS];
+  unsigned long _commandCount;
+
+  unsigned long _firstCommandAt;
+  unsigned long _lastCommandAt;
+  unsigned long _merged;
+  unsigned long _sent;
+  unsigned long _failed;
+
+  void commandAdded(CommandKind kind);
+  void setPlayState(PlayState state);
+  void navigate(SpotifyNavigation direction);
+  void sent(bool success);
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyHTTPClientTransport.h"
+
+// Response headers HTTPClient should keep for us
+static const char *collectedHeaders[] = {"Transfer-Encoding", "Retry-After", "ETag"};
+
+SpotifyHTTPClientTransport::SpotifyHTTPClientTransport(uint16_t timeout)
+{
+    _timeout = timeout;
+    _http.setTimeout(timeout);
+    _http.setConnectTimeout(timeout);
+    _http.collectHeaders(collectedHeaders, sizeof(collectedHeaders) / sizeof(collectedHeaders[0]));
+}
+
+int SpotifyHTTPClientTransport::request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+                                        const char *accept, const char *contentType, const char *authorization, const char *body,
+                                        bool keepAlive)
+{
+    _response.reset();
+    memset(&_timing, 0, sizeof(_timing));
+    _http.setReuse(keepAlive);
+    // HTTPClient only takes a WiFiClient
+    if (!_http.begin(static_cast<WiFiClient &>(client), String(host), port, String(uri), true))
+    {
+        Serial.println(F("Connection failed"));
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+
+    if (accept != NULL)
+    {
+        _http.addHeader(F("Accept"), accept);
+    }
+
+    if (contentType != NULL)
+    {
+        _http.addHeader(F("Content-Type"), contentType);
+    }
+
+    if (authorization != NULL)
+    {
+        _http.addHeader(F("Authorization"), authorization);
+    }
+
+    // HTTPClient connects, sends and waits for the response in one go,
+    // so all of it ends up in waitMs
+    unsigned long start = millis();
+    int statusCode;
+    if (body == NULL)
+    {
+        statusCode = _http.sendRequest(method);
+    }
+    else
+    {
+        // Will be replaced by HttpClient, if > 0)
+        _http.addHeader(F("Content-Length"), "0");
+        _timing.bytesSent = strlen(body);
+        statusCode = _http.sendRequest(method, (uint8_t *)body, strlen(body));
+    }
+    _timing.waitMs = millis() - start;
+
+    if (statusCode > 0)
+    {
+        _response.beginBody(_http.getSize(), _http.header("Transfer-Encoding").equalsIgnoreCase("chunked"));
+        _response.statusCode = statusCode;
+        if (_http.hasHeader("Retry-After"))
+        {
+            _response.retryAfter = _http.header("Retry-After").toInt();
+        }
+        strncpy(_response.etag, _http.header("ETag").c_str(), SPOTIFY_HTTP_ETAG_LENGTH - 1);
+        _response.etag[SPOTIFY_HTTP_ETAG_LENGTH - 1] = '\0';
+        _body.begin(_http.getStream(), _response, _timeout);
+    }
+    return statusCode;
+}
+
+SpotifyBodyStream &SpotifyHTTPClientTransport::getStream()
+{
+    return _body;
+}
+
+long SpotifyHTTPClientTransport::getSize()
+{
+    return _response.contentLength;
+}
+
+long SpotifyHTTPClientTransport::getRetryAfter()
+{
+    return _response.retryAfter;
+}
+
+const char *SpotifyHTTPClientTransport::getETag()
+{
+    return _response.etag;
+}
+
+void SpotifyHTTPClientTransport::end()
+{
+    if (_response.headersComplete() && !_response.bodyComplete())
+    {
+        // The rest of the body is still on its way, this connection can't be reused
+        _http.getStream().stop();
+    }
+    // With reuse set, HTTPClient leaves the connection open if the server allows it
+    _http.end();
+    _response.reset();
+}
+
+void SpotifyHTTPClientTransport::setTimeout(unsigned long timeout)
+{
+    _timeout = timeout;
+    _http.setTimeout(timeout);
+    _http.setConnectTimeout(timeout);
+}
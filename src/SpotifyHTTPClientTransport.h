@@ -0,0 +1,59 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyHTTPClientTransport_h
+#define SpotifyHTTPClientTransport_h
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#if defined(ESP8266)
+#include <ESP8266HTTPClient.h>
+#else
+#include <HTTPClient.h>
+#endif
+#include "SpotifyTransport.h"
+
+// Uses the HTTPClient of the ESP core. It needs the client to be a
+// WiFiClient (or WiFiClientSecure), other Clients can only be used with
+// SpotifyLeanTransport.
+class SpotifyHTTPClientTransport : public SpotifyTransport
+{
+public:
+  SpotifyHTTPClientTransport(uint16_t timeout);
+
+  int request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+              const char *accept, const char *contentType, const char *authorization, const char *body,
+              bool keepAlive);
+  using SpotifyTransport::request;
+  SpotifyBodyStream &getStream();
+  long getSize();
+  long getRetryAfter();
+  const char *getETag();
+  void end();
+  void setTimeout(unsigned long timeout);
+
+private:
+  HTTPClient _http;
+  SpotifyHttpResponse _response;
+  SpotifyBodyStream _body;
+  uint16_t _timeout;
+};
+
+#endif
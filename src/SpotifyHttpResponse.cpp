@@ -0,0 +1,362 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyHttpResponse.h"
+
+SpotifyHttpResponse::SpotifyHttpResponse()
+{
+    reset();
+}
+
+void SpotifyHttpResponse::reset(bool expectBody)
+{
+    statusCode = 0;
+    contentLength = -1;
+    chunked = false;
+    keepAlive = true;
+    retryAfter = -1;
+    etag[0] = '\0';
+    bytesReceived = 0;
+    _state = STATUS_LINE;
+    _expectBody = expectBody;
+    _remaining = 0;
+    _lineLength = 0;
+}
+
+void SpotifyHttpResponse::beginBody(long length, bool isChunked)
+{
+    reset();
+    statusCode = 200;
+    contentLength = length;
+    chunked = isChunked;
+    startBody();
+}
+
+bool SpotifyHttpResponse::readLine(Client &client)
+{
+    while (client.available() > 0)
+    {
+        char c = client.read();
+        bytesReceived++;
+        if (c == '\n')
+        {
+            // Strip the \r, lines are always terminated by \r\n
+            if (_lineLength > 0 && _line[_lineLength - 1] == '\r')
+            {
+                _lineLength--;
+            }
+            _line[_lineLength] = '\0';
+            _lineLength = 0;
+            return true;
+        }
+        if (_lineLength < SPOTIFY_HTTP_LINE_LENGTH - 1)
+        {
+            _line[_lineLength++] = c;
+        }
+    }
+    return false;
+}
+
+void SpotifyHttpResponse::parseStatusLine()
+{
+    // HTTP/1.1 200 OK
+    const char *space = strchr(_line, ' ');
+    statusCode = (space != NULL) ? atoi(space + 1) : -1;
+    if (strncmp(_line, "HTTP/1.0", 8) == 0)
+    {
+        keepAlive = false;
+    }
+}
+
+void SpotifyHttpResponse::parseHeaderLine()
+{
+    char *colon = strchr(_line, ':');
+    if (colon == NULL)
+    {
+        return;
+    }
+    *colon = '\0';
+    char *value = colon + 1;
+    while (*value == ' ')
+    {
+        value++;
+    }
+
+    if (strcasecmp(_line, "Content-Length") == 0)
+    {
+        contentLength = atol(value);
+    }
+    else if (strcasecmp(_line, "Transfer-Encoding") == 0)
+    {
+        chunked = (strcasecmp(value, "chunked") == 0);
+    }
+    else if (strcasecmp(_line, "Connection") == 0)
+    {
+        keepAlive = (strcasecmp(value, "close") != 0);
+    }
+    else if (strcasecmp(_line, "Retry-After") == 0)
+    {
+        retryAfter = atol(value);
+    }
+    else if (strcasecmp(_line, "ETag") == 0)
+    {
+        strncpy(etag, value, SPOTIFY_HTTP_ETAG_LENGTH - 1);
+        etag[SPOTIFY_HTTP_ETAG_LENGTH - 1] = '\0';
+    }
+}
+
+void SpotifyHttpResponse::startBody()
+{
+    // 1xx, 204 and 304 never have a body
+    if (!_expectBody || statusCode < 200 || statusCode == 204 || statusCode == 304)
+    {
+        _state = DONE;
+    }
+    else if (chunked)
+    {
+        _state = CHUNK_SIZE;
+    }
+    else if (contentLength >= 0)
+    {
+        _remaining = contentLength;
+        _state = (_remaining > 0) ? BODY : DONE;
+    }
+    else
+    {
+        // Body ends when the server closes the connection
+        _remaining = -1;
+        keepAlive = false;
+        _state = BODY;
+    }
+}
+
+bool SpotifyHttpResponse::readHeaders(Client &client)
+{
+    while (_state == STATUS_LINE || _state == HEADER_LINE)
+    {
+        if (!readLine(client))
+        {
+            return false;
+        }
+
+        if (_state == STATUS_LINE)
+        {
+            parseStatusLine();
+            _state = HEADER_LINE;
+        }
+        else if (_line[0] == '\0')
+        {
+            startBody();
+        }
+        else
+        {
+            parseHeaderLine();
+        }
+    }
+    return true;
+}
+
+size_t SpotifyHttpResponse::readBody(Client &client, uint8_t *buffer, size_t length)
+{
+    size_t copied = 0;
+    while (copied < length && _state != DONE && _state != STATUS_LINE && _state != HEADER_LINE)
+    {
+        if (_state == BODY || _state == CHUNK_DATA)
+        {
+            int available = client.available();
+            if (available <= 0)
+            {
+                if (_remaining < 0 && !client.connected())
+                {
+                    // No length, the body ended with the connection
+                    _state = DONE;
+                }
+                break;
+            }
+            size_t toRead = min((size_t)available, length - copied);
+            if (_remaining >= 0 && (long)toRead > _remaining)
+            {
+                toRead = _remaining;
+            }
+            int read = client.read(buffer + copied, toRead);
+            if (read <= 0)
+            {
+                break;
+            }
+            copied += read;
+            bytesReceived += read;
+            if (_remaining >= 0)
+            {
+                _remaining -= read;
+                if (_remaining == 0)
+                {
+                    _state = (_state == BODY) ? DONE : CHUNK_DATA_END;
+                }
+            }
+        }
+        else
+        {
+            if (!readLine(client))
+            {
+                break;
+            }
+            if (_state == CHUNK_SIZE)
+            {
+                _remaining = strtol(_line, NULL, 16);
+                _state = (_remaining > 0) ? CHUNK_DATA : CHUNK_TRAILER;
+            }
+            else if (_state == CHUNK_DATA_END)
+            {
+                _state = CHUNK_SIZE;
+            }
+            else if (_line[0] == '\0')
+            {
+                // Empty line after the last chunk
+                _state = DONE;
+            }
+        }
+    }
+    return copied;
+}
+
+bool SpotifyHttpResponse::headersComplete()
+{
+    return _state != STATUS_LINE && _state != HEADER_LINE;
+}
+
+bool SpotifyHttpResponse::bodyComplete()
+{
+    return _state == DONE;
+}
+
+SpotifyBodyStream::SpotifyBodyStream()
+{
+    _client = NULL;
+    _response = NULL;
+    _timeout = 0;
+    _waitedMs = 0;
+    _peeked = -1;
+}
+
+void SpotifyBodyStream::begin(Client &client, SpotifyHttpResponse &response, unsigned long timeout)
+{
+    _client = &client;
+    _response = &response;
+    _timeout = timeout;
+    _waitedMs = 0;
+    _peeked = -1;
+}
+
+int SpotifyBodyStream::available()
+{
+    if (_peeked >= 0)
+    {
+        return 1;
+    }
+    if (_client == NULL || _response->bodyComplete())
+    {
+        return 0;
+    }
+    // Might include chunk sizes, but there is something to read
+    return _client->available();
+}
+
+size_t SpotifyBodyStream::readAvailable(uint8_t *buffer, size_t length)
+{
+    if (_client == NULL || length == 0)
+    {
+        return 0;
+    }
+    size_t read = 0;
+    if (_peeked >= 0)
+    {
+        buffer[read++] = _peeked;
+        _peeked = -1;
+    }
+    return read + _response->readBody(*_client, buffer + read, length - read);
+}
+
+int SpotifyBodyStream::read()
+{
+    if (_peeked >= 0)
+    {
+        int c = _peeked;
+        _peeked = -1;
+        return c;
+    }
+    if (_client == NULL)
+    {
+        return -1;
+    }
+
+    uint8_t c;
+    if (_response->readBody(*_client, &c, 1) > 0)
+    {
+        return c;
+    }
+
+    unsigned long start = millis();
+    while (_response->readBody(*_client, &c, 1) == 0)
+    {
+        if (_response->bodyComplete() || failed() || millis() - start > _timeout)
+        {
+            _waitedMs += millis() - start;
+            return -1;
+        }
+        // give the esp a breather
+        yield();
+    }
+    _waitedMs += millis() - start;
+    return c;
+}
+
+int SpotifyBodyStream::peek()
+{
+    if (_peeked < 0)
+    {
+        _peeked = read();
+    }
+    return _peeked;
+}
+
+size_t SpotifyBodyStream::write(uint8_t)
+{
+    return 0;
+}
+
+bool SpotifyBodyStream::complete()
+{
+    return _peeked < 0 && _response != NULL && _response->bodyComplete();
+}
+
+unsigned long SpotifyBodyStream::waitedMs()
+{
+    return _waitedMs;
+}
+
+size_t SpotifyBodyStream::bytesReceived()
+{
+    return (_response != NULL) ? _response->bytesReceived : 0;
+}
+
+bool SpotifyBodyStream::failed()
+{
+    return _client == NULL || (!_client->connected() && _client->available() <= 0 && !_response->bodyComplete());
+}
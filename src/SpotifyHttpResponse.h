@@ -0,0 +1,113 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyHttpResponse_h
+#define SpotifyHttpResponse_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Longer header lines are cut off, we only care about a few short ones
+#define SPOTIFY_HTTP_LINE_LENGTH 64
+#define SPOTIFY_HTTP_ETAG_LENGTH 48
+
+// Reads a HTTP/1.1 response from a client without ever waiting for data,
+// everything that is not available yet is picked up by the next call.
+class SpotifyHttpResponse
+{
+public:
+  SpotifyHttpResponse();
+  void reset(bool expectBody = true);
+  // Only decode the body, the headers were already read by someone else
+  void beginBody(long length, bool isChunked);
+
+  // Returns true once the status line and all headers were read
+  bool readHeaders(Client &client);
+  // Copies up to length bytes of the (de-chunked) body into buffer and
+  // returns how many were copied
+  size_t readBody(Client &client, uint8_t *buffer, size_t length);
+  bool headersComplete();
+  bool bodyComplete();
+
+  int statusCode;
+  long contentLength;
+  bool chunked;
+  bool keepAlive;
+  // Seconds, -1 if not sent
+  long retryAfter;
+  char etag[SPOTIFY_HTTP_ETAG_LENGTH];
+  size_t bytesReceived;
+
+private:
+  enum ParseState
+  {
+    STATUS_LINE,
+    HEADER_LINE,
+    BODY,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_DATA_END,
+    CHUNK_TRAILER,
+    DONE
+  };
+
+  ParseState _state;
+  bool _expectBody;
+  long _remaining;
+  char _line[SPOTIFY_HTTP_LINE_LENGTH];
+  uint8_t _lineLength;
+
+  bool readLine(Client &client);
+  void parseStatusLine();
+  void parseHeaderLine();
+  void startBody();
+};
+
+// The body of a response as a Stream, e.g. for deserializeJson(). Reading
+// waits for data like any other Stream, readAvailable() doesn't.
+class SpotifyBodyStream : public Stream
+{
+public:
+  SpotifyBodyStream();
+  void begin(Client &client, SpotifyHttpResponse &response, unsigned long timeout);
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t);
+  size_t readAvailable(uint8_t *buffer, size_t length);
+  // The whole body was read
+  bool complete();
+  // Neither more data nor the end of the body will come
+  bool failed();
+  // Time read() spent waiting for data since begin()
+  unsigned long waitedMs();
+  // Everything read from the client for this response so far
+  size_t bytesReceived();
+
+private:
+  Client *_client;
+  SpotifyHttpResponse *_response;
+  unsigned long _timeout;
+  unsigned long _waitedMs;
+  int _peeked;
+};
+
+#endif
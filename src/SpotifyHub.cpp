@@ -0,0 +1,679 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyHub.h"
+
+// Magic, version, type, sequence (2 bytes) and fields
+#define SPOTIFY_HUB_HEADER_SIZE 7
+// A full state moves the progress by more than this after a seek
+#define SPOTIFY_HUB_PROGRESS_JUMP_MS 1000
+
+// Everything is little endian, strings are a length byte and the characters
+class SpotifyHubWriter
+{
+public:
+  SpotifyHubWriter(uint8_t *buffer, size_t size) : _buffer(buffer), _size(size), _length(0), _overflowed(false) {}
+
+  void u8(uint8_t value)
+  {
+    if (_length < _size)
+    {
+      _buffer[_length++] = value;
+    }
+    else
+    {
+      _overflowed = true;
+    }
+  }
+  void u16(uint16_t value)
+  {
+    u8(value);
+    u8(value >> 8);
+  }
+  void u32(uint32_t value)
+  {
+    u16(value);
+    u16(value >> 16);
+  }
+  void str(const char *text)
+  {
+    size_t length = min(strlen(text), (size_t)255);
+    u8(length);
+    for (size_t i = 0; i < length; i++)
+    {
+      u8(text[i]);
+    }
+  }
+
+  size_t length() { return _length; }
+  bool overflowed() { return _overflowed; }
+
+private:
+  uint8_t *_buffer;
+  size_t _size;
+  size_t _length;
+  bool _overflowed;
+};
+
+// Reads past the end return 0 and set failed()
+class SpotifyHubReader
+{
+public:
+  SpotifyHubReader(const uint8_t *buffer, size_t length) : _buffer(buffer), _length(length), _position(0), _failed(false) {}
+
+  uint8_t u8()
+  {
+    if (_position < _length)
+    {
+      return _buffer[_position++];
+    }
+    _failed = true;
+    return 0;
+  }
+  uint16_t u16()
+  {
+    uint16_t value = u8();
+    return value | ((uint16_t)u8() << 8);
+  }
+  uint32_t u32()
+  {
+    uint32_t value = u16();
+    return value | ((uint32_t)u16() << 16);
+  }
+  // Cut off to fit, like the strings filled by ArduinoSpotify
+  void str(char *dest, size_t size)
+  {
+    size_t length = u8();
+    size_t kept = min(length, size - 1);
+    for (size_t i = 0; i < length; i++)
+    {
+      uint8_t c = u8();
+      if (i < kept)
+      {
+        dest[i] = c;
+      }
+    }
+    dest[kept] = '\0';
+  }
+
+  bool failed() { return _failed; }
+
+private:
+  const uint8_t *_buffer;
+  size_t _length;
+  size_t _position;
+  bool _failed;
+};
+
+static void writeHeader(SpotifyHubWriter &writer, SpotifyHubPacketType type, uint16_t sequence, uint8_t fields)
+{
+    writer.u8('S');
+    writer.u8('H');
+    writer.u8(SPOTIFY_HUB_VERSION);
+    writer.u8(type);
+    writer.u16(sequence);
+    writer.u8(fields);
+}
+
+static void writeState(SpotifyHubWriter &writer, const SpotifyHubState &state, uint8_t fields, long progressMs)
+{
+    const CurrentlyPlayingFixed &track = state.currentlyPlaying;
+    const PlayerDetailsFixed &player = state.playerDetails;
+
+    if (fields & SPOTIFY_HUB_TRACK)
+    {
+        writer.str(track.trackName);
+        writer.str(track.trackUri);
+        writer.str(track.firstArtistName);
+        writer.str(track.firstArtistUri);
+        writer.str(track.albumName);
+        writer.str(track.albumUri);
+        writer.str(track.contextUri);
+        writer.u32(track.duraitonMs);
+        writer.u8(track.numImages);
+        for (int i = 0; i < track.numImages; i++)
+        {
+            writer.u16(track.albumImages[i].width);
+            writer.u16(track.albumImages[i].height);
+            writer.str(track.albumImages[i].url);
+        }
+    }
+    if (fields & SPOTIFY_HUB_PLAYING)
+    {
+        writer.u8((player.isPlaying ? 1 : 0) | (state.active ? 2 : 0));
+    }
+    if (fields & SPOTIFY_HUB_PROGRESS)
+    {
+        writer.u32(progressMs);
+    }
+    if (fields & SPOTIFY_HUB_DEVICE)
+    {
+        writer.str(player.device.id);
+        writer.str(player.device.name);
+        writer.str(player.device.type);
+        writer.u8((player.device.isActive ? 1 : 0) | (player.device.isRestricted ? 2 : 0) |
+                  (player.device.isPrivateSession ? 4 : 0));
+    }
+    if (fields & SPOTIFY_HUB_VOLUME)
+    {
+        writer.u8(player.device.volumePrecent);
+    }
+    if (fields & SPOTIFY_HUB_SHUFFLE_REPEAT)
+    {
+        writer.u8(player.shuffleState);
+        writer.u8(player.repeateState);
+    }
+}
+
+static bool readState(SpotifyHubReader &reader, SpotifyHubState &state, uint8_t fields)
+{
+    CurrentlyPlayingFixed &track = state.currentlyPlaying;
+    PlayerDetailsFixed &player = state.playerDetails;
+
+    if (fields & SPOTIFY_HUB_TRACK)
+    {
+        reader.str(track.trackName, SPOTIFY_NAME_LENGTH);
+        reader.str(track.trackUri, SPOTIFY_URI_LENGTH);
+        reader.str(track.firstArtistName, SPOTIFY_NAME_LENGTH);
+        reader.str(track.firstArtistUri, SPOTIFY_URI_LENGTH);
+        reader.str(track.albumName, SPOTIFY_NAME_LENGTH);
+        reader.str(track.albumUri, SPOTIFY_URI_LENGTH);
+        reader.str(track.contextUri, SPOTIFY_URI_LENGTH);
+        track.duraitonMs = reader.u32();
+        uint8_t numImages = reader.u8();
+        track.numImages = 0;
+        for (uint8_t i = 0; i < numImages; i++)
+        {
+            // The hub might have been built with more images than we keep
+            SpotifyImageFixed image;
+            image.width = reader.u16();
+            image.height = reader.u16();
+            reader.str(image.url, SPOTIFY_URL_LENGTH);
+            if (track.numImages < SPOTIFY_NUM_ALBUM_IMAGES)
+            {
+                track.albumImages[track.numImages++] = image;
+            }
+        }
+    }
+    if (fields & SPOTIFY_HUB_PLAYING)
+    {
+        uint8_t flags = reader.u8();
+        player.isPlaying = flags & 1;
+        state.active = flags & 2;
+        track.isPlaying = player.isPlaying;
+    }
+    if (fields & SPOTIFY_HUB_PROGRESS)
+    {
+        player.progressMs = reader.u32();
+        track.progressMs = player.progressMs;
+    }
+    if (fields & SPOTIFY_HUB_DEVICE)
+    {
+        reader.str(player.device.id, SPOTIFY_DEVICE_ID_LENGTH);
+        reader.str(player.device.name, SPOTIFY_NAME_LENGTH);
+        reader.str(player.device.type, SPOTIFY_DEVICE_TYPE_LENGTH);
+        uint8_t flags = reader.u8();
+        player.device.isActive = flags & 1;
+        player.device.isRestricted = flags & 2;
+        player.device.isPrivateSession = flags & 4;
+    }
+    if (fields & SPOTIFY_HUB_VOLUME)
+    {
+        player.device.volumePrecent = reader.u8();
+    }
+    if (fields & SPOTIFY_HUB_SHUFFLE_REPEAT)
+    {
+        player.shuffleState = reader.u8();
+        uint8_t repeat = reader.u8();
+        player.repeateState = (repeat <= REPEAT_OFF) ? (RepeatOptions)repeat : REPEAT_OFF;
+    }
+    return !reader.failed();
+}
+
+// Packets of other versions (or other protocols on the port) are dropped
+static bool readHeader(SpotifyHubReader &reader, uint8_t &type, uint16_t &sequence, uint8_t &fields)
+{
+    bool valid = reader.u8() == 'S' && reader.u8() == 'H' && reader.u8() == SPOTIFY_HUB_VERSION;
+    type = reader.u8();
+    sequence = reader.u16();
+    fields = reader.u8();
+    return valid && !reader.failed();
+}
+
+// The parts that differ, except for the progress
+static uint8_t stateChanges(const SpotifyHubState &from, const SpotifyHubState &to)
+{
+    if (from.active != to.active)
+    {
+        return SPOTIFY_HUB_ALL;
+    }
+
+    uint8_t fields = 0;
+    if (strcmp(from.currentlyPlaying.trackUri, to.currentlyPlaying.trackUri) != 0 ||
+        strcmp(from.currentlyPlaying.contextUri, to.currentlyPlaying.contextUri) != 0)
+    {
+        fields |= SPOTIFY_HUB_TRACK;
+    }
+    if (from.playerDetails.isPlaying != to.playerDetails.isPlaying)
+    {
+        fields |= SPOTIFY_HUB_PLAYING;
+    }
+    const SpotifyDeviceFixed &fromDevice = from.playerDetails.device;
+    const SpotifyDeviceFixed &toDevice = to.playerDetails.device;
+    if (strcmp(fromDevice.id, toDevice.id) != 0 || strcmp(fromDevice.name, toDevice.name) != 0 ||
+        fromDevice.isActive != toDevice.isActive)
+    {
+        fields |= SPOTIFY_HUB_DEVICE;
+    }
+    if (fromDevice.volumePrecent != toDevice.volumePrecent)
+    {
+        fields |= SPOTIFY_HUB_VOLUME;
+    }
+    if (from.playerDetails.shuffleState != to.playerDetails.shuffleState ||
+        from.playerDetails.repeateState != to.playerDetails.repeateState)
+    {
+        fields |= SPOTIFY_HUB_SHUFFLE_REPEAT;
+    }
+    return fields;
+}
+
+SpotifyHub::SpotifyHub(ArduinoSpotify &spotify, WiFiUDP &udp, IPAddress group, uint16_t port)
+{
+    _spotify = &spotify;
+    _udp = &udp;
+    _group = group;
+    _port = port;
+    memset(&_state, 0, sizeof(_state));
+    _hasState = false;
+    _sequence = 0;
+    _lastPoll = 0;
+    _lastFullState = 0;
+    _progressAt = 0;
+    packetsSent = 0;
+    bytesSent = 0;
+}
+
+bool SpotifyHub::begin()
+{
+    return _udp->begin(_port) == 1;
+}
+
+void SpotifyHub::loop()
+{
+    while (_udp->parsePacket() > 0)
+    {
+        int length = _udp->read(_packet, SPOTIFY_HUB_HEADER_SIZE);
+        SpotifyHubReader reader(_packet, length > 0 ? length : 0);
+        uint8_t type;
+        uint16_t sequence;
+        uint8_t fields;
+        if (readHeader(reader, type, sequence, fields) && type == SPOTIFY_HUB_REQUEST && _hasState)
+        {
+            // Only to the client that asked, with the sequence number the
+            // next delta follows on from
+            send(SPOTIFY_HUB_FULL, SPOTIFY_HUB_ALL, _udp->remoteIP(), _udp->remotePort());
+        }
+    }
+
+    unsigned long now = millis();
+    if (pollIntervalMs > 0 && (_lastPoll == 0 || now - _lastPoll >= pollIntervalMs))
+    {
+        _lastPoll = now;
+        CurrentlyPlayingFixed currentlyPlaying;
+        PlayerDetailsFixed playerDetails;
+        if (_spotify->getPlayerState(playerDetails, currentlyPlaying, market))
+        {
+            publish(currentlyPlaying, playerDetails, true);
+        }
+        else if (_spotify->getLastStatusCode() == 204)
+        {
+            memset(&currentlyPlaying, 0, sizeof(currentlyPlaying));
+            memset(&playerDetails, 0, sizeof(playerDetails));
+            publish(currentlyPlaying, playerDetails, false);
+        }
+        // Errors keep the last state, the clients can't do better either
+    }
+    else if (_hasState && now - _lastFullState >= fullStateIntervalMs)
+    {
+        _sequence++;
+        send(SPOTIFY_HUB_FULL, SPOTIFY_HUB_ALL, _group, _port);
+        _lastFullState = now;
+    }
+}
+
+uint8_t SpotifyHub::changedFields(const SpotifyHubState &state, unsigned long now)
+{
+    if (!_hasState)
+    {
+        return SPOTIFY_HUB_ALL;
+    }
+
+    uint8_t fields = stateChanges(_state, state);
+    // Where the clients think it is
+    long expected = _state.playerDetails.progressMs;
+    if (_state.playerDetails.isPlaying)
+    {
+        expected += now - _progressAt;
+    }
+    if ((fields & (SPOTIFY_HUB_TRACK | SPOTIFY_HUB_PLAYING)) ||
+        labs(state.playerDetails.progressMs - expected) > (long)progressDriftMs)
+    {
+        fields |= SPOTIFY_HUB_PROGRESS;
+    }
+    return fields;
+}
+
+void SpotifyHub::publish(const CurrentlyPlayingFixed &currentlyPlaying, const PlayerDetailsFixed &playerDetails, bool active)
+{
+    unsigned long now = millis();
+    SpotifyHubState state;
+    state.active = active;
+    state.currentlyPlaying = currentlyPlaying;
+    state.playerDetails = playerDetails;
+    // The progress of the player state is the one that is sent
+    state.playerDetails.progressMs = currentlyPlaying.progressMs;
+
+    uint8_t fields = changedFields(state, now);
+    if (!(fields & SPOTIFY_HUB_PROGRESS) && _hasState)
+    {
+        // Keep what the clients extrapolate from
+        state.playerDetails.progressMs = _state.playerDetails.progressMs;
+    }
+    else
+    {
+        _progressAt = now;
+    }
+    _state = state;
+    _hasState = true;
+
+    if (now - _lastFullState >= fullStateIntervalMs || fields == SPOTIFY_HUB_ALL)
+    {
+        _sequence++;
+        send(SPOTIFY_HUB_FULL, SPOTIFY_HUB_ALL, _group, _port);
+        _lastFullState = now;
+    }
+    else if (fields != 0)
+    {
+        _sequence++;
+        send(SPOTIFY_HUB_DELTA, fields, _group, _port);
+    }
+}
+
+void SpotifyHub::send(SpotifyHubPacketType type, uint8_t fields, IPAddress address, uint16_t port)
+{
+    // The progress as of now, not as of the last time it was sent
+    long progressMs = _state.playerDetails.progressMs;
+    if (_state.playerDetails.isPlaying)
+    {
+        progressMs += millis() - _progressAt;
+    }
+
+    SpotifyHubWriter writer(_packet, sizeof(_packet));
+    writeHeader(writer, type, _sequence, fields);
+    writeState(writer, _state, fields, progressMs);
+    if (writer.overflowed())
+    {
+        Serial.println(F("Hub state doesn't fit SPOTIFY_HUB_PACKET_SIZE"));
+        return;
+    }
+
+    if (!_udp->beginPacket(address, port))
+    {
+        return;
+    }
+    _udp->write(_packet, writer.length());
+    if (_udp->endPacket())
+    {
+        packetsSent++;
+        bytesSent += writer.length();
+    }
+}
+
+SpotifyHubClient::SpotifyHubClient(WiFiUDP &udp, IPAddress group, uint16_t port)
+{
+    _udp = &udp;
+    _group = group;
+    _port = port;
+    memset(&_state, 0, sizeof(_state));
+    _state.currentlyPlaying.error = true;
+    _state.playerDetails.error = true;
+    _hasState = false;
+    _synced = false;
+    _sequence = 0;
+    _changed = 0;
+    _hubKnown = false;
+    _lastPacket = 0;
+    _lastRequest = 0;
+    _progressAt = 0;
+    packetsReceived = 0;
+    packetsMissed = 0;
+}
+
+bool SpotifyHubClient::begin()
+{
+    // 224.0.0.0 to 239.255.255.255
+    if ((_group[0] & 0xF0) != 0xE0)
+    {
+        return _udp->begin(_port) == 1;
+    }
+#if defined(ESP8266)
+    // On any interface
+    return _udp->beginMulticast(IPAddress(0, 0, 0, 0), _group, _port) == 1;
+#else
+    return _udp->beginMulticast(_group, _port) == 1;
+#endif
+}
+
+bool SpotifyHubClient::loop()
+{
+    _changed = 0;
+    int size;
+    while ((size = _udp->parsePacket()) > 0)
+    {
+        int length = _udp->read(_packet, sizeof(_packet));
+        if (size > (int)sizeof(_packet) || length <= 0)
+        {
+            // Not one of ours, the rest of it is dropped by the next parsePacket()
+            continue;
+        }
+
+        SpotifyHubReader reader(_packet, length);
+        uint8_t type;
+        uint16_t sequence;
+        uint8_t fields;
+        if (!readHeader(reader, type, sequence, fields) || (type != SPOTIFY_HUB_FULL && type != SPOTIFY_HUB_DELTA))
+        {
+            continue;
+        }
+        packetsReceived++;
+        _hub = _udp->remoteIP();
+        _hubKnown = true;
+        _lastPacket = millis();
+
+        if (type == SPOTIFY_HUB_DELTA && (!_synced || sequence != (uint16_t)(_sequence + 1)))
+        {
+            // The change this one builds on is missing
+            if (_synced)
+            {
+                packetsMissed++;
+                _synced = false;
+            }
+            _sequence = sequence;
+            continue;
+        }
+        if (type == SPOTIFY_HUB_FULL && _synced && sequence != _sequence && sequence != (uint16_t)(_sequence + 1))
+        {
+            packetsMissed++;
+        }
+
+        _incoming = _state;
+        if (!readState(reader, _incoming, fields))
+        {
+            continue;
+        }
+        _incoming.currentlyPlaying.error = !_incoming.active;
+        _incoming.playerDetails.error = !_incoming.active;
+        _incoming.currentlyPlaying.truncated = false;
+        _incoming.playerDetails.truncated = false;
+        if (type == SPOTIFY_HUB_DELTA)
+        {
+            _changed |= fields;
+        }
+        else if (!_hasState)
+        {
+            _changed = SPOTIFY_HUB_ALL;
+        }
+        else
+        {
+            // Only where it differs, or the caller would redraw
+            // everything every fullStateIntervalMs
+            _changed |= stateChanges(_state, _incoming);
+            if ((_changed & (SPOTIFY_HUB_TRACK | SPOTIFY_HUB_PLAYING)) ||
+                labs(_incoming.playerDetails.progressMs - progressMs()) > SPOTIFY_HUB_PROGRESS_JUMP_MS)
+            {
+                _changed |= SPOTIFY_HUB_PROGRESS;
+            }
+        }
+        _state = _incoming;
+        if (fields & SPOTIFY_HUB_PROGRESS)
+        {
+            _progressAt = _lastPacket;
+        }
+        _hasState = true;
+        _synced = true;
+        _sequence = sequence;
+    }
+
+    if (!_synced && _hubKnown && millis() - _lastRequest >= requestIntervalMs)
+    {
+        requestState();
+    }
+    return _changed != 0;
+}
+
+uint8_t SpotifyHubClient::changedFields()
+{
+    return _changed;
+}
+
+bool SpotifyHubClient::hasState()
+{
+    return _hasState;
+}
+
+unsigned long SpotifyHubClient::ageMs()
+{
+    return millis() - _lastPacket;
+}
+
+long SpotifyHubClient::progressMs()
+{
+    long progress = _state.playerDetails.progressMs;
+    if (_state.playerDetails.isPlaying)
+    {
+        progress += millis() - _progressAt;
+        // The hub tells us about the next track on its next poll
+        if (_state.currentlyPlaying.duraitonMs > 0)
+        {
+            progress = min(progress, _state.currentlyPlaying.duraitonMs);
+        }
+    }
+    return progress;
+}
+
+void SpotifyHubClient::requestState()
+{
+    _lastRequest = millis();
+    SpotifyHubWriter writer(_packet, sizeof(_packet));
+    writeHeader(writer, SPOTIFY_HUB_REQUEST, _sequence, 0);
+    if (_udp->beginPacket(_hub, _port))
+    {
+        _udp->write(_packet, writer.length());
+        _udp->endPacket();
+    }
+}
+
+bool SpotifyHubClient::getCurrentlyPlaying(CurrentlyPlayingFixed &currentlyPlaying)
+{
+    currentlyPlaying = _state.currentlyPlaying;
+    currentlyPlaying.progressMs = progressMs();
+    return _hasState && _state.active;
+}
+
+bool SpotifyHubClient::getPlayerDetails(PlayerDetailsFixed &playerDetails)
+{
+    playerDetails = _state.playerDetails;
+    playerDetails.progressMs = progressMs();
+    return _hasState && _state.active;
+}
+
+CurrentlyPlaying SpotifyHubClient::getCurrentlyPlaying()
+{
+    const CurrentlyPlayingFixed &track = _state.currentlyPlaying;
+    CurrentlyPlaying currentlyPlaying;
+    currentlyPlaying.error = !_hasState || !_state.active;
+    if (currentlyPlaying.error)
+    {
+        return currentlyPlaying;
+    }
+
+    currentlyPlaying.firstArtistName = track.firstArtistName;
+    currentlyPlaying.firstArtistUri = track.firstArtistUri;
+    currentlyPlaying.albumName = track.albumName;
+    currentlyPlaying.albumUri = track.albumUri;
+    currentlyPlaying.trackName = track.trackName;
+    currentlyPlaying.trackUri = track.trackUri;
+    currentlyPlaying.contextUri = track.contextUri;
+    currentlyPlaying.numImages = track.numImages;
+    for (int i = 0; i < track.numImages; i++)
+    {
+        currentlyPlaying.albumImages[i].height = track.albumImages[i].height;
+        currentlyPlaying.albumImages[i].width = track.albumImages[i].width;
+        currentlyPlaying.albumImages[i].url = track.albumImages[i].url;
+    }
+    currentlyPlaying.isPlaying = track.isPlaying;
+    currentlyPlaying.progressMs = progressMs();
+    currentlyPlaying.duraitonMs = track.duraitonMs;
+    return currentlyPlaying;
+}
+
+PlayerDetails SpotifyHubClient::getPlayerDetails()
+{
+    const PlayerDetailsFixed &player = _state.playerDetails;
+    PlayerDetails playerDetails;
+    playerDetails.error = !_hasState || !_state.active;
+    if (playerDetails.error)
+    {
+        return playerDetails;
+    }
+
+    playerDetails.device.id = player.device.id;
+    playerDetails.device.name = player.device.name;
+    playerDetails.device.type = player.device.type;
+    playerDetails.device.isActive = player.device.isActive;
+    playerDetails.device.isRestricted = player.device.isRestricted;
+    playerDetails.device.isPrivateSession = player.device.isPrivateSession;
+    playerDetails.device.volumePrecent = player.device.volumePrecent;
+    playerDetails.progressMs = progressMs();
+    playerDetails.isPlaying = player.isPlaying;
+    playerDetails.repeateState = player.repeateState;
+    playerDetails.shuffleState = player.shuffleState;
+    return playerDetails;
+}
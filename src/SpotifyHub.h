@@ -0,0 +1,163 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyHub_h
+#define SpotifyHub_h
+
+#include "ArduinoSpotify.h"
+#include <WiFiUdp.h>
+
+// Where the hub publishes to by default (administratively scoped multicast),
+// a broadcast or unicast address works as well
+#define SPOTIFY_HUB_GROUP IPAddress(239, 255, 77, 77)
+#define SPOTIFY_HUB_PORT 4277
+// Enough for a full state with every string at its maximum length
+#define SPOTIFY_HUB_PACKET_SIZE 1024
+#define SPOTIFY_HUB_VERSION 1
+
+// Parts of the player state, a packet carries the ones that changed
+#define SPOTIFY_HUB_TRACK 0x01
+// Playing/paused and whether anything is playing at all
+#define SPOTIFY_HUB_PLAYING 0x02
+#define SPOTIFY_HUB_PROGRESS 0x04
+#define SPOTIFY_HUB_DEVICE 0x08
+#define SPOTIFY_HUB_VOLUME 0x10
+#define SPOTIFY_HUB_SHUFFLE_REPEAT 0x20
+#define SPOTIFY_HUB_ALL 0x3F
+
+enum SpotifyHubPacketType
+{
+  SPOTIFY_HUB_FULL = 1,
+  SPOTIFY_HUB_DELTA,
+  // Sent by a client that missed a packet, answered with a full state
+  SPOTIFY_HUB_REQUEST
+};
+
+// What the hub and its clients share
+struct SpotifyHubState
+{
+  // False while nothing is playing (Spotify answered 204)
+  bool active;
+  CurrentlyPlayingFixed currentlyPlaying;
+  PlayerDetailsFixed playerDetails;
+};
+
+// Polls the player state with one ArduinoSpotify and publishes what changed
+// to any number of SpotifyHubClients on the LAN, so a dozen displays cost one
+// poll and one TLS session instead of twelve. Deltas are only sent when
+// something changed, the full state every fullStateIntervalMs.
+class SpotifyHub
+{
+public:
+  SpotifyHub(ArduinoSpotify &spotify, WiFiUDP &udp, IPAddress group = SPOTIFY_HUB_GROUP, uint16_t port = SPOTIFY_HUB_PORT);
+
+  // Listens on the port for clients asking for the full state
+  bool begin();
+  // Call from loop(): answers clients and polls every pollIntervalMs
+  void loop();
+  // Publishes a state you fetched yourself, active = false for nothing playing.
+  // Use it with pollIntervalMs = 0 to keep loop() from polling.
+  void publish(const CurrentlyPlayingFixed &currentlyPlaying, const PlayerDetailsFixed &playerDetails, bool active = true);
+
+  unsigned long pollIntervalMs = 5000;
+  // For clients that missed a packet or just started, and to tell them the hub is still there
+  unsigned long fullStateIntervalMs = 15000;
+  // Clients move the progress on by themselves, it's only sent again when
+  // it is off by more than this (after a seek etc.)
+  unsigned long progressDriftMs = 1000;
+  const char *market = "";
+
+  unsigned long packetsSent;
+  unsigned long bytesSent;
+
+private:
+  ArduinoSpotify *_spotify;
+  WiFiUDP *_udp;
+  IPAddress _group;
+  uint16_t _port;
+  SpotifyHubState _state;
+  bool _hasState;
+  uint16_t _sequence;
+  unsigned long _lastPoll;
+  unsigned long _lastFullState;
+  // When the progress the clients have was sent
+  unsigned long _progressAt;
+  uint8_t _packet[SPOTIFY_HUB_PACKET_SIZE];
+
+  uint8_t changedFields(const SpotifyHubState &state, unsigned long now);
+  void send(SpotifyHubPacketType type, uint8_t fields, IPAddress address, uint16_t port);
+};
+
+// Gets the player state from a SpotifyHub instead of Spotify, no credentials
+// (or TLS) needed. Missed packets are noticed by their sequence number, the
+// client then asks the hub for the full state.
+class SpotifyHubClient
+{
+public:
+  SpotifyHubClient(WiFiUDP &udp, IPAddress group = SPOTIFY_HUB_GROUP, uint16_t port = SPOTIFY_HUB_PORT);
+
+  // Joins the multicast group (or listens on the port for other addresses)
+  bool begin();
+  // Call from loop(), returns true if the state changed
+  bool loop();
+  // SPOTIFY_HUB_* parts that changed in the last loop() that returned true
+  uint8_t changedFields();
+
+  // False until the first full state arrived
+  bool hasState();
+  // ms since the hub was last heard from
+  unsigned long ageMs();
+
+  // Same as the ArduinoSpotify methods, false (or error set) while nothing
+  // is playing or there is no state yet. The progress is moved on while playing.
+  bool getCurrentlyPlaying(CurrentlyPlayingFixed &currentlyPlaying);
+  bool getPlayerDetails(PlayerDetailsFixed &playerDetails);
+  CurrentlyPlaying getCurrentlyPlaying();
+  PlayerDetails getPlayerDetails();
+
+  // A client that missed a packet asks for the full state at most this often
+  unsigned long requestIntervalMs = 1000;
+
+  unsigned long packetsReceived;
+  unsigned long packetsMissed;
+
+private:
+  WiFiUDP *_udp;
+  IPAddress _group;
+  uint16_t _port;
+  SpotifyHubState _state;
+  SpotifyHubState _incoming;
+  bool _hasState;
+  // Every packet since the last full state was applied
+  bool _synced;
+  uint16_t _sequence;
+  uint8_t _changed;
+  IPAddress _hub;
+  bool _hubKnown;
+  unsigned long _lastPacket;
+  unsigned long _lastRequest;
+  unsigned long _progressAt;
+  uint8_t _packet[SPOTIFY_HUB_PACKET_SIZE];
+
+  long progressMs();
+  void requestState();
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyLockFree_h
+#define SpotifyLockFree_h
+
+#include <Arduino.h>
+
+// Ring buffer for exactly one task pushing and one task popping, neither
+// of them ever waits for the other. N has to be a power of two.
+template <typename T, uint8_t N>
+class SpotifySpscRing
+{
+public:
+  SpotifySpscRing() : _head(0), _tail(0) {}
+
+  // Producer only, false if the ring is full
+  bool push(const T &item)
+  {
+    uint8_t head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+    uint8_t next = (head + 1) & (N - 1);
+    if (next == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE))
+    {
+      return false;
+    }
+    _items[head] = item;
+    // The item has to be written before the consumer can see it
+    __atomic_store_n(&_head, next, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Consumer only, false if the ring is empty
+  bool pop(T &item)
+  {
+    uint8_t tail = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+    {
+      return false;
+    }
+    item = _items[tail];
+    // Only then may the producer reuse the slot
+    __atomic_store_n(&_tail, (uint8_t)((tail + 1) & (N - 1)), __ATOMIC_RELEASE);
+    return true;
+  }
+
+private:
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "N has to be a power of two");
+  T _items[N];
+  uint8_t _head;
+  uint8_t _tail;
+};
+
+// Hands the latest value from one writer to any number of readers without
+// locks. The writer fills the buffer that isn't published and then flips
+// them; a reader only has to retry if the writer published twice while it
+// was copying. T has to be a plain struct, it is copied word by word.
+template <typename T>
+class SpotifySnapshotBuffer
+{
+public:
+  SpotifySnapshotBuffer() : _published(0)
+  {
+    _sequence[0] = 0;
+    _sequence[1] = 0;
+  }
+
+  // Writer only
+  void publish(const T &value)
+  {
+    uint8_t index = 1 - __atomic_load_n(&_published, __ATOMIC_RELAXED);
+    // Odd while the buffer is written
+    __atomic_store_n(&_sequence[index], _sequence[index] + 1, __ATOMIC_RELAXED);
+    copy<__ATOMIC_RELAXED, __ATOMIC_RELEASE>(&_values[index], &value);
+    __atomic_store_n(&_sequence[index], _sequence[index] + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&_published, index, __ATOMIC_RELEASE);
+  }
+
+  // False if nothing was published yet
+  bool read(T &value)
+  {
+    while (true)
+    {
+      uint8_t index = __atomic_load_n(&_published, __ATOMIC_ACQUIRE);
+      uint32_t before = __atomic_load_n(&_sequence[index], __ATOMIC_ACQUIRE);
+      if (before == 0)
+      {
+        return false;
+      }
+      if (before & 1)
+      {
+        continue;
+      }
+      copy<__ATOMIC_ACQUIRE, __ATOMIC_RELAXED>(&value, &_values[index]);
+      if (__atomic_load_n(&_sequence[index], __ATOMIC_RELAXED) == before)
+      {
+        return true;
+      }
+    }
+  }
+
+private:
+  T _values[2];
+  uint32_t _sequence[2];
+  uint8_t _published;
+
+  // A reader may copy while the writer overwrites the same buffer (it
+  // throws the copy away then), so the copy is done with atomics. A reader
+  // that sees a single word of the next value through the acquire loads
+  // also sees the odd sequence before it, and retries.
+  template <int LoadOrder, int StoreOrder>
+  static void copy(T *to, const T *from)
+  {
+    if (alignof(T) % sizeof(uint32_t) == 0)
+    {
+      uint32_t *toWords = (uint32_t *)to;
+      const uint32_t *fromWords = (const uint32_t *)from;
+      for (size_t i = 0; i < sizeof(T) / sizeof(uint32_t); i++)
+      {
+        __atomic_store_n(&toWords[i], __atomic_load_n(&fromWords[i], LoadOrder), StoreOrder);
+      }
+    }
+    else
+    {
+      uint8_t *toBytes = (uint8_t *)to;
+      const uint8_t *fromBytes = (const uint8_t *)from;
+      for (size_t i = 0; i < sizeof(T); i++)
+      {
+        __atomic_store_n(&toBytes[i], __atomic_load_n(&fromBytes[i], LoadOrder), StoreOrder);
+      }
+    }
+  }
+};
+
+#endif
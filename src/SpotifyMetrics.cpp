@@ -0,0 +1,175 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyMetrics.h"
+
+SpotifyMetrics::SpotifyMetrics()
+{
+    _callback = NULL;
+    reset();
+}
+
+void SpotifyMetrics::onRequest(SpotifyMetricsCallback callback)
+{
+    _callback = callback;
+}
+
+void SpotifyMetrics::reset()
+{
+    _endpointCount = 0;
+    _requests = 0;
+    memset(&_last, 0, sizeof(_last));
+}
+
+SpotifyMetrics::Endpoint *SpotifyMetrics::findEndpoint(const char *name, bool create)
+{
+    for (uint8_t i = 0; i < _endpointCount; i++)
+    {
+        if (strcmp(_endpoints[i].name, name) == 0)
+        {
+            return &_endpoints[i];
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    Endpoint *endpoint;
+    if (_endpointCount < SPOTIFY_METRICS_ENDPOINTS)
+    {
+        endpoint = &_endpoints[_endpointCount++];
+    }
+    else
+    {
+        // Replace the one that wasn't requested for the longest time
+        endpoint = &_endpoints[0];
+        for (uint8_t i = 1; i < _endpointCount; i++)
+        {
+            if (_endpoints[i].lastUsed < endpoint->lastUsed)
+            {
+                endpoint = &_endpoints[i];
+            }
+        }
+    }
+
+    strncpy(endpoint->name, name, SPOTIFY_METRICS_ENDPOINT_LENGTH - 1);
+    endpoint->name[SPOTIFY_METRICS_ENDPOINT_LENGTH - 1] = '\0';
+    endpoint->count = 0;
+    endpoint->next = 0;
+    endpoint->requests = 0;
+    endpoint->errors = 0;
+    return endpoint;
+}
+
+void SpotifyMetrics::record(const SpotifyRequestMetrics &metrics)
+{
+    _last = metrics;
+    Endpoint *endpoint = findEndpoint(metrics.endpoint, true);
+    endpoint->lastUsed = ++_requests;
+    endpoint->requests++;
+    if (metrics.statusCode < 200 || metrics.statusCode >= 300)
+    {
+        endpoint->errors++;
+    }
+
+    for (uint8_t phase = 0; phase < SPOTIFY_PHASES; phase++)
+    {
+        endpoint->samples[endpoint->next][phase] = min(metrics.phaseMs[phase], 65535UL);
+    }
+    endpoint->next = (endpoint->next + 1) % SPOTIFY_METRICS_WINDOW;
+    if (endpoint->count < SPOTIFY_METRICS_WINDOW)
+    {
+        endpoint->count++;
+    }
+
+    if (_callback != NULL)
+    {
+        _callback(metrics);
+    }
+}
+
+uint8_t SpotifyMetrics::endpointCount()
+{
+    return _endpointCount;
+}
+
+const char *SpotifyMetrics::endpointName(uint8_t index)
+{
+    return (index < _endpointCount) ? _endpoints[index].name : NULL;
+}
+
+bool SpotifyMetrics::getSummary(const char *endpoint, SpotifyMetricsPhase phase, SpotifyMetricsSummary &summary)
+{
+    Endpoint *found = findEndpoint(endpoint, false);
+    if (found == NULL)
+    {
+        return false;
+    }
+    return getSummary((uint8_t)(found - _endpoints), phase, summary);
+}
+
+bool SpotifyMetrics::getSummary(uint8_t index, SpotifyMetricsPhase phase, SpotifyMetricsSummary &summary)
+{
+    if (index >= _endpointCount || _endpoints[index].count == 0 || phase >= SPOTIFY_PHASES)
+    {
+        return false;
+    }
+
+    // Sort a copy of the window, it's tiny
+    Endpoint *endpoint = &_endpoints[index];
+    uint16_t sorted[SPOTIFY_METRICS_WINDOW];
+    unsigned long sum = 0;
+    for (uint8_t i = 0; i < endpoint->count; i++)
+    {
+        uint16_t value = endpoint->samples[i][phase];
+        sum += value;
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > value)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+
+    summary.samples = endpoint->count;
+    summary.minMs = sorted[0];
+    summary.avgMs = sum / endpoint->count;
+    // Nearest rank
+    summary.p95Ms = sorted[(endpoint->count * 95 + 99) / 100 - 1];
+    return true;
+}
+
+unsigned long SpotifyMetrics::requestCount(uint8_t index)
+{
+    return (index < _endpointCount) ? _endpoints[index].requests : 0;
+}
+
+unsigned long SpotifyMetrics::errorCount(uint8_t index)
+{
+    return (index < _endpointCount) ? _endpoints[index].errors : 0;
+}
+
+const SpotifyRequestMetrics &SpotifyMetrics::lastRequest()
+{
+    return _last;
+}
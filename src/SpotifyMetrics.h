@@ -0,0 +1,125 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyMetrics_h
+#define SpotifyMetrics_h
+
+#include <Arduino.h>
+
+// Endpoints that get their own statistics, the least recently used one is replaced
+#ifndef SPOTIFY_METRICS_ENDPOINTS
+#define SPOTIFY_METRICS_ENDPOINTS 8
+#endif
+// Requests per endpoint the min/avg/p95 values are calculated from
+#ifndef SPOTIFY_METRICS_WINDOW
+#define SPOTIFY_METRICS_WINDOW 16
+#endif
+// Path without the query, e.g. "/v1/me/player/currently-playing"
+#define SPOTIFY_METRICS_ENDPOINT_LENGTH 40
+
+enum SpotifyMetricsPhase
+{
+  // Refreshing the access token before the request
+  SPOTIFY_PHASE_TOKEN_REFRESH,
+  // TCP connect and TLS handshake, 0 when the connection was reused
+  SPOTIFY_PHASE_CONNECT,
+  SPOTIFY_PHASE_SEND,
+  // Until the response headers were read
+  SPOTIFY_PHASE_WAIT,
+  SPOTIFY_PHASE_BODY,
+  SPOTIFY_PHASE_PARSE,
+  // Player commands only: from the call (or queueing the async version)
+  // until the response arrived, i.e. button-to-effect latency
+  SPOTIFY_PHASE_COMMAND,
+  SPOTIFY_PHASE_TOTAL,
+  SPOTIFY_PHASES
+};
+
+struct SpotifyRequestMetrics
+{
+  char endpoint[SPOTIFY_METRICS_ENDPOINT_LENGTH];
+  int statusCode;
+  // A kept-alive connection was used
+  bool reused;
+  bool async;
+  unsigned long phaseMs[SPOTIFY_PHASES];
+  size_t bytesSent;
+  size_t bytesReceived;
+  uint32_t heapBefore;
+  uint32_t heapAfter;
+};
+
+struct SpotifyMetricsSummary
+{
+  unsigned long minMs;
+  unsigned long avgMs;
+  unsigned long p95Ms;
+  // Requests the values are calculated from
+  uint8_t samples;
+};
+
+typedef void (*SpotifyMetricsCallback)(const SpotifyRequestMetrics &metrics);
+
+// Keeps the phase timings of the last SPOTIFY_METRICS_WINDOW requests to each
+// endpoint. Pass it to ArduinoSpotify::setMetrics().
+class SpotifyMetrics
+{
+public:
+  SpotifyMetrics();
+
+  // Called for every finished request
+  void onRequest(SpotifyMetricsCallback callback);
+  void record(const SpotifyRequestMetrics &metrics);
+  void reset();
+
+  uint8_t endpointCount();
+  // NULL if there is no endpoint at that index
+  const char *endpointName(uint8_t index);
+  // Returns false if nothing was recorded for the endpoint
+  bool getSummary(const char *endpoint, SpotifyMetricsPhase phase, SpotifyMetricsSummary &summary);
+  bool getSummary(uint8_t index, SpotifyMetricsPhase phase, SpotifyMetricsSummary &summary);
+  // All requests of the endpoint since reset(), and those that failed
+  unsigned long requestCount(uint8_t index);
+  unsigned long errorCount(uint8_t index);
+  const SpotifyRequestMetrics &lastRequest();
+
+private:
+  struct Endpoint
+  {
+    char name[SPOTIFY_METRICS_ENDPOINT_LENGTH];
+    // Capped at 65535ms
+    uint16_t samples[SPOTIFY_METRICS_WINDOW][SPOTIFY_PHASES];
+    uint8_t count;
+    uint8_t next;
+    unsigned long requests;
+    unsigned long errors;
+    unsigned long lastUsed;
+  };
+
+  Endpoint _endpoints[SPOTIFY_METRICS_ENDPOINTS];
+  uint8_t _endpointCount;
+  unsigned long _requests;
+  SpotifyRequestMetrics _last;
+  SpotifyMetricsCallback _callback;
+
+  Endpoint *findEndpoint(const char *name, bool create);
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPlaybackTracker.h"
+
+SpotifyPlaybackTracker::SpotifyPlaybackTracker()
+{
+    _hasState = false;
+    _isPlaying = false;
+    _progressMs = 0;
+    _durationMs = 0;
+    _trackHash = 0;
+    _lastDriftMs = 0;
+    _fetchCount = 0;
+    _updatedAt = 0;
+    _nextFetchAt = 0;
+    // Nothing known yet, fetch right away
+    _fetchForced = true;
+}
+
+void SpotifyPlaybackTracker::update(const CurrentlyPlaying &currentlyPlaying)
+{
+    updateState(currentlyPlaying.error, currentlyPlaying.isPlaying, currentlyPlaying.progressMs,
+                currentlyPlaying.duraitonMs, spotifyHash(currentlyPlaying.trackUri.c_str()));
+}
+
+void SpotifyPlaybackTracker::update(const CurrentlyPlayingFixed &currentlyPlaying)
+{
+    updateState(currentlyPlaying.error, currentlyPlaying.isPlaying, currentlyPlaying.progressMs,
+                currentlyPlaying.duraitonMs, spotifyHash(currentlyPlaying.trackUri));
+}
+
+void SpotifyPlaybackTracker::updateState(bool error, bool isPlaying, long progressMs, long durationMs, uint32_t trackHash)
+{
+    _fetchCount++;
+
+    if (error)
+    {
+        // Keep extrapolating what we have, just try again a bit later
+        scheduleFetch(errorIntervalMs);
+        return;
+    }
+
+    if (_hasState && _isPlaying && isPlaying && _trackHash == trackHash)
+    {
+        _lastDriftMs = positionMs() - progressMs;
+    }
+    else
+    {
+        _lastDriftMs = 0;
+    }
+
+    _updatedAt = millis();
+    _hasState = true;
+    _isPlaying = isPlaying;
+    _progressMs = progressMs;
+    _durationMs = durationMs;
+    _trackHash = trackHash;
+
+    if (!_isPlaying)
+    {
+        scheduleFetch(pausedIntervalMs);
+        return;
+    }
+
+    // Mid-track nothing changes unless someone else uses the player, so only
+    // check rarely, but be there right after the track should have ended
+    unsigned long delayMs = playingIntervalMs;
+    if (_durationMs > _progressMs)
+    {
+        unsigned long untilTrackEnd = (_durationMs - _progressMs) + trackEndDelayMs;
+        if (untilTrackEnd < delayMs)
+        {
+            delayMs = untilTrackEnd;
+        }
+    }
+    else
+    {
+        delayMs = trackEndDelayMs;
+    }
+    scheduleFetch(delayMs);
+}
+
+void SpotifyPlaybackTracker::commandSent()
+{
+    if (msUntilNextFetch() > afterCommandDelayMs)
+    {
+        scheduleFetch(afterCommandDelayMs);
+    }
+}
+
+void SpotifyPlaybackTracker::scheduleFetch(unsigned long delayMs)
+{
+    _nextFetchAt = millis() + delayMs;
+    _fetchForced = false;
+}
+
+bool SpotifyPlaybackTracker::fetchDue()
+{
+    return msUntilNextFetch() == 0;
+}
+
+unsigned long SpotifyPlaybackTracker::msUntilNextFetch()
+{
+    if (_fetchForced)
+    {
+        return 0;
+    }
+    // Works across millis() overflows as long as the delays stay below ~24 days
+    long remaining = (long)(_nextFetchAt - millis());
+    return (remaining > 0) ? remaining : 0;
+}
+
+long SpotifyPlaybackTracker::positionMs()
+{
+    if (!_isPlaying)
+    {
+        return _progressMs;
+    }
+    long position = _progressMs + (long)(millis() - _updatedAt);
+    if (_durationMs > 0 && position > _durationMs)
+    {
+        return _durationMs;
+    }
+    return position;
+}
+
+long SpotifyPlaybackTracker::durationMs()
+{
+    return _durationMs;
+}
+
+bool SpotifyPlaybackTracker::isPlaying()
+{
+    return _isPlaying;
+}
+
+bool SpotifyPlaybackTracker::hasState()
+{
+    return _hasState;
+}
+
+long SpotifyPlaybackTracker::lastDriftMs()
+{
+    return _lastDriftMs;
+}
+
+unsigned long SpotifyPlaybackTracker::fetchCount()
+{
+    return _fetchCount;
+}
@@ -0,0 +1,81 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPlaybackTracker_h
+#define SpotifyPlaybackTracker_h
+
+#include "ArduinoSpotify.h"
+
+// Keeps track of the playback position between requests and decides when
+// the next real getCurrentlyPlaying is needed:
+//
+//   if (tracker.fetchDue())
+//   {
+//       tracker.update(spotify.getCurrentlyPlaying());
+//   }
+//   drawProgress(tracker.positionMs(), tracker.durationMs());
+class SpotifyPlaybackTracker
+{
+public:
+  SpotifyPlaybackTracker();
+
+  // Call with the result of every real fetch
+  void update(const CurrentlyPlaying &currentlyPlaying);
+  void update(const CurrentlyPlayingFixed &currentlyPlaying);
+  // Call after a player command so the result gets picked up soon
+  void commandSent();
+
+  bool fetchDue();
+  unsigned long msUntilNextFetch();
+
+  long positionMs();
+  long durationMs();
+  bool isPlaying();
+  bool hasState();
+  // Difference between the extrapolated and the fetched position on the last
+  // update (only while the same track kept playing)
+  long lastDriftMs();
+  unsigned long fetchCount();
+
+  // Longest time between fetches while a track is playing
+  unsigned long playingIntervalMs = 30000;
+  unsigned long pausedIntervalMs = 10000;
+  // How long after the expected end of the track to fetch again
+  unsigned long trackEndDelayMs = 1000;
+  unsigned long afterCommandDelayMs = 500;
+  unsigned long errorIntervalMs = 5000;
+
+private:
+  bool _hasState;
+  bool _isPlaying;
+  long _progressMs;
+  long _durationMs;
+  uint32_t _trackHash;
+  long _lastDriftMs;
+  unsigned long _fetchCount;
+  unsigned long _updatedAt;
+  unsigned long _nextFetchAt;
+  bool _fetchForced;
+
+  void updateState(bool error, bool isPlaying, long progressMs, long durationMs, uint32_t trackHash);
+  void scheduleFetch(unsigned long delayMs);
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPlayerObserver.h"
+
+SpotifyPlayerObserver::SpotifyPlayerObserver()
+{
+    _trackChanged = NULL;
+    _playStateChanged = NULL;
+    _deviceChanged = NULL;
+    _volumeChanged = NULL;
+    _shuffleRepeatChanged = NULL;
+    reset();
+}
+
+void SpotifyPlayerObserver::reset()
+{
+    _hasTrack = false;
+    _hasPlayState = false;
+    _hasDevice = false;
+    _hasVolume = false;
+    _hasShuffleRepeat = false;
+}
+
+void SpotifyPlayerObserver::onTrackChanged(SpotifyTrackChangedCallback callback)
+{
+    _trackChanged = callback;
+}
+
+void SpotifyPlayerObserver::onPlayStateChanged(SpotifyPlayStateChangedCallback callback)
+{
+    _playStateChanged = callback;
+}
+
+void SpotifyPlayerObserver::onDeviceChanged(SpotifyDeviceChangedCallback callback)
+{
+    _deviceChanged = callback;
+}
+
+void SpotifyPlayerObserver::onVolumeChanged(SpotifyVolumeChangedCallback callback)
+{
+    _volumeChanged = callback;
+}
+
+void SpotifyPlayerObserver::onShuffleRepeatChanged(SpotifyShuffleRepeatChangedCallback callback)
+{
+    _shuffleRepeatChanged = callback;
+}
+
+void SpotifyPlayerObserver::updatePlayState(bool isPlaying)
+{
+    if (_hasPlayState && _isPlaying == isPlaying)
+    {
+        return;
+    }
+    _hasPlayState = true;
+    _isPlaying = isPlaying;
+    if (_playStateChanged != NULL)
+    {
+        _playStateChanged(isPlaying);
+    }
+}
+
+void SpotifyPlayerObserver::update(const CurrentlyPlaying &currentlyPlaying)
+{
+    if (currentlyPlaying.error)
+    {
+        return;
+    }
+
+    uint32_t trackHash = spotifyHash(currentlyPlaying.trackUri.c_str());
+    if (!_hasTrack || _trackHash != trackHash)
+    {
+        _hasTrack = true;
+        _trackHash = trackHash;
+        if (_trackChanged != NULL)
+        {
+            _trackChanged(currentlyPlaying);
+        }
+    }
+
+    updatePlayState(currentlyPlaying.isPlaying);
+}
+
+void SpotifyPlayerObserver::update(const PlayerDetails &playerDetails)
+{
+    if (playerDetails.error)
+    {
+        return;
+    }
+
+    uint32_t deviceHash = spotifyHash(playerDetails.device.id.c_str());
+    if (!_hasDevice || _deviceHash != deviceHash)
+    {
+        _hasDevice = true;
+        _deviceHash = deviceHash;
+        if (_deviceChanged != NULL)
+        {
+            _deviceChanged(playerDetails.device);
+        }
+    }
+
+    if (!_hasVolume || _volume != playerDetails.device.volumePrecent)
+    {
+        _hasVolume = true;
+        _volume = playerDetails.device.volumePrecent;
+        if (_volumeChanged != NULL)
+        {
+            _volumeChanged(_volume);
+        }
+    }
+
+    if (!_hasShuffleRepeat || _shuffle != playerDetails.shuffleState || _repeat != playerDetails.repeateState)
+    {
+        _hasShuffleRepeat = true;
+        _shuffle = playerDetails.shuffleState;
+        _repeat = playerDetails.repeateState;
+        if (_shuffleRepeatChanged != NULL)
+        {
+            _shuffleRepeatChanged(_shuffle, _repeat);
+        }
+    }
+
+    updatePlayState(playerDetails.isPlaying);
+}
+
+void SpotifyPlayerObserver::update(const SpotifyAsyncResult &result)
+{
+    if (result.error)
+    {
+        return;
+    }
+    if (result.currentlyPlaying != NULL)
+    {
+        update(*result.currentlyPlaying);
+    }
+    if (result.playerDetails != NULL)
+    {
+        update(*result.playerDetails);
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPlayerObserver_h
+#define SpotifyPlayerObserver_h
+
+#include "ArduinoSpotify.h"
+
+typedef void (*SpotifyTrackChangedCallback)(const CurrentlyPlaying &currentlyPlaying);
+typedef void (*SpotifyPlayStateChangedCallback)(bool isPlaying);
+typedef void (*SpotifyDeviceChangedCallback)(const SpotifyDevice &device);
+typedef void (*SpotifyVolumeChangedCallback)(uint8_t volumePercent);
+typedef void (*SpotifyShuffleRepeatChangedCallback)(bool shuffle, RepeatOptions repeat);
+
+// Feed it every result and it calls back only when something changed.
+// Only hashes of the track URI and device ID are kept, not the strings.
+class SpotifyPlayerObserver
+{
+public:
+  SpotifyPlayerObserver();
+
+  void onTrackChanged(SpotifyTrackChangedCallback callback);
+  void onPlayStateChanged(SpotifyPlayStateChangedCallback callback);
+  void onDeviceChanged(SpotifyDeviceChangedCallback callback);
+  void onVolumeChanged(SpotifyVolumeChangedCallback callback);
+  void onShuffleRepeatChanged(SpotifyShuffleRepeatChangedCallback callback);
+
+  void update(const CurrentlyPlaying &currentlyPlaying);
+  void update(const PlayerDetails &playerDetails);
+  // For the results of the async methods
+  void update(const SpotifyAsyncResult &result);
+  // Everything counts as changed on the next update
+  void reset();
+
+private:
+  SpotifyTrackChangedCallback _trackChanged;
+  SpotifyPlayStateChangedCallback _playStateChanged;
+  SpotifyDeviceChangedCallback _deviceChanged;
+  SpotifyVolumeChangedCallback _volumeChanged;
+  SpotifyShuffleRepeatChangedCallback _shuffleRepeatChanged;
+
+  bool _hasTrack;
+  uint32_t _trackHash;
+  bool _hasPlayState;
+  bool _isPlaying;
+  bool _hasDevice;
+  uint32_t _deviceHash;
+  bool _hasVolume;
+  uint8_t _volume;
+  bool _hasShuffleRepeat;
+  bool _shuffle;
+  RepeatOptions _repeat;
+
+  void updatePlayState(bool isPlaying);
+};
+
+#endif
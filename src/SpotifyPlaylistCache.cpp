@@ -0,0 +1,346 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPlaylistCache.h"
+
+// "SPL" + format version
+#define SPOTIFY_PLAYLIST_FILE_MAGIC 0x53504c01
+
+SpotifyFilePlaylistStore::SpotifyFilePlaylistStore(fs::FS &fs, const char *directory)
+{
+    _fs = &fs;
+    _directory = directory;
+    _writingId[0] = '\0';
+}
+
+void SpotifyFilePlaylistStore::playlistPath(const char *playlistId, const char *extension, char *path, size_t pathSize)
+{
+    snprintf(path, pathSize, "%s/%s.%s", _directory, playlistId, extension);
+}
+
+bool SpotifyFilePlaylistStore::openPlaylist(const char *playlistId, fs::File &file, SpotifyPlaylistInfo &info)
+{
+    char path[SPOTIFY_PLAYLIST_CACHE_MAX_PATH];
+    playlistPath(playlistId, "bin", path, sizeof(path));
+    file = _fs->open(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    uint32_t magic;
+    if (file.read((uint8_t *)&magic, sizeof(magic)) != sizeof(magic) || magic != SPOTIFY_PLAYLIST_FILE_MAGIC ||
+        file.read((uint8_t *)&info, sizeof(info)) != sizeof(info))
+    {
+        file.close();
+        return false;
+    }
+    info.snapshotId[SPOTIFY_SNAPSHOT_ID_LENGTH - 1] = '\0';
+    return true;
+}
+
+bool SpotifyFilePlaylistStore::getInfo(const char *playlistId, SpotifyPlaylistInfo &info)
+{
+    fs::File file;
+    if (!openPlaylist(playlistId, file, info))
+    {
+        return false;
+    }
+    file.close();
+    return true;
+}
+
+// Tracks are stored as their strings (each ending with a 0) followed by the
+// duration and flags, usually about 150 bytes instead of sizeof(SpotifyTrackFixed)
+static bool writeString(fs::File &file, const char *value)
+{
+    size_t length = strlen(value) + 1;
+    return file.write((const uint8_t *)value, length) == length;
+}
+
+static bool readString(fs::File &file, char *value, size_t size)
+{
+    size_t length = file.readBytesUntil('\0', value, size);
+    if (length >= size)
+    {
+        // Longer than it was when it was written, the file is damaged
+        return false;
+    }
+    value[length] = '\0';
+    return true;
+}
+
+int SpotifyFilePlaylistStore::readTracks(const char *playlistId, SpotifyTrackCallback callback, void *context)
+{
+    fs::File file;
+    SpotifyPlaylistInfo info;
+    if (!openPlaylist(playlistId, file, info))
+    {
+        return -1;
+    }
+
+    SpotifyTrackFixed track;
+    int32_t durationMs;
+    uint8_t flags;
+    uint32_t index = 0;
+    while (index < info.trackCount)
+    {
+        if (!readString(file, track.name, sizeof(track.name)) ||
+            !readString(file, track.uri, sizeof(track.uri)) ||
+            !readString(file, track.firstArtistName, sizeof(track.firstArtistName)) ||
+            !readString(file, track.firstArtistUri, sizeof(track.firstArtistUri)) ||
+            !readString(file, track.albumName, sizeof(track.albumName)) ||
+            !readString(file, track.albumUri, sizeof(track.albumUri)) ||
+            !readString(file, track.timestamp, sizeof(track.timestamp)) ||
+            file.read((uint8_t *)&durationMs, sizeof(durationMs)) != sizeof(durationMs) ||
+            file.read(&flags, sizeof(flags)) != sizeof(flags))
+        {
+            Serial.println(F("Stored playlist is damaged"));
+            file.close();
+            return -1;
+        }
+        track.durationMs = durationMs;
+        track.isLocal = flags & 1;
+        track.truncated = flags & 2;
+
+        if (!callback(track, index++, context))
+        {
+            break;
+        }
+    }
+
+    file.close();
+    return index;
+}
+
+bool SpotifyFilePlaylistStore::beginWrite(const char *playlistId)
+{
+    abortWrite();
+
+    // LittleFS needs the directory, SPIFFS doesn't know about directories
+    _fs->mkdir(_directory);
+
+    char path[SPOTIFY_PLAYLIST_CACHE_MAX_PATH];
+    playlistPath(playlistId, "tmp", path, sizeof(path));
+    _writing = _fs->open(path, "w");
+    if (!_writing)
+    {
+        Serial.println(F("Could not create playlist file"));
+        return false;
+    }
+    strncpy(_writingId, playlistId, sizeof(_writingId) - 1);
+    _writingId[sizeof(_writingId) - 1] = '\0';
+
+    // The header is filled in by finishWrite()
+    uint8_t header[sizeof(uint32_t) + sizeof(SpotifyPlaylistInfo)] = {0};
+    return _writing.write(header, sizeof(header)) == sizeof(header);
+}
+
+bool SpotifyFilePlaylistStore::writeTrack(const SpotifyTrackFixed &track)
+{
+    if (!_writing)
+    {
+        return false;
+    }
+
+    int32_t durationMs = track.durationMs;
+    uint8_t flags = (track.isLocal ? 1 : 0) | (track.truncated ? 2 : 0);
+    return writeString(_writing, track.name) &&
+           writeString(_writing, track.uri) &&
+           writeString(_writing, track.firstArtistName) &&
+           writeString(_writing, track.firstArtistUri) &&
+           writeString(_writing, track.albumName) &&
+           writeString(_writing, track.albumUri) &&
+           writeString(_writing, track.timestamp) &&
+           _writing.write((const uint8_t *)&durationMs, sizeof(durationMs)) == sizeof(durationMs) &&
+           _writing.write(&flags, sizeof(flags)) == sizeof(flags);
+}
+
+bool SpotifyFilePlaylistStore::finishWrite(const SpotifyPlaylistInfo &info)
+{
+    if (!_writing)
+    {
+        return false;
+    }
+
+    uint32_t magic = SPOTIFY_PLAYLIST_FILE_MAGIC;
+    bool written = _writing.seek(0) &&
+                   _writing.write((const uint8_t *)&magic, sizeof(magic)) == sizeof(magic) &&
+                   _writing.write((const uint8_t *)&info, sizeof(info)) == sizeof(info);
+    _writing.close();
+
+    char tmpPath[SPOTIFY_PLAYLIST_CACHE_MAX_PATH];
+    playlistPath(_writingId, "tmp", tmpPath, sizeof(tmpPath));
+    if (!written)
+    {
+        Serial.println(F("Could not write playlist file"));
+        _fs->remove(tmpPath);
+        return false;
+    }
+
+    // SPIFFS can't rename onto an existing file
+    char path[SPOTIFY_PLAYLIST_CACHE_MAX_PATH];
+    playlistPath(_writingId, "bin", path, sizeof(path));
+    _fs->remove(path);
+    return _fs->rename(tmpPath, path);
+}
+
+void SpotifyFilePlaylistStore::abortWrite()
+{
+    if (!_writing)
+    {
+        return;
+    }
+
+    _writing.close();
+    char path[SPOTIFY_PLAYLIST_CACHE_MAX_PATH];
+    playlistPath(_writingId, "tmp", path, sizeof(path));
+    _fs->remove(path);
+}
+
+void SpotifyFilePlaylistStore::remove(const char *playlistId)
+{
+    char path[SPOTIFY_PLAYLIST_CACHE_MAX_PATH];
+    playlistPath(playlistId, "bin", path, sizeof(path));
+    _fs->remove(path);
+}
+
+SpotifyPlaylistCache::SpotifyPlaylistCache(ArduinoSpotify &spotify, SpotifyPlaylistStore &store)
+{
+    _spotify = &spotify;
+    _store = &store;
+    _hits = 0;
+    _misses = 0;
+    _bytesSaved = 0;
+}
+
+int SpotifyPlaylistCache::getTracks(const char *playlistId, SpotifyTrackCallback callback, void *context)
+{
+    char snapshotId[SPOTIFY_SNAPSHOT_ID_LENGTH];
+    if (!_spotify->getPlaylistSnapshot(playlistId, snapshotId, sizeof(snapshotId)))
+    {
+        if (!useStaleOnError)
+        {
+            return -1;
+        }
+        Serial.println(F("Could not check playlist, using the stored tracks"));
+        return _store->readTracks(playlistId, callback, context);
+    }
+    return getTracksWithSnapshot(playlistId, snapshotId, callback, context);
+}
+
+int SpotifyPlaylistCache::getTracks(const SpotifyPlaylistFixed &playlist, SpotifyTrackCallback callback, void *context)
+{
+    if (playlist.truncated)
+    {
+        // The snapshot_id might be cut off, ask for it instead
+        return getTracks(playlist.id, callback, context);
+    }
+    return getTracksWithSnapshot(playlist.id, playlist.snapshotId, callback, context);
+}
+
+struct SpotifyPlaylistDownload
+{
+    SpotifyPlaylistStore *store;
+    SpotifyTrackCallback callback;
+    void *context;
+    // The callback hasn't stopped yet
+    bool forwarding;
+    int forwarded;
+    bool writeFailed;
+};
+
+static bool storeTrack(const SpotifyTrackFixed &track, int index, void *context)
+{
+    SpotifyPlaylistDownload *download = (SpotifyPlaylistDownload *)context;
+    if (!download->writeFailed)
+    {
+        download->writeFailed = !download->store->writeTrack(track);
+    }
+    if (download->forwarding)
+    {
+        download->forwarded++;
+        download->forwarding = download->callback(track, index, download->context);
+    }
+    // Keep going as long as either of them still needs the tracks
+    return download->forwarding || !download->writeFailed;
+}
+
+int SpotifyPlaylistCache::getTracksWithSnapshot(const char *playlistId, const char *snapshotId, SpotifyTrackCallback callback, void *context)
+{
+    SpotifyPlaylistInfo info;
+    if (_store->getInfo(playlistId, info) && strcmp(info.snapshotId, snapshotId) == 0)
+    {
+        // Without a callback this only makes sure the playlist is stored
+        int count = callback != NULL ? _store->readTracks(playlistId, callback, context) : (int)info.trackCount;
+        if (count >= 0)
+        {
+            _hits++;
+            _bytesSaved += info.downloadBytes;
+            return count;
+        }
+        // Damaged, download it again
+    }
+
+    _misses++;
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Playlist changed: "));
+    Serial.println(playlistId);
+#endif
+
+    SpotifyPlaylistDownload download;
+    download.store = _store;
+    download.callback = callback;
+    download.context = context;
+    download.forwarding = callback != NULL;
+    download.forwarded = 0;
+    download.writeFailed = !_store->beginWrite(playlistId);
+
+    int count = _spotify->getPlaylistTracks(playlistId, storeTrack, &download);
+    if (count < 0 || download.writeFailed)
+    {
+        _store->abortWrite();
+        return count < 0 ? -1 : download.forwarded;
+    }
+
+    strncpy(info.snapshotId, snapshotId, sizeof(info.snapshotId) - 1);
+    info.snapshotId[sizeof(info.snapshotId) - 1] = '\0';
+    info.trackCount = count;
+    info.downloadBytes = _spotify->getLastListBytes();
+    _store->finishWrite(info);
+
+    return callback != NULL ? download.forwarded : count;
+}
+
+unsigned long SpotifyPlaylistCache::hits()
+{
+    return _hits;
+}
+
+unsigned long SpotifyPlaylistCache::misses()
+{
+    return _misses;
+}
+
+unsigned long SpotifyPlaylistCache::bytesSaved()
+{
+    return _bytesSaved;
+}
@@ -0,0 +1,113 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPlaylistCache_h
+#define SpotifyPlaylistCache_h
+
+#include <FS.h>
+#include "ArduinoSpotify.h"
+
+// Directory + "/" + playlist ID + ".tmp"
+#define SPOTIFY_PLAYLIST_CACHE_MAX_PATH 64
+
+// What is known about the stored copy of a playlist
+struct SpotifyPlaylistInfo
+{
+  char snapshotId[SPOTIFY_SNAPSHOT_ID_LENGTH];
+  uint32_t trackCount;
+  // Bytes it took to download the tracks
+  uint32_t downloadBytes;
+};
+
+// Somewhere to keep the tracks of playlists
+class SpotifyPlaylistStore
+{
+public:
+  virtual ~SpotifyPlaylistStore() {}
+  // False if the playlist isn't stored
+  virtual bool getInfo(const char *playlistId, SpotifyPlaylistInfo &info) = 0;
+  // Returns the number of tracks passed to the callback or -1 on errors
+  virtual int readTracks(const char *playlistId, SpotifyTrackCallback callback, void *context) = 0;
+  // Replaces the stored tracks: beginWrite(), writeTrack() for every track
+  // and finishWrite(). Until then the old copy stays readable.
+  virtual bool beginWrite(const char *playlistId) = 0;
+  virtual bool writeTrack(const SpotifyTrackFixed &track) = 0;
+  virtual bool finishWrite(const SpotifyPlaylistInfo &info) = 0;
+  virtual void abortWrite() = 0;
+  virtual void remove(const char *playlistId) = 0;
+};
+
+// Stores every playlist in a file of its own, e.g. on LittleFS, SPIFFS or an SD card
+class SpotifyFilePlaylistStore : public SpotifyPlaylistStore
+{
+public:
+  SpotifyFilePlaylistStore(fs::FS &fs, const char *directory = "/playlists");
+  bool getInfo(const char *playlistId, SpotifyPlaylistInfo &info);
+  int readTracks(const char *playlistId, SpotifyTrackCallback callback, void *context);
+  bool beginWrite(const char *playlistId);
+  bool writeTrack(const SpotifyTrackFixed &track);
+  bool finishWrite(const SpotifyPlaylistInfo &info);
+  void abortWrite();
+  void remove(const char *playlistId);
+
+private:
+  fs::FS *_fs;
+  const char *_directory;
+  fs::File _writing;
+  char _writingId[SPOTIFY_PLAYLIST_ID_LENGTH];
+
+  void playlistPath(const char *playlistId, const char *extension, char *path, size_t pathSize);
+  bool openPlaylist(const char *playlistId, fs::File &file, SpotifyPlaylistInfo &info);
+};
+
+// Only downloads the tracks of a playlist again when it changed. Every call
+// asks for the playlist's snapshot_id first (a response of a few hundred
+// bytes), if it's still the stored one the tracks come from the store.
+class SpotifyPlaylistCache
+{
+public:
+  SpotifyPlaylistCache(ArduinoSpotify &spotify, SpotifyPlaylistStore &store);
+
+  // Passes all tracks of the playlist to the callback and returns how many,
+  // or -1 on errors. If the callback stops early while the tracks are
+  // downloaded, the rest is still downloaded (but not passed on) to store them.
+  int getTracks(const char *playlistId, SpotifyTrackCallback callback, void *context = NULL);
+  // Uses the snapshot_id from getPlaylists() instead of asking for it
+  int getTracks(const SpotifyPlaylistFixed &playlist, SpotifyTrackCallback callback, void *context = NULL);
+
+  // Use the stored copy when the snapshot_id can't be checked (e.g. offline)
+  bool useStaleOnError = true;
+
+  unsigned long hits();
+  unsigned long misses();
+  // Bytes that didn't have to be downloaded thanks to hits
+  unsigned long bytesSaved();
+
+private:
+  ArduinoSpotify *_spotify;
+  SpotifyPlaylistStore *_store;
+  unsigned long _hits;
+  unsigned long _misses;
+  unsigned long _bytesSaved;
+
+  int getTracksWithSnapshot(const char *playlistId, const char *snapshotId, SpotifyTrackCallback callback, void *context);
+};
+
+#endif
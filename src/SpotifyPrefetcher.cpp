@@ -0,0 +1,310 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPrefetcher.h"
+
+SpotifyPrefetcher::SpotifyPrefetcher(ArduinoSpotify &spotify, uint8_t *buffer, size_t bufferSize)
+{
+    _spotify = &spotify;
+    size_t capacity = bufferSize / SPOTIFY_PREFETCH_TRACKS;
+    for (uint8_t i = 0; i < SPOTIFY_PREFETCH_TRACKS; i++)
+    {
+        _slots[i].state = SPOTIFY_PREFETCH_EMPTY;
+        _slots[i].image = buffer + i * capacity;
+        _slots[i].capacity = capacity;
+        _slots[i].imageLength = 0;
+    }
+    _currentUri[0] = '\0';
+    _queueStale = true;
+    _queueFetchedAt = 0;
+    _hits = 0;
+    _misses = 0;
+    _prefetched = 0;
+    _wasted = 0;
+    _wastedBytes = 0;
+}
+
+bool SpotifyPrefetcher::prefetch()
+{
+    if (_queueStale || millis() - _queueFetchedAt > queueIntervalMs)
+    {
+        return fetchQueue();
+    }
+
+    // The track that plays next goes first
+    int next = -1;
+    for (uint8_t i = 0; i < SPOTIFY_PREFETCH_TRACKS; i++)
+    {
+        if (_slots[i].state == SPOTIFY_PREFETCH_PENDING && (next < 0 || _slots[i].position < _slots[next].position))
+        {
+            next = i;
+        }
+    }
+    if (next < 0)
+    {
+        return false;
+    }
+    fetchImage(_slots[next]);
+    return true;
+}
+
+bool SpotifyPrefetcher::fetchQueue()
+{
+    _queueFetchedAt = millis();
+    uint8_t maxTracks = tracks < SPOTIFY_PREFETCH_TRACKS ? tracks : SPOTIFY_PREFETCH_TRACKS;
+    int count = _spotify->getQueue(_queue, maxTracks);
+    // On errors it's tried again after queueIntervalMs
+    _queueStale = false;
+    if (count < 0)
+    {
+        return false;
+    }
+
+    // Tracks that are still coming keep their slot (and image)
+    bool kept[SPOTIFY_PREFETCH_TRACKS] = {false};
+    for (uint8_t i = 0; i < SPOTIFY_PREFETCH_TRACKS; i++)
+    {
+        if (_slots[i].state == SPOTIFY_PREFETCH_EMPTY)
+        {
+            continue;
+        }
+        bool stillQueued = false;
+        for (int j = 0; j < count; j++)
+        {
+            if (!kept[j] && strcmp(_slots[i].track.trackUri, _queue[j].trackUri) == 0)
+            {
+                kept[j] = true;
+                _slots[i].position = j;
+                stillQueued = true;
+                break;
+            }
+        }
+        if (!stillQueued)
+        {
+            dropSlot(_slots[i]);
+        }
+    }
+
+    for (int j = 0; j < count; j++)
+    {
+        if (kept[j] || _queue[j].trackUri[0] == '\0')
+        {
+            continue;
+        }
+        for (uint8_t i = 0; i < SPOTIFY_PREFETCH_TRACKS; i++)
+        {
+            if (_slots[i].state == SPOTIFY_PREFETCH_EMPTY)
+            {
+                _slots[i].track = _queue[j];
+                _slots[i].position = j;
+                _slots[i].played = false;
+                _slots[i].imageLength = 0;
+                _slots[i].state = SPOTIFY_PREFETCH_PENDING;
+                break;
+            }
+        }
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Prefetch queue: "));
+    Serial.println(count);
+#endif
+    return true;
+}
+
+void SpotifyPrefetcher::dropSlot(SpotifyPrefetchSlot &slot)
+{
+    if (slot.state == SPOTIFY_PREFETCH_READY && !slot.played)
+    {
+        // Skipped or removed from the queue
+        _wasted++;
+        _wastedBytes += slot.imageLength;
+    }
+    slot.state = SPOTIFY_PREFETCH_EMPTY;
+}
+
+int SpotifyPrefetcher::pickImage(const CurrentlyPlayingFixed &track)
+{
+    int picked = -1;
+    for (int i = 0; i < track.numImages; i++)
+    {
+        int width = track.albumImages[i].width;
+        if (picked < 0)
+        {
+            picked = i;
+            continue;
+        }
+        int pickedWidth = track.albumImages[picked].width;
+        // Smallest one that is large enough, otherwise the largest one
+        if (width >= imageWidth ? (pickedWidth < imageWidth || width < pickedWidth) : (pickedWidth < imageWidth && width > pickedWidth))
+        {
+            picked = i;
+        }
+    }
+    return picked;
+}
+
+static bool storePrefetchedImage(const uint8_t *data, size_t length, size_t received, long contentLength, void *context)
+{
+    SpotifyPrefetchSlot *slot = (SpotifyPrefetchSlot *)context;
+    if ((contentLength > 0 && (size_t)contentLength > slot->capacity) || slot->imageLength + length > slot->capacity)
+    {
+        return false;
+    }
+    memcpy(slot->image + slot->imageLength, data, length);
+    slot->imageLength += length;
+    return true;
+}
+
+bool SpotifyPrefetcher::fetchImage(SpotifyPrefetchSlot &slot)
+{
+    int image = pickImage(slot.track);
+    if (image < 0)
+    {
+        slot.state = SPOTIFY_PREFETCH_FAILED;
+        return false;
+    }
+    char *url = slot.track.albumImages[image].url;
+
+    // Tracks of the same album share their art
+    for (uint8_t i = 0; i < SPOTIFY_PREFETCH_TRACKS; i++)
+    {
+        SpotifyPrefetchSlot &other = _slots[i];
+        if (&other != &slot && other.state == SPOTIFY_PREFETCH_READY && other.imageLength <= slot.capacity &&
+            strcmp(other.track.albumImages[pickImage(other.track)].url, url) == 0)
+        {
+            memcpy(slot.image, other.image, other.imageLength);
+            slot.imageLength = other.imageLength;
+            slot.state = SPOTIFY_PREFETCH_READY;
+            _prefetched++;
+            return true;
+        }
+    }
+
+    slot.imageLength = 0;
+    if (!_spotify->getImage(url, storePrefetchedImage, &slot))
+    {
+        Serial.println(F("Could not prefetch image"));
+        slot.state = SPOTIFY_PREFETCH_FAILED;
+        return false;
+    }
+
+    _prefetched++;
+    slot.state = SPOTIFY_PREFETCH_READY;
+    return true;
+}
+
+int SpotifyPrefetcher::findSlot(const char *trackUri)
+{
+    for (uint8_t i = 0; i < SPOTIFY_PREFETCH_TRACKS; i++)
+    {
+        if (_slots[i].state != SPOTIFY_PREFETCH_EMPTY && strcmp(_slots[i].track.trackUri, trackUri) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool SpotifyPrefetcher::update(const char *trackUri)
+{
+    int slot = findSlot(trackUri);
+    bool ready = slot >= 0 && _slots[slot].state == SPOTIFY_PREFETCH_READY;
+    if (trackUri[0] == '\0' || strcmp(trackUri, _currentUri) == 0)
+    {
+        return ready;
+    }
+    // The first track isn't a track change
+    bool first = _currentUri[0] == '\0';
+    strncpy(_currentUri, trackUri, sizeof(_currentUri) - 1);
+    _currentUri[sizeof(_currentUri) - 1] = '\0';
+
+    if (ready)
+    {
+        _hits++;
+    }
+    else if (!first)
+    {
+        _misses++;
+    }
+    if (slot >= 0)
+    {
+        _slots[slot].played = true;
+    }
+
+    // Everything moved up (or the user started something else)
+    _queueStale = true;
+    return ready;
+}
+
+const uint8_t *SpotifyPrefetcher::getImage(const char *trackUri, size_t &length)
+{
+    int slot = findSlot(trackUri);
+    if (slot < 0 || _slots[slot].state != SPOTIFY_PREFETCH_READY)
+    {
+        length = 0;
+        return NULL;
+    }
+    length = _slots[slot].imageLength;
+    return _slots[slot].image;
+}
+
+const CurrentlyPlayingFixed *SpotifyPrefetcher::upcoming(uint8_t position)
+{
+    for (uint8_t i = 0; i < SPOTIFY_PREFETCH_TRACKS; i++)
+    {
+        if (_slots[i].state != SPOTIFY_PREFETCH_EMPTY && !_slots[i].played && _slots[i].position == position)
+        {
+            return &_slots[i].track;
+        }
+    }
+    return NULL;
+}
+
+unsigned long SpotifyPrefetcher::hits()
+{
+    return _hits;
+}
+
+unsigned long SpotifyPrefetcher::misses()
+{
+    return _misses;
+}
+
+unsigned long SpotifyPrefetcher::wasted()
+{
+    return _wasted;
+}
+
+size_t SpotifyPrefetcher::wastedBytes()
+{
+    return _wastedBytes;
+}
+
+float SpotifyPrefetcher::hitRatio()
+{
+    unsigned long changes = _hits + _misses;
+    return changes == 0 ? 0 : (float)_hits / changes;
+}
+
+float SpotifyPrefetcher::wasteRatio()
+{
+    return _prefetched == 0 ? 0 : (float)_wasted / _prefetched;
+}
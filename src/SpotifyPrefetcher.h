@@ -0,0 +1,121 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPrefetcher_h
+#define SpotifyPrefetcher_h
+
+#include "ArduinoSpotify.h"
+
+// Tracks of the queue that are prefetched at most
+#ifndef SPOTIFY_PREFETCH_TRACKS
+#define SPOTIFY_PREFETCH_TRACKS 2
+#endif
+
+enum SpotifyPrefetchState
+{
+  SPOTIFY_PREFETCH_EMPTY,
+  SPOTIFY_PREFETCH_PENDING,
+  SPOTIFY_PREFETCH_READY,
+  // The image didn't fit or couldn't be downloaded
+  SPOTIFY_PREFETCH_FAILED
+};
+
+struct SpotifyPrefetchSlot
+{
+  CurrentlyPlayingFixed track;
+  SpotifyPrefetchState state;
+  // Position in the queue, 0 plays next
+  uint8_t position;
+  // It started playing, so dropping it isn't a waste
+  bool played;
+  uint8_t *image;
+  size_t imageLength;
+  size_t capacity;
+};
+
+// Gets the next tracks of the queue and their album art while there is
+// nothing else to do, so a track change can be shown right away instead
+// of after the next getCurrentlyPlaying and getImage:
+//
+//   prefetcher.prefetch();  // when idle, does one request per call
+//   ...
+//   if (spotify.getCurrentlyPlaying(currentlyPlaying)
+//       && prefetcher.update(currentlyPlaying.trackUri))
+//   {
+//       size_t length;
+//       const uint8_t *jpeg = prefetcher.getImage(currentlyPlaying.trackUri, length);
+//   }
+class SpotifyPrefetcher
+{
+public:
+  // The buffer is split between the tracks, every image has to fit into its part
+  SpotifyPrefetcher(ArduinoSpotify &spotify, uint8_t *buffer, size_t bufferSize);
+
+  // Does the next step (getting the queue or one image), returns false if
+  // there was nothing to do
+  bool prefetch();
+  // Call with every track URI that is fetched, returns true if its image was prefetched
+  bool update(const char *trackUri);
+
+  // The prefetched image of the track, NULL if there is none. It stays valid
+  // until the next prefetch().
+  const uint8_t *getImage(const char *trackUri, size_t &length);
+  // The track at the given position of the queue, NULL if it isn't known
+  const CurrentlyPlayingFixed *upcoming(uint8_t position);
+
+  // Tracks to prefetch, up to SPOTIFY_PREFETCH_TRACKS
+  uint8_t tracks = SPOTIFY_PREFETCH_TRACKS;
+  // The image with the smallest width at least this large is used
+  int imageWidth = 300;
+  // The queue can change without the track changing, check it this often
+  unsigned long queueIntervalMs = 30000;
+
+  // Track changes the image was ready for
+  unsigned long hits();
+  unsigned long misses();
+  // Prefetched images that were dropped without being played
+  unsigned long wasted();
+  size_t wastedBytes();
+  // hits / track changes, wasted / prefetched images
+  float hitRatio();
+  float wasteRatio();
+
+private:
+  ArduinoSpotify *_spotify;
+  SpotifyPrefetchSlot _slots[SPOTIFY_PREFETCH_TRACKS];
+  // Filled by getQueue(), kept here to spare the stack
+  CurrentlyPlayingFixed _queue[SPOTIFY_PREFETCH_TRACKS];
+  char _currentUri[SPOTIFY_URI_LENGTH];
+  bool _queueStale;
+  unsigned long _queueFetchedAt;
+  unsigned long _hits;
+  unsigned long _misses;
+  unsigned long _prefetched;
+  unsigned long _wasted;
+  size_t _wastedBytes;
+
+  bool fetchQueue();
+  bool fetchImage(SpotifyPrefetchSlot &slot);
+  int findSlot(const char *trackUri);
+  void dropSlot(SpotifyPrefetchSlot &slot);
+  int pickImage(const CurrentlyPlayingFixed &track);
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyQuery.h"
+
+SpotifyQueryWriter::SpotifyQueryWriter(char *buffer, size_t size, const char *path)
+{
+    _buffer = buffer;
+    _size = size;
+    _length = 0;
+    _hasQuery = false;
+    _overflowed = false;
+    if (_size > 0)
+    {
+        _buffer[0] = '\0';
+    }
+    append(path);
+    _hasQuery = strchr(path, '?') != NULL;
+}
+
+void SpotifyQueryWriter::append(char c)
+{
+    if (_length + 1 >= _size)
+    {
+        _overflowed = true;
+        return;
+    }
+    _buffer[_length++] = c;
+    _buffer[_length] = '\0';
+}
+
+void SpotifyQueryWriter::append(const char *text)
+{
+    while (*text != '\0' && !_overflowed)
+    {
+        append(*text++);
+    }
+}
+
+void SpotifyQueryWriter::startParam(const char *name)
+{
+    // An empty path is a form body, it doesn't start with '?'
+    if (_length > 0)
+    {
+        append(_hasQuery ? '&' : '?');
+    }
+    _hasQuery = true;
+    append(name);
+    append('=');
+}
+
+void SpotifyQueryWriter::appendEncoded(const char *text)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (const char *c = text; *c != '\0' && !_overflowed; c++)
+    {
+        // Without the cast bytes >= 0x80 (UTF-8) are negative, which isalnum() must not get
+        if (isalnum((unsigned char)*c) || *c == '-' || *c == '_' || *c == '.' || *c == '~')
+        {
+            append(*c);
+        }
+        else
+        {
+            append('%');
+            append(hex[(uint8_t)*c >> 4]);
+            append(hex[(uint8_t)*c & 0x0F]);
+        }
+    }
+}
+
+SpotifyQueryWriter &SpotifyQueryWriter::addSegment(const char *segment)
+{
+    if (_hasQuery)
+    {
+        // Would end up in the query
+        _overflowed = true;
+        return *this;
+    }
+    if (_length == 0 || _buffer[_length - 1] != '/')
+    {
+        append('/');
+    }
+    appendEncoded(segment);
+    return *this;
+}
+
+SpotifyQueryWriter &SpotifyQueryWriter::add(const char *name, const char *value)
+{
+    if (value == NULL || value[0] == '\0')
+    {
+        return *this;
+    }
+
+    startParam(name);
+    appendEncoded(value);
+    return *this;
+}
+
+SpotifyQueryWriter &SpotifyQueryWriter::add(const char *name, long value)
+{
+    char number[SPOTIFY_INT_PARAM_LENGTH + 1];
+    snprintf(number, sizeof(number), "%ld", value);
+    startParam(name);
+    append(number);
+    return *this;
+}
+
+SpotifyQueryWriter &SpotifyQueryWriter::add(const char *name, int value)
+{
+    return add(name, (long)value);
+}
+
+SpotifyQueryWriter &SpotifyQueryWriter::add(const char *name, bool value)
+{
+    startParam(name);
+    append(value ? "true" : "false");
+    return *this;
+}
+
+const char *SpotifyQueryWriter::c_str() const
+{
+    return _buffer;
+}
+
+size_t SpotifyQueryWriter::length() const
+{
+    return _length;
+}
+
+bool SpotifyQueryWriter::overflowed() const
+{
+    return _overflowed;
+}
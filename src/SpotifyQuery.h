@@ -0,0 +1,112 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyQuery_h
+#define SpotifyQuery_h
+
+#include <Arduino.h>
+
+// Returned instead of a status code when a path didn't fit its buffer
+#define SPOTIFY_PATH_TOO_LONG -414
+
+// Longest values of the typed parameters
+#define SPOTIFY_INT_PARAM_LENGTH 11
+// Two letter country code or "from_token"
+#define SPOTIFY_MARKET_LENGTH 10
+
+// Bytes a parameter adds to a query: separator, name, '=' and up to
+// valueLength characters. That is the length after URL-encoding, which
+// takes 3 bytes for every character other than A-Z, a-z, 0-9 and -_.~, so
+// it is an upper bound the values have to stay below, not their size.
+template <size_t M>
+constexpr size_t spotifyQueryParam(const char (&name)[M], size_t valueLength)
+{
+  // M counts the terminator, that's where the separator goes
+  return M + 1 + valueLength;
+}
+
+// Size of the buffer for a path (sizeof(path), so including the
+// terminator) with the given parameters
+constexpr size_t spotifyQuerySize(size_t pathSize)
+{
+  return pathSize;
+}
+
+template <typename... Params>
+constexpr size_t spotifyQuerySize(size_t pathSize, size_t param, Params... params)
+{
+  return spotifyQuerySize(pathSize + param, params...);
+}
+
+// Appends URL-encoded parameters to a path (or starts a form body when the
+// path is empty). Nothing is written past the buffer; if something didn't fit
+// overflowed() is set and the result must not be used.
+class SpotifyQueryWriter
+{
+public:
+  SpotifyQueryWriter(char *buffer, size_t size, const char *path = "");
+
+  // Appends '/' (unless the path ends in one) and a URL-encoded path
+  // segment, e.g. an ID. Only before the parameters.
+  SpotifyQueryWriter &addSegment(const char *segment);
+  // Empty values are left out
+  SpotifyQueryWriter &add(const char *name, const char *value);
+  SpotifyQueryWriter &add(const char *name, long value);
+  SpotifyQueryWriter &add(const char *name, int value);
+  SpotifyQueryWriter &add(const char *name, bool value);
+
+  const char *c_str() const;
+  size_t length() const;
+  bool overflowed() const;
+
+private:
+  char *_buffer;
+  size_t _size;
+  size_t _length;
+  bool _hasQuery;
+  bool _overflowed;
+
+  void append(char c);
+  void append(const char *text);
+  void appendEncoded(const char *text);
+  void startParam(const char *name);
+};
+
+// A SpotifyQueryWriter with its own buffer of N bytes, use spotifyQuerySize()
+// for N:
+//
+//   SpotifyQuery<spotifyQuerySize(sizeof(SPOTIFY_SEEK_ENDPOINT),
+//                                 spotifyQueryParam("position_ms", SPOTIFY_INT_PARAM_LENGTH))>
+//       path(SPOTIFY_SEEK_ENDPOINT);
+//   path.add("position_ms", position);
+template <size_t N>
+class SpotifyQuery : public SpotifyQueryWriter
+{
+public:
+  explicit SpotifyQuery(const char *path = "") : SpotifyQueryWriter(_storage, N, path) {}
+  // The writer would still point to the buffer of the original
+  SpotifyQuery(const SpotifyQuery &) = delete;
+  SpotifyQuery &operator=(const SpotifyQuery &) = delete;
+
+private:
+  char _storage[N];
+};
+
+#endif
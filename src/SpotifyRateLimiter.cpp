@@ -0,0 +1,148 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyRateLimiter.h"
+
+SpotifyRateLimiter::SpotifyRateLimiter()
+{
+    reset();
+}
+
+void SpotifyRateLimiter::reset()
+{
+    _tokens = -1;
+    _lastRefill = 0;
+    _backoffStart = 0;
+    _backoffMs = 0;
+    _rateLimitedInRow = 0;
+    _refused = 0;
+    _rateLimited = 0;
+}
+
+void SpotifyRateLimiter::refill()
+{
+    unsigned long now = millis();
+    if (_tokens < 0)
+    {
+        _tokens = burst;
+        _lastRefill = now;
+        return;
+    }
+
+    if (refillMs == 0)
+    {
+        _tokens = burst;
+        return;
+    }
+
+    unsigned long added = (now - _lastRefill) / refillMs;
+    if (added > 0)
+    {
+        _tokens = min((unsigned long)burst, _tokens + added);
+        // Keep the part of the interval that didn't add a token yet
+        _lastRefill += added * refillMs;
+    }
+    if (_tokens >= burst)
+    {
+        _lastRefill = now;
+    }
+}
+
+unsigned long SpotifyRateLimiter::backoffRemainingMs()
+{
+    unsigned long elapsed = millis() - _backoffStart;
+    return (elapsed < _backoffMs) ? _backoffMs - elapsed : 0;
+}
+
+bool SpotifyRateLimiter::canSend(SpotifyPriority priority)
+{
+    if (!enabled)
+    {
+        return true;
+    }
+    if (backoffRemainingMs() > 0)
+    {
+        return false;
+    }
+    if (!tokenBucket)
+    {
+        return true;
+    }
+
+    refill();
+    int16_t needed = (priority == SPOTIFY_PRIORITY_USER) ? 1 : reservedForUser + 1;
+    return _tokens >= needed;
+}
+
+bool SpotifyRateLimiter::acquire(SpotifyPriority priority)
+{
+    if (!canSend(priority))
+    {
+        _refused++;
+        return false;
+    }
+    if (enabled && tokenBucket)
+    {
+        _tokens--;
+    }
+    return true;
+}
+
+void SpotifyRateLimiter::rateLimited(long retryAfter)
+{
+    _rateLimited++;
+    if (retryAfter >= 0)
+    {
+        _backoffMs = retryAfter * 1000;
+    }
+    else
+    {
+        _backoffMs = defaultBackoffMs << min(_rateLimitedInRow, (uint8_t)8);
+    }
+    _backoffMs = min(_backoffMs, maxBackoffMs);
+    _backoffStart = millis();
+    if (_rateLimitedInRow < 255)
+    {
+        _rateLimitedInRow++;
+    }
+    // Start over slowly
+    _tokens = 0;
+    _lastRefill = _backoffStart + _backoffMs;
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Rate limited, backing off for (ms): "));
+    Serial.println(_backoffMs);
+#endif
+}
+
+void SpotifyRateLimiter::succeeded()
+{
+    _rateLimitedInRow = 0;
+}
+
+unsigned long SpotifyRateLimiter::refusedCount()
+{
+    return _refused;
+}
+
+unsigned long SpotifyRateLimiter::rateLimitedCount()
+{
+    return _rateLimited;
+}
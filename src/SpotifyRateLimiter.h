@@ -0,0 +1,88 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyRateLimiter_h
+#define SpotifyRateLimiter_h
+
+#include <Arduino.h>
+
+// Returned instead of a HTTP status code when a request wasn't sent
+// because of the rate limit
+#define SPOTIFY_RATE_LIMITED -429
+
+enum SpotifyPriority
+{
+  // Polling the player state, devices etc.
+  SPOTIFY_PRIORITY_BACKGROUND,
+  // Player commands
+  SPOTIFY_PRIORITY_USER
+};
+
+// Keeps the requests to api.spotify.com within the rate limit. After a 429
+// every request is refused until Retry-After has passed, sending more would
+// only make the lockout longer. On top of that a token bucket can limit how
+// many requests are sent at all, that one is off unless tokenBucket is set.
+class SpotifyRateLimiter
+{
+public:
+  SpotifyRateLimiter();
+
+  // Takes a token, returns false if the request must not be sent
+  bool acquire(SpotifyPriority priority);
+  // Like acquire(), without taking the token
+  bool canSend(SpotifyPriority priority);
+  // Call with Retry-After (seconds, < 0 if not sent) of a 429 response
+  void rateLimited(long retryAfter);
+  // Call for every other response
+  void succeeded();
+  void reset();
+
+  unsigned long backoffRemainingMs();
+  unsigned long refusedCount();
+  unsigned long rateLimitedCount();
+
+  // Off: nothing is ever refused, not even during the backoff
+  bool enabled = true;
+  // Also refuse requests once the bucket is empty
+  bool tokenBucket = false;
+  // Requests that can be sent in a row
+  uint8_t burst = 10;
+  // One more request is allowed every refillMs
+  unsigned long refillMs = 1000;
+  // Tokens only player commands may use, so polling never locks them out
+  uint8_t reservedForUser = 2;
+  // Backoff after a 429 without Retry-After, doubled for every one in a row
+  unsigned long defaultBackoffMs = 5000;
+  unsigned long maxBackoffMs = 120000;
+
+private:
+  // -1 until the first request, so burst can still be changed
+  int16_t _tokens;
+  unsigned long _lastRefill;
+  unsigned long _backoffStart;
+  unsigned long _backoffMs;
+  uint8_t _rateLimitedInRow;
+  unsigned long _refused;
+  unsigned long _rateLimited;
+
+  void refill();
+};
+
+#endif
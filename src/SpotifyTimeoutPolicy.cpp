@@ -0,0 +1,227 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyTimeoutPolicy.h"
+
+// Upper end of the histogram buckets in ms, the last bucket is open
+static const uint16_t bucketLimits[SPOTIFY_LATENCY_BUCKETS - 1] = {100, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000, 8000};
+
+// Counts are halved when an endpoint has this many samples,
+// so old responses fade out instead of being kept forever
+#define SPOTIFY_LATENCY_MAX_SAMPLES 128
+
+// FNV-1a, like spotifyHash(), over length bytes
+static uint32_t hashBytes(uint32_t hash, const char *text, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+SpotifyTimeoutPolicy::SpotifyTimeoutPolicy()
+{
+    reset();
+}
+
+void SpotifyTimeoutPolicy::reset()
+{
+    memset(_endpoints, 0, sizeof(_endpoints));
+    _retries = 0;
+    _timeouts = 0;
+}
+
+uint32_t SpotifyTimeoutPolicy::endpointKey(const char *method, const char *host, const char *uri)
+{
+    // The terminators keep "GET" + "api..." apart from "GE" + "Tapi..."
+    uint32_t hash = hashBytes(2166136261UL, method, strlen(method) + 1);
+    hash = hashBytes(hash, host, strlen(host) + 1);
+
+    const char *segment = uri;
+    while (*segment != '\0' && *segment != '?')
+    {
+        size_t length = strcspn(segment + 1, "/?") + 1;
+        if (length <= SPOTIFY_ID_SEGMENT_LENGTH + 1)
+        {
+            hash = hashBytes(hash, segment, length);
+        }
+        segment += length;
+    }
+    return (hash != 0) ? hash : 1;
+}
+
+SpotifyEndpointLatency *SpotifyTimeoutPolicy::findEndpoint(const char *method, const char *host, const char *uri, bool create)
+{
+    uint32_t key = endpointKey(method, host, uri);
+    SpotifyEndpointLatency *oldest = NULL;
+    for (uint8_t i = 0; i < SPOTIFY_TIMEOUT_ENDPOINTS; i++)
+    {
+        SpotifyEndpointLatency *endpoint = &_endpoints[i];
+        if (endpoint->key == key)
+        {
+            endpoint->lastUsed = millis();
+            return endpoint;
+        }
+        // An unused entry, or else the one that wasn't used the longest
+        if (oldest == NULL || (oldest->key != 0 && endpoint->key == 0) ||
+            (endpoint->key != 0 && oldest->key != 0 && millis() - endpoint->lastUsed > millis() - oldest->lastUsed))
+        {
+            oldest = endpoint;
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+    memset(oldest, 0, sizeof(SpotifyEndpointLatency));
+    oldest->key = key;
+    oldest->lastUsed = millis();
+    return oldest;
+}
+
+void SpotifyTimeoutPolicy::addSample(SpotifyEndpointLatency &endpoint, unsigned long latencyMs)
+{
+    uint8_t bucket = 0;
+    while (bucket < SPOTIFY_LATENCY_BUCKETS - 1 && latencyMs > bucketLimits[bucket])
+    {
+        bucket++;
+    }
+    endpoint.counts[bucket]++;
+    endpoint.samples++;
+
+    if (endpoint.samples >= SPOTIFY_LATENCY_MAX_SAMPLES)
+    {
+        endpoint.samples = 0;
+        for (uint8_t i = 0; i < SPOTIFY_LATENCY_BUCKETS; i++)
+        {
+            endpoint.counts[i] /= 2;
+            endpoint.samples += endpoint.counts[i];
+        }
+    }
+}
+
+unsigned long SpotifyTimeoutPolicy::percentile(const SpotifyEndpointLatency &endpoint, uint8_t percent)
+{
+    if (endpoint.samples == 0 || endpoint.samples < minSamples)
+    {
+        return 0;
+    }
+
+    unsigned long needed = ((unsigned long)endpoint.samples * percent + 99) / 100;
+    unsigned long counted = 0;
+    for (uint8_t i = 0; i < SPOTIFY_LATENCY_BUCKETS - 1; i++)
+    {
+        counted += endpoint.counts[i];
+        if (counted >= needed)
+        {
+            return bucketLimits[i];
+        }
+    }
+    return maxTimeoutMs;
+}
+
+unsigned long SpotifyTimeoutPolicy::percentile(const char *method, const char *host, const char *uri, uint8_t percent)
+{
+    SpotifyEndpointLatency *endpoint = findEndpoint(method, host, uri, false);
+    return (endpoint != NULL) ? percentile(*endpoint, percent) : 0;
+}
+
+unsigned long SpotifyTimeoutPolicy::timeoutFor(const char *method, const char *host, const char *uri)
+{
+    if (!enabled)
+    {
+        return defaultTimeoutMs;
+    }
+
+    unsigned long p95 = percentile(method, host, uri, 95);
+    if (p95 == 0)
+    {
+        return defaultTimeoutMs;
+    }
+
+    unsigned long timeout = p95 + p95 * marginPercent / 100 + marginMs;
+    return constrain(timeout, minTimeoutMs, maxTimeoutMs);
+}
+
+void SpotifyTimeoutPolicy::record(const char *method, const char *host, const char *uri, unsigned long latencyMs)
+{
+    if (enabled)
+    {
+        addSample(*findEndpoint(method, host, uri, true), latencyMs);
+    }
+}
+
+void SpotifyTimeoutPolicy::recordTimeout(const char *method, const char *host, const char *uri, unsigned long timeoutMs)
+{
+    _timeouts++;
+    if (enabled)
+    {
+        // All we know is that it would have taken longer, which still moves
+        // the p95 (and the next timeout) up when it happens often enough
+        addSample(*findEndpoint(method, host, uri, true), timeoutMs + 1);
+    }
+}
+
+bool SpotifyTimeoutPolicy::shouldRetry(const char *method, int statusCode, uint8_t attempt)
+{
+    // PUT/POST (player commands, token refreshes) might have been carried
+    // out even though the response never arrived, sending them again could
+    // e.g. skip two tracks instead of one
+    if (!enabled || attempt > maxRetries || strcmp(method, "GET") != 0)
+    {
+        return false;
+    }
+
+    bool transient = (statusCode == HTTPC_ERROR_READ_TIMEOUT ||
+                      statusCode == HTTPC_ERROR_CONNECTION_LOST ||
+                      statusCode == HTTPC_ERROR_CONNECTION_REFUSED ||
+                      statusCode == HTTPC_ERROR_NOT_CONNECTED ||
+                      statusCode == HTTPC_ERROR_SEND_HEADER_FAILED ||
+                      statusCode == 500 || statusCode == 502 ||
+                      statusCode == 503 || statusCode == 504);
+    if (transient)
+    {
+        _retries++;
+    }
+    return transient;
+}
+
+unsigned long SpotifyTimeoutPolicy::backoffMs(uint8_t attempt)
+{
+    unsigned long backoff = backoffBaseMs;
+    for (uint8_t i = 1; i < attempt && backoff < backoffMaxMs; i++)
+    {
+        backoff *= 2;
+    }
+    return min(backoff, backoffMaxMs);
+}
+
+unsigned long SpotifyTimeoutPolicy::retryCount()
+{
+    return _retries;
+}
+
+unsigned long SpotifyTimeoutPolicy::timeoutCount()
+{
+    return _timeouts;
+}
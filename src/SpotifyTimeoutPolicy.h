@@ -0,0 +1,113 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyTimeoutPolicy_h
+#define SpotifyTimeoutPolicy_h
+
+#include <Arduino.h>
+#include "SpotifyTransport.h"
+
+// Timeout of a request until its endpoint has enough samples,
+// and of every request with the policy turned off
+#ifndef SPOTIFY_TIMEOUT
+#define SPOTIFY_TIMEOUT 2000
+#endif
+
+// Endpoints that get their own latency histogram, the one that wasn't
+// used the longest is replaced when there is a new one
+#ifndef SPOTIFY_TIMEOUT_ENDPOINTS
+#define SPOTIFY_TIMEOUT_ENDPOINTS 8
+#endif
+#define SPOTIFY_LATENCY_BUCKETS 12
+
+// Path segments longer than this are IDs (22 characters) or image hashes,
+// they are left out of the endpoints here and in SpotifyMetrics
+#define SPOTIFY_ID_SEGMENT_LENGTH 20
+
+struct SpotifyEndpointLatency
+{
+  // Method, host and path without the query and IDs, so all playlists
+  // (or all images) share one entry. 0 for an unused entry.
+  uint32_t key;
+  uint16_t counts[SPOTIFY_LATENCY_BUCKETS];
+  uint16_t samples;
+  unsigned long lastUsed;
+};
+
+// Learns how long every endpoint takes to answer and sets its timeout to the
+// p95 of that plus a margin, instead of one SPOTIFY_TIMEOUT for a quick
+// nextTrack() and a large image alike. Also decides which failed requests are
+// sent again: only GETs, after a backoff that doubles with every attempt, and
+// only async ones unless syncRetries is set.
+class SpotifyTimeoutPolicy
+{
+public:
+  SpotifyTimeoutPolicy();
+
+  // Timeout in ms for the next request to this endpoint
+  unsigned long timeoutFor(const char *method, const char *host, const char *uri);
+  // Time from sending the request until the response headers arrived
+  void record(const char *method, const char *host, const char *uri, unsigned long latencyMs);
+  // There was no response within timeoutMs
+  void recordTimeout(const char *method, const char *host, const char *uri, unsigned long timeoutMs);
+  // The latency percent of the responses stayed below (as the upper end of
+  // its histogram bucket), 0 until the endpoint has minSamples
+  unsigned long percentile(const char *method, const char *host, const char *uri, uint8_t percent = 95);
+
+  // Whether a request that failed with statusCode (timeout, lost connection
+  // or 5xx) should be sent again, attempt is 1 for the first retry
+  bool shouldRetry(const char *method, int statusCode, uint8_t attempt);
+  unsigned long backoffMs(uint8_t attempt);
+  void reset();
+
+  unsigned long retryCount();
+  unsigned long timeoutCount();
+
+  // When off every request gets defaultTimeoutMs and nothing is retried
+  bool enabled = true;
+  // Used until an endpoint has minSamples responses
+  unsigned long defaultTimeoutMs = SPOTIFY_TIMEOUT;
+  uint8_t minSamples = 8;
+  // timeout = p95 + p95 * marginPercent / 100 + marginMs
+  uint8_t marginPercent = 50;
+  unsigned long marginMs = 300;
+  unsigned long minTimeoutMs = 500;
+  unsigned long maxTimeoutMs = 10000;
+  // Retries of a GET, the first one after backoffBaseMs
+  uint8_t maxRetries = 2;
+  unsigned long backoffBaseMs = 200;
+  unsigned long backoffMaxMs = 2000;
+  // Retry the blocking calls as well, not just the async ones. Off by
+  // default, with it a call can block for maxRetries + 1 timeouts plus the
+  // backoffs (3 * 2000 + 600ms with the defaults).
+  bool syncRetries = false;
+
+private:
+  SpotifyEndpointLatency _endpoints[SPOTIFY_TIMEOUT_ENDPOINTS];
+  unsigned long _retries;
+  unsigned long _timeouts;
+
+  static uint32_t endpointKey(const char *method, const char *host, const char *uri);
+  SpotifyEndpointLatency *findEndpoint(const char *method, const char *host, const char *uri, bool create);
+  void addSample(SpotifyEndpointLatency &endpoint, unsigned long latencyMs);
+  unsigned long percentile(const SpotifyEndpointLatency &endpoint, uint8_t percent);
+};
+
+#endif
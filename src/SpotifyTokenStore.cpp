@@ -0,0 +1,102 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyTokenStore.h"
+
+SpotifyFileTokenStore::SpotifyFileTokenStore(fs::FS &fs, const char *path)
+{
+    _fs = &fs;
+    _path = path;
+}
+
+bool SpotifyFileTokenStore::load(SpotifyStoredToken &token)
+{
+    fs::File file = _fs->open(_path, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    // Format: the expiry on the first line, the token on the second one
+    bool loaded = false;
+    char line[16];
+    size_t length = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[length] = '\0';
+    token.expiresAt = strtoul(line, NULL, 10);
+    length = file.readBytesUntil('\n', token.accessToken, SPOTIFY_MAX_TOKEN_LENGTH - 1);
+    token.accessToken[length] = '\0';
+    loaded = (token.expiresAt > 0 && length > 0);
+
+    file.close();
+    return loaded;
+}
+
+bool SpotifyFileTokenStore::save(const SpotifyStoredToken &token)
+{
+    fs::File file = _fs->open(_path, "w");
+    if (!file)
+    {
+        Serial.println(F("Could not open token file"));
+        return false;
+    }
+
+    file.print(token.expiresAt);
+    file.print('\n');
+    file.print(token.accessToken);
+    file.print('\n');
+    file.close();
+    return true;
+}
+
+#if defined(ESP32)
+SpotifyPreferencesTokenStore::SpotifyPreferencesTokenStore(const char *name)
+{
+    _name = name;
+}
+
+bool SpotifyPreferencesTokenStore::load(SpotifyStoredToken &token)
+{
+    Preferences preferences;
+    if (!preferences.begin(_name, true))
+    {
+        return false;
+    }
+
+    token.expiresAt = preferences.getULong("expires", 0);
+    size_t length = preferences.getString("token", token.accessToken, SPOTIFY_MAX_TOKEN_LENGTH);
+    preferences.end();
+    return token.expiresAt > 0 && length > 0;
+}
+
+bool SpotifyPreferencesTokenStore::save(const SpotifyStoredToken &token)
+{
+    Preferences preferences;
+    if (!preferences.begin(_name, false))
+    {
+        Serial.println(F("Could not open preferences"));
+        return false;
+    }
+
+    bool saved = preferences.putString("token", token.accessToken) > 0 &&
+                 preferences.putULong("expires", token.expiresAt) > 0;
+    preferences.end();
+    return saved;
+}
+#endif
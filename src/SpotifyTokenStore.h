@@ -0,0 +1,76 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyTokenStore_h
+#define SpotifyTokenStore_h
+
+#include <Arduino.h>
+#include <FS.h>
+#if defined(ESP32)
+#include <Preferences.h>
+#endif
+
+// Access tokens are about 200-300 characters (without "Bearer ")
+#define SPOTIFY_MAX_TOKEN_LENGTH 512
+
+struct SpotifyStoredToken
+{
+  char accessToken[SPOTIFY_MAX_TOKEN_LENGTH];
+  // Unix time, so it can be checked after a reboot (needs the clock to be set)
+  uint32_t expiresAt;
+};
+
+// Somewhere to keep the access token across reboots
+class SpotifyTokenStore
+{
+public:
+  virtual ~SpotifyTokenStore() {}
+  virtual bool load(SpotifyStoredToken &token) = 0;
+  virtual bool save(const SpotifyStoredToken &token) = 0;
+};
+
+// Stores the token in a file, e.g. on LittleFS or SPIFFS
+class SpotifyFileTokenStore : public SpotifyTokenStore
+{
+public:
+  SpotifyFileTokenStore(fs::FS &fs, const char *path = "/spotify_token");
+  bool load(SpotifyStoredToken &token);
+  bool save(const SpotifyStoredToken &token);
+
+private:
+  fs::FS *_fs;
+  const char *_path;
+};
+
+#if defined(ESP32)
+// Stores the token in NVS
+class SpotifyPreferencesTokenStore : public SpotifyTokenStore
+{
+public:
+  SpotifyPreferencesTokenStore(const char *name = "spotify");
+  bool load(SpotifyStoredToken &token);
+  bool save(const SpotifyStoredToken &token);
+
+private:
+  const char *_name;
+};
+#endif
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyTransport.h"
+
+static const char requestLineTemplate[] PROGMEM = "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n";
+static const char headerTemplate[] PROGMEM = "%s: %s\r\n";
+static const char contentLengthTemplate[] PROGMEM = "Content-Length: %ld\r\n";
+
+// Collects what's written in a String
+class SpotifyStringPrint : public Print
+{
+public:
+    SpotifyStringPrint(String &out) : _out(out) {}
+
+    size_t write(uint8_t c)
+    {
+        _out += (char)c;
+        return 1;
+    }
+
+private:
+    String &_out;
+};
+
+// Fills the buffer behind the request headers and writes it to the client
+// when it's full, so a small body goes out with the headers in one write
+class SpotifyRequestWriter : public Print
+{
+public:
+    SpotifyRequestWriter(Client &client, char *buffer, size_t size, size_t length)
+        : _client(client), _buffer(buffer), _size(size), _length(length), _sent(0), _failed(false) {}
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+
+    size_t write(const uint8_t *data, size_t size)
+    {
+        size_t written = 0;
+        while (written < size)
+        {
+            if (_length == _size && !send())
+            {
+                break;
+            }
+            size_t part = min(size - written, _size - _length);
+            memcpy(_buffer + _length, data + written, part);
+            _length += part;
+            written += part;
+        }
+        return written;
+    }
+
+    // Writes what's buffered, false once a write failed
+    bool send()
+    {
+        if (!_failed && _length > 0)
+        {
+            _failed = _client.write((const uint8_t *)_buffer, _length) != _length;
+            if (!_failed)
+            {
+                _sent += _length;
+                _length = 0;
+            }
+        }
+        return !_failed;
+    }
+
+    size_t sent() { return _sent; }
+
+private:
+    Client &_client;
+    char *_buffer;
+    size_t _size;
+    size_t _length;
+    size_t _sent;
+    bool _failed;
+};
+
+int SpotifyTransport::request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+                              const char *accept, const char *contentType, const char *authorization,
+                              const SpotifyRequestBody &body, bool keepAlive)
+{
+    String serialized;
+    serialized.reserve(body.length());
+    SpotifyStringPrint out(serialized);
+    body.writeTo(out);
+    return request(client, host, port, method, uri, accept, contentType, authorization, serialized.c_str(), keepAlive);
+}
+
+SpotifyLeanTransport::SpotifyLeanTransport(unsigned long timeout)
+{
+    _client = NULL;
+    _timeout = timeout;
+    _keepAlive = false;
+}
+
+int SpotifyLeanTransport::formatRequest(char *buffer, size_t size, const char *host, const char *method, const char *uri,
+                                        const char *accept, const char *contentType, const char *authorization,
+                                        long bodyLength, bool keepAlive)
+{
+    size_t length = snprintf_P(buffer, size, requestLineTemplate, method, uri, host, keepAlive ? "keep-alive" : "close");
+    if (length < size && accept != NULL)
+    {
+        length += snprintf_P(buffer + length, size - length, headerTemplate, "Accept", accept);
+    }
+    if (length < size && contentType != NULL)
+    {
+        length += snprintf_P(buffer + length, size - length, headerTemplate, "Content-Type", contentType);
+    }
+    if (length < size && authorization != NULL)
+    {
+        length += snprintf_P(buffer + length, size - length, headerTemplate, "Authorization", authorization);
+    }
+    if (length < size && bodyLength >= 0)
+    {
+        length += snprintf_P(buffer + length, size - length, contentLengthTemplate, bodyLength);
+    }
+    if (length < size)
+    {
+        length += snprintf(buffer + length, size - length, "\r\n");
+    }
+    return (length < size) ? (int)length : -1;
+}
+
+int SpotifyLeanTransport::request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+                                  const char *accept, const char *contentType, const char *authorization, const char *body,
+                                  bool keepAlive)
+{
+    if (body == NULL)
+    {
+        return send(client, host, port, method, uri, accept, contentType, authorization, NULL, keepAlive);
+    }
+    SpotifyStringBody stringBody(body);
+    return send(client, host, port, method, uri, accept, contentType, authorization, &stringBody, keepAlive);
+}
+
+int SpotifyLeanTransport::request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+                                  const char *accept, const char *contentType, const char *authorization,
+                                  const SpotifyRequestBody &body, bool keepAlive)
+{
+    return send(client, host, port, method, uri, accept, contentType, authorization, &body, keepAlive);
+}
+
+int SpotifyLeanTransport::send(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+                               const char *accept, const char *contentType, const char *authorization,
+                               const SpotifyRequestBody *body, bool keepAlive)
+{
+    _client = &client;
+    _keepAlive = keepAlive;
+    _response.reset(strcmp(method, "HEAD") != 0);
+    _body.begin(client, _response, _timeout);
+    memset(&_timing, 0, sizeof(_timing));
+
+    unsigned long start = millis();
+    if (!client.connected() && !client.connect(host, port))
+    {
+        Serial.println(F("Connection failed"));
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    _timing.connectMs = millis() - start;
+
+    long bodyLength = (body != NULL) ? (long)body->length() : -1;
+    char header[SPOTIFY_REQUEST_HEADER_SIZE];
+    int headerLength = formatRequest(header, sizeof(header), host, method, uri, accept, contentType, authorization, bodyLength, keepAlive);
+    if (headerLength < 0)
+    {
+        Serial.println(F("Request headers too long"));
+        return HTTPC_ERROR_TOO_LESS_RAM;
+    }
+
+    start = millis();
+    SpotifyRequestWriter out(client, header, sizeof(header), headerLength);
+    size_t written = (body != NULL) ? body->writeTo(out) : 0;
+    bool sent = out.send();
+    if (out.sent() < (size_t)headerLength)
+    {
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+    if (!sent || written != (size_t)max(bodyLength, 0L))
+    {
+        return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+    }
+    _timing.bytesSent = out.sent();
+    _timing.sendMs = millis() - start;
+
+    start = millis();
+    unsigned long lastProgress = start;
+    size_t received = 0;
+    while (!_response.readHeaders(client))
+    {
+        if (_response.bytesReceived != received)
+        {
+            received = _response.bytesReceived;
+            lastProgress = millis();
+        }
+        else if (!client.connected() && client.available() <= 0)
+        {
+            return HTTPC_ERROR_CONNECTION_LOST;
+        }
+        else if (millis() - lastProgress > _timeout)
+        {
+            return HTTPC_ERROR_READ_TIMEOUT;
+        }
+        // give the esp a breather
+        yield();
+    }
+    _timing.waitMs = millis() - start;
+
+    return _response.statusCode;
+}
+
+SpotifyBodyStream &SpotifyLeanTransport::getStream()
+{
+    return _body;
+}
+
+long SpotifyLeanTransport::getSize()
+{
+    return _response.contentLength;
+}
+
+long SpotifyLeanTransport::getRetryAfter()
+{
+    return _response.retryAfter;
+}
+
+const char *SpotifyLeanTransport::getETag()
+{
+    return _response.etag;
+}
+
+void SpotifyLeanTransport::end()
+{
+    if (_client == NULL)
+    {
+        return;
+    }
+
+    // Skip what's left of the body if it's already there
+    uint8_t discard[64];
+    while (_response.headersComplete() && !_response.bodyComplete() &&
+           _response.readBody(*_client, discard, sizeof(discard)) > 0)
+    {
+    }
+
+    if (!_keepAlive || !_response.keepAlive || !_response.bodyComplete())
+    {
+        _client->stop();
+    }
+    _client = NULL;
+}
+
+void SpotifyLeanTransport::setTimeout(unsigned long timeout)
+{
+    _timeout = timeout;
+}
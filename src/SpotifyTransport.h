@@ -0,0 +1,158 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyTransport_h
+#define SpotifyTransport_h
+
+#include <Arduino.h>
+#include <Client.h>
+#include "SpotifyHttpResponse.h"
+
+// Same codes as the HTTPClient of the ESP cores, so callers don't have to
+// care which transport they got the error from
+#ifndef HTTPC_ERROR_CONNECTION_REFUSED
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+#endif
+
+// Request line and headers are formatted into a buffer of this size,
+// the Authorization header alone is about 300 bytes
+#define SPOTIFY_REQUEST_HEADER_SIZE 768
+
+// Where the time of the last request() went, in ms
+struct SpotifyTransportTiming
+{
+  // TCP connect and TLS handshake
+  unsigned long connectMs;
+  unsigned long sendMs;
+  // Until the response headers were read
+  unsigned long waitMs;
+  size_t bytesSent;
+};
+
+// A request body the transport writes out itself, e.g. a JSON document that
+// is serialized straight into the request instead of into a buffer first
+class SpotifyRequestBody
+{
+public:
+  virtual ~SpotifyRequestBody() {}
+
+  virtual size_t length() const = 0;
+  // Writes the body, returns the number of bytes written
+  virtual size_t writeTo(Print &out) const = 0;
+};
+
+// A body that is already a string
+class SpotifyStringBody : public SpotifyRequestBody
+{
+public:
+  SpotifyStringBody(const char *body) : _body(body) {}
+
+  size_t length() const { return strlen(_body); }
+  size_t writeTo(Print &out) const { return out.write((const uint8_t *)_body, strlen(_body)); }
+
+private:
+  const char *_body;
+};
+
+// Sends a request over a connection and gives access to the response
+class SpotifyTransport
+{
+public:
+  virtual ~SpotifyTransport() {}
+
+  // Sends the request and reads the response headers. Returns the status
+  // code or one of the (negative) HTTPC_ERROR_* codes. accept, contentType,
+  // authorization and body may be NULL.
+  virtual int request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+                      const char *accept, const char *contentType, const char *authorization, const char *body,
+                      bool keepAlive) = 0;
+  // Same with a body that is written by the transport. By default it's
+  // collected in a String and sent with the request above.
+  virtual int request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+                      const char *accept, const char *contentType, const char *authorization,
+                      const SpotifyRequestBody &body, bool keepAlive);
+  // The response body, without chunk sizes
+  virtual SpotifyBodyStream &getStream() = 0;
+  // Content-Length of the response, -1 if not known
+  virtual long getSize() = 0;
+  // Retry-After in seconds, -1 if not sent
+  virtual long getRetryAfter() = 0;
+  virtual const char *getETag() = 0;
+  // Done with the response, keeps the connection open if possible
+  virtual void end() = 0;
+  // For the requests from now on: connecting (where the transport does that)
+  // and waiting for the response headers and each part of the body
+  virtual void setTimeout(unsigned long timeout) = 0;
+
+  const SpotifyTransportTiming &getTiming() { return _timing; }
+
+protected:
+  SpotifyTransportTiming _timing;
+};
+
+// Writes the request straight to the client and only looks at the headers we
+// need, so no Strings are created for the URI, headers or response headers.
+class SpotifyLeanTransport : public SpotifyTransport
+{
+public:
+  SpotifyLeanTransport(unsigned long timeout = 2000);
+
+  int request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+              const char *accept, const char *contentType, const char *authorization, const char *body,
+              bool keepAlive);
+  int request(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+              const char *accept, const char *contentType, const char *authorization,
+              const SpotifyRequestBody &body, bool keepAlive);
+  SpotifyBodyStream &getStream();
+  long getSize();
+  long getRetryAfter();
+  const char *getETag();
+  void end();
+  void setTimeout(unsigned long timeout);
+
+  // Formats request line and headers, returns the length or -1 if the buffer is too small.
+  // bodyLength < 0 leaves out Content-Length.
+  static int formatRequest(char *buffer, size_t size, const char *host, const char *method, const char *uri,
+                           const char *accept, const char *contentType, const char *authorization,
+                           long bodyLength, bool keepAlive);
+
+private:
+  int send(Client &client, const char *host, uint16_t port, const char *method, const char *uri,
+           const char *accept, const char *contentType, const char *authorization,
+           const SpotifyRequestBody *body, bool keepAlive);
+
+  Client *_client;
+  SpotifyHttpResponse _response;
+  SpotifyBodyStream _body;
+  unsigned long _timeout;
+  bool _keepAlive;
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyWorker.h"
+
+#if defined(ESP32) || defined(SPOTIFY_WORKER_STD_THREAD)
+
+SpotifyWorker::SpotifyWorker(ArduinoSpotify &spotify)
+{
+    _spotify = &spotify;
+#if defined(ESP32)
+    _task = NULL;
+#else
+    _woken = false;
+    _stopping = false;
+#endif
+    _droppedCommands = 0;
+    memset(&_state, 0, sizeof(_state));
+}
+
+#if defined(ESP32)
+
+bool SpotifyWorker::begin(BaseType_t core, uint32_t stackSize, UBaseType_t priority)
+{
+    if (_task != NULL)
+    {
+        return true;
+    }
+    if (xTaskCreatePinnedToCore(taskMain, "spotify", stackSize, this, priority, &_task, core) != pdPASS)
+    {
+        Serial.println(F("Could not start Spotify worker"));
+        _task = NULL;
+        return false;
+    }
+    return true;
+}
+
+void SpotifyWorker::waitForCommands(unsigned long timeout)
+{
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout));
+}
+
+void SpotifyWorker::wake()
+{
+    if (_task != NULL)
+    {
+        xTaskNotifyGive(_task);
+    }
+}
+
+bool SpotifyWorker::running()
+{
+    // The task is deleted with the device
+    return true;
+}
+
+#else
+
+SpotifyWorker::~SpotifyWorker()
+{
+    end();
+}
+
+bool SpotifyWorker::begin()
+{
+    if (_thread.joinable())
+    {
+        return true;
+    }
+    _stopping = false;
+    _thread = std::thread(taskMain, this);
+    return true;
+}
+
+void SpotifyWorker::end()
+{
+    if (!_thread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_wakeLock);
+        _stopping = true;
+    }
+    _wakeUp.notify_one();
+    _thread.join();
+}
+
+void SpotifyWorker::waitForCommands(unsigned long timeout)
+{
+    std::unique_lock<std::mutex> lock(_wakeLock);
+    _wakeUp.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return _woken || _stopping; });
+    _woken = false;
+}
+
+void SpotifyWorker::wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(_wakeLock);
+        _woken = true;
+    }
+    _wakeUp.notify_one();
+}
+
+bool SpotifyWorker::running()
+{
+    std::lock_guard<std::mutex> lock(_wakeLock);
+    return !_stopping;
+}
+
+#endif
+
+void SpotifyWorker::taskMain(void *worker)
+{
+    ((SpotifyWorker *)worker)->run();
+}
+
+void SpotifyWorker::run()
+{
+    unsigned long nextFetch = millis();
+    while (running())
+    {
+        SpotifyWorkerCommand command;
+        bool sent = false;
+        while (_commands.pop(command))
+        {
+            if (command.type == SPOTIFY_WORKER_REFRESH)
+            {
+                nextFetch = millis();
+                continue;
+            }
+            if (execute(command))
+            {
+                _state.commandsDone++;
+            }
+            else
+            {
+                _state.commandsFailed++;
+            }
+            sent = true;
+        }
+        if (sent)
+        {
+            // Give the player a moment before asking for the result
+            nextFetch = millis() + afterCommandDelayMs;
+        }
+
+        long untilFetch = (long)(nextFetch - millis());
+        if (untilFetch <= 0)
+        {
+            fetchState();
+            nextFetch = millis() + pollIntervalMs;
+            continue;
+        }
+
+        // Woken up early by new commands
+        waitForCommands(untilFetch);
+    }
+}
+
+bool SpotifyWorker::execute(const SpotifyWorkerCommand &command)
+{
+    switch (command.type)
+    {
+    case SPOTIFY_WORKER_PLAY:
+        return _spotify->play(command.deviceId);
+    case SPOTIFY_WORKER_PAUSE:
+        return _spotify->pause(command.deviceId);
+    case SPOTIFY_WORKER_NEXT:
+        return _spotify->nextTrack(command.deviceId);
+    case SPOTIFY_WORKER_PREVIOUS:
+        return _spotify->previousTrack(command.deviceId);
+    case SPOTIFY_WORKER_VOLUME:
+        return _spotify->setVolume(command.value, command.deviceId);
+    case SPOTIFY_WORKER_SEEK:
+        return _spotify->seek(command.value, command.deviceId);
+    case SPOTIFY_WORKER_SHUFFLE:
+        return _spotify->toggleShuffle(command.value != 0, command.deviceId);
+    case SPOTIFY_WORKER_REPEAT:
+        return _spotify->setRepeatMode((RepeatOptions)command.value, command.deviceId);
+    default:
+        return false;
+    }
+}
+
+void SpotifyWorker::fetchState()
+{
+    // Nothing is filled in on errors, so the last state stays
+    _state.error = !_spotify->getPlayerState(_state.playerDetails, _state.currentlyPlaying, market);
+    if (!_state.error)
+    {
+        _state.fetchedAt = millis();
+    }
+    _state.sequence++;
+    _snapshots.publish(_state);
+}
+
+bool SpotifyWorker::queue(SpotifyWorkerCommandType type, int value, const char *deviceId)
+{
+    SpotifyWorkerCommand command;
+    command.type = type;
+    command.value = value;
+    strncpy(command.deviceId, deviceId, sizeof(command.deviceId) - 1);
+    command.deviceId[sizeof(command.deviceId) - 1] = '\0';
+
+    if (!_commands.push(command))
+    {
+        _droppedCommands++;
+        return false;
+    }
+    wake();
+    return true;
+}
+
+bool SpotifyWorker::play(const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_PLAY, 0, deviceId);
+}
+
+bool SpotifyWorker::pause(const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_PAUSE, 0, deviceId);
+}
+
+bool SpotifyWorker::nextTrack(const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_NEXT, 0, deviceId);
+}
+
+bool SpotifyWorker::previousTrack(const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_PREVIOUS, 0, deviceId);
+}
+
+bool SpotifyWorker::setVolume(int volume, const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_VOLUME, volume, deviceId);
+}
+
+bool SpotifyWorker::seek(int position, const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_SEEK, position, deviceId);
+}
+
+bool SpotifyWorker::toggleShuffle(bool shuffle, const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_SHUFFLE, shuffle, deviceId);
+}
+
+bool SpotifyWorker::setRepeatMode(RepeatOptions repeat, const char *deviceId)
+{
+    return queue(SPOTIFY_WORKER_REPEAT, repeat, deviceId);
+}
+
+bool SpotifyWorker::refresh()
+{
+    return queue(SPOTIFY_WORKER_REFRESH, 0, "");
+}
+
+bool SpotifyWorker::getSnapshot(SpotifyPlayerSnapshot &snapshot)
+{
+    return _snapshots.read(snapshot);
+}
+
+unsigned long SpotifyWorker::droppedCommands()
+{
+    return _droppedCommands;
+}
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyWorker_h
+#define SpotifyWorker_h
+
+#include "ArduinoSpotify.h"
+#include "SpotifyLockFree.h"
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#elif defined(SPOTIFY_WORKER_STD_THREAD)
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// Commands that can wait for the worker, one less than this fits
+#ifndef SPOTIFY_WORKER_QUEUE_SIZE
+#define SPOTIFY_WORKER_QUEUE_SIZE 8
+#endif
+
+// Latest player state as published by the worker
+struct SpotifyPlayerSnapshot
+{
+  PlayerDetailsFixed playerDetails;
+  CurrentlyPlayingFixed currentlyPlaying;
+  // millis() when it was fetched
+  unsigned long fetchedAt;
+  // Counts the snapshots published so far
+  uint32_t sequence;
+  // Commands the worker sent so far and how many of them failed
+  uint32_t commandsDone;
+  uint32_t commandsFailed;
+  // The last fetch failed, the state is the one of the fetch before
+  bool error;
+};
+
+enum SpotifyWorkerCommandType
+{
+  SPOTIFY_WORKER_PLAY,
+  SPOTIFY_WORKER_PAUSE,
+  SPOTIFY_WORKER_NEXT,
+  SPOTIFY_WORKER_PREVIOUS,
+  SPOTIFY_WORKER_VOLUME,
+  SPOTIFY_WORKER_SEEK,
+  SPOTIFY_WORKER_SHUFFLE,
+  SPOTIFY_WORKER_REPEAT,
+  // Only fetches the player state
+  SPOTIFY_WORKER_REFRESH
+};
+
+struct SpotifyWorkerCommand
+{
+  SpotifyWorkerCommandType type;
+  int value;
+  char deviceId[SPOTIFY_DEVICE_ID_LENGTH];
+};
+
+#if defined(ESP32) || defined(SPOTIFY_WORKER_STD_THREAD)
+// Moves all requests to a task of their own (by default on core 0, next to
+// WiFi), so the loop() task never waits for the network. Commands go to the
+// task through a SpotifySpscRing and the player state comes back through a
+// SpotifySnapshotBuffer, both without locks.
+//
+// After begin() the ArduinoSpotify object belongs to the task, don't call it
+// from anywhere else. The methods here may only be called from one task.
+//
+// With SPOTIFY_WORKER_STD_THREAD defined (and no ESP32) the task is a
+// std::thread instead, that's how the tests run it on a PC.
+class SpotifyWorker
+{
+public:
+  SpotifyWorker(ArduinoSpotify &spotify);
+
+#if defined(ESP32)
+  bool begin(BaseType_t core = 0, uint32_t stackSize = 8192, UBaseType_t priority = 1);
+#else
+  ~SpotifyWorker();
+  bool begin();
+  // Waits for the request in progress and stops the thread
+  void end();
+#endif
+
+  // These return false if the queue is full
+  bool play(const char *deviceId = "");
+  bool pause(const char *deviceId = "");
+  bool nextTrack(const char *deviceId = "");
+  bool previousTrack(const char *deviceId = "");
+  bool setVolume(int volume, const char *deviceId = "");
+  bool seek(int position, const char *deviceId = "");
+  bool toggleShuffle(bool shuffle, const char *deviceId = "");
+  bool setRepeatMode(RepeatOptions repeat, const char *deviceId = "");
+  // Fetch the player state now instead of after pollIntervalMs
+  bool refresh();
+
+  // Copies the latest player state, false if there is none yet
+  bool getSnapshot(SpotifyPlayerSnapshot &snapshot);
+  // Commands that didn't fit into the queue
+  unsigned long droppedCommands();
+
+  // Set these before begin()
+  unsigned long pollIntervalMs = 1000;
+  // Delay between a command and fetching its result
+  unsigned long afterCommandDelayMs = 300;
+  const char *market = "";
+
+private:
+  ArduinoSpotify *_spotify;
+#if defined(ESP32)
+  TaskHandle_t _task;
+#else
+  std::thread _thread;
+  std::mutex _wakeLock;
+  std::condition_variable _wakeUp;
+  bool _woken;
+  bool _stopping;
+#endif
+  SpotifySpscRing<SpotifyWorkerCommand, SPOTIFY_WORKER_QUEUE_SIZE> _commands;
+  SpotifySnapshotBuffer<SpotifyPlayerSnapshot> _snapshots;
+  // Only used by the task
+  SpotifyPlayerSnapshot _state;
+  unsigned long _droppedCommands;
+
+  bool queue(SpotifyWorkerCommandType type, int value, const char *deviceId);
+  bool execute(const SpotifyWorkerCommand &command);
+  void fetchState();
+  void run();
+  // Returns early when a command is queued
+  void waitForCommands(unsigned long timeout);
+  void wake();
+  bool running();
+  static void taskMain(void *worker);
+};
+#endif
+
+#endif